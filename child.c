@@ -55,11 +55,19 @@
 
 #include "pool.h"
 #include "pool_ip.h"
+#include "pool_proto_modules.h"
 #include "md5.h"
 
 static POOL_CONNECTION *do_accept(int unix_fd, int inet_fd, struct timeval *timeout);
+static POOL_CONNECTION *accept_frontend(int fd, int inet);
 static StartupPacket *read_startup_packet(POOL_CONNECTION *cp);
+static void cancel_authentication_timeout(void);
+static POOL_CONNECTION_POOL *start_session(POOL_CONNECTION *frontend);
+static void end_session(POOL_CONNECTION *frontend, POOL_CONNECTION_POOL *backend);
+static int connection_cache_enabled(StartupPacket *sp);
+static StartupPacket *copy_startup_packet(StartupPacket *sp);
 static POOL_CONNECTION_POOL *connect_backend(StartupPacket *sp, POOL_CONNECTION *frontend);
+static void do_worker(int unix_fd, int inet_fd);
 static RETSIGTYPE die(int sig);
 static RETSIGTYPE close_idle_connection(int sig);
 static RETSIGTYPE wakeup_handler(int sig);
@@ -70,6 +78,8 @@ static void send_frontend_exits(void);
 static int s_do_auth(POOL_CONNECTION_POOL_SLOT *cp, char *password);
 static void connection_count_up(void);
 static void connection_count_down(void);
+static int choose_node_by_weight(int *eligible);
+static void count_load_balanced_queries(int *active);
 
 /*
  * non 0 means SIGTERM(smart shutdown) or SIGINT(fast shutdown) has arrived
@@ -88,6 +98,58 @@ volatile sig_atomic_t got_sighup = 0;
 
 int LocalSessionId;	/* Local session id */
 
+/*
+ * A session served by a child with sessions_per_child > 1. Sessions
+ * are linked in order of last activity, least recent first, for
+ * client_idle_limit.
+ *
+ * In transaction pooling mode, backend is NULL while the session has
+ * returned its connection pool. A session which needs a pool while
+ * none is available waits in a FIFO queue.
+ */
+typedef struct WorkerSession {
+	POOL_CONNECTION *frontend;
+	POOL_CONNECTION_POOL *backend;
+	POOL_SESSION_CONTEXT *context;
+	StartupPacket *sp;			/* to take a pool again. transaction pooling only */
+	int load_balancing_node;	/* load balance node while backend is NULL */
+	int waiting;				/* non 0 if waiting for a pool */
+	int session_id;				/* LocalSessionId of the session */
+	char ps_data[NI_MAXHOST];	/* remote_ps_data of the session */
+	long idle_start;			/* last activity in milliseconds */
+	unsigned int round;			/* last event loop round the session ran */
+	struct WorkerSession *prev;
+	struct WorkerSession *next;
+	struct WorkerSession *wait_next;
+} WorkerSession;
+
+static WorkerSession *worker_head;	/* least recently active session */
+static WorkerSession *worker_tail;	/* most recently active session */
+static int worker_nsessions;		/* number of sessions */
+static unsigned int worker_round;	/* event loop round */
+static long worker_idle_since;		/* when the last session ended */
+static WorkerSession **worker_fd_map;	/* session by descriptor */
+static int worker_fd_map_size;
+static POOL_EVENT_SET *worker_events;	/* listening sockets and sessions */
+static POOL_SESSION_CONTEXT *worker_base_context;	/* context between sessions */
+static WorkerSession *worker_wait_head;	/* sessions waiting for a pool */
+static WorkerSession *worker_wait_tail;
+
+static int worker_accept(int fd, int inet);
+static void worker_run(WorkerSession *s);
+static void worker_end(WorkerSession *s, int error);
+static int worker_watch(WorkerSession *s);
+static void worker_forget(WorkerSession *s);
+static void worker_forget_backend(WorkerSession *s);
+static void worker_release(WorkerSession *s);
+static int worker_acquire(WorkerSession *s);
+static void worker_wait(WorkerSession *s);
+static void worker_unwait(WorkerSession *s);
+static void worker_run_waiting(void);
+static void worker_touch(WorkerSession *s);
+static int worker_map_fd(int fd, WorkerSession *s);
+static int worker_check_idle_limits(long now, long recovery_start);
+
 /*
 * child main loop
 */
@@ -101,8 +163,7 @@ void do_child(int unix_fd, int inet_fd)
 	struct timeval timeout;
 	static int connected;
 	int connections_count = 0;	/* used if child_max_connections > 0 */
-	int found;
-	char psbuf[NI_MAXHOST + 128];
+	POOL_SESSION_CONTEXT *context;
 
 	pool_debug("I am %d", getpid());
 
@@ -134,7 +195,7 @@ void do_child(int unix_fd, int inet_fd)
 	srandom((unsigned int) now.tv_usec);
 
 	/* initialize systemdb connection */
-	if (pool_config->parallel_mode || pool_config->enable_query_cache)
+	if (pool_config->parallel_mode || SYSTEMDB_QUERY_CACHE)
 	{
 		system_db_connect();
 		if (PQstatus(system_db_info->pgconn) != CONNECTION_OK)
@@ -164,13 +225,24 @@ void do_child(int unix_fd, int inet_fd)
 	timeout.tv_sec = pool_config->child_life_time;
 	timeout.tv_usec = 0;
 
-	init_prepared_list();
+	/* create query processing state of the session */
+	context = pool_create_session_context();
+	if (context == NULL)
+		child_exit(1);
+	pool_set_session_context(context);
+
+	/* take over connections from the previous child */
+	pool_handoff_adopt(my_proc_id);
+
+	/* connect to backends before clients arrive */
+	pool_prewarm_connections();
+
+	/* serve multiple sessions at a time */
+	if (MULTIPLEXED_MODE)
+		do_worker(unix_fd, inet_fd);
 
 	for (;;)
 	{
-		int connection_reuse = 1;
-		StartupPacket *sp;
-
 		idle = 1;
 
 		/* pgpool stop request already sent? */
@@ -198,6 +270,9 @@ void do_child(int unix_fd, int inet_fd)
 			timeout.tv_sec = pool_config->child_life_time;
 			timeout.tv_usec = 0;
 			pool_debug("fronttend is 0, but continue: connected=%d, child_life=%d, sec=%d, usec=%d", connected, pool_config->child_life_time, timeout.tv_sec,  timeout.tv_usec);
+
+			/* make connections again if they expired */
+			pool_prewarm_connections();
 			continue;
 		}
 
@@ -215,189 +290,14 @@ void do_child(int unix_fd, int inet_fd)
 			backend_timer_expired = 0;
 		}
 
-		/* read the startup packet */
-	retry_startup:
-		sp = read_startup_packet(frontend);
-		if (sp == NULL)
-		{
-			/* failed to read the startup packet. return to the accept() loop */
-			pool_close(frontend);
-			connection_count_down();
-			continue;
-		}
-
-		/* cancel request? */
-		if (sp->major == 1234 && sp->minor == 5678)
+		backend = start_session(frontend);
+		if (backend == NULL)
 		{
-			cancel_request((CancelPacket *)sp->startup_packet);
-
-			pool_close(frontend);
-			pool_free_startup_packet(sp);
 			connection_count_down();
 			continue;
 		}
 
-		/* SSL? */
-		if (sp->major == 1234 && sp->minor == 5679 && !frontend->ssl_active)
-		{
-			pool_debug("SSLRequest from client");
-			pool_ssl_negotiate_serverclient(frontend);
-			goto retry_startup;
-		}
-
-		if (pool_config->enable_pool_hba)
-		{
-			/*
-			 * do client authentication.
-			 * Note that ClientAuthentication does not return if frontend
-			 * was rejected; it simply terminates this process.
-			 */
-			frontend->protoVersion = sp->major;
-			frontend->database = strdup(sp->database);
-			if (frontend->database == NULL)
-			{
-				pool_error("do_child: strdup failed: %s\n", strerror(errno));
-				child_exit(1);
-			}
-			frontend->username = strdup(sp->user);
-			if (frontend->username == NULL)
-			{
-				pool_error("do_child: strdup failed: %s\n", strerror(errno));
-				child_exit(1);
-			}
-			ClientAuthentication(frontend);
-		}
-
-		/*
-		 * Ok, negotiaton with frontend has been done. Let's go to the next step.
-		 */
-
-		/*
-		 * if there's no connection associated with user and database,
-		 * we need to connect to the backend and send the startup packet.
-		 */
-
-		/* look for existing connection */
-		found = 0;
-		backend = pool_get_cp(sp->user, sp->database, sp->major, 1);
-
-		if (backend != NULL)
-		{
-			found = 1;
-
-			/* existing connection associated with same user/database/major found.
-			 * however we should make sure that the startup packet contents are identical.
-			 * OPTION data and others might be different.
-			 */
-			if (sp->len != MASTER_CONNECTION(backend)->sp->len)
-			{
-				pool_debug("pool_process_query: connection exists but startup packet length is not identical");
-				found = 0;
-			}
-			else if(memcmp(sp->startup_packet, MASTER_CONNECTION(backend)->sp->startup_packet, sp->len) != 0)
-			{
-				pool_debug("pool_process_query: connection exists but startup packet contents is not identical");
-				found = 0;
-			}
-
-			if (found == 0)
-			{
-				/* we need to discard existing connection since startup packet is different */
-				pool_discard_cp(sp->user, sp->database, sp->major);
-				backend = NULL;
-			}
-		}
-
-		if (backend == NULL)
-		{
-			/* create a new connection to backend */
-			connection_reuse = 0;
-
-			if ((backend = connect_backend(sp, frontend)) == NULL)
-			{
-				connection_count_down();
-				continue;
-			}
-		}
-
-		else
-		{
-			int i, freed = 0;
-			/*
-			 * save startup packet info
-			 */
-			for (i = 0; i < NUM_BACKENDS; i++)
-			{
-				if (VALID_BACKEND(i))
-				{
-					if (!freed)
-					{
-						pool_free_startup_packet(backend->slots[i]->sp);
-						freed = 1;
-					}
-					backend->slots[i]->sp = sp;
-				}
-			}
-
-			/* reuse existing connection to backend */
-
-			if (pool_do_reauth(frontend, backend))
-			{
-				pool_close(frontend);
-				connection_count_down();
-				continue;
-			}
-
-			if (MAJOR(backend) == 3)
-			{
-				if (send_params(frontend, backend))
-				{
-					pool_close(frontend);
-					connection_count_down();
-					continue;
-				}
-			}
-
-			/* send ReadyForQuery to frontend */
-			pool_write(frontend, "Z", 1);
-
-			if (MAJOR(backend) == 3)
-			{
-				int len;
-				char tstate;
-
-				len = htonl(5);
-				pool_write(frontend, &len, sizeof(len));
-				tstate = TSTATE(backend);
-				pool_write(frontend, &tstate, 1);
-			}
-
-			if (pool_flush(frontend) < 0)
-			{
-				pool_close(frontend);
-				connection_count_down();
-				continue;
-			}
-
-		}
-
 		connected = 1;
-		LocalSessionId++;
-
- 		/* show ps status */
-		sp = MASTER_CONNECTION(backend)->sp;
-		snprintf(psbuf, sizeof(psbuf), "%s %s %s idle",
-				 sp->user, sp->database, remote_ps_data);
-		set_ps_display(psbuf, false);
-
-		if (MAJOR(backend) == PROTO_MAJOR_V2)
-			TSTATE(backend) = 'I';
-
-		if (pool_config->load_balance_mode)
-		{
-			/* select load balancing node */
-			backend->info->load_balancing_node = select_load_balancing_node();
-		}
 
 		/* query process loop */
 		for (;;)
@@ -406,48 +306,11 @@ void do_child(int unix_fd, int inet_fd)
 
 			status = pool_process_query(frontend, backend, 0);
 
-			sp = MASTER_CONNECTION(backend)->sp;
-
 			switch (status)
 			{
 				/* client exits */
 				case POOL_END:
-					/*
-					 * do not cache connection if:
-					 * pool_config->connection_cahe == 0 or
-					 * database name is template0, template1, postgres or regression
-					 */
-					if (pool_config->connection_cache == 0 ||
-						!strcmp(sp->database, "template0") ||
-						!strcmp(sp->database, "template1") ||
-						!strcmp(sp->database, "postgres") ||
-						!strcmp(sp->database, "regression"))
-					{
-						reset_connection();
-						pool_close(frontend);
-						pool_send_frontend_exits(backend);
-						pool_discard_cp(sp->user, sp->database, sp->major);
-					}
-					else
-					{
-						POOL_STATUS status1;
-
-						/* send reset request to backend */
-						status1 = pool_process_query(frontend, backend, 1);
-						pool_close(frontend);
-
-						/* if we detect errors on resetting connection, we need to discard
-						 * this connection since it might be in unknown status
-						 */
-						if (status1 != POOL_CONTINUE)
-						{
-							pool_debug("error in resetting connections. discarding connection pools...");
-							pool_send_frontend_exits(backend);
-							pool_discard_cp(sp->user, sp->database, sp->major);
-						}
-						else
-							pool_connection_pool_timer(backend);
-					}
+					end_session(frontend, backend);
 					break;
 
 				/* error occured. discard backend connection pool
@@ -468,12 +331,6 @@ void do_child(int unix_fd, int inet_fd)
 					child_exit(1);
 					break;
 
-				/* not implemented yet */
-				case POOL_IDLE:
-					do_accept(unix_fd, inet_fd, &timeout);
-					pool_debug("accept while idle");
-					break;
-
 				default:
 					break;
 			}
@@ -497,7 +354,10 @@ void do_child(int unix_fd, int inet_fd)
 			( connections_count >= pool_config->child_max_connections ) )
 		{
 			pool_log("child exiting, %d connections reached", pool_config->child_max_connections);
-			send_frontend_exits();
+			/*
+			 * Doesn't need to call this. child_exit() calls it.
+			 * send_frontend_exits();
+			 */
 			child_exit(2);
 		}
 	}
@@ -556,38 +416,45 @@ void pool_unset_nonblock(int fd)
 */
 static POOL_CONNECTION *do_accept(int unix_fd, int inet_fd, struct timeval *timeout)
 {
-    fd_set	readmask;
+	static POOL_EVENT_SET *accept_events;	/* listening sockets */
     int fds;
 	int save_errno;
-
-	SockAddr saddr;
 	int fd = 0;
-	int afd;
 	int inet = 0;
-	POOL_CONNECTION *cp;
-#ifdef ACCEPT_PERFORMANCE
-	struct timeval now1, now2;
-	static long atime;
-	static int cnt;
-#endif
 	struct timeval *timeoutval;
 	struct timeval tv1, tv2, tmback = {0, 0};
-
-	char remote_host[NI_MAXHOST];
-	char remote_port[NI_MAXSERV];
+	int timeoutms;
 
 	set_ps_display("wait for connection request", false);
 
-	FD_ZERO(&readmask);
-	FD_SET(unix_fd, &readmask);
-	if (inet_fd)
-		FD_SET(inet_fd, &readmask);
+	/* listening sockets are registered only once */
+	if (accept_events == NULL)
+	{
+		accept_events = pool_event_create();
+		if (accept_events == NULL)
+			child_exit(1);
+
+		/*
+		 * All children wait for the same listening sockets. Ask the
+		 * kernel to wake up only one of them for a connection
+		 * request, rather than all idle children racing for
+		 * accept().
+		 */
+		if (pool_event_watch(accept_events, unix_fd, POOL_EVENT_READ | POOL_EVENT_EXCLUSIVE) < 0)
+			child_exit(1);
+		if (inet_fd && pool_event_watch(accept_events, inet_fd, POOL_EVENT_READ | POOL_EVENT_EXCLUSIVE) < 0)
+			child_exit(1);
+	}
 
 	if (timeout->tv_sec == 0 && timeout->tv_usec == 0)
+	{
 		timeoutval = NULL;
+		timeoutms = -1;
+	}
 	else
 	{
 		timeoutval = timeout;
+		timeoutms = timeout->tv_sec * 1000 + (timeout->tv_usec + 999) / 1000;
 		tmback.tv_sec = timeout->tv_sec;
 		tmback.tv_usec = timeout->tv_usec;
 		gettimeofday(&tv1, NULL);
@@ -598,7 +465,7 @@ static POOL_CONNECTION *do_accept(int unix_fd, int inet_fd, struct timeval *time
 #endif
 	}
 
-	fds = select(Max(unix_fd, inet_fd)+1, &readmask, NULL, NULL, timeoutval);
+	fds = pool_event_wait(accept_events, timeoutms);
 
 	save_errno = errno;
 	/* check backend timer is expired */
@@ -647,7 +514,7 @@ static POOL_CONNECTION *do_accept(int unix_fd, int inet_fd, struct timeval *time
 		if (errno == EAGAIN || errno == EINTR)
 			return NULL;
 
-		pool_error("select() failed. reason %s", strerror(errno));
+		pool_error("do_accept: pool_event_wait() failed. reason %s", strerror(errno));
 		return NULL;
 	}
 
@@ -657,17 +524,40 @@ static POOL_CONNECTION *do_accept(int unix_fd, int inet_fd, struct timeval *time
 		return NULL;
 	}
 
-	if (FD_ISSET(unix_fd, &readmask))
+	if (pool_event_ready(accept_events, unix_fd) & POOL_EVENT_READ)
 	{
 		fd = unix_fd;
 	}
 
-	if (FD_ISSET(inet_fd, &readmask))
+	if (inet_fd && (pool_event_ready(accept_events, inet_fd) & POOL_EVENT_READ))
 	{
 		fd = inet_fd;
 		inet++;
 	}
 
+	return accept_frontend(fd, inet);
+}
+
+/*
+ * accept() a connection request on the listening socket fd and
+ * return the new frontend connection. inet is non 0 if fd is the
+ * INET domain socket. Returns NULL if there's no request to accept.
+ */
+static POOL_CONNECTION *accept_frontend(int fd, int inet)
+{
+	int save_errno;
+	SockAddr saddr;
+	int afd;
+	POOL_CONNECTION *cp;
+#ifdef ACCEPT_PERFORMANCE
+	struct timeval now1, now2;
+	static long atime;
+	static int cnt;
+#endif
+
+	char remote_host[NI_MAXHOST];
+	char remote_port[NI_MAXSERV];
+
 	/*
 	 * Note that some SysV systems do not work here. For those
 	 * systems, we need some locking mechanism for the fd.
@@ -684,6 +574,9 @@ static POOL_CONNECTION *do_accept(int unix_fd, int inet_fd, struct timeval *time
 	/* wait if recovery is started */
 	while (*InRecovery == 1)
 	{
+		/* do not keep other sessions of this child waiting */
+		if (MULTIPLEXED_MODE)
+			return NULL;
 		pause();
 	}
 
@@ -896,7 +789,11 @@ static StartupPacket *read_startup_packet(POOL_CONNECTION *cp)
 		return NULL;
 	}
 
-	if (pool_config->authentication_timeout > 0)
+	/*
+	 * a child serving multiple sessions must not exit on timeout. it
+	 * uses pool_set_timeout() instead. see worker_accept().
+	 */
+	if (pool_config->authentication_timeout > 0 && !MULTIPLEXED_MODE)
 	{
 		pool_signal(SIGALRM, authentication_timeout);
 		alarm(pool_config->authentication_timeout);
@@ -926,8 +823,7 @@ static StartupPacket *read_startup_packet(POOL_CONNECTION *cp)
 	{
 		pool_error("read_startup_packet: out of memory");
 		pool_free_startup_packet(sp);
-		alarm(0);
-		pool_signal(SIGALRM, SIG_IGN);
+		cancel_authentication_timeout();
 		return NULL;
 	}
 
@@ -935,8 +831,7 @@ static StartupPacket *read_startup_packet(POOL_CONNECTION *cp)
 	if (pool_read(cp, sp->startup_packet, len))
 	{
 		pool_free_startup_packet(sp);
-		alarm(0);
-		pool_signal(SIGALRM, SIG_IGN);
+		cancel_authentication_timeout();
 		return NULL;
 	}
 
@@ -956,8 +851,7 @@ static StartupPacket *read_startup_packet(POOL_CONNECTION *cp)
 			{
 				pool_error("read_startup_packet: out of memory");
 				pool_free_startup_packet(sp);
-				alarm(0);
-				pool_signal(SIGALRM, SIG_IGN);
+				cancel_authentication_timeout();
 				return NULL;
 			}
 			strncpy(sp->database, sp2->database, SM_DATABASE);
@@ -967,8 +861,7 @@ static StartupPacket *read_startup_packet(POOL_CONNECTION *cp)
 			{
 				pool_error("read_startup_packet: out of memory");
 				pool_free_startup_packet(sp);
-				alarm(0);
-				pool_signal(SIGALRM, SIG_IGN);
+				cancel_authentication_timeout();
 				return NULL;
 			}
 			strncpy(sp->user, sp2->user, SM_USER);
@@ -988,8 +881,7 @@ static StartupPacket *read_startup_packet(POOL_CONNECTION *cp)
 					{
 						pool_error("read_startup_packet: out of memory");
 						pool_free_startup_packet(sp);
-						alarm(0);
-						pool_signal(SIGALRM, SIG_IGN);
+						cancel_authentication_timeout();
 						return NULL;
 					}
 				}
@@ -1001,8 +893,7 @@ static StartupPacket *read_startup_packet(POOL_CONNECTION *cp)
 					{
 						pool_error("read_startup_packet: out of memory");
 						pool_free_startup_packet(sp);
-						alarm(0);
-						pool_signal(SIGALRM, SIG_IGN);
+						cancel_authentication_timeout();
 						return NULL;
 					}
 				}
@@ -1017,8 +908,7 @@ static StartupPacket *read_startup_packet(POOL_CONNECTION *cp)
 			{
 				pool_error("read_startup_packet: out of memory");
 				pool_free_startup_packet(sp);
-				alarm(0);
-				pool_signal(SIGALRM, SIG_IGN);
+				cancel_authentication_timeout();
 				return NULL;
 			}
 			sp->user = calloc(1, 1);
@@ -1026,8 +916,7 @@ static StartupPacket *read_startup_packet(POOL_CONNECTION *cp)
 			{
 				pool_error("read_startup_packet: out of memory");
 				pool_free_startup_packet(sp);
-				alarm(0);
-				pool_signal(SIGALRM, SIG_IGN);
+				cancel_authentication_timeout();
 				return NULL;
 			}
 			break;
@@ -1035,16 +924,26 @@ static StartupPacket *read_startup_packet(POOL_CONNECTION *cp)
 		default:
 			pool_error("read_startup_packet: invalid major no: %d", sp->major);
 			pool_free_startup_packet(sp);
-			alarm(0);
-			pool_signal(SIGALRM, SIG_IGN);
+			cancel_authentication_timeout();
 			return NULL;
 	}
 
 	pool_debug("Protocol Major: %d Minor: %d database: %s user: %s",
 			   sp->major, sp->minor, sp->database, sp->user);
+	cancel_authentication_timeout();
+	return sp;
+}
+
+/*
+ * disarm the timer set by read_startup_packet
+ */
+static void cancel_authentication_timeout(void)
+{
+	if (MULTIPLEXED_MODE)
+		return;
+
 	alarm(0);
 	pool_signal(SIGALRM, SIG_IGN);
-	return sp;
 }
 
 /*
@@ -1130,72 +1029,1103 @@ void cancel_request(CancelPacket *sp)
 	}
 }
 
-static POOL_CONNECTION_POOL *connect_backend(StartupPacket *sp, POOL_CONNECTION *frontend)
+/*
+ * Negotiate with a frontend just accepted: read the startup packet,
+ * authenticate the client and connect to backends, or reuse a
+ * connection pool. Returns the connection pool of the session. On
+ * failure, the frontend is closed and NULL is returned.
+ */
+static POOL_CONNECTION_POOL *start_session(POOL_CONNECTION *frontend)
 {
 	POOL_CONNECTION_POOL *backend;
-	int i;
+	StartupPacket *sp;
+	int found;
+	char psbuf[NI_MAXHOST + 128];
 
-	/* connect to the backend */
-	backend = pool_create_cp();
-	if (backend == NULL)
+	/* read the startup packet */
+retry_startup:
+	sp = read_startup_packet(frontend);
+	if (sp == NULL)
 	{
-		pool_send_error_message(frontend, sp->major, "XX000", "connection cache is full", "",
-								"increase max_pool", __FILE__, __LINE__);
+		/* failed to read the startup packet. return to the accept() loop */
 		pool_close(frontend);
-		pool_free_startup_packet(sp);
 		return NULL;
 	}
 
-	for (i=0;i<NUM_BACKENDS;i++)
+	/* cancel request? */
+	if (sp->major == 1234 && sp->minor == 5678)
 	{
-		if (VALID_BACKEND(i))
-		{
-			/* set DB node id */
-			CONNECTION(backend, i)->db_node_id = i;
+		cancel_request((CancelPacket *)sp->startup_packet);
 
-			/* mark this is a backend connection */
-			CONNECTION(backend, i)->isbackend = 1;
-			pool_ssl_negotiate_clientserver(CONNECTION(backend, i));
+		pool_close(frontend);
+		pool_free_startup_packet(sp);
+		return NULL;
+	}
 
-			/*
-			 * save startup packet info
-			 */
-			CONNECTION_SLOT(backend, i)->sp = sp;
+	/* SSL? */
+	if (sp->major == 1234 && sp->minor == 5679 && !frontend->ssl_active)
+	{
+		pool_debug("SSLRequest from client");
+		pool_ssl_negotiate_serverclient(frontend);
+		goto retry_startup;
+	}
 
-			/* send startup packet */
-			if (send_startup_packet(CONNECTION_SLOT(backend, i)) < 0)
-			{
-				pool_error("do_child: fails to send startup packet to the %d th backend", i);
-				pool_discard_cp(sp->user, sp->database, sp->major);
-				pool_close(frontend);
-				return NULL;
-			}
+	if (pool_config->enable_pool_hba)
+	{
+		/*
+		 * do client authentication.
+		 * Note that ClientAuthentication does not return if frontend
+		 * was rejected; it simply terminates this process. If this
+		 * child serves multiple sessions, it returns -1 instead.
+		 */
+		frontend->protoVersion = sp->major;
+		frontend->database = strdup(sp->database);
+		if (frontend->database == NULL)
+		{
+			pool_error("do_child: strdup failed: %s\n", strerror(errno));
+			child_exit(1);
+		}
+		frontend->username = strdup(sp->user);
+		if (frontend->username == NULL)
+		{
+			pool_error("do_child: strdup failed: %s\n", strerror(errno));
+			child_exit(1);
+		}
+		if (ClientAuthentication(frontend) < 0)
+		{
+			pool_close(frontend);
+			pool_free_startup_packet(sp);
+			return NULL;
 		}
 	}
 
 	/*
-	 * do authentication stuff
+	 * Ok, negotiaton with frontend has been done. Let's go to the next step.
 	 */
-	if (pool_do_auth(frontend, backend))
+
+	/*
+	 * if there's no connection associated with user and database,
+	 * we need to connect to the backend and send the startup packet.
+	 */
+
+	/* look for existing connection */
+	found = 0;
+	backend = pool_get_cp(sp->user, sp->database, sp->major, 1);
+
+	if (backend != NULL)
 	{
-		pool_close(frontend);
-		pool_discard_cp(sp->user, sp->database, sp->major);
-		return NULL;
+		found = 1;
+
+		/* existing connection associated with same user/database/major found.
+		 * however we should make sure that the startup packet contents are identical.
+		 * OPTION data and others might be different.
+		 */
+		if (sp->len != MASTER_CONNECTION(backend)->sp->len)
+		{
+			pool_debug("pool_process_query: connection exists but startup packet length is not identical");
+			found = 0;
+		}
+		else if(memcmp(sp->startup_packet, MASTER_CONNECTION(backend)->sp->startup_packet, sp->len) != 0)
+		{
+			pool_debug("pool_process_query: connection exists but startup packet contents is not identical");
+			found = 0;
+		}
+
+		if (found == 0)
+		{
+			/* we need to discard existing connection since startup packet is different */
+			pool_discard_pool(backend);
+			backend = NULL;
+		}
 	}
 
-	return backend;
-}
+	if (backend == NULL)
+	{
+		/* create a new connection to backend */
+		pool_stats_count_connection_pool(0);
 
-/*
- * signal handler for SIGTERM, SIGINT and SIGQUUT
- */
-static RETSIGTYPE die(int sig)
-{
-	pool_debug("child received shutdown request signal %d", sig);
+		if ((backend = connect_backend(sp, frontend)) == NULL)
+			return NULL;
 
-	exit_request = sig;
+		/* use the same startup packet for prewarming */
+		pool_prewarm_remember(sp);
+	}
 
-	switch (sig)
+	else
+	{
+		int i, freed = 0;
+		/*
+		 * save startup packet info
+		 */
+		for (i = 0; i < NUM_BACKENDS; i++)
+		{
+			if (VALID_BACKEND(i))
+			{
+				if (!freed)
+				{
+					pool_free_startup_packet(backend->slots[i]->sp);
+					freed = 1;
+				}
+				backend->slots[i]->sp = sp;
+			}
+		}
+
+		/* reuse existing connection to backend */
+		pool_stats_count_connection_pool(1);
+
+		/*
+		 * if we fail to talk with the frontend, backend connections
+		 * are still usable. return them to the pool.
+		 */
+		if (pool_do_reauth(frontend, backend))
+		{
+			pool_close(frontend);
+			pool_connection_pool_timer(backend);
+			return NULL;
+		}
+
+		if (MAJOR(backend) == 3)
+		{
+			if (send_params(frontend, backend))
+			{
+				pool_close(frontend);
+				pool_connection_pool_timer(backend);
+				return NULL;
+			}
+		}
+
+		/* send ReadyForQuery to frontend */
+		pool_write(frontend, "Z", 1);
+
+		if (MAJOR(backend) == 3)
+		{
+			int len;
+			char tstate;
+
+			len = htonl(5);
+			pool_write(frontend, &len, sizeof(len));
+			tstate = TSTATE(backend);
+			pool_write(frontend, &tstate, 1);
+		}
+
+		if (pool_flush(frontend) < 0)
+		{
+			pool_close(frontend);
+			pool_connection_pool_timer(backend);
+			return NULL;
+		}
+
+	}
+
+	LocalSessionId++;
+
+	/* show ps status */
+	sp = MASTER_CONNECTION(backend)->sp;
+	snprintf(psbuf, sizeof(psbuf), "%s %s %s idle",
+			 sp->user, sp->database, remote_ps_data);
+	set_ps_display(psbuf, false);
+
+	if (MAJOR(backend) == PROTO_MAJOR_V2)
+		TSTATE(backend) = 'I';
+
+	if (pool_config->load_balance_mode)
+	{
+		/* select load balancing node */
+		backend->info->load_balancing_node = select_load_balancing_node();
+	}
+
+	return backend;
+}
+
+/*
+ * The client of the session exited. Reset backend connections and
+ * return them to the pool, or discard them.
+ */
+static void end_session(POOL_CONNECTION *frontend, POOL_CONNECTION_POOL *backend)
+{
+	if (!connection_cache_enabled(MASTER_CONNECTION(backend)->sp))
+	{
+		reset_connection();
+		pool_close(frontend);
+		pool_send_frontend_exits(backend);
+		pool_discard_pool(backend);
+	}
+	/*
+	 * if the session did not leave anything to be
+	 * reset, return the connection to the pool without
+	 * issuing reset queries.
+	 */
+	else if (pool_config->reset_only_modified_session &&
+			 !need_reset_connection(backend))
+	{
+		pool_debug("do_child: session state is not modified. skip reset queries");
+		reset_connection();
+		pool_close(frontend);
+		pool_connection_pool_timer(backend);
+	}
+	else
+	{
+		POOL_STATUS status1;
+
+		/* send reset request to backend */
+		status1 = pool_process_query(frontend, backend, 1);
+		pool_close(frontend);
+
+		/* if we detect errors on resetting connection, we need to discard
+		 * this connection since it might be in unknown status
+		 */
+		if (status1 != POOL_CONTINUE)
+		{
+			pool_debug("error in resetting connections. discarding connection pools...");
+			pool_send_frontend_exits(backend);
+			pool_discard_pool(backend);
+		}
+		else
+			pool_connection_pool_timer(backend);
+	}
+}
+
+/*
+ * do not cache connection if:
+ * pool_config->connection_cahe == 0 or
+ * database name is template0, template1, postgres or regression
+ */
+static int connection_cache_enabled(StartupPacket *sp)
+{
+	return !(pool_config->connection_cache == 0 ||
+			 !strcmp(sp->database, "template0") ||
+			 !strcmp(sp->database, "template1") ||
+			 !strcmp(sp->database, "postgres") ||
+			 !strcmp(sp->database, "regression"));
+}
+
+static POOL_CONNECTION_POOL *connect_backend(StartupPacket *sp, POOL_CONNECTION *frontend)
+{
+	POOL_CONNECTION_POOL *backend;
+	int i;
+
+	/* connect to the backend */
+	backend = pool_create_cp();
+	if (backend == NULL)
+	{
+		pool_send_error_message(frontend, sp->major, "XX000", "connection cache is full", "",
+								"increase max_pool", __FILE__, __LINE__);
+		pool_close(frontend);
+		pool_free_startup_packet(sp);
+		return NULL;
+	}
+
+	for (i=0;i<NUM_BACKENDS;i++)
+	{
+		if (VALID_BACKEND(i))
+		{
+			/* set DB node id */
+			CONNECTION(backend, i)->db_node_id = i;
+
+			/* mark this is a backend connection */
+			CONNECTION(backend, i)->isbackend = 1;
+			pool_ssl_negotiate_clientserver(CONNECTION(backend, i));
+
+			/*
+			 * save startup packet info
+			 */
+			CONNECTION_SLOT(backend, i)->sp = sp;
+
+			/* send startup packet */
+			if (send_startup_packet(CONNECTION_SLOT(backend, i)) < 0)
+			{
+				pool_error("do_child: fails to send startup packet to the %d th backend", i);
+				pool_discard_pool(backend);
+				pool_close(frontend);
+				return NULL;
+			}
+		}
+	}
+
+	/*
+	 * do authentication stuff
+	 */
+	if (pool_do_auth(frontend, backend))
+	{
+		pool_close(frontend);
+		pool_discard_pool(backend);
+		return NULL;
+	}
+
+	return backend;
+}
+
+/*
+ * Main loop of a child serving multiple sessions (sessions_per_child
+ * > 1). Waits for connection requests and for data of all sessions,
+ * and runs a session while it has something to do. Never returns.
+ */
+static void do_worker(int unix_fd, int inet_fd)
+{
+	static int *ready_fds;		/* descriptors reported ready */
+	static int ready_size;
+	int connections_count = 0;	/* used if child_max_connections > 0 */
+	int connected = 0;
+	long recovery_start = 0;	/* when we noticed recovery started */
+
+	pool_debug("do_worker: serve up to %d sessions", pool_config->sessions_per_child);
+
+	worker_base_context = session_context;
+	worker_events = pool_event_create();
+	if (worker_events == NULL)
+		child_exit(1);
+
+	worker_idle_since = pool_event_now();
+	set_ps_display("wait for connection request", false);
+
+	for (;;)
+	{
+		int accepting;
+		int timeout;
+		int nready;
+		int i;
+		long now;
+
+		idle = (worker_nsessions == 0);
+
+		/* pgpool stop request already sent? */
+		check_stop_request();
+
+		/* check backend timer is expired */
+		if (backend_timer_expired)
+		{
+			pool_backend_timer();
+			backend_timer_expired = 0;
+		}
+
+		/* reload config file */
+		if (got_sighup)
+		{
+			pool_get_config(get_config_file_name(), RELOAD_CONFIG);
+			if (pool_config->enable_pool_hba)
+				load_hba(get_hba_file_name());
+			if (pool_config->parallel_mode)
+				pool_memset_system_db_info(system_db_info->info);
+			got_sighup = 0;
+		}
+
+		/* check if maximum connections count for this child reached */
+		if (pool_config->child_max_connections > 0 &&
+			connections_count >= pool_config->child_max_connections &&
+			worker_nsessions == 0)
+		{
+			pool_log("child exiting, %d connections reached", pool_config->child_max_connections);
+			child_exit(2);
+		}
+
+		/*
+		 * terminate sessions idle too long and compute time to wait
+		 */
+		now = pool_event_now();
+
+		if (*InRecovery == 0)
+			recovery_start = 0;
+		else if (recovery_start == 0)
+			recovery_start = now;
+
+		timeout = worker_check_idle_limits(now, recovery_start);
+
+		/* pools may have been released since sessions began to wait */
+		worker_run_waiting();
+
+		/*
+		 * accept new clients unless shutting down, in recovery or
+		 * serving as many sessions as allowed. In transaction pooling
+		 * mode, a new client needs a pool which no session waits for.
+		 */
+		accepting = !exit_request && *InRecovery == 0 &&
+			worker_nsessions < pool_config->sessions_per_child &&
+			(pool_config->child_max_connections <= 0 ||
+			 connections_count < pool_config->child_max_connections) &&
+			(!TRANSACTION_POOLING ||
+			 (worker_wait_head == NULL && pool_cp_available()));
+
+		if (pool_event_watch(worker_events, unix_fd, accepting ? POOL_EVENT_READ | POOL_EVENT_EXCLUSIVE : 0) < 0)
+			child_exit(1);
+		if (inet_fd && pool_event_watch(worker_events, inet_fd, accepting ? POOL_EVENT_READ | POOL_EVENT_EXCLUSIVE : 0) < 0)
+			child_exit(1);
+
+		/*
+		 * Nobody tells us recovery started or finished. Wake up every
+		 * second to check it.
+		 */
+		if ((*InRecovery || (worker_nsessions > 0 && pool_config->client_idle_limit_in_recovery > 0)) &&
+			(timeout < 0 || timeout > 1000))
+			timeout = 1000;
+
+		if (worker_nsessions == 0 && pool_config->child_life_time > 0)
+		{
+			long left = worker_idle_since + pool_config->child_life_time * 1000L - now;
+
+			if (left <= 0)
+			{
+				if (connected)
+				{
+					pool_debug("child life %d seconds expired", pool_config->child_life_time);
+					child_exit(2);
+				}
+
+				/* make connections again if they expired */
+				pool_prewarm_connections();
+				worker_idle_since = now;
+				left = pool_config->child_life_time * 1000L;
+			}
+
+			if (timeout < 0 || timeout > left)
+				timeout = left;
+		}
+
+		nready = pool_event_wait(worker_events, timeout);
+
+		if (nready == -1)
+		{
+			if (errno == EINTR)
+				continue;
+
+			pool_error("do_worker: pool_event_wait() failed. reason: %s", strerror(errno));
+			child_exit(1);
+		}
+
+		if (nready == 0)
+			continue;
+
+		/*
+		 * running a session adds and removes descriptors. collect
+		 * ready ones first.
+		 */
+		if (nready > ready_size)
+		{
+			int *p = realloc(ready_fds, sizeof(int) * nready);
+
+			if (p == NULL)
+			{
+				pool_error("do_worker: realloc failed: %s", strerror(errno));
+				child_exit(1);
+			}
+			ready_fds = p;
+			ready_size = nready;
+		}
+		for (i = 0; i < nready; i++)
+			ready_fds[i] = pool_event_ready_fd(worker_events, i);
+
+		worker_round++;
+
+		for (i = 0; i < nready; i++)
+		{
+			int fd = ready_fds[i];
+			WorkerSession *s;
+
+			if (fd == unix_fd || (inet_fd && fd == inet_fd))
+			{
+				if (worker_accept(fd, fd != unix_fd))
+				{
+					connected = 1;
+					if (pool_config->child_max_connections > 0)
+						connections_count++;
+				}
+				continue;
+			}
+
+			if (fd < 0 || fd >= worker_fd_map_size)
+				continue;
+
+			/*
+			 * the session may have ended, or both its frontend and
+			 * backend may be ready
+			 */
+			s = worker_fd_map[fd];
+			if (s == NULL || s->round == worker_round)
+				continue;
+
+			s->round = worker_round;
+			worker_run(s);
+		}
+	}
+}
+
+/*
+ * Accept a connection request and start a session. Returns non 0 if
+ * a session was started.
+ */
+static int worker_accept(int fd, int inet)
+{
+	POOL_CONNECTION *frontend;
+	POOL_CONNECTION_POOL *backend;
+	WorkerSession *s;
+
+	frontend = accept_frontend(fd, inet);
+	if (frontend == NULL)
+		return 0;
+
+	/* set frontend fd to blocking */
+	pool_unset_nonblock(frontend->fd);
+
+	s = calloc(1, sizeof(*s));
+	if (s == NULL)
+	{
+		pool_error("worker_accept: calloc failed: %s", strerror(errno));
+		pool_close(frontend);
+		connection_count_down();
+		return 0;
+	}
+
+	s->context = pool_create_session_context();
+	if (s->context == NULL)
+	{
+		free(s);
+		pool_close(frontend);
+		connection_count_down();
+		return 0;
+	}
+
+	/*
+	 * Other sessions wait while the client is authenticated. Don't
+	 * let a client keep them waiting longer than
+	 * authentication_timeout.
+	 */
+	idle = 0;
+	pool_set_session_context(s->context);
+	pool_set_timeout(pool_config->authentication_timeout);
+	backend = start_session(frontend);
+	pool_set_timeout(0);
+
+	if (backend == NULL)
+	{
+		pool_set_session_context(worker_base_context);
+		pool_destroy_session_context(s->context);
+		free(s);
+		connection_count_down();
+		return 0;
+	}
+
+	s->frontend = frontend;
+	s->backend = backend;
+	s->session_id = LocalSessionId;
+	session_context->backend_idle = 1;
+
+	/*
+	 * A session which cannot take a pool again with its startup
+	 * packet keeps the pool as in session pooling mode.
+	 */
+	if (TRANSACTION_POOLING)
+		s->sp = copy_startup_packet(MASTER_CONNECTION(backend)->sp);
+	memcpy(s->ps_data, remote_ps_data, sizeof(s->ps_data));
+
+	s->prev = worker_tail;
+	if (worker_tail)
+		worker_tail->next = s;
+	else
+		worker_head = s;
+	worker_tail = s;
+	worker_nsessions++;
+
+	/* the client may have sent a query already */
+	s->round = worker_round;
+	worker_run(s);
+
+	return 1;
+}
+
+/*
+ * Process data of the session until it would have to wait.
+ */
+static void worker_run(WorkerSession *s)
+{
+	POOL_STATUS status;
+
+	pool_set_session_context(s->context);
+	LocalSessionId = s->session_id;
+	memcpy(remote_ps_data, s->ps_data, sizeof(remote_ps_data));
+
+	/*
+	 * The session returned its pool and the client sent something.
+	 * Sessions waiting for a pool go first.
+	 */
+	if (s->backend == NULL)
+	{
+		int st = -1;
+
+		if (worker_wait_head == NULL || worker_wait_head == s)
+			st = worker_acquire(s);
+
+		if (st == -1)
+		{
+			worker_wait(s);
+			pool_set_session_context(worker_base_context);
+			return;
+		}
+
+		worker_unwait(s);
+
+		if (st < 0)
+		{
+			pool_send_error_message(s->frontend, s->sp->major, "XX000",
+									"failed to connect to backend", "", "",
+									__FILE__, __LINE__);
+			pool_flush(s->frontend);
+			worker_end(s, 1);
+			pool_set_session_context(worker_base_context);
+			return;
+		}
+	}
+
+	status = pool_process_query(s->frontend, s->backend, 0);
+
+	switch (status)
+	{
+		case POOL_CONTINUE:
+		case POOL_IDLE:
+			if (status == POOL_IDLE)
+				worker_release(s);
+
+			if (worker_watch(s) < 0)
+			{
+				worker_end(s, 1);
+				break;
+			}
+			worker_touch(s);
+			break;
+
+		/* client exits */
+		case POOL_END:
+			worker_end(s, 0);
+			break;
+
+		/*
+		 * error occured. discard backend connection pool and
+		 * disconnect connection to the frontend. other sessions
+		 * are not affected.
+		 */
+		case POOL_ERROR:
+			pool_log("do_worker: session terminated due to error");
+			worker_end(s, 1);
+			break;
+
+		/* fatal error occured. just exit myself... */
+		case POOL_FATAL:
+			notice_backend_error(1);
+			child_exit(1);
+			break;
+
+		default:
+			break;
+	}
+
+	pool_set_session_context(worker_base_context);
+}
+
+/*
+ * End the session and free it. If error is non 0, backend
+ * connections are discarded since they might be in unknown status.
+ * Must be called while the session is current.
+ */
+static void worker_end(WorkerSession *s, int error)
+{
+	worker_forget(s);
+	worker_unwait(s);
+
+	if (s->backend == NULL)
+	{
+		reset_connection();
+		pool_close(s->frontend);
+	}
+	else if (error)
+	{
+		reset_connection();
+		pool_close(s->frontend);
+		pool_send_frontend_exits(s->backend);
+		pool_discard_pool(s->backend);
+	}
+	else
+		end_session(s->frontend, s->backend);
+
+	/* free prepared statements left by a failed reset */
+	reset_connection();
+
+	if (s->prev)
+		s->prev->next = s->next;
+	else
+		worker_head = s->next;
+	if (s->next)
+		s->next->prev = s->prev;
+	else
+		worker_tail = s->prev;
+
+	worker_nsessions--;
+	connection_count_down();
+
+	pool_set_session_context(worker_base_context);
+	pool_destroy_session_context(s->context);
+	pool_free_startup_packet(s->sp);
+	free(s);
+
+	if (worker_nsessions == 0)
+	{
+		worker_idle_since = pool_event_now();
+		set_ps_display("wait for connection request", false);
+	}
+}
+
+/*
+ * Watch descriptors of the session as pool_process_query does: the
+ * frontend is muted while backends process a query, and backends not
+ * used by the query are muted. Must be called while the session is
+ * current. Returns 0 on success, -1 on error.
+ */
+static int worker_watch(WorkerSession *s)
+{
+	POOL_CONNECTION_POOL *backend = s->backend;
+	int i;
+
+	if (worker_map_fd(s->frontend->fd, s) < 0 ||
+		pool_event_watch(worker_events, s->frontend->fd,
+						 session_context->in_progress || s->waiting ? 0 : POOL_EVENT_READ|POOL_EVENT_EXCEPT) < 0)
+		return -1;
+
+	if (backend == NULL)
+		return 0;
+
+	for (i=0;i<pool_config->backend_desc->num_backends;i++)
+	{
+		int ev = 0;
+
+		if (CONNECTION_SLOT(backend, i) == NULL)
+			continue;
+
+		if (i < NUM_BACKENDS && VALID_BACKEND(i))
+			ev = POOL_EVENT_READ|POOL_EVENT_EXCEPT;
+
+		if (worker_map_fd(CONNECTION(backend, i)->fd, s) < 0 ||
+			pool_event_watch(worker_events, CONNECTION(backend, i)->fd, ev) < 0)
+			return -1;
+	}
+	return 0;
+}
+
+/*
+ * Stop watching descriptors of the session. Backend connections
+ * returned to the pool must not wake us up.
+ */
+static void worker_forget(WorkerSession *s)
+{
+	int fd;
+
+	fd = s->frontend->fd;
+	pool_event_unwatch(worker_events, fd);
+	if (fd >= 0 && fd < worker_fd_map_size && worker_fd_map[fd] == s)
+		worker_fd_map[fd] = NULL;
+
+	worker_forget_backend(s);
+}
+
+/*
+ * Stop watching backend connections of the session.
+ */
+static void worker_forget_backend(WorkerSession *s)
+{
+	POOL_CONNECTION_POOL *backend = s->backend;
+	int fd;
+	int i;
+
+	if (backend == NULL)
+		return;
+
+	for (i=0;i<pool_config->backend_desc->num_backends;i++)
+	{
+		if (CONNECTION_SLOT(backend, i) == NULL)
+			continue;
+
+		fd = CONNECTION(backend, i)->fd;
+		pool_event_unwatch(worker_events, fd);
+		if (fd >= 0 && fd < worker_fd_map_size && worker_fd_map[fd] == s)
+			worker_fd_map[fd] = NULL;
+	}
+}
+
+/*
+ * In transaction pooling mode, return the connection pool of the
+ * session if backends wait for a new query outside a transaction
+ * block and the session has nothing another client must not see or
+ * could lose: prepared statements, session level state (see
+ * check_session_state()) and data not read yet. Pools authenticated
+ * with a password are kept, since worker_acquire() cannot connect
+ * for the session without the password. Must be called while the
+ * session is current.
+ */
+static void worker_release(WorkerSession *s)
+{
+	POOL_CONNECTION_POOL *backend = s->backend;
+	int i;
+
+	if (!TRANSACTION_POOLING || backend == NULL || s->sp == NULL ||
+		MAJOR(backend) != PROTO_MAJOR_V3 ||
+		!connection_cache_enabled(s->sp) ||
+		!session_context->backend_idle ||
+		session_context->in_progress ||
+		session_context->in_load_balance ||
+		need_reset_connection(backend) ||
+		MASTER(backend)->auth_kind != 0)
+		return;
+
+	for (i=0;i<NUM_BACKENDS;i++)
+	{
+		if (VALID_BACKEND(i) && CONNECTION(backend, i)->len > 0)
+			return;
+	}
+
+	pool_debug("worker_release: session %d returns connection pool", s->session_id);
+
+	/* the unnamed statement is gone with the backend */
+	delete_all_prepared_list(session_context->prepared_list, NULL);
+
+	s->load_balancing_node = backend->info->load_balancing_node;
+	worker_forget_backend(s);
+	pool_connection_pool_timer(backend);
+	s->backend = NULL;
+}
+
+/*
+ * Take a connection pool for a session which returned its pool: a
+ * released pool made with the same startup packet, or a new one
+ * connected without the client. Returns 0 on success, -1 if no pool
+ * is available now, -2 on error. Must be called while the session is
+ * current.
+ */
+static int worker_acquire(WorkerSession *s)
+{
+	POOL_CONNECTION_POOL *backend;
+	StartupPacket *sp = s->sp;
+
+	backend = pool_get_cp(sp->user, sp->database, sp->major, 1);
+
+	/* options in the startup packet may differ. see start_session() */
+	if (backend != NULL &&
+		(sp->len != MASTER_CONNECTION(backend)->sp->len ||
+		 memcmp(sp->startup_packet, MASTER_CONNECTION(backend)->sp->startup_packet, sp->len) != 0))
+	{
+		pool_discard_pool(backend);
+		backend = NULL;
+	}
+
+	if (backend != NULL)
+		pool_stats_count_connection_pool(1);
+	else
+	{
+		StartupPacket *copy;
+
+		if (!pool_cp_available())
+			return -1;
+
+		pool_stats_count_connection_pool(0);
+
+		copy = copy_startup_packet(sp);
+		if (copy == NULL)
+			return -2;
+
+		backend = pool_prewarm_connect(copy);
+		if (backend == NULL)
+		{
+			pool_error("worker_acquire: failed to connect user: %s database: %s",
+					   sp->user, sp->database);
+			return -2;
+		}
+	}
+
+	pool_debug("worker_acquire: session %d takes connection pool", s->session_id);
+
+	if (pool_config->load_balance_mode)
+		backend->info->load_balancing_node = s->load_balancing_node;
+
+	s->backend = backend;
+	session_context->backend_idle = 1;
+	return 0;
+}
+
+/*
+ * Make the session wait for a pool. The frontend is muted until the
+ * session gets a pool.
+ */
+static void worker_wait(WorkerSession *s)
+{
+	if (s->waiting)
+		return;
+
+	pool_debug("worker_wait: session %d waits for connection pool", s->session_id);
+
+	s->waiting = 1;
+	s->wait_next = NULL;
+	if (worker_wait_tail)
+		worker_wait_tail->wait_next = s;
+	else
+		worker_wait_head = s;
+	worker_wait_tail = s;
+
+	pool_event_watch(worker_events, s->frontend->fd, 0);
+}
+
+/*
+ * Remove the session from the queue of sessions waiting for a pool.
+ */
+static void worker_unwait(WorkerSession *s)
+{
+	WorkerSession **p;
+
+	if (!s->waiting)
+		return;
+
+	for (p = &worker_wait_head; *p; p = &(*p)->wait_next)
+	{
+		if (*p == s)
+		{
+			*p = s->wait_next;
+			break;
+		}
+	}
+
+	worker_wait_tail = NULL;
+	for (p = &worker_wait_head; *p; p = &(*p)->wait_next)
+		worker_wait_tail = *p;
+
+	s->waiting = 0;
+	s->wait_next = NULL;
+}
+
+/*
+ * Run sessions waiting for a pool, in order, while pools are
+ * available.
+ */
+static void worker_run_waiting(void)
+{
+	WorkerSession *s;
+
+	while ((s = worker_wait_head) != NULL && pool_cp_available())
+	{
+		s->round = worker_round;
+		worker_run(s);
+	}
+}
+
+/*
+ * Make the session the most recently active one.
+ */
+static void worker_touch(WorkerSession *s)
+{
+	s->idle_start = pool_event_now();
+
+	if (s == worker_tail)
+		return;
+
+	/* unlink */
+	if (s->prev)
+		s->prev->next = s->next;
+	else
+		worker_head = s->next;
+	s->next->prev = s->prev;
+
+	/* append */
+	s->prev = worker_tail;
+	s->next = NULL;
+	worker_tail->next = s;
+	worker_tail = s;
+}
+
+/*
+ * Remember the descriptor belongs to the session. Returns 0 on
+ * success, -1 on error.
+ */
+static int worker_map_fd(int fd, WorkerSession *s)
+{
+	if (fd < 0)
+		return -1;
+
+	if (fd >= worker_fd_map_size)
+	{
+		int size = worker_fd_map_size ? worker_fd_map_size : 64;
+		WorkerSession **p;
+
+		while (size <= fd)
+			size *= 2;
+
+		p = realloc(worker_fd_map, sizeof(WorkerSession *) * size);
+		if (p == NULL)
+		{
+			pool_error("worker_map_fd: realloc failed: %s", strerror(errno));
+			return -1;
+		}
+		memset(p + worker_fd_map_size, 0, sizeof(WorkerSession *) * (size - worker_fd_map_size));
+		worker_fd_map = p;
+		worker_fd_map_size = size;
+	}
+
+	worker_fd_map[fd] = s;
+	return 0;
+}
+
+/*
+ * Terminate sessions which reached client_idle_limit, or
+ * client_idle_limit_in_recovery if recovery_start is not 0. Returns
+ * milliseconds until the next session reaches the limit, or -1 if
+ * there is no limit.
+ */
+static int worker_check_idle_limits(long now, long recovery_start)
+{
+	WorkerSession *s;
+	WorkerSession *next;
+	long limit;
+
+	if (recovery_start == 0 && pool_config->client_idle_limit > 0)
+		limit = pool_config->client_idle_limit * 1000L;
+	else if (recovery_start != 0 && pool_config->client_idle_limit_in_recovery > 0)
+		limit = pool_config->client_idle_limit_in_recovery * 1000L;
+	else
+		return -1;
+
+	/* the least recently active session comes first */
+	for (s = worker_head; s != NULL; s = next)
+	{
+		long start = s->idle_start;
+		long left;
+
+		next = s->next;
+
+		/* the client is not idle but waits for us */
+		if (s->waiting)
+			continue;
+
+		if (start < recovery_start)
+			start = recovery_start;
+
+		left = start + limit - now;
+		if (left > 0)
+			return left;
+
+		if (recovery_start)
+			pool_log("do_worker: session forced to terminate due to client_idle_limit_in_recovery(%d) reached", pool_config->client_idle_limit_in_recovery);
+		else
+			pool_log("do_worker: session forced to terminate due to client_idle_limit(%d) reached", pool_config->client_idle_limit);
+
+		pool_set_session_context(s->context);
+		LocalSessionId = s->session_id;
+		worker_end(s, 0);
+	}
+	return -1;
+}
+
+/*
+ * signal handler for SIGTERM, SIGINT and SIGQUUT
+ */
+static RETSIGTYPE die(int sig)
+{
+	pool_debug("child received shutdown request signal %d", sig);
+
+	exit_request = sig;
+
+	switch (sig)
 	{
 		case SIGTERM:	/* smart shutdown */
 			if (idle == 0)
@@ -1340,17 +2270,51 @@ void pool_free_startup_packet(StartupPacket *sp)
 	}
 }
 
+/*
+ * Returns a copy of the startup packet, or NULL on error.
+ */
+static StartupPacket *copy_startup_packet(StartupPacket *sp)
+{
+	StartupPacket *copy;
+
+	copy = calloc(1, sizeof(*copy));
+	if (copy == NULL)
+	{
+		pool_error("copy_startup_packet: calloc failed: %s", strerror(errno));
+		return NULL;
+	}
+
+	copy->startup_packet = malloc(sp->len);
+	copy->database = strdup(sp->database);
+	copy->user = strdup(sp->user);
+	if (copy->startup_packet == NULL || copy->database == NULL || copy->user == NULL)
+	{
+		pool_error("copy_startup_packet: malloc failed: %s", strerror(errno));
+		pool_free_startup_packet(copy);
+		return NULL;
+	}
+
+	memcpy(copy->startup_packet, sp->startup_packet, sp->len);
+	copy->len = sp->len;
+	copy->major = sp->major;
+	copy->minor = sp->minor;
+
+	return copy;
+}
+
 /*
  * Do house keeping works when pgpool child process exits
  */
 void child_exit(int code)
 {
 	/* count down global connection counter */
-	if (accepted)
+	if (MULTIPLEXED_MODE)
+		MY_PROCESS_INFO.connected = 0;
+	else if (accepted)
 		connection_count_down();
 
 	/* prepare to shutdown connections to system db */
-	if(pool_config->parallel_mode || pool_config->enable_query_cache)
+	if(pool_config->parallel_mode || SYSTEMDB_QUERY_CACHE)
 	{
 		if (system_db_info->pgconn)
 			pool_close_libpq_connection();
@@ -1358,6 +2322,13 @@ void child_exit(int code)
 			pool_close(pool_system_db_connection()->con);
 	}
 
+	/*
+	 * exiting because of child_life_time or child_max_connections?
+	 * pass cached connections to the next child.
+	 */
+	if (code == 2)
+		pool_handoff_send();
+
 	/* let backend know now we are exiting */
 	send_frontend_exits();
 
@@ -1752,13 +2723,13 @@ static int s_do_auth(POOL_CONNECTION_POOL_SLOT *cp, char *password)
 
 /*
  * Count up connection counter (from frontend to pgpool)
- * in shared memory
+ * in shared memory. The counter is in the process table entry of
+ * this child, which only this child writes.
+ * pool_get_connection_count() sums them up.
  */
 static void connection_count_up(void)
 {
-	pool_semaphore_lock(CONN_COUNTER_SEM);
-	Req_info->conn_counter++;
-	pool_semaphore_unlock(CONN_COUNTER_SEM);
+	MY_PROCESS_INFO.connected++;
 }
 
 /*
@@ -1767,18 +2738,17 @@ static void connection_count_up(void)
  */
 static void connection_count_down(void)
 {
-	pool_semaphore_lock(CONN_COUNTER_SEM);
 	/*
-	 * Make sure that we do not decrement too much.  If failed to read
+	 * This may be called twice for a connection.  If failed to read
 	 * a start up packet, or receive cancel request etc.,
 	 * connection_count_down() is called and goes back to the
 	 * connection accept loop. Problem is, at the very beginning of
 	 * the connection accept loop, if we have received a signal, we
 	 * call child_exit() which calls connection_count_down() again.
+	 * Do not count down below 0.
 	 */
-	if (Req_info->conn_counter > 0)
-		Req_info->conn_counter--;
-	pool_semaphore_unlock(CONN_COUNTER_SEM);
+	if (MY_PROCESS_INFO.connected > 0)
+		MY_PROCESS_INFO.connected--;
 }
 
 /*
@@ -1791,20 +2761,94 @@ static RETSIGTYPE wakeup_handler(int sig)
 
 
 /*
- * Select load balancing node
+ * Select load balancing node according to load_balance_policy
  */
 int select_load_balancing_node(void)
+{
+	char *policy = pool_config->load_balance_policy;
+	int node;
+
+	if (!strcmp(policy, "random"))
+	{
+		node = choose_node_by_weight(NULL);
+	}
+	else
+	{
+		int active[MAX_NUM_BACKENDS];
+
+		count_load_balanced_queries(active);
+
+		if (!strcmp(policy, "power_of_two"))
+		{
+			int eligible[MAX_NUM_BACKENDS];
+			int second;
+			int i;
+
+			node = choose_node_by_weight(NULL);
+			for (i=0;i<NUM_BACKENDS;i++)
+				eligible[i] = (i != node);
+			second = choose_node_by_weight(eligible);
+
+			if (node >= 0 && second >= 0 &&
+				active[second] / BACKEND_INFO(second).backend_weight <
+				active[node] / BACKEND_INFO(node).backend_weight)
+				node = second;
+		}
+		else
+		{
+			int eligible[MAX_NUM_BACKENDS];
+			double score[MAX_NUM_BACKENDS];
+			double min_score = 0.0;
+			int i;
+
+			/* score is the expected response time or the number of queries */
+			for (i=0;i<NUM_BACKENDS;i++)
+			{
+				eligible[i] = 0;
+				if (!VALID_BACKEND(i) || BACKEND_INFO(i).backend_weight <= 0.0)
+					continue;
+
+				score[i] = (active[i] + 1) / BACKEND_INFO(i).backend_weight;
+				if (!strcmp(policy, "latency"))
+					score[i] *= BACKEND_INFO(i).query_latency + 1;
+
+				if (score[i] < min_score || min_score == 0.0)
+					min_score = score[i];
+			}
+
+			/* break ties at random */
+			for (i=0;i<NUM_BACKENDS;i++)
+			{
+				if (VALID_BACKEND(i) && BACKEND_INFO(i).backend_weight > 0.0 &&
+					score[i] == min_score)
+					eligible[i] = 1;
+			}
+			node = choose_node_by_weight(eligible);
+		}
+	}
+
+	session_context->selected_slot = node >= 0 ? node : MASTER_NODE_ID;
+
+	pool_debug("select_load_balancing_node: selected backend id is %d", session_context->selected_slot);
+	return session_context->selected_slot;
+}
+
+/*
+ * choose a backend in random manner with weight. if eligible is not
+ * NULL, only nodes whose eligible[node] is non 0 are considered.
+ * returns -1 if no node has weight.
+ */
+static int choose_node_by_weight(int *eligible)
 {
 	double total_weight,r;
+	int node = -1;
 	int i;
 
-	/* choose a backend in random manner with weight */
-	selected_slot = MASTER_NODE_ID;
 	total_weight = 0.0;
 
 	for (i=0;i<NUM_BACKENDS;i++)
 	{
-		if (VALID_BACKEND(i))
+		if (VALID_BACKEND(i) && (eligible == NULL || eligible[i]))
 		{
 			total_weight += BACKEND_INFO(i).backend_weight;
 		}
@@ -1813,18 +2857,36 @@ int select_load_balancing_node(void)
 	total_weight = 0.0;
 	for (i=0;i<NUM_BACKENDS;i++)
 	{
-		if (VALID_BACKEND(i) && BACKEND_INFO(i).backend_weight > 0.0)
+		if (VALID_BACKEND(i) && BACKEND_INFO(i).backend_weight > 0.0 &&
+			(eligible == NULL || eligible[i]))
 		{
 			if(r >= total_weight)
-				selected_slot = i;
+				node = i;
 			else
 				break;
 			total_weight += BACKEND_INFO(i).backend_weight;
 		}
 	}
+	return node;
+}
+
+/*
+ * count load balanced queries running on each node by other children
+ */
+static void count_load_balanced_queries(int *active)
+{
+	int i;
 
-	pool_debug("select_load_balancing_node: selected backend id is %d", selected_slot);
-	return selected_slot;
+	for (i=0;i<MAX_NUM_BACKENDS;i++)
+		active[i] = 0;
+
+	for (i=0;i<pool_config->num_init_children;i++)
+	{
+		int node = pids[i].load_balance_node;
+
+		if (i != my_proc_id && node >= 0 && node < MAX_NUM_BACKENDS)
+			active[node]++;
+	}
 }
 
 /* SIGHUP handler */
@@ -36,6 +36,7 @@
 #include <fcntl.h>
 
 #include <sys/wait.h>
+#include <poll.h>
 
 #include <stdio.h>
 #include <errno.h>
@@ -81,6 +82,23 @@
 
 
 #define PGPOOLMAXLITSENQUEUELENGTH 10000
+
+/*
+ * State of health check of a backend
+ */
+typedef enum {
+	HC_CONNECTING,		/* waiting for connect(2) to complete */
+	HC_WAIT_RESPONSE,	/* startup packet sent */
+	HC_OK,
+	HC_FAILED
+} HealthCheckState;
+
+typedef struct {
+	int fd;
+	HealthCheckState state;
+	struct timeval start;	/* when the check started */
+} HealthCheckProbe;
+
 static void daemonize(void);
 static int read_pid_file(void);
 static void write_pid_file(void);
@@ -97,7 +115,9 @@ static void reaper(void);
 static void wakeup_children(void);
 static void reload_config(void);
 static int pool_pause(struct timeval *timeout);
-static void pool_sleep(unsigned int second);
+static void pool_sleep(unsigned int msec);
+static void start_health_check_probe(int node, HealthCheckProbe *probe, void *packet, int len);
+static void send_health_check_startup(int node, HealthCheckProbe *probe, void *packet, int len);
 static void kill_all_children(int sig);
 static int get_next_master_node(void);
 
@@ -373,7 +393,7 @@ int main(int argc, char **argv)
 	read_status_file();
 
 	/* clear cache */
-	if (clear_cache && pool_config->enable_query_cache && SYSDB_STATUS == CON_UP)
+	if (clear_cache && SYSTEMDB_QUERY_CACHE && SYSDB_STATUS == CON_UP)
 	{
 		Interval interval[1];
 
@@ -434,7 +454,6 @@ int main(int argc, char **argv)
 	Req_info->kind = NODE_UP_REQUEST;
 	memset(Req_info->node_id, -1, sizeof(int) * MAX_NUM_BACKENDS);
 	Req_info->master_node_id = get_next_master_node();
-	Req_info->conn_counter = 0;
 
 	InRecovery = pool_shared_memory_create(sizeof(int));
 	if (InRecovery == NULL)
@@ -444,6 +463,44 @@ int main(int argc, char **argv)
 	}
 	*InRecovery = 0;
 
+	/* create statistics area on shared memory */
+	if (pool_stats_init())
+	{
+		pool_error("failed to allocate statistics area");
+		myexit(1);
+	}
+
+	/* prepare for connecting to backends in advance */
+	if (pool_prewarm_init())
+	{
+		pool_error("failed to initialize prewarm_connections");
+		myexit(1);
+	}
+
+	/* create the socket to pass connections of exiting children */
+	if (pool_handoff_init())
+	{
+		pool_error("failed to initialize handoff_connections");
+		myexit(1);
+	}
+
+	/* create relation cache on shared memory */
+	if (pool_relcache_init(pool_config->relcache_size))
+	{
+		pool_error("failed to allocate relation cache");
+		myexit(1);
+	}
+
+	/* create query cache on shared memory */
+	if (SHMEM_QUERY_CACHE)
+	{
+		if (pool_shmem_cache_init(pool_config->query_cache_size))
+		{
+			pool_error("failed to allocate query cache");
+			myexit(1);
+		}
+	}
+
 	/*
 	 * We need to block signal here. Otherwise child might send some
 	 * signals, for example SIGUSR1(fail over).  Children will inherit
@@ -520,10 +577,12 @@ int main(int argc, char **argv)
 				/*
 				 * set health checker timeout. we want to detect
 				 * communication path failure much earlier before
-				 * TCP/IP stack detects it.
+				 * TCP/IP stack detects it. health_check() has its own
+				 * timer in milliseconds. This one is mainly for
+				 * SystemDB.
 				 */
 				pool_signal(SIGALRM, health_check_timer_handler);
-				alarm(pool_config->health_check_timeout);
+				alarm((pool_config->health_check_timeout + 999) / 1000);
 			}
 
 			/*
@@ -534,7 +593,9 @@ int main(int argc, char **argv)
 			POOL_SETMASK(&UnBlockSig);
 			sts = health_check();
 			POOL_SETMASK(&BlockSig);
-			if (pool_config->parallel_mode || pool_config->enable_query_cache)
+			if (sts == 0)
+				retrycnt = 0;
+			if (pool_config->parallel_mode || SYSTEMDB_QUERY_CACHE)
 				sys_sts = system_db_health_check();
 
 			if ((sts > 0 || sys_sts < 0) && (errno != EINTR || (errno == EINTR && health_check_timer_expired)))
@@ -543,8 +604,20 @@ int main(int argc, char **argv)
 				{
 					sts--;
 
-					if (!pool_config->parallel_mode)
+					if (!pool_config->parallel_mode &&
+						retrycnt < pool_config->health_check_max_retries)
 					{
+						retrycnt++;
+						pool_signal(SIGALRM, SIG_IGN);	/* Cancel timer */
+
+						sleep_time = pool_config->health_check_retry_delay;
+						pool_log("health check of %d th backend failed. retry after %d milliseconds", sts, sleep_time);
+						pool_sleep(sleep_time);
+						continue;
+					}
+					else if (!pool_config->parallel_mode)
+					{
+						retrycnt = 0;
 						pool_log("set %d th backend down status", sts);
 						Req_info->kind = NODE_DOWN_REQUEST;
 						Req_info->node_id[0] = sts;
@@ -569,7 +642,7 @@ int main(int argc, char **argv)
 						{
 							/* continue to retry */
 							sleep_time = pool_config->health_check_period/NUM_BACKENDS;
-							pool_debug("retry sleep time: %d seconds", sleep_time);
+							pool_debug("retry sleep time: %d milliseconds", sleep_time);
 							pool_sleep(sleep_time);
 							continue;
 						}
@@ -589,7 +662,7 @@ int main(int argc, char **argv)
 					else if (sts == 0) /* goes to sleep only when SystemDB alone was down */
 					{
 						sleep_time = pool_config->health_check_period/NUM_BACKENDS;
-						pool_debug("retry sleep time: %d seconds", sleep_time);
+						pool_debug("retry sleep time: %d milliseconds", sleep_time);
 						pool_sleep(sleep_time);
 						continue;
 					}
@@ -894,6 +967,9 @@ pid_t pcp_fork_a_child(int unix_fd, int inet_fd, char *pcp_conf_file)
 
 		myargv = save_ps_display_args(myargc, myargv);
 
+		/* connections passed by children are not for us */
+		pool_handoff_adopt(-1);
+
 		/* call PCP child main */
 		POOL_SETMASK(&UnBlockSig);
 		reload_config_request = 0;
@@ -914,6 +990,13 @@ pid_t fork_a_child(int unix_fd, int inet_fd, int id)
 {
 	pid_t pid;
 
+	/* the new child is not running any load balanced query */
+	pids[id].load_balance_node = -1;
+	pids[id].connected = 0;
+
+	/* get connections passed by the previous child of this slot */
+	pool_handoff_receive();
+
 	pid = fork();
 
 	if (pid == 0)
@@ -938,6 +1021,7 @@ pid_t fork_a_child(int unix_fd, int inet_fd, int id)
 		POOL_SETMASK(&UnBlockSig);
 		reload_config_request = 0;
 		my_proc_id = id;
+		pool_stats_set_child(id);
 		do_child(unix_fd, inet_fd);
 	}
 	else if (pid == -1)
@@ -945,6 +1029,9 @@ pid_t fork_a_child(int unix_fd, int inet_fd, int id)
 		pool_error("fork() failed. reason: %s", strerror(errno));
 		myexit(1);
 	}
+
+	/* the child has its own copies of the passed connections */
+	pool_handoff_forget(id);
 	return pid;
 }
 
@@ -1352,6 +1439,7 @@ static void failover(void)
 				 BACKEND_INFO(node_id).backend_hostname,
 				 BACKEND_INFO(node_id).backend_port);
 		BACKEND_INFO(node_id).backend_status = CON_CONNECT_WAIT;	/* unset down status */
+		pool_stats_count_failover(node_id, 1);
 		trigger_failover_command(node_id, pool_config->failback_command);
 	}
 	else
@@ -1369,6 +1457,7 @@ static void failover(void)
 
 
 				BACKEND_INFO(Req_info->node_id[i]).backend_status = CON_DOWN;	/* set down status */
+				pool_stats_count_failover(Req_info->node_id[i], 0);
 				/* save down node */
 				nodes[Req_info->node_id[i]] = 1;
 				cnt++;
@@ -1472,6 +1561,9 @@ static void failover(void)
 	memset(Req_info->node_id, -1, sizeof(int) * MAX_NUM_BACKENDS);
 	pool_semaphore_unlock(REQUEST_INFO_SEM);
 
+	/* connections passed by children are for the old set of nodes */
+	pool_handoff_discard();
+
 	/* fork the children */
 	for (i=0;i<pool_config->num_init_children;i++)
 	{
@@ -1512,15 +1604,16 @@ static RETSIGTYPE health_check_timer_handler(int sig)
 
 
 /*
- * check if we can connect to the backend
- * returns 0 for ok. otherwise returns backend id + 1
+ * check if we can connect to the backends. All the backends are
+ * probed at the same time with non-blocking sockets, so a check
+ * takes at most health_check_timeout regardless of the number of
+ * backends.
+ * returns 0 for ok. otherwise returns backend id + 1 of the first
+ * failed backend.
  */
 int health_check(void)
 {
-	int fd;
-	int sts;
-	static bool is_first = true;
-	static char *dbname;
+	static char *dbname = "postgres";
 
 	/* V2 startup packet */
 	typedef struct {
@@ -1528,117 +1621,266 @@ int health_check(void)
 		StartupPacket_v2 sp;
 	} MySp;
 	MySp mysp;
-	char kind;
+	HealthCheckProbe probes[MAX_NUM_BACKENDS];
+	struct pollfd pollfds[MAX_NUM_BACKENDS];
+	int nodes[MAX_NUM_BACKENDS];
+	long deadline = 0;
+	int pending;
 	int i;
 
 	/* Do health check during recovery */
 	if (*InRecovery)
 		return 0;
 
- Retry:
-	/*
-	 * First we try with "postgres" database.
-	 */
-	if (is_first)
-		dbname = "postgres";
-
 	memset(&mysp, 0, sizeof(mysp));
 	mysp.len = htonl(296);
 	mysp.sp.protoVersion = htonl(PROTO_MAJOR_V2 << 16);
-	strcpy(mysp.sp.database, dbname);
 	strncpy(mysp.sp.user, pool_config->health_check_user, sizeof(mysp.sp.user) - 1);
 	*mysp.sp.options = '\0';
 	*mysp.sp.unused = '\0';
 	*mysp.sp.tty = '\0';
 
+	if (pool_config->health_check_timeout > 0)
+		deadline = pool_event_now() + pool_config->health_check_timeout;
+
+	pending = 0;
 	for (i=0;i<pool_config->backend_desc->num_backends;i++)
 	{
 		pool_debug("health_check: %d th DB node status: %d", i, BACKEND_INFO(i).backend_status);
 
+		probes[i].fd = -1;
+		probes[i].state = HC_OK;
+
 		if (BACKEND_INFO(i).backend_status == CON_UNUSED ||
 			BACKEND_INFO(i).backend_status == CON_DOWN)
 			continue;
 
-		if (*(BACKEND_INFO(i).backend_hostname) == '\0')
-			fd = connect_unix_domain_socket(i);
-		else
-			fd = connect_inet_domain_socket(i);
+		strcpy(mysp.sp.database, dbname);
+		start_health_check_probe(i, &probes[i], &mysp, sizeof(mysp));
+		if (probes[i].state != HC_FAILED)
+			pending++;
+	}
 
-		if (fd < 0)
-		{
-			pool_error("health check failed. %d th host %s at port %d is down",
-					   i,
-					   BACKEND_INFO(i).backend_hostname,
-					   BACKEND_INFO(i).backend_port);
+	while (pending > 0)
+	{
+		int timeout = -1;
+		int n = 0;
+		int r;
 
-			return i+1;
+		for (i=0;i<pool_config->backend_desc->num_backends;i++)
+		{
+			if (probes[i].state == HC_CONNECTING || probes[i].state == HC_WAIT_RESPONSE)
+			{
+				pollfds[n].fd = probes[i].fd;
+				pollfds[n].events = probes[i].state == HC_CONNECTING ? POLLOUT : POLLIN;
+				pollfds[n].revents = 0;
+				nodes[n++] = i;
+			}
 		}
 
-		if (write(fd, &mysp, sizeof(mysp)) < 0)
+		if (deadline)
 		{
-			pool_error("health check failed during write. host %s at port %d is down. reason: %s",
-					   BACKEND_INFO(i).backend_hostname,
-					   BACKEND_INFO(i).backend_port,
-					   strerror(errno));
-			close(fd);
-			return i+1;
+			timeout = deadline - pool_event_now();
+			if (timeout < 0)
+				timeout = 0;
 		}
 
-		/*
-		 * Don't bother to be blocked by read(2). It will be
-		 * interrupted by ALRAM anyway.
-		 */
-		sts = read(fd, &kind, 1);
-		if (sts == -1)
+		r = poll(pollfds, n, timeout);
+		if (r < 0)
 		{
-			pool_error("health check failed during read. host %s at port %d is down. reason: %s",
-					   BACKEND_INFO(i).backend_hostname,
-					   BACKEND_INFO(i).backend_port,
-					   strerror(errno));
-			close(fd);
-			return i+1;
+			/* SIGALRM of the health check timer means time out */
+			if (errno == EINTR && !health_check_timer_expired)
+				continue;
+			r = 0;
 		}
-		else if (sts == 0)
+
+		if (r == 0)
 		{
-			pool_error("health check failed. EOF encountered. host %s at port %d is down",
-					   BACKEND_INFO(i).backend_hostname,
-					   BACKEND_INFO(i).backend_port);
-			close(fd);
-			return i+1;
+			for (i=0;i<n;i++)
+			{
+				pool_error("health check failed. timed out. host %s at port %d is down",
+						   BACKEND_INFO(nodes[i]).backend_hostname,
+						   BACKEND_INFO(nodes[i]).backend_port);
+				close(probes[nodes[i]].fd);
+				probes[nodes[i]].state = HC_FAILED;
+			}
+			break;
 		}
 
-		if (is_first)
-			is_first = false;
-
-		/*
-		 * If a backend raised a FATAL error(max connections error or
-		 * starting up error?), do not send a Terminate message.
-		 */
-		if ((kind != 'E') && (write(fd, "X", 1) < 0))
+		for (i=0;i<n;i++)
 		{
-			if (!strcmp(dbname, "postgres"))
+			HealthCheckProbe *probe = &probes[nodes[i]];
+
+			if (pollfds[i].revents == 0)
+				continue;
+
+			if (probe->state == HC_CONNECTING)
+			{
+				int err = 0;
+				socklen_t len = sizeof(err);
+
+				if (getsockopt(probe->fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0)
+					err = errno;
+
+				if (err)
+				{
+					pool_error("health check failed. %d th host %s at port %d is down. reason: %s",
+							   nodes[i],
+							   BACKEND_INFO(nodes[i]).backend_hostname,
+							   BACKEND_INFO(nodes[i]).backend_port,
+							   strerror(err));
+					close(probe->fd);
+					probe->state = HC_FAILED;
+				}
+				else
+					send_health_check_startup(nodes[i], probe, &mysp, sizeof(mysp));
+			}
+			else
 			{
+				char kind;
+				int sts;
+
+				sts = read(probe->fd, &kind, 1);
+				if (sts == -1 && (errno == EAGAIN || errno == EINTR))
+					continue;
+
+				if (sts == -1)
+				{
+					pool_error("health check failed during read. host %s at port %d is down. reason: %s",
+							   BACKEND_INFO(nodes[i]).backend_hostname,
+							   BACKEND_INFO(nodes[i]).backend_port,
+							   strerror(errno));
+					close(probe->fd);
+					probe->state = HC_FAILED;
+				}
+				else if (sts == 0)
+				{
+					pool_error("health check failed. EOF encountered. host %s at port %d is down",
+							   BACKEND_INFO(nodes[i]).backend_hostname,
+							   BACKEND_INFO(nodes[i]).backend_port);
+					close(probe->fd);
+					probe->state = HC_FAILED;
+				}
 				/*
-				 * Retry with template1
+				 * If a backend raised a FATAL error(max connections error or
+				 * starting up error?), do not send a Terminate message.
 				 */
-				dbname = "template1";
-				goto Retry;
+				else if ((kind != 'E') && (write(probe->fd, "X", 1) < 0))
+				{
+					close(probe->fd);
+
+					if (!strcmp(dbname, "postgres"))
+					{
+						/*
+						 * Retry with template1
+						 */
+						dbname = "template1";
+						strcpy(mysp.sp.database, dbname);
+						start_health_check_probe(nodes[i], probe, &mysp, sizeof(mysp));
+					}
+					else
+					{
+						pool_error("health check failed during write. host %s at port %d is down. reason: %s. Perhaps wrong health check user?",
+								   BACKEND_INFO(nodes[i]).backend_hostname,
+								   BACKEND_INFO(nodes[i]).backend_port,
+								   strerror(errno));
+						probe->state = HC_FAILED;
+					}
+				}
+				else
+				{
+					long usec;
+					struct timeval now;
+
+					gettimeofday(&now, NULL);
+					usec = (now.tv_sec - probe->start.tv_sec) * 1000000L +
+						(now.tv_usec - probe->start.tv_usec);
+					BACKEND_INFO(nodes[i]).health_check_latency = usec > 0 ? usec : 0;
+					pool_debug("health_check: %d th DB node responded in %ld usec", nodes[i], usec);
+
+					close(probe->fd);
+					probe->state = HC_OK;
+				}
 			}
 
-			pool_error("health check failed during write. host %s at port %d is down. reason: %s. Perhaps wrong health check user?",
-					   BACKEND_INFO(i).backend_hostname,
-					   BACKEND_INFO(i).backend_port,
-					   strerror(errno));
-			close(fd);
-			return i+1;
+			if (probe->state == HC_OK || probe->state == HC_FAILED)
+				pending--;
 		}
+	}
 
-		close(fd);
+	for (i=0;i<pool_config->backend_desc->num_backends;i++)
+	{
+		if (probes[i].state == HC_FAILED)
+		{
+			/* tell the caller that this is not an interrupted system call */
+			if (!health_check_timer_expired)
+				errno = 0;
+			return i+1;
+		}
 	}
 
 	return 0;
 }
 
+/*
+ * start connecting to a backend for health check. probe->state is
+ * set to HC_FAILED on error.
+ */
+static void start_health_check_probe(int node, HealthCheckProbe *probe, void *packet, int len)
+{
+	gettimeofday(&probe->start, NULL);
+
+	if (*(BACKEND_INFO(node).backend_hostname) == '\0')
+	{
+		/* connecting to a local socket completes immediately */
+		probe->fd = connect_unix_domain_socket(node);
+		if (probe->fd >= 0 && fcntl(probe->fd, F_SETFL, O_NONBLOCK) < 0)
+		{
+			close(probe->fd);
+			probe->fd = -1;
+		}
+		if (probe->fd >= 0)
+		{
+			send_health_check_startup(node, probe, packet, len);
+			return;
+		}
+	}
+	else
+	{
+		probe->fd = connect_inet_domain_socket_nonblock(node);
+		if (probe->fd >= 0)
+		{
+			probe->state = HC_CONNECTING;
+			return;
+		}
+	}
+
+	pool_error("health check failed. %d th host %s at port %d is down",
+			   node,
+			   BACKEND_INFO(node).backend_hostname,
+			   BACKEND_INFO(node).backend_port);
+	probe->state = HC_FAILED;
+}
+
+/*
+ * send the startup packet on a connected socket. The packet is small
+ * enough to fit in the socket buffer of a fresh connection.
+ */
+static void send_health_check_startup(int node, HealthCheckProbe *probe, void *packet, int len)
+{
+	if (write(probe->fd, packet, len) != len)
+	{
+		pool_error("health check failed during write. host %s at port %d is down. reason: %s",
+				   BACKEND_INFO(node).backend_hostname,
+				   BACKEND_INFO(node).backend_port,
+				   strerror(errno));
+		close(probe->fd);
+		probe->state = HC_FAILED;
+		return;
+	}
+	probe->state = HC_WAIT_RESPONSE;
+}
+
 /*
  * check if we can connect to the SystemDB
  * returns 0 for ok. otherwise returns -1
@@ -1837,6 +2079,21 @@ pool_get_process_list(int *array_size)
 	return array;
 }
 
+/*
+ * get number of frontends connected to pgpool
+ */
+int
+pool_get_connection_count(void)
+{
+	int		i;
+	int		count = 0;
+
+	for (i = 0; i < pool_config->num_init_children; i++)
+		count += pids[i].connected;
+
+	return count;
+}
+
 /*
  * get process information specified by pid
  */
@@ -1949,41 +2206,35 @@ static int pool_pause(struct timeval *timeout)
 }
 
 /*
- * sleep for seconds specified by "second".  Unlike pool_pause(), this
- * function guarantees that it will sleep for specified seconds.  This
+ * sleep for milliseconds specified by "msec".  Unlike pool_pause(), this
+ * function guarantees that it will sleep for specified time.  This
  * function uses pool_pause() internally. If it informs that there is
  * a pending signal event, they are processed using CHECK_REQUEST
  * macro. Note that most of these processes are done while all signals
  * are blocked.
  */
-static void pool_sleep(unsigned int second)
+static void pool_sleep(unsigned int msec)
 {
-	struct timeval current_time, sleep_time;
+	long now, wakeup_time;
 
-	gettimeofday(&current_time, NULL);
-	sleep_time.tv_sec = second + current_time.tv_sec;
-	sleep_time.tv_usec = current_time.tv_usec;
+	now = pool_event_now();
+	wakeup_time = now + msec;
 
 	POOL_SETMASK(&UnBlockSig);
-	while (sleep_time.tv_sec > current_time.tv_sec)
+	while (wakeup_time > now)
 	{
 		struct timeval timeout;
 		int r;
 
-		timeout.tv_sec = sleep_time.tv_sec - current_time.tv_sec;
-		timeout.tv_usec = sleep_time.tv_usec - current_time.tv_usec;
-		if (timeout.tv_usec < 0)
-		{
-			timeout.tv_sec--;
-			timeout.tv_usec += 1000000;
-		}
+		timeout.tv_sec = (wakeup_time - now) / 1000;
+		timeout.tv_usec = (wakeup_time - now) % 1000 * 1000;
 
 		r = pool_pause(&timeout);
 		POOL_SETMASK(&BlockSig);
 		if (r > 0)
 			CHECK_REQUEST;
 		POOL_SETMASK(&UnBlockSig);
-		gettimeofday(&current_time, NULL);
+		now = pool_event_now();
 	}
 	POOL_SETMASK(&BlockSig);
 }
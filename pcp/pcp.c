@@ -509,6 +509,201 @@ pcp_node_info(int nid)
 	return NULL;
 }
 
+/* --------------------------------
+ * pcp_node_stats - get statistics of node pointed by given argument
+ *
+ * return structure of node statistics on success, NULL otherwise
+ * --------------------------------
+ */
+NodeStats *
+pcp_node_stats(int nid)
+{
+	int wsize;
+	char node_id[16];
+	char tos;
+	char *buf = NULL;
+	int rsize;
+
+	if (pc == NULL)
+	{
+		if (debug) fprintf(stderr, "DEBUG: connection does not exist\n");
+		errorcode = NOCONNERR;
+		return NULL;
+	}
+
+	snprintf(node_id, sizeof(node_id), "%d", nid);
+
+	pcp_write(pc, "G", 1);
+	wsize = htonl(strlen(node_id)+1 + sizeof(int));
+	pcp_write(pc, &wsize, sizeof(int));
+	pcp_write(pc, node_id, strlen(node_id)+1);
+	if (pcp_flush(pc) < 0)
+	{
+		if (debug) fprintf(stderr, "DEBUG: could not send data to backend\n");
+		return NULL;
+	}
+	if (debug) fprintf(stderr, "DEBUG: send: tos=\"G\", len=%d\n", ntohl(wsize));
+
+	if (pcp_read(pc, &tos, 1))
+		return NULL;
+	if (pcp_read(pc, &rsize, sizeof(int)))
+		return NULL;
+	rsize = ntohl(rsize);
+	buf = (char *)malloc(rsize);
+	if (buf == NULL)
+	{
+		errorcode = NOMEMERR;
+		return NULL;
+	}
+	if (pcp_read(pc, buf, rsize - sizeof(int)))
+	{
+		free(buf);
+		return NULL;
+	}
+
+	if (debug) fprintf(stderr, "DEBUG: recv: tos=\"%c\", len=%d, data=%s\n", tos, rsize, buf);
+
+	if (tos == 'e')
+	{
+		if (debug) fprintf(stderr, "DEBUG: command failed. reason=%s\n", buf);
+		errorcode = BACKENDERR;
+		free(buf);
+		return NULL;
+	}
+	else if (tos == 'g')
+	{
+		if (strcmp(buf, "CommandComplete") == 0)
+		{
+			char *index = buf;
+			NodeStats *stats;
+			unsigned long long *values[6 + NUM_LATENCY_BUCKETS];
+			int i;
+
+			stats = (NodeStats *)malloc(sizeof(NodeStats));
+			if (stats == NULL)
+			{
+				errorcode = NOMEMERR;
+				free(buf);
+				return NULL;
+			}
+
+			values[0] = &stats->select_count;
+			values[1] = &stats->write_count;
+			values[2] = &stats->bytes_received;
+			values[3] = &stats->bytes_sent;
+			values[4] = &stats->failover_count;
+			values[5] = &stats->failback_count;
+			for (i = 0; i < NUM_LATENCY_BUCKETS; i++)
+				values[6 + i] = &stats->latency[i];
+
+			for (i = 0; i < 6 + NUM_LATENCY_BUCKETS; i++)
+			{
+				index = (char *) memchr(index, '\0', rsize - (index - buf)) + 1;
+				*values[i] = strtoull(index, NULL, 10);
+			}
+
+			free(buf);
+			return stats;
+		}
+	}
+
+	free(buf);
+	return NULL;
+}
+
+/* --------------------------------
+ * pcp_pool_stats - get statistics not related to nodes
+ *
+ * return structure of statistics on success, NULL otherwise
+ * --------------------------------
+ */
+PoolStats *
+pcp_pool_stats(void)
+{
+	int wsize;
+	char tos;
+	char *buf = NULL;
+	int rsize;
+
+	if (pc == NULL)
+	{
+		if (debug) fprintf(stderr, "DEBUG: connection does not exist\n");
+		errorcode = NOCONNERR;
+		return NULL;
+	}
+
+	pcp_write(pc, "K", 1);
+	wsize = htonl(sizeof(int));
+	pcp_write(pc, &wsize, sizeof(int));
+	if (pcp_flush(pc) < 0)
+	{
+		if (debug) fprintf(stderr, "DEBUG: could not send data to backend\n");
+		return NULL;
+	}
+	if (debug) fprintf(stderr, "DEBUG: send: tos=\"K\", len=%d\n", ntohl(wsize));
+
+	if (pcp_read(pc, &tos, 1))
+		return NULL;
+	if (pcp_read(pc, &rsize, sizeof(int)))
+		return NULL;
+	rsize = ntohl(rsize);
+	buf = (char *)malloc(rsize);
+	if (buf == NULL)
+	{
+		errorcode = NOMEMERR;
+		return NULL;
+	}
+	if (pcp_read(pc, buf, rsize - sizeof(int)))
+	{
+		free(buf);
+		return NULL;
+	}
+
+	if (debug) fprintf(stderr, "DEBUG: recv: tos=\"%c\", len=%d, data=%s\n", tos, rsize, buf);
+
+	if (tos == 'e')
+	{
+		if (debug) fprintf(stderr, "DEBUG: command failed. reason=%s\n", buf);
+		errorcode = BACKENDERR;
+		free(buf);
+		return NULL;
+	}
+	else if (tos == 'k')
+	{
+		if (strcmp(buf, "CommandComplete") == 0)
+		{
+			char *index = buf;
+			PoolStats *stats;
+
+			stats = (PoolStats *)malloc(sizeof(PoolStats));
+			if (stats == NULL)
+			{
+				errorcode = NOMEMERR;
+				free(buf);
+				return NULL;
+			}
+
+			index = (char *) memchr(index, '\0', rsize) + 1;
+			stats->connection_pool_hit = strtoull(index, NULL, 10);
+
+			index = (char *) memchr(index, '\0', rsize) + 1;
+			stats->connection_pool_miss = strtoull(index, NULL, 10);
+
+			index = (char *) memchr(index, '\0', rsize) + 1;
+			stats->query_cache_hit = strtoull(index, NULL, 10);
+
+			index = (char *) memchr(index, '\0', rsize) + 1;
+			stats->query_cache_miss = strtoull(index, NULL, 10);
+
+			free(buf);
+			return stats;
+		}
+	}
+
+	free(buf);
+	return NULL;
+}
+
 /* --------------------------------
  * pcp_node_count - get number of nodes currently connected to pgpool
  *
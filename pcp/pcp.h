@@ -54,6 +54,8 @@ extern void pcp_disconnect(void);
 extern int pcp_terminate_pgpool(char mode);
 extern int pcp_node_count(void);
 extern BackendInfo *pcp_node_info(int nid);
+extern NodeStats *pcp_node_stats(int nid);
+extern PoolStats *pcp_pool_stats(void);
 extern int *pcp_process_count(int *process_count);
 extern ProcessInfo *pcp_process_info(int pid, int *array_size);
 extern SystemDBInfo *pcp_systemdb_info(void);
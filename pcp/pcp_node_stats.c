@@ -0,0 +1,175 @@
+/*
+ * $Header$
+ *
+ * pgpool: a language independent connection pool server for PostgreSQL 
+ * written by Tatsuo Ishii
+ *
+ * Copyright (c) 2003-2010	PgPool Global Development Group
+ *
+ * Permission to use, copy, modify, and distribute this software and
+ * its documentation for any purpose and without fee is hereby
+ * granted, provided that the above copyright notice appear in all
+ * copies and that both that copyright notice and this permission
+ * notice appear in supporting documentation, and that the name of the
+ * author not be used in advertising or publicity pertaining to
+ * distribution of the software without specific, written prior
+ * permission. The author makes no representations about the
+ * suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * Client program to send "node stats" command.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "pcp.h"
+
+static void usage(void);
+static void myexit(ErrorCode e);
+
+int
+main(int argc, char **argv)
+{
+	long timeout;
+	char host[MAX_DB_HOST_NAMELEN];
+	int port;
+	char user[MAX_USER_PASSWD_LEN];
+	char pass[MAX_USER_PASSWD_LEN];
+	int nodeID;
+	NodeStats *stats;
+	int i;
+	int ch;
+
+	while ((ch = getopt(argc, argv, "hd")) != -1) {
+		switch (ch) {
+		case 'd':
+			pcp_enable_debug();
+			break;
+
+		case 'h':
+		case '?':
+		default:
+			usage();
+			exit(0);
+		}
+	}
+	argc -= optind;
+	argv += optind;
+
+	if (argc != 6)
+	{
+		errorcode = INVALERR;
+		pcp_errorstr(errorcode);
+		myexit(errorcode);
+	}
+
+	timeout = atol(argv[0]);
+	if (timeout < 0) {
+		errorcode = INVALERR;
+		pcp_errorstr(errorcode);
+		myexit(errorcode);
+	}
+
+	if (strlen(argv[1]) >= MAX_DB_HOST_NAMELEN)
+	{
+		errorcode = INVALERR;
+		pcp_errorstr(errorcode);
+		myexit(errorcode);
+	}
+	strcpy(host, argv[1]);
+
+	port = atoi(argv[2]);
+	if (port <= 1024 || port > 65535)
+	{
+		errorcode = INVALERR;
+		pcp_errorstr(errorcode);
+		myexit(errorcode);
+	}
+
+	if (strlen(argv[3]) >= MAX_USER_PASSWD_LEN)
+	{
+		errorcode = INVALERR;
+		pcp_errorstr(errorcode);
+		myexit(errorcode);
+	}
+	strcpy(user, argv[3]);
+
+	if (strlen(argv[4]) >= MAX_USER_PASSWD_LEN)
+	{
+		errorcode = INVALERR;
+		pcp_errorstr(errorcode);
+		myexit(errorcode);
+	}
+	strcpy(pass, argv[4]);
+
+	nodeID = atoi(argv[5]);
+	if (nodeID < 0 || nodeID > MAX_NUM_BACKENDS)
+	{
+		errorcode = INVALERR;
+		pcp_errorstr(errorcode);
+		myexit(errorcode);
+	}
+
+	pcp_set_timeout(timeout);
+
+	if (pcp_connect(host, port, user, pass))
+	{
+		pcp_errorstr(errorcode);
+		myexit(errorcode);
+	}
+
+	if ((stats = pcp_node_stats(nodeID)) == NULL)
+	{
+		pcp_errorstr(errorcode);
+		pcp_disconnect();
+		myexit(errorcode);
+	} else {
+		printf("%llu %llu %llu %llu %llu %llu",
+			   stats->select_count,
+			   stats->write_count,
+			   stats->bytes_received,
+			   stats->bytes_sent,
+			   stats->failover_count,
+			   stats->failback_count);
+		for (i = 0; i < NUM_LATENCY_BUCKETS; i++)
+			printf(" %llu", stats->latency[i]);
+		printf("\n");
+
+		free(stats);
+	}
+
+	pcp_disconnect();
+
+	return 0;
+}
+
+static void
+usage(void)
+{
+	fprintf(stderr, "pcp_node_stats - display a pgpool-II node's statistics\n\n");
+	fprintf(stderr, "Usage: pcp_node_stats [-d] timeout hostname port# username password nodeID\n");
+	fprintf(stderr, "Usage: pcp_node_stats -h\n\n");
+	fprintf(stderr, "  -d       - enable debug message (optional)\n");
+	fprintf(stderr, "  timeout  - connection timeout value in seconds. command exits on timeout\n");
+	fprintf(stderr, "  hostname - pgpool-II hostname\n");
+	fprintf(stderr, "  port#    - pgpool-II port number\n");
+	fprintf(stderr, "  username - username for PCP authentication\n");
+	fprintf(stderr, "  password - password for PCP authentication\n");
+	fprintf(stderr, "  nodeID   - ID of a node to get statistics for\n");
+	fprintf(stderr, "  -h       - print this help\n");
+}
+
+static void
+myexit(ErrorCode e)
+{
+	if (e == INVALERR)
+	{
+		usage();
+		exit(e);
+	}
+
+	exit(e);
+}
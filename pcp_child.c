@@ -353,6 +353,96 @@ set_ps_display(buf, false);
 				break;
 			}
 
+			case 'G':			/* node statistics */
+			{
+				int node_id;
+				int wsize;
+				NodeStats stats;
+
+				node_id = atoi(buf);
+
+				if (pool_get_node_stats(node_id, &stats) < 0)
+				{
+					char code[] = "Invalid Node ID";
+
+					pcp_write(frontend, "e", 1);
+					wsize = htonl(sizeof(code) + sizeof(int));
+					pcp_write(frontend, &wsize, sizeof(int));
+					pcp_write(frontend, code, sizeof(code));
+					if (pcp_flush(frontend) < 0)
+					{
+						pool_error("pcp_child: pcp_flush() failed. reason: %s", strerror(errno));
+						exit(1);
+					}
+
+					pool_debug("pcp_child: invalid node ID");
+				}
+				else
+				{
+					char code[] = "CommandComplete";
+					unsigned long long values[6 + NUM_LATENCY_BUCKETS];
+					char mesg[(6 + NUM_LATENCY_BUCKETS) * 21];	/* 20 digits and a null */
+					int mesg_len = 0;
+					int i;
+
+					values[0] = stats.select_count;
+					values[1] = stats.write_count;
+					values[2] = stats.bytes_received;
+					values[3] = stats.bytes_sent;
+					values[4] = stats.failover_count;
+					values[5] = stats.failback_count;
+					for (i = 0; i < NUM_LATENCY_BUCKETS; i++)
+						values[6 + i] = stats.latency[i];
+
+					for (i = 0; i < 6 + NUM_LATENCY_BUCKETS; i++)
+						mesg_len += snprintf(mesg + mesg_len, sizeof(mesg) - mesg_len, "%llu", values[i]) + 1;
+
+					pcp_write(frontend, "g", 1);
+					wsize = htonl(sizeof(code) + mesg_len + sizeof(int));
+					pcp_write(frontend, &wsize, sizeof(int));
+					pcp_write(frontend, code, sizeof(code));
+					pcp_write(frontend, mesg, mesg_len);
+					if (pcp_flush(frontend) < 0)
+					{
+						pool_error("pcp_child: pcp_flush() failed. reason: %s", strerror(errno));
+						exit(1);
+					}
+
+					pool_debug("pcp_child: retrieved node statistics from shared memory");
+				}
+				break;
+			}
+
+			case 'K':			/* pool statistics */
+			{
+				int wsize;
+				PoolStats stats;
+				char code[] = "CommandComplete";
+				char mesg[4 * 21];	/* 20 digits and a null */
+				int mesg_len;
+
+				pool_get_pool_stats(&stats);
+
+				mesg_len = snprintf(mesg, sizeof(mesg), "%llu", stats.connection_pool_hit) + 1;
+				mesg_len += snprintf(mesg + mesg_len, sizeof(mesg) - mesg_len, "%llu", stats.connection_pool_miss) + 1;
+				mesg_len += snprintf(mesg + mesg_len, sizeof(mesg) - mesg_len, "%llu", stats.query_cache_hit) + 1;
+				mesg_len += snprintf(mesg + mesg_len, sizeof(mesg) - mesg_len, "%llu", stats.query_cache_miss) + 1;
+
+				pcp_write(frontend, "k", 1);
+				wsize = htonl(sizeof(code) + mesg_len + sizeof(int));
+				pcp_write(frontend, &wsize, sizeof(int));
+				pcp_write(frontend, code, sizeof(code));
+				pcp_write(frontend, mesg, mesg_len);
+				if (pcp_flush(frontend) < 0)
+				{
+					pool_error("pcp_child: pcp_flush() failed. reason: %s", strerror(errno));
+					exit(1);
+				}
+
+				pool_debug("pcp_child: retrieved pool statistics from shared memory");
+				break;
+			}
+
 			case 'N':			/* process count */
 			{
 				int wsize;
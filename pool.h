@@ -32,6 +32,7 @@
 #include "libpq-fe.h"
 #include <stdio.h>
 #include <time.h>
+#include <sys/time.h>
 #include <sys/types.h>
 #include <limits.h>
 
@@ -138,8 +139,12 @@ typedef struct {
 	char *pcp_socket_dir;		/* PCP socket directory */
 	int pcp_timeout;			/* PCP timeout for an idle client */
     int	num_init_children;	/* # of children initially pre-forked */
+	int sessions_per_child; /* max # of frontend sessions a child serves at the same time */
+	char *pool_mode;	/* when backend connections return to the pool. "session" or "transaction" */
     int	child_life_time;	/* if idle for this seconds, child exits */
     int	connection_life_time;	/* if idle for this seconds, connection closes */
+    char *prewarm_connections;	/* comma separated user:database pairs to connect in advance */
+    int	handoff_connections;	/* if non 0, pass cached connections to the next child */
     int	child_max_connections;	/* if max_connections received, child exits */
 	int client_idle_limit;		/* If client_idle_limit is n (n > 0), the client is forced to be
 								   disconnected after n seconds idle */
@@ -155,6 +160,8 @@ typedef struct {
 	int enable_pool_hba;		/* 0:false, 1:true - enables pool_hba.conf file authentication */
 
 	int load_balance_mode;		/* load balance mode */
+	char *load_balance_policy;	/* how to choose load balance node */
+	int statement_level_load_balance; /* if non 0, choose load balance node for each query */
 
 	int replication_stop_on_mismatch;		/* if there's a data mismatch between master and secondary
 											 * start degenration to stop replication mode
@@ -165,8 +172,14 @@ typedef struct {
 	int print_timestamp;		/* if non 0, print time stamp to each log line */
 	int master_slave_mode;		/* if non 0, operate in master/slave mode */
 	int connection_cache;		/* if non 0, cache connection pool */
-	int health_check_timeout;	/* health check timeout */
-	int health_check_period;	/* health check period */
+	int reset_only_modified_session; /* if non 0, issue reset queries only if the session modified its state */
+	int read_buffer_size;		/* size of per connection read buffer in bytes */
+	int relcache_size;		/* number of relation cache entries on shared memory */
+	int parse_cache_size;	/* number of parse trees cached in each child */
+	int health_check_timeout;	/* health check timeout in milliseconds */
+	int health_check_period;	/* health check period in milliseconds */
+	int health_check_max_retries;	/* number of retries before failover */
+	int health_check_retry_delay;	/* delay between retries in milliseconds */
 	char *health_check_user;		/* PostgreSQL user name for health check */
 	char *failover_command;     /* execute command when failover happens */
 	char *failback_command;     /* execute command when failback happens */
@@ -196,6 +209,9 @@ typedef struct {
 	int parallel_mode;	/* if non 0, run in parallel query mode */
 
 	int enable_query_cache;		/* if non 0, use query cache. 0 by default */
+	char *query_cache_method;	/* where to store query cache. "systemdb" or "shmem" */
+	int query_cache_size;		/* size of shared memory query cache in bytes */
+	int query_cache_expire;		/* life time of shared memory query cache in seconds. 0 means forever */
 
 	char *pgpool2_hostname;		/* pgpool2 hostname */
 	char *system_db_hostname;	/* system DB hostname */
@@ -204,6 +220,7 @@ typedef struct {
 	char *system_db_schema;		/* system DB schema name */
 	char *system_db_user;		/* user name to access system DB */
 	char *system_db_password;	/* password to access system DB */
+	int copy_batch_size;	/* bytes of rows sent to a backend at once by COPY FROM in parallel mode */
 
 	char *lobj_lock_table;		/* table name to lock for rewriting lo_creat */
 
@@ -358,6 +375,8 @@ typedef struct {
 	void *data;	/* user data */
 	int refcnt;		/* reference count */
 	int session_id;		/* LocalSessionId */
+	unsigned int hash;	/* hash of dbname and relname */
+	unsigned int generation;	/* relation cache generation when registered */
 } PoolRelCache;
 
 typedef struct {
@@ -379,6 +398,94 @@ typedef struct {
 	PoolRelCache *cache;	/* cache data */
 } POOL_RELCACHE;
 
+/*
+ * Per session state of query processing. Formerly these were process
+ * global variables of pool_process_query.c and pool_proto_modules.c.
+ * All modules refer to the state through session_context, so a
+ * process can switch among several sessions by changing it. See
+ * pool_session_context.c.
+ */
+struct pool_portal;
+struct pool_prepared_statement_list;
+
+typedef struct {
+	/* load balancing */
+	int in_load_balance;	/* non 0 if in load balance mode */
+	int selected_slot;		/* selected DB node for load balance */
+	int master_slave_dml;	/* non 0 if master/slave mode is specified in config file */
+	int force_replication;
+	int replication_was_enabled;		/* replication mode was enabled */
+	int master_slave_was_enabled;	/* master/slave mode was enabled */
+	struct timeval load_balance_start_time;	/* when load balanced query started */
+
+	/* query processing */
+	int internal_transaction_started;		/* to issue table lock command a transaction
+											   has been started internally */
+	int in_progress;		/* indicates while doing something after receiving Query */
+	int mismatch_ntuples;	/* number of updated tuples */
+	int select_in_transaction; /* non 0 if select query is in transaction */
+	int execute_select; /* non 0 if select query is in transaction */
+	int receive_extended_begin;	/* non 0 if "BEGIN" query with extended query protocol received */
+	int session_state_modified;	/* non 0 if session level state (run time
+								 * parameters, temporary tables, cursors
+								 * WITH HOLD etc.) might have been created */
+	int backend_idle;	/* non 0 if ReadyForQuery is the last message from
+						 * backends and nothing has been sent since */
+
+	/*
+	 * Non 0 if allow to close internal transaction.  This variable was
+	 * introduced on 2008/4/3 not to close an internal transaction when
+	 * Sync message is received after receiving Parse message. This hack
+	 * is for PHP-PDO.
+	 */
+	int allow_close_transaction;
+
+	int is_select_pgcatalog;
+	int is_select_for_update; /* 1 if SELECT INTO or SELECT FOR UPDATE */
+	bool is_parallel_table;
+
+	/*
+	 * query string produced by nodeToString() in simpleQuery().
+	 * this variable only usefull when enable_query_cache is true.
+	 */
+	char *parsed_query;
+	int cache_execute_result;	/* parsed_query is for Execute, whose result lacks RowDescription */
+
+	/*
+	 * hash of tables modified by the current transaction. shared
+	 * memory query cache of them is invalidated when the transaction
+	 * ends.
+	 */
+	unsigned int *cache_invalidate_tables;
+	int num_cache_invalidate_tables;
+	int cache_invalidate_tables_size;
+
+	int relcache_ddl_in_transaction;	/* non 0 if DDL has been issued in the transaction */
+
+	/* COPY */
+	char *copy_table;  /* copy table name */
+	char *copy_schema;  /* copy table name */
+	char copy_delimiter; /* copy delimiter char */
+	char *copy_null; /* copy null string */
+
+	/* prepared statements and portals */
+	void (*pending_function)(struct pool_prepared_statement_list *p, struct pool_portal *portal);
+	struct pool_portal *pending_prepared_portal;
+	struct pool_portal *unnamed_statement;
+	struct pool_portal *unnamed_portal;
+	struct pool_prepared_statement_list *prepared_list; /* prepared statement name list */
+
+	/*
+	 * values of process wide state changed by load balancing, saved
+	 * while another session is current. see pool_set_session_context()
+	 */
+	int shared_state_saved;	/* non 0 if following are valid */
+	int saved_replication_enabled;
+	int saved_master_slave_enabled;
+	LOAD_BALANCE_STATUS saved_load_balance_status[MAX_NUM_BACKENDS];
+	int saved_load_balance_node;
+} POOL_SESSION_CONTEXT;
+
 
 #ifdef NOT_USED
 #define NUM_BACKENDS (in_load_balance? (selected_slot+1) : \
@@ -386,19 +493,19 @@ typedef struct {
 					   pool_config->backend_desc->num_backends))
 #endif
 /* NUM_BACKENDS now always returns actual number of backends if not in_load_balance */
-#define NUM_BACKENDS (in_load_balance ? (selected_slot+1) : pool_config->backend_desc->num_backends)
+#define NUM_BACKENDS (session_context->in_load_balance ? (session_context->selected_slot+1) : pool_config->backend_desc->num_backends)
 #define BACKEND_INFO(backend_id) (pool_config->backend_desc->backend_info[(backend_id)])
 #define LOAD_BALANCE_STATUS(backend_id) (pool_config->load_balance_status[(backend_id)])
 /* if RAW_MODE, VALID_BACKEND returns the selected node only */
 #define VALID_BACKEND(backend_id) \
 	(RAW_MODE ? (backend_id) == MASTER_NODE_ID : \
-	(in_load_balance ? LOAD_BALANCE_STATUS(backend_id) == LOAD_SELECTED : \
+	(session_context->in_load_balance ? LOAD_BALANCE_STATUS(backend_id) == LOAD_SELECTED : \
     ((BACKEND_INFO(backend_id).backend_status == CON_UP) || \
 	 (BACKEND_INFO(backend_id).backend_status == CON_CONNECT_WAIT))))
 #define CONNECTION_SLOT(p, slot) ((p)->slots[(slot)])
 #define CONNECTION(p, slot) (CONNECTION_SLOT(p, slot)->con)
 #define MASTER_CONNECTION(p) ((p)->slots[MASTER_NODE_ID])
-#define MASTER_NODE_ID (in_load_balance? selected_slot : Req_info->master_node_id)
+#define MASTER_NODE_ID (session_context->in_load_balance? session_context->selected_slot : Req_info->master_node_id)
 #define IS_MASTER_NODE_ID(node_id) (MASTER_NODE_ID == (node_id))
 //#define SECONDARY_CONNECTION(p) ((p)->slots[1])
 #define REPLICATION (pool_config->replication_enabled)
@@ -406,6 +513,8 @@ typedef struct {
 #define DUAL_MODE (REPLICATION || MASTER_SLAVE)
 #define PARALLEL_MODE (pool_config->parallel_mode)
 #define RAW_MODE (!REPLICATION && !PARALLEL_MODE && !MASTER_SLAVE)
+#define MULTIPLEXED_MODE (pool_config->sessions_per_child > 1)
+#define TRANSACTION_POOLING (MULTIPLEXED_MODE && !strcmp(pool_config->pool_mode, "transaction"))
 #define MASTER(p) MASTER_CONNECTION(p)->con
 //#define SECONDARY(p) SECONDARY_CONNECTION(p)->con
 #define MAJOR(p) MASTER_CONNECTION(p)->sp->major
@@ -414,6 +523,15 @@ typedef struct {
 #define SYSDB_CONNECTION (system_db_info->connection)
 #define SYSDB_STATUS (*system_db_info->system_db_status)
 
+/* query cache is stored in shared memory rather than System DB */
+#define SHMEM_QUERY_CACHE (pool_config->enable_query_cache && !strcmp(pool_config->query_cache_method, "shmem"))
+/* query cache is stored in System DB */
+#define SYSTEMDB_QUERY_CACHE (pool_config->enable_query_cache && !SHMEM_QUERY_CACHE)
+/* query cache can be looked up and registered */
+#define QUERY_CACHE_AVAILABLE (SHMEM_QUERY_CACHE || (SYSTEMDB_QUERY_CACHE && SYSDB_STATUS == CON_UP))
+/* max number of tables a query can reference to be cached in shared memory */
+#define SHMEM_CACHE_MAX_TABLES 8
+
 #define Max(x, y)		((x) > (y) ? (x) : (y))
 #define Min(x, y)		((x) < (y) ? (x) : (y))
 
@@ -424,9 +542,11 @@ typedef struct {
 #define NO_LOAD_BALANCE "/*NO LOAD BALANCE*/"
 #define NO_LOAD_BALANCE_COMMENT_SZ (sizeof(NO_LOAD_BALANCE)-1)
 
-#define MAX_NUM_SEMAPHORES		3
-#define CONN_COUNTER_SEM 0
-#define REQUEST_INFO_SEM 1
+#define MAX_NUM_SEMAPHORES		4
+#define REQUEST_INFO_SEM 0
+#define QUERY_CACHE_SEM 1
+#define RELCACHE_SEM 2
+#define PREWARM_SEM 3
 
 #define MY_PROCESS_INFO (pids[my_proc_id])
 
@@ -454,7 +574,6 @@ typedef struct {
 	POOL_REQUEST_KIND	kind;	/* request kind */
 	int node_id[MAX_NUM_BACKENDS];		/* request node id */
 	int master_node_id;	/* the youngest node id which is not in down status */
-	int conn_counter;
 } POOL_REQUEST_INFO;
 
 /* description of row. corresponding to RowDescription message */
@@ -479,6 +598,16 @@ typedef struct {
 	char **data;		/* actual row character data terminated with null */
 } POOL_SELECT_RESULT;
 
+/*
+ * I/O readiness notification. see pool_event.c
+ */
+#define POOL_EVENT_READ		0x01	/* readable, hang up or error */
+#define POOL_EVENT_EXCEPT	0x02	/* out-of-band data */
+#define POOL_EVENT_EXCLUSIVE	0x04	/* wake up only one of the processes
+										 * waiting for fd */
+
+typedef struct POOL_EVENT_SET POOL_EVENT_SET;
+
 /*
  * global variables
  */
@@ -491,9 +620,7 @@ extern int my_proc_id;  /* process table id (!= UNIX's PID) */
 extern POOL_SYSTEMDB_CONNECTION_POOL *system_db_info; /* systemdb */
 extern ProcessInfo *pids; /* shmem process information table */
 extern ConnectionInfo *con_info; /* shmem connection info table */
-extern int in_load_balance;		/* non 0 if in load balance mode */
-extern int selected_slot;		/* selected DB node for load balance */
-extern int master_slave_dml;	/* non 0 if master/slave mode is specified in config file */
+extern POOL_SESSION_CONTEXT *session_context;	/* current session */
 extern POOL_REQUEST_INFO *Req_info;
 extern volatile sig_atomic_t *InRecovery;
 extern char remote_ps_data[];		/* used for set_ps_display */
@@ -541,6 +668,7 @@ extern int pool_flush_it(POOL_CONNECTION *cp);
 extern int pool_write_and_flush(POOL_CONNECTION *cp, void *buf, int len);
 extern char *pool_read_string(POOL_CONNECTION *cp, int *len, int line);
 extern int pool_unread(POOL_CONNECTION *cp, void *data, int len);
+extern int pool_relay_messages(POOL_CONNECTION *src, POOL_CONNECTION *dst, char kind);
 
 extern int pool_do_auth(POOL_CONNECTION *frontend, POOL_CONNECTION_POOL *backend);
 extern int pool_do_reauth(POOL_CONNECTION *frontend, POOL_CONNECTION_POOL *cp);
@@ -549,6 +677,11 @@ extern int pool_init_cp(void);
 extern POOL_CONNECTION_POOL *pool_create_cp(void);
 extern POOL_CONNECTION_POOL *pool_get_cp(char *user, char *database, int protoMajor, int check_socket);
 extern void pool_discard_cp(char *user, char *database, int protoMajor);
+extern void pool_discard_pool(POOL_CONNECTION_POOL *backend);
+extern int pool_exists_cp(char *user, char *database, int protoMajor);
+extern int pool_num_free_cp(void);
+extern int pool_cp_available(void);
+extern POOL_CONNECTION_POOL *pool_get_free_cp(void);
 extern void pool_backend_timer(void);
 
 /* SSL functionality */
@@ -574,6 +707,7 @@ extern RETSIGTYPE pool_backend_timer_handler(int sig);
 extern int connect_inet_domain_socket(int secondary_backend);
 extern int connect_unix_domain_socket(int secondary_backend);
 extern int connect_inet_domain_socket_by_port(char *host, int port);
+extern int connect_inet_domain_socket_nonblock(int slot);
 extern int connect_unix_domain_socket_by_port(int port, char *socket_dir);
 
 extern void pool_set_timeout(int timeoutval);
@@ -627,7 +761,6 @@ extern void child_exit(int code);
 extern int health_check(void);
 extern int system_db_health_check(void);
 
-extern void init_prepared_list(void);
 
 extern void *pool_shared_memory_create(size_t size);
 extern void pool_shmem_exit(int code);
@@ -640,6 +773,7 @@ extern BackendInfo *pool_get_node_info(int node_number);
 extern int pool_get_node_count(void);
 extern int *pool_get_process_list(int *array_size);
 extern ProcessInfo *pool_get_process_info(pid_t pid);
+extern int pool_get_connection_count(void);
 extern SystemDBInfo *pool_get_system_db_info(void);
 extern POOL_STATUS OneNode_do_command(POOL_CONNECTION *frontend, POOL_CONNECTION *backend, char *query, char *database);
 
@@ -655,15 +789,31 @@ extern int system_db_connect (void);
 extern int pool_memset_system_db_info (SystemDBInfo *info);
 extern void pool_close_libpq_connection(void);
 
+/* pool_dist.c */
+extern int pool_dist_rule_init(DistDefInfo *info);
+extern int pool_dist_rule_eval(DistDefInfo *info, const char *value);
+extern int pool_dist_cache_lookup(DistDefInfo *info, const char *value);
+extern void pool_dist_cache_store(DistDefInfo *info, const char *value, int node);
+
 /* pool_query_cache.c */
 extern POOL_STATUS pool_query_cache_lookup(POOL_CONNECTION *frontend, char *query, char *database, char tstate);
 extern int pool_query_cache_register(char kind, POOL_CONNECTION *frontend, char *database, char *data, int data_len, char *query);
 extern int pool_query_cache_table_exists(void);
+extern void pool_query_cache_invalidate(void);
 extern int pool_clear_cache_by_time(Interval *interval, int size);
 
+/* pool_shmem_cache.c */
+extern int pool_shmem_cache_init(size_t size);
+extern int pool_shmem_cache_fetch(char *key, char **data, int *len);
+extern int pool_shmem_cache_store(char *key, char *data, int len,
+								  unsigned int *tables, unsigned int *generations, int num_tables);
+extern void pool_shmem_cache_generations(unsigned int *tables, int num_tables, unsigned int *generations);
+extern void pool_shmem_cache_invalidate(unsigned int *tables, int num_tables);
+extern void pool_shmem_cache_clear(void);
+
 /* pool_hba.c */
 extern void load_hba(char *hbapath);
-extern void ClientAuthentication(POOL_CONNECTION *frontend);
+extern int ClientAuthentication(POOL_CONNECTION *frontend);
 
 /* pool_ip.c */
 extern void pool_getnameinfo_all(SockAddr *saddr, char *remote_host, char *remote_port);
@@ -692,6 +842,7 @@ extern void check_stop_request(void);
 /* pool_process_query.c */
 extern void reset_variables(void);
 extern void reset_connection(void);
+extern int need_reset_connection(POOL_CONNECTION_POOL *backend);
 extern void per_node_statement_log(POOL_CONNECTION_POOL *backend, int node_id, char *query);
 extern void per_node_error_log(POOL_CONNECTION_POOL *backend, int node_id, char *query, char *prefix, bool unread);
 extern int pool_extract_error_message(bool read_kind, POOL_CONNECTION *backend, int major, bool unread, char **message);
@@ -706,9 +857,59 @@ extern POOL_RELCACHE *pool_create_relcache(int cachesize, char *sql,
 									bool issessionlocal);
 extern void pool_discard_relcache(POOL_RELCACHE *relcache);
 extern void *pool_search_relcache(POOL_RELCACHE *relcache, POOL_CONNECTION_POOL *backend, char *table);
+extern int pool_relcache_init(int size);
+extern void pool_relcache_invalidate(void);
+extern void pool_relcache_end_transaction(void);
 extern void *int_register_func(POOL_SELECT_RESULT *res);
 extern void *int_unregister_func(void *data);
 
+/* pool_session_context.c */
+extern POOL_SESSION_CONTEXT *pool_create_session_context(void);
+extern void pool_destroy_session_context(POOL_SESSION_CONTEXT *context);
+extern POOL_SESSION_CONTEXT *pool_set_session_context(POOL_SESSION_CONTEXT *context);
+
+/* pool_event.c */
+extern POOL_EVENT_SET *pool_event_create(void);
+extern void pool_event_destroy(POOL_EVENT_SET *set);
+extern int pool_event_watch(POOL_EVENT_SET *set, int fd, int events);
+extern void pool_event_unwatch(POOL_EVENT_SET *set, int fd);
+extern void pool_event_clear(POOL_EVENT_SET *set);
+extern void pool_event_forget(int fd);
+extern int pool_event_wait(POOL_EVENT_SET *set, int timeout);
+extern int pool_event_ready(POOL_EVENT_SET *set, int fd);
+extern int pool_event_ready_fd(POOL_EVENT_SET *set, int n);
+extern int pool_event_wait_fd(int fd, int timeout);
+extern int pool_event_wait_fds(int *fds, int *revents, int n, int timeout);
+extern long pool_event_now(void);
+
+/* pool_stats.c */
+extern int pool_stats_init(void);
+extern void pool_stats_set_child(int id);
+extern void pool_stats_count_received(POOL_CONNECTION *cp, int len);
+extern void pool_stats_count_sent(POOL_CONNECTION *cp, int len);
+extern void pool_stats_query_start(int is_select);
+extern void pool_stats_query_end(POOL_CONNECTION_POOL *backend);
+extern void pool_stats_count_connection_pool(int hit);
+extern void pool_stats_count_query_cache(int hit);
+extern void pool_stats_count_failover(int node_id, int failback);
+extern int pool_get_node_stats(int node_id, NodeStats *stats);
+extern void pool_get_pool_stats(PoolStats *stats);
+extern int pool_stats_latency_bound(int bucket);
+
+/* pool_prewarm.c */
+extern int pool_prewarm_init(void);
+extern void pool_prewarm_connections(void);
+extern void pool_prewarm_remember(StartupPacket *sp);
+extern POOL_CONNECTION_POOL *pool_prewarm_connect(StartupPacket *sp);
+
+/* pool_handoff.c */
+extern int pool_handoff_init(void);
+extern void pool_handoff_send(void);
+extern void pool_handoff_receive(void);
+extern void pool_handoff_forget(int id);
+extern void pool_handoff_discard(void);
+extern void pool_handoff_adopt(int id);
+
 /* pool_lobj.c */
 extern char *pool_rewrite_lo_creat(char kind, char *packet, int packet_len, POOL_CONNECTION *frontend, POOL_CONNECTION_POOL *backend, int* len);
 
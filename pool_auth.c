@@ -123,6 +123,16 @@ from pool_read_message_length and recheck the pg_hba.conf settings.");
 
 	authkind = ntohl(authkind);
 
+	/*
+	 * connecting without a frontend (see pool_prewarm.c)? we cannot
+	 * ask anybody for a password.
+	 */
+	if (frontend->fd < 0 && authkind != 0)
+	{
+		pool_error("pool_do_auth: authentication kind %d requires a frontend. use trust authentication", authkind);
+		return -1;
+	}
+
 	/* trust? */
 	if (authkind == 0)
 	{
@@ -482,6 +492,13 @@ static POOL_STATUS pool_send_auth_ok(POOL_CONNECTION *frontend, int pid, int key
 		pool_write(frontend, &len, sizeof(len));
 	}
 
+	/*
+	 * in transaction pooling mode the backend serves other clients
+	 * too. do not let the client cancel their queries.
+	 */
+	if (TRANSACTION_POOLING)
+		key = random();
+
 	pool_debug("pool_send_auth_ok: send pid %d to frontend", ntohl(pid));
 
 	pool_write(frontend, &pid, sizeof(pid));
@@ -547,6 +547,7 @@ typedef enum {
 static char *extract_string(char *value, POOL_TOKEN token);
 static char **extract_string_tokens(char *str, char *delim, int *n);
 static int eval_logical(char *str);
+static int eval_seconds(char *str, POOL_TOKEN token);
 static void clear_host_entry(int slot);
 
 #line 553 "pool_config.c"
@@ -1868,10 +1869,14 @@ int pool_init_config(void)
 	pool_config->backend_socket_dir = DEFAULT_SOCKET_DIR;
 	pool_config->pcp_timeout = 10;
 	pool_config->num_init_children = 32;
+	pool_config->sessions_per_child = 1;
+	pool_config->pool_mode = "session";
 	pool_config->max_pool = 4;
 	pool_config->child_life_time = 300;
 	pool_config->client_idle_limit = 0;
 	pool_config->connection_life_time = 0;
+	pool_config->prewarm_connections = "";
+	pool_config->handoff_connections = 0;
 	pool_config->child_max_connections = 0;
 	pool_config->authentication_timeout = 60;
 	pool_config->logdir = DEFAULT_LOGDIR;
@@ -1884,6 +1889,8 @@ int pool_init_config(void)
 
 	pool_config->replication_mode = 0;
 	pool_config->load_balance_mode = 0;
+	pool_config->load_balance_policy = "random";
+	pool_config->statement_level_load_balance = 0;
 	pool_config->replication_stop_on_mismatch = 0;
 	pool_config->replicate_select = 0;
 	pool_config->reset_query_list = default_reset_query_list;
@@ -1892,8 +1899,14 @@ int pool_init_config(void)
 	pool_config->print_timestamp = 1;
 	pool_config->master_slave_mode = 0;
 	pool_config->connection_cache = 1;
-	pool_config->health_check_timeout = 20;
+	pool_config->reset_only_modified_session = 0;
+	pool_config->read_buffer_size = 65536;
+	pool_config->relcache_size = 256;
+	pool_config->parse_cache_size = 256;
+	pool_config->health_check_timeout = 20000;
 	pool_config->health_check_period = 0;
+	pool_config->health_check_max_retries = 0;
+	pool_config->health_check_retry_delay = 1000;
 	pool_config->health_check_user = "nobody";
 	pool_config->failover_command = "";
 	pool_config->failback_command = "";
@@ -1902,12 +1915,16 @@ int pool_init_config(void)
 	pool_config->ignore_leading_white_space = 1;
 	pool_config->parallel_mode = 0;
 	pool_config->enable_query_cache = 0;
+	pool_config->query_cache_method = "systemdb";
+	pool_config->query_cache_size = 33554432;
+	pool_config->query_cache_expire = 0;
 	pool_config->system_db_hostname = "localhost";
 	pool_config->system_db_port = 5432;
 	pool_config->system_db_dbname = "pgpool";
 	pool_config->system_db_schema = "pgpool_catalog";
 	pool_config->system_db_user = "pgpool";
 	pool_config->system_db_password = "";
+	pool_config->copy_batch_size = 65536;
 	pool_config->backend_desc->num_backends = 0;
     pool_config->recovery_user = "";
     pool_config->recovery_password = "";
@@ -2108,6 +2125,45 @@ int pool_get_config(char *confpath, POOL_CONFIG_CONTEXT context)
 			}
 			pool_config->num_init_children = v;
 		}
+
+		else if (!strcmp(key, "sessions_per_child") && CHECK_CONTEXT(INIT_CONFIG, context))
+		{
+			int v = atoi(yytext);
+
+			if (token != POOL_INTEGER || v < 1)
+			{
+				pool_error("pool_config: %s must be equal or higher than 1 numeric value", key);
+				fclose(fd);
+				return(-1);
+			}
+			pool_config->sessions_per_child = v;
+		}
+
+		else if (!strcmp(key, "pool_mode") && CHECK_CONTEXT(INIT_CONFIG, context))
+		{
+			char *str;
+
+			if (token != POOL_STRING && token != POOL_UNQUOTED_STRING && token != POOL_KEY)
+			{
+				PARSE_ERROR();
+				fclose(fd);
+				return(-1);
+			}
+			str = extract_string(yytext, token);
+			if (str == NULL)
+			{
+				fclose(fd);
+				return(-1);
+			}
+			if (strcmp(str, "session") && strcmp(str, "transaction"))
+			{
+				pool_error("pool_config: %s must be either \"session\" or \"transaction\"", key);
+				free(str);
+				fclose(fd);
+				return(-1);
+			}
+			pool_config->pool_mode = str;
+		}
 		else if (!strcmp(key, "child_life_time") &&
 				 CHECK_CONTEXT(INIT_CONFIG|RELOAD_CONFIG, context))
 		{
@@ -2147,6 +2203,36 @@ int pool_get_config(char *confpath, POOL_CONFIG_CONTEXT context)
 			}
 			pool_config->connection_life_time = v;
 		}
+		else if (!strcmp(key, "prewarm_connections") && CHECK_CONTEXT(INIT_CONFIG, context))
+		{
+			char *str;
+
+			if (token != POOL_STRING && token != POOL_UNQUOTED_STRING && token != POOL_KEY)
+			{
+				PARSE_ERROR();
+				fclose(fd);
+				return(-1);
+			}
+			str = extract_string(yytext, token);
+			if (str == NULL)
+			{
+				fclose(fd);
+				return(-1);
+			}
+			pool_config->prewarm_connections = str;
+		}
+		else if (!strcmp(key, "handoff_connections") && CHECK_CONTEXT(INIT_CONFIG, context))
+		{
+			int v = eval_logical(yytext);
+
+			if (v < 0)
+			{
+				pool_error("pool_config: invalid value %s for %s", yytext, key);
+				fclose(fd);
+				return(-1);
+			}
+			pool_config->handoff_connections = v;
+		}
 		else if (!strcmp(key, "child_max_connections") &&
 				 CHECK_CONTEXT(INIT_CONFIG|RELOAD_CONFIG, context))
 		{
@@ -2310,6 +2396,46 @@ int pool_get_config(char *confpath, POOL_CONFIG_CONTEXT context)
 			}
 			pool_config->load_balance_mode = v;
 		}
+		else if (!strcmp(key, "load_balance_policy") &&
+				 CHECK_CONTEXT(INIT_CONFIG|RELOAD_CONFIG, context))
+		{
+			char *str;
+
+			if (token != POOL_STRING && token != POOL_UNQUOTED_STRING && token != POOL_KEY)
+			{
+				PARSE_ERROR();
+				fclose(fd);
+				return(-1);
+			}
+			str = extract_string(yytext, token);
+			if (str == NULL)
+			{
+				fclose(fd);
+				return(-1);
+			}
+			if (strcmp(str, "random") && strcmp(str, "least_queries") &&
+				strcmp(str, "latency") && strcmp(str, "power_of_two"))
+			{
+				pool_error("pool_config: %s must be one of \"random\", \"least_queries\", \"latency\" or \"power_of_two\"", key);
+				free(str);
+				fclose(fd);
+				return(-1);
+			}
+			pool_config->load_balance_policy = str;
+		}
+		else if (!strcmp(key, "statement_level_load_balance") &&
+				 CHECK_CONTEXT(INIT_CONFIG|RELOAD_CONFIG, context))
+		{
+			int v = eval_logical(yytext);
+
+			if (v < 0)
+			{
+				pool_error("pool_config: invalid value %s for %s", yytext, key);
+				fclose(fd);
+				return(-1);
+			}
+			pool_config->statement_level_load_balance = v;
+		}
 		else if (!strcmp(key, "replication_stop_on_mismatch") &&
 				 CHECK_CONTEXT(INIT_CONFIG|RELOAD_CONFIG, context))
 		{
@@ -2409,22 +2535,90 @@ int pool_get_config(char *confpath, POOL_CONFIG_CONTEXT context)
 			pool_config->connection_cache = v;
 		}
 
-		else if (!strcmp(key, "health_check_timeout") &&
+		else if (!strcmp(key, "reset_only_modified_session") &&
+				 CHECK_CONTEXT(INIT_CONFIG|RELOAD_CONFIG, context))
+		{
+			int v = eval_logical(yytext);
+
+			if (v < 0)
+			{
+				pool_error("pool_config: invalid value %s for %s", yytext, key);
+				fclose(fd);
+				return(-1);
+			}
+			pool_config->reset_only_modified_session = v;
+		}
+
+		else if (!strcmp(key, "read_buffer_size") &&
 				 CHECK_CONTEXT(INIT_CONFIG|RELOAD_CONFIG, context))
 		{
 			int v = atoi(yytext);
 
+			if (token != POOL_INTEGER || v < 1024)
+			{
+				pool_error("pool_config: %s must be equal or higher than 1024 numeric value", key);
+				fclose(fd);
+				return(-1);
+			}
+			pool_config->read_buffer_size = v;
+		}
+
+		else if (!strcmp(key, "relcache_size") && CHECK_CONTEXT(INIT_CONFIG, context))
+		{
+			int v = atoi(yytext);
+
 			if (token != POOL_INTEGER || v < 0)
 			{
 				pool_error("pool_config: %s must be equal or higher than 0 numeric value", key);
 				fclose(fd);
 				return(-1);
 			}
+			pool_config->relcache_size = v;
+		}
+
+		else if (!strcmp(key, "parse_cache_size") && CHECK_CONTEXT(INIT_CONFIG, context))
+		{
+			int v = atoi(yytext);
+
+			if (token != POOL_INTEGER || v < 0)
+			{
+				pool_error("pool_config: %s must be equal or higher than 0 numeric value", key);
+				fclose(fd);
+				return(-1);
+			}
+			pool_config->parse_cache_size = v;
+		}
+
+		else if (!strcmp(key, "health_check_timeout") &&
+				 CHECK_CONTEXT(INIT_CONFIG|RELOAD_CONFIG, context))
+		{
+			int v = eval_seconds(yytext, token);
+
+			if (v < 0)
+			{
+				pool_error("pool_config: %s must be equal or higher than 0 numeric value", key);
+				fclose(fd);
+				return(-1);
+			}
 			pool_config->health_check_timeout = v;
 		}
 
 		else if (!strcmp(key, "health_check_period") &&
 				 CHECK_CONTEXT(INIT_CONFIG|RELOAD_CONFIG, context))
+		{
+			int v = eval_seconds(yytext, token);
+
+			if (v < 0)
+			{
+				pool_error("pool_config: %s must be equal or higher than 0 numeric value", key);
+				fclose(fd);
+				return(-1);
+			}
+			pool_config->health_check_period = v;
+		}
+
+		else if (!strcmp(key, "health_check_max_retries") &&
+				 CHECK_CONTEXT(INIT_CONFIG|RELOAD_CONFIG, context))
 		{
 			int v = atoi(yytext);
 
@@ -2434,7 +2628,21 @@ int pool_get_config(char *confpath, POOL_CONFIG_CONTEXT context)
 				fclose(fd);
 				return(-1);
 			}
-			pool_config->health_check_period = v;
+			pool_config->health_check_max_retries = v;
+		}
+
+		else if (!strcmp(key, "health_check_retry_delay") &&
+				 CHECK_CONTEXT(INIT_CONFIG|RELOAD_CONFIG, context))
+		{
+			int v = eval_seconds(yytext, token);
+
+			if (v < 0)
+			{
+				pool_error("pool_config: %s must be equal or higher than 0 numeric value", key);
+				fclose(fd);
+				return(-1);
+			}
+			pool_config->health_check_retry_delay = v;
 		}
 
 		else if (!strcmp(key, "health_check_user") &&
@@ -2673,6 +2881,59 @@ int pool_get_config(char *confpath, POOL_CONFIG_CONTEXT context)
 			pool_config->enable_query_cache = v;
 		}
 
+		else if (!strcmp(key, "query_cache_method") && CHECK_CONTEXT(INIT_CONFIG, context))
+		{
+			char *str;
+
+			if (token != POOL_STRING && token != POOL_UNQUOTED_STRING && token != POOL_KEY)
+			{
+				PARSE_ERROR();
+				fclose(fd);
+				return(-1);
+			}
+			str = extract_string(yytext, token);
+			if (str == NULL)
+			{
+				fclose(fd);
+				return(-1);
+			}
+			if (strcmp(str, "systemdb") && strcmp(str, "shmem"))
+			{
+				pool_error("pool_config: %s must be either \"systemdb\" or \"shmem\"", key);
+				free(str);
+				fclose(fd);
+				return(-1);
+			}
+			pool_config->query_cache_method = str;
+		}
+
+		else if (!strcmp(key, "query_cache_size") && CHECK_CONTEXT(INIT_CONFIG, context))
+		{
+			int v = atoi(yytext);
+
+			if (token != POOL_INTEGER || v < 65536)
+			{
+				pool_error("pool_config: %s must be equal or higher than 65536 numeric value", key);
+				fclose(fd);
+				return(-1);
+			}
+			pool_config->query_cache_size = v;
+		}
+
+		else if (!strcmp(key, "query_cache_expire") &&
+				 CHECK_CONTEXT(INIT_CONFIG|RELOAD_CONFIG, context))
+		{
+			int v = atoi(yytext);
+
+			if (token != POOL_INTEGER || v < 0)
+			{
+				pool_error("pool_config: %s must be equal or higher than 0 numeric value", key);
+				fclose(fd);
+				return(-1);
+			}
+			pool_config->query_cache_expire = v;
+		}
+
 		else if (!strcmp(key, "pgpool2_hostname") && CHECK_CONTEXT(INIT_CONFIG, context))
 		{
 			char *str;
@@ -2801,6 +3062,20 @@ int pool_get_config(char *confpath, POOL_CONFIG_CONTEXT context)
 			pool_config->system_db_password = str;
 		}
 
+		else if (!strcmp(key, "copy_batch_size") &&
+				 CHECK_CONTEXT(INIT_CONFIG|RELOAD_CONFIG, context))
+		{
+			int v = atoi(yytext);
+
+			if (token != POOL_INTEGER || v < 0)
+			{
+				pool_error("pool_config: %s must be equal or higher than 0 numeric value", key);
+				fclose(fd);
+				return(-1);
+			}
+			pool_config->copy_batch_size = v;
+		}
+
 		else if (!strncmp(key, "backend_hostname", 16) &&
 				 CHECK_CONTEXT(INIT_CONFIG|RELOAD_CONFIG, context) &&
 				 mypid == getpid()) /* this parameter must be modified by parent pid */
@@ -3106,7 +3381,7 @@ int pool_get_config(char *confpath, POOL_CONFIG_CONTEXT context)
 		}
 	}
 
-	if (pool_config->parallel_mode || pool_config->enable_query_cache)
+	if (pool_config->parallel_mode || SYSTEMDB_QUERY_CACHE)
 	{
 		int dist_num;
 		SystemDBInfo *info;
@@ -3153,7 +3428,7 @@ int pool_get_config(char *confpath, POOL_CONFIG_CONTEXT context)
 				return(-1);
 			}
 		}
-		if (pool_config->enable_query_cache)
+		if (SYSTEMDB_QUERY_CACHE)
 		{
 			info->query_cache_table_info.register_prepared_statement = NULL;
 			if (! pool_query_cache_table_exists())
@@ -3205,6 +3480,24 @@ static int eval_logical(char *str)
 	return ret;
 }
 
+/*
+ * Convert a number of seconds, which may have a fractional part, to
+ * milliseconds. Returns -1 if the value is not a number or negative.
+ */
+static int eval_seconds(char *str, POOL_TOKEN token)
+{
+	double v;
+
+	if (token != POOL_INTEGER && token != POOL_REAL)
+		return -1;
+
+	v = atof(str);
+	if (v < 0 || v > INT_MAX / 1000)
+		return -1;
+
+	return (int) (v * 1000 + 0.5);
+}
+
 /*
  * extract tokens separated by delimi from str. return value is an
  * array of pointers to malloced strings. number of tokens is set to
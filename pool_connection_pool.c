@@ -41,16 +41,55 @@
 #include <string.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <fcntl.h>
 
 #include "pool.h"
 
 POOL_CONNECTION_POOL *pool_connection_pool;	/* connection pool */
 volatile sig_atomic_t backend_timer_expired = 0; /* flag for connection closed timer is expired */
 
+static int connect_inet_domain_socket_internal(char *host, int port, bool nonblock);
 static POOL_CONNECTION_POOL_SLOT *create_cp(POOL_CONNECTION_POOL_SLOT *cp, int slot);
 static POOL_CONNECTION_POOL *new_connection(POOL_CONNECTION_POOL *p);
 static int check_socket_status(int fd);
 
+/*
+ * Index of connection pools.
+ *
+ * Connection pools released by pool_connection_pool_timer are
+ * registered in an open addressing hash table keyed on user, database
+ * and protocol major version, and linked in LRU order of release
+ * time. pool_get_cp finds a pool without scanning all max_pool
+ * entries and pool_create_cp evicts the least recently released pool
+ * without looking for the oldest close time.
+ *
+ * Pools may be cleared without unregistering (e.g. by
+ * close_idle_connection signal handler), so entries found in the
+ * index are always verified against the pool itself.
+ */
+#define CP_INDEX_EMPTY 0
+#define CP_INDEX_DELETED (-1)
+
+static int *cp_index;	/* hash table. pool number + 1 or CP_INDEX_EMPTY/DELETED */
+static int cp_index_size;	/* number of hash table entries. power of 2 */
+static int cp_index_deleted;	/* number of CP_INDEX_DELETED entries */
+static unsigned int *cp_hash;	/* hash value of each pool. valid if cp_registered */
+static char *cp_registered;	/* non 0 if the pool is in the index */
+static int *cp_lru_prev;	/* LRU links by pool number. -1 terminates */
+static int *cp_lru_next;
+static int cp_lru_head = -1;	/* least recently released */
+static int cp_lru_tail = -1;	/* most recently released */
+
+static unsigned int cp_key_hash(char *user, char *database, int protoMajor);
+static int cp_match(POOL_CONNECTION_POOL *p, char *user, char *database, int protoMajor);
+static POOL_CONNECTION_POOL *cp_index_lookup(char *user, char *database, int protoMajor);
+static void cp_index_register(POOL_CONNECTION_POOL *p);
+static void cp_index_unregister(POOL_CONNECTION_POOL *p);
+static void cp_index_rebuild(void);
+static void cp_lru_unlink(int n);
+static void cp_lru_append(int n);
+static void discard_cp(POOL_CONNECTION_POOL *p);
+
 /*
 * initialize connection pools. this should be called once at the startup.
 */
@@ -71,6 +110,26 @@ int pool_init_cp(void)
 		pool_connection_pool[i].info = &(MY_PROCESS_INFO.connection_info[i]);
 		memset(pool_connection_pool[i].info, 0, sizeof(ConnectionInfo));
 	}
+
+	/* hash table is kept at most half full */
+	cp_index_size = 4;
+	while (cp_index_size < pool_config->max_pool * 2)
+		cp_index_size *= 2;
+
+	cp_index = calloc(cp_index_size, sizeof(int));
+	cp_hash = calloc(pool_config->max_pool, sizeof(unsigned int));
+	cp_registered = calloc(pool_config->max_pool, sizeof(char));
+	cp_lru_prev = malloc(sizeof(int) * pool_config->max_pool);
+	cp_lru_next = malloc(sizeof(int) * pool_config->max_pool);
+	if (cp_index == NULL || cp_hash == NULL || cp_registered == NULL ||
+		cp_lru_prev == NULL || cp_lru_next == NULL)
+	{
+		pool_error("pool_init_cp: malloc() failed");
+		return -1;
+	}
+	for (i = 0; i < pool_config->max_pool; i++)
+		cp_lru_prev[i] = cp_lru_next[i] = -1;
+
 	return 0;
 }
 
@@ -85,7 +144,7 @@ POOL_CONNECTION_POOL *pool_get_cp(char *user, char *database, int protoMajor, in
 	int	oldmask;
 #endif
 
-	int i, j, freed = 0;
+	int j, freed = 0;
 	ConnectionInfo *info;
 
 	POOL_CONNECTION_POOL *p = pool_connection_pool;
@@ -98,71 +157,68 @@ POOL_CONNECTION_POOL *pool_get_cp(char *user, char *database, int protoMajor, in
 
 	POOL_SETMASK2(&BlockSig, &oldmask);
 
-	for (i=0;i<pool_config->max_pool;i++)
+	p = cp_index_lookup(user, database, protoMajor);
+	if (p)
 	{
-		if (MASTER_CONNECTION(p) &&
-			MASTER_CONNECTION(p)->sp &&
-			MASTER_CONNECTION(p)->sp->major == protoMajor &&
-			MASTER_CONNECTION(p)->sp->user != NULL &&
-			strcmp(MASTER_CONNECTION(p)->sp->user, user) == 0 &&
-			strcmp(MASTER_CONNECTION(p)->sp->database, database) == 0)
+		int sock_broken = 0;
+
+		/*
+		 * mark this connection is under use. it is not found by
+		 * pool_get_cp until released again, since a child serving
+		 * multiple sessions may have other pools for the same key.
+		 */
+		MASTER_CONNECTION(p)->closetime = 0;
+		cp_index_unregister(p);
+		p->info->counter++;
+		POOL_SETMASK(&oldmask);
+
+		if (check_socket)
 		{
-			int sock_broken = 0;
+			for (j=0;j<NUM_BACKENDS;j++)
+			{
+				if (!VALID_BACKEND(j))
+					continue;
 
-			/* mark this connection is under use */
-			MASTER_CONNECTION(p)->closetime = 0;
-			p->info->counter++;
-			POOL_SETMASK(&oldmask);
+				if  (CONNECTION_SLOT(p, j))
+				{
+					sock_broken = check_socket_status(CONNECTION(p, j)->fd);
+					if (sock_broken < 0)
+						break;
+				}
+				else
+				{
+					sock_broken = -1;
+					break;
+				}
+			}
 
-			if (check_socket)
+			if (sock_broken < 0)
 			{
+				pool_log("connection closed. retry to create new connection pool.");
 				for (j=0;j<NUM_BACKENDS;j++)
 				{
-					if (!VALID_BACKEND(j))
+					if (!VALID_BACKEND(j) || (CONNECTION_SLOT(p, j) == NULL))
 						continue;
 
-					if  (CONNECTION_SLOT(p, j))
-					{
-						sock_broken = check_socket_status(CONNECTION(p, j)->fd);
-						if (sock_broken < 0)
-							break;
-					}
-					else
+					if (!freed)
 					{
-						sock_broken = -1;
-						break;
+						pool_free_startup_packet(CONNECTION_SLOT(p, j)->sp);
+						freed = 1;
 					}
-				}
-
-				if (sock_broken < 0)
-				{
-					pool_log("connection closed. retry to create new connection pool.");
-					for (j=0;j<NUM_BACKENDS;j++)
-					{
-						if (!VALID_BACKEND(j) || (CONNECTION_SLOT(p, j) == NULL))
-							continue;
 
-						if (!freed)
-						{
-							pool_free_startup_packet(CONNECTION_SLOT(p, j)->sp);
-							freed = 1;
-						}
-
-						pool_close(CONNECTION(p, j));
-						free(CONNECTION_SLOT(p, j));
-					}
-					info = p->info;
-					memset(p, 0, sizeof(POOL_CONNECTION_POOL_SLOT));
-					p->info = info;
-					memset(p->info, 0, sizeof(ConnectionInfo));
-					POOL_SETMASK(&oldmask);
-					return NULL;
+					pool_close(CONNECTION(p, j));
+					free(CONNECTION_SLOT(p, j));
 				}
+				info = p->info;
+				memset(p, 0, sizeof(POOL_CONNECTION_POOL));
+				p->info = info;
+				memset(p->info, 0, sizeof(ConnectionInfo));
+				POOL_SETMASK(&oldmask);
+				return NULL;
 			}
-			POOL_SETMASK(&oldmask);
-			return p;
 		}
-		p++;
+		POOL_SETMASK(&oldmask);
+		return p;
 	}
 
 	POOL_SETMASK(&oldmask);
@@ -175,8 +231,20 @@ POOL_CONNECTION_POOL *pool_get_cp(char *user, char *database, int protoMajor, in
 void pool_discard_cp(char *user, char *database, int protoMajor)
 {
 	POOL_CONNECTION_POOL *p = pool_get_cp(user, database, protoMajor, 0);
-	ConnectionInfo *info;
-	int i, freed = 0;
+	int i;
+
+	/* the pool may not have been released to the index yet */
+	if (p == NULL && pool_connection_pool)
+	{
+		for (i=0;i<pool_config->max_pool;i++)
+		{
+			if (cp_match(&pool_connection_pool[i], user, database, protoMajor))
+			{
+				p = &pool_connection_pool[i];
+				break;
+			}
+		}
+	}
 
 	if (p == NULL)
 	{
@@ -184,6 +252,105 @@ void pool_discard_cp(char *user, char *database, int protoMajor)
 		return;
 	}
 
+	discard_cp(p);
+}
+
+/*
+ * disconnect and release the connection pool. unlike pool_discard_cp,
+ * this does not look for the pool by user and database, which may
+ * match pools of other sessions.
+ */
+void pool_discard_pool(POOL_CONNECTION_POOL *backend)
+{
+	discard_cp(backend);
+}
+
+/*
+ * returns non 0 if there's a connection pool for user, database and
+ * protoMajor, either in use or released
+ */
+int pool_exists_cp(char *user, char *database, int protoMajor)
+{
+	int i;
+
+	if (pool_connection_pool == NULL)
+		return 0;
+
+	for (i=0;i<pool_config->max_pool;i++)
+	{
+		if (cp_match(&pool_connection_pool[i], user, database, protoMajor))
+			return 1;
+	}
+	return 0;
+}
+
+/*
+ * returns number of empty connection pool slots
+ */
+int pool_num_free_cp(void)
+{
+	int i;
+	int n = 0;
+
+	if (pool_connection_pool == NULL)
+		return 0;
+
+	for (i=0;i<pool_config->max_pool;i++)
+	{
+		if (MASTER_CONNECTION(&pool_connection_pool[i]) == NULL)
+			n++;
+	}
+	return n;
+}
+
+/*
+ * returns non 0 if pool_create_cp would succeed, i.e. there's an
+ * empty slot or a released connection pool
+ */
+int pool_cp_available(void)
+{
+	int i;
+
+	if (pool_connection_pool == NULL)
+		return 0;
+
+	for (i=0;i<pool_config->max_pool;i++)
+	{
+		if (MASTER_CONNECTION(&pool_connection_pool[i]) == NULL ||
+			MASTER_CONNECTION(&pool_connection_pool[i])->closetime)
+			return 1;
+	}
+	return 0;
+}
+
+/*
+ * returns an empty connection pool slot, or NULL if there's none
+ */
+POOL_CONNECTION_POOL *pool_get_free_cp(void)
+{
+	int i;
+
+	if (pool_connection_pool == NULL)
+		return NULL;
+
+	for (i=0;i<pool_config->max_pool;i++)
+	{
+		if (MASTER_CONNECTION(&pool_connection_pool[i]) == NULL)
+			return &pool_connection_pool[i];
+	}
+	return NULL;
+}
+
+/*
+ * close backend connections of the pool and make it empty
+ */
+static void discard_cp(POOL_CONNECTION_POOL *p)
+{
+	ConnectionInfo *info;
+	int i, freed = 0;
+
+	cp_index_unregister(p);
+
 	for (i=0;i<NUM_BACKENDS;i++)
 	{
 		if (!VALID_BACKEND(i))
@@ -210,10 +377,8 @@ void pool_discard_cp(char *user, char *database, int protoMajor)
 */
 POOL_CONNECTION_POOL *pool_create_cp(void)
 {
-	int i, freed = 0;
-	time_t closetime;
+	int i;
 	POOL_CONNECTION_POOL *oldestp;
-	ConnectionInfo *info;
 
 	POOL_CONNECTION_POOL *p = pool_connection_pool;
 
@@ -233,22 +398,23 @@ POOL_CONNECTION_POOL *pool_create_cp(void)
 	pool_debug("no empty connection slot was found");
 
 	/*
-	 * no empty connection slot was found. look for the oldest connection and discard it.
+	 * no empty connection slot was found. discard the least recently
+	 * released connection. pools in use are not in the LRU list, but
+	 * a pool cleared behind us (e.g. by close_idle_connection) and
+	 * reused may still be linked.
 	 */
-	oldestp = p = pool_connection_pool;
-	closetime = MASTER_CONNECTION(p)->closetime;
-	for (i=0;i<pool_config->max_pool;i++)
+	for (;;)
 	{
-		pool_debug("user: %s database: %s closetime: %ld",
-				   MASTER_CONNECTION(p)->sp->user,
-				   MASTER_CONNECTION(p)->sp->database,
-				   MASTER_CONNECTION(p)->closetime);
-		if (MASTER_CONNECTION(p)->closetime < closetime)
+		if (cp_lru_head < 0)
 		{
-			closetime = MASTER_CONNECTION(p)->closetime;
-			oldestp = p;
+			pool_error("pool_create_cp: all connection pools are in use");
+			return NULL;
 		}
-		p++;
+
+		oldestp = &pool_connection_pool[cp_lru_head];
+		if (MASTER_CONNECTION(oldestp) && MASTER_CONNECTION(oldestp)->closetime)
+			break;
+		cp_index_unregister(oldestp);
 	}
 
 	p = oldestp;
@@ -259,25 +425,7 @@ POOL_CONNECTION_POOL *pool_create_cp(void)
 			   MASTER_CONNECTION(p)->sp->user,
 			   MASTER_CONNECTION(p)->sp->database);
 
-	for (i=0;i<NUM_BACKENDS;i++)
-	{
-		if (!VALID_BACKEND(i))
-			continue;
-
-		if (!freed)
-		{
-			pool_free_startup_packet(CONNECTION_SLOT(p, i)->sp);
-			freed = 1;
-		}
-
-		pool_close(CONNECTION(p, i));
-		free(CONNECTION_SLOT(p, i));
-	}
-
-	info = p->info;
-	memset(p, 0, sizeof(POOL_CONNECTION_POOL));
-	p->info = info;
-	memset(p->info, 0, sizeof(ConnectionInfo));
+	discard_cp(p);
 
 	return new_connection(p);
 }
@@ -294,6 +442,9 @@ void pool_connection_pool_timer(POOL_CONNECTION_POOL *backend)
 
 	MASTER_CONNECTION(backend)->closetime = time(NULL);		/* set connection close time */
 
+	/* make the pool visible to pool_get_cp as the most recently released one */
+	cp_index_register(backend);
+
 	if (pool_config->connection_life_time == 0)
 		return;
 
@@ -365,6 +516,7 @@ void pool_backend_timer(void)
 						   MASTER_CONNECTION(p)->sp->user, MASTER_CONNECTION(p)->sp->database);
 
 				pool_send_frontend_exits(p);
+				cp_index_unregister(p);
 
 				for (j=0;j<NUM_BACKENDS;j++)
 				{
@@ -471,6 +623,27 @@ int connect_unix_domain_socket_by_port(int port, char *socket_dir)
 }
 
 int connect_inet_domain_socket_by_port(char *host, int port)
+{
+	return connect_inet_domain_socket_internal(host, port, false);
+}
+
+/*
+ * Same as connect_inet_domain_socket() except that the socket is in
+ * non-blocking mode and connect(2) may be still in progress. The
+ * caller waits for the socket to become writable and checks SO_ERROR.
+ */
+int connect_inet_domain_socket_nonblock(int slot)
+{
+	char *host;
+	int port;
+
+	host = pool_config->backend_desc->backend_info[slot].backend_hostname;
+	port = pool_config->backend_desc->backend_info[slot].backend_port;
+
+	return connect_inet_domain_socket_internal(host, port, true);
+}
+
+static int connect_inet_domain_socket_internal(char *host, int port, bool nonblock)
 {
 	int fd;
 	int len;
@@ -512,13 +685,24 @@ int connect_inet_domain_socket_by_port(char *host, int port)
 			(char *) hp->h_addr,
 			hp->h_length);
 
+	if (nonblock && fcntl(fd, F_SETFL, O_NONBLOCK) < 0)
+	{
+		pool_error("connect_inet_domain_socket: fcntl() failed: %s", strerror(errno));
+		close(fd);
+		return -1;
+	}
+
 	for (;;)
 	{
 		if (connect(fd, (struct sockaddr *)&addr, len) < 0)
 		{
-			if (errno == EINTR || errno == EAGAIN)
+			if (errno == EINTR || (errno == EAGAIN && !nonblock))
 				continue;
 
+			/* caller waits for completion of non-blocking connect */
+			if (nonblock && errno == EINPROGRESS)
+				break;
+
 			pool_error("connect_inet_domain_socket: connect() failed: %s",strerror(errno));
 			close(fd);
 			return -1;
@@ -645,3 +829,196 @@ static int check_socket_status(int fd)
 
 	return -1;
 }
+
+/*
+ * hash value of connection pool key. FNV-1a.
+ */
+static unsigned int cp_key_hash(char *user, char *database, int protoMajor)
+{
+	unsigned int h = 2166136261U;
+	unsigned char *c;
+
+	for (c = (unsigned char *)user; *c; c++)
+		h = (h ^ *c) * 16777619U;
+	h = (h ^ 0) * 16777619U;
+	for (c = (unsigned char *)database; *c; c++)
+		h = (h ^ *c) * 16777619U;
+	h = (h ^ (unsigned char)protoMajor) * 16777619U;
+
+	return h;
+}
+
+/*
+ * returns non 0 if the pool is for user, database and protoMajor
+ */
+static int cp_match(POOL_CONNECTION_POOL *p, char *user, char *database, int protoMajor)
+{
+	return MASTER_CONNECTION(p) &&
+		MASTER_CONNECTION(p)->sp &&
+		MASTER_CONNECTION(p)->sp->major == protoMajor &&
+		MASTER_CONNECTION(p)->sp->user != NULL &&
+		strcmp(MASTER_CONNECTION(p)->sp->user, user) == 0 &&
+		strcmp(MASTER_CONNECTION(p)->sp->database, database) == 0;
+}
+
+/*
+ * look for a released pool in the index. stale entries found on the
+ * way are removed.
+ */
+static POOL_CONNECTION_POOL *cp_index_lookup(char *user, char *database, int protoMajor)
+{
+	unsigned int h = cp_key_hash(user, database, protoMajor);
+	unsigned int mask = cp_index_size - 1;
+	unsigned int pos;
+	int i;
+
+	for (i = 0, pos = h & mask; i < cp_index_size; i++, pos = (pos + 1) & mask)
+	{
+		int n = cp_index[pos];
+		POOL_CONNECTION_POOL *p;
+
+		if (n == CP_INDEX_EMPTY)
+			break;
+		if (n == CP_INDEX_DELETED)
+			continue;
+
+		n--;
+		if (cp_hash[n] != h)
+			continue;
+
+		p = &pool_connection_pool[n];
+		if (cp_match(p, user, database, protoMajor))
+			return p;
+
+		/* the pool has been cleared or reused behind us */
+		if (MASTER_CONNECTION(p) == NULL || MASTER_CONNECTION(p)->closetime == 0)
+			cp_index_unregister(p);
+	}
+	return NULL;
+}
+
+/*
+ * register a pool to the index and make it the most recently
+ * released one
+ */
+static void cp_index_register(POOL_CONNECTION_POOL *p)
+{
+	int n = p - pool_connection_pool;
+	unsigned int h;
+	unsigned int mask;
+	unsigned int pos;
+	StartupPacket *sp;
+
+	if (cp_index == NULL)
+		return;
+
+	sp = MASTER_CONNECTION(p)->sp;
+	if (sp == NULL || sp->user == NULL)
+		return;
+
+	h = cp_key_hash(sp->user, sp->database, sp->major);
+
+	if (cp_registered[n])
+	{
+		if (cp_hash[n] == h)
+		{
+			cp_lru_unlink(n);
+			cp_lru_append(n);
+			return;
+		}
+		/* the pool was cleared and reused for another key */
+		cp_index_unregister(p);
+	}
+
+	if (cp_index_deleted > cp_index_size / 4)
+		cp_index_rebuild();
+
+	cp_hash[n] = h;
+	mask = cp_index_size - 1;
+	for (pos = cp_hash[n] & mask; cp_index[pos] > 0; pos = (pos + 1) & mask)
+		;
+	if (cp_index[pos] == CP_INDEX_DELETED)
+		cp_index_deleted--;
+	cp_index[pos] = n + 1;
+	cp_registered[n] = 1;
+	cp_lru_append(n);
+}
+
+/*
+ * remove a pool from the index
+ */
+static void cp_index_unregister(POOL_CONNECTION_POOL *p)
+{
+	int n = p - pool_connection_pool;
+	unsigned int mask;
+	unsigned int pos;
+	int i;
+
+	if (cp_index == NULL || !cp_registered[n])
+		return;
+
+	mask = cp_index_size - 1;
+	for (i = 0, pos = cp_hash[n] & mask; i < cp_index_size; i++, pos = (pos + 1) & mask)
+	{
+		if (cp_index[pos] == CP_INDEX_EMPTY)
+			break;
+		if (cp_index[pos] == n + 1)
+		{
+			cp_index[pos] = CP_INDEX_DELETED;
+			cp_index_deleted++;
+			break;
+		}
+	}
+	cp_registered[n] = 0;
+	cp_lru_unlink(n);
+}
+
+/*
+ * rebuild the hash table to get rid of deleted entries
+ */
+static void cp_index_rebuild(void)
+{
+	unsigned int mask = cp_index_size - 1;
+	unsigned int pos;
+	int n;
+
+	memset(cp_index, 0, sizeof(int) * cp_index_size);
+	cp_index_deleted = 0;
+
+	for (n = 0; n < pool_config->max_pool; n++)
+	{
+		if (!cp_registered[n])
+			continue;
+		for (pos = cp_hash[n] & mask; cp_index[pos] != CP_INDEX_EMPTY; pos = (pos + 1) & mask)
+			;
+		cp_index[pos] = n + 1;
+	}
+}
+
+static void cp_lru_unlink(int n)
+{
+	if (cp_lru_prev[n] >= 0)
+		cp_lru_next[cp_lru_prev[n]] = cp_lru_next[n];
+	else if (cp_lru_head == n)
+		cp_lru_head = cp_lru_next[n];
+	else
+		return;		/* not linked */
+
+	if (cp_lru_next[n] >= 0)
+		cp_lru_prev[cp_lru_next[n]] = cp_lru_prev[n];
+	else
+		cp_lru_tail = cp_lru_prev[n];
+
+	cp_lru_prev[n] = cp_lru_next[n] = -1;
+}
+
+static void cp_lru_append(int n)
+{
+	cp_lru_prev[n] = cp_lru_tail;
+	cp_lru_next[n] = -1;
+	if (cp_lru_tail >= 0)
+		cp_lru_next[cp_lru_tail] = n;
+	else
+		cp_lru_head = n;
+	cp_lru_tail = n;
+}
@@ -0,0 +1,537 @@
+/* -*-pgsql-c-*- */
+/*
+ * $Header$
+ *
+ * pgpool: a language independent connection pool server for PostgreSQL
+ * written by Tatsuo Ishii
+ *
+ * Copyright (c) 2003-2010	PgPool Global Development Group
+ *
+ * Permission to use, copy, modify, and distribute this software and
+ * its documentation for any purpose and without fee is hereby
+ * granted, provided that the above copyright notice appear in all
+ * copies and that both that copyright notice and this permission
+ * notice appear in supporting documentation, and that the name of the
+ * author not be used in advertising or publicity pertaining to
+ * distribution of the software without specific, written prior
+ * permission. The author makes no representations about the
+ * suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * pool_dist.c: built-in distribution rules and the cache of node ids
+ *
+ * dist_def_func of pgpool_catalog.dist_def is usually the name of a
+ * function on SystemDB, which is called for each row inserted in
+ * parallel mode. If it is one of the following instead, the rule is
+ * evaluated in pgpool without asking SystemDB.
+ *
+ *   modulo([N])            key mod N. key must be an integer
+ *   hash([N[, family]])    hash of key mod N. family is fnv1a (default) or md5
+ *   range(B0, B1, ...)     node i if key <= Bi, otherwise the last node
+ *   list(V:I, ..., [*:I])  node I for value V, * matches any other value
+ *
+ * N defaults to the number of backends. Values are compared as
+ * integers if the key column is an integer type, otherwise as byte
+ * strings. They may be quoted with single quotes.
+ *
+ * Node ids are cached by value for each rule, so that a distribution
+ * function on SystemDB is called once for each distinct value. Such a
+ * function must be immutable.
+ */
+#include "config.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "pool.h"
+#include "md5.h"
+
+#define DIST_CACHE_SIZE 1024		/* number of cache entries. must be power of 2 */
+#define DIST_CACHE_VALUE_LEN 64		/* longer values are not cached */
+
+typedef unsigned int (*DistHashFunc)(const char *value, int len);
+
+typedef struct {
+	char *name;
+	DistHashFunc func;
+} DistHashFamily;
+
+typedef struct {
+	char *value;		/* NULL if the key is an integer */
+	long long ivalue;	/* value if the key is an integer */
+	int node;
+} DistListItem;
+
+typedef enum {
+	DIST_RULE_MODULO,
+	DIST_RULE_HASH,
+	DIST_RULE_RANGE,
+	DIST_RULE_LIST
+} DIST_RULE_KIND;
+
+struct DistRule {
+	DIST_RULE_KIND kind;
+	int is_integer;			/* non 0 if the key is an integer */
+	int num_nodes;			/* modulus. 0 means number of backends */
+	DistHashFunc hash;
+	int num_items;			/* range bounds or list items */
+	DistListItem *items;
+	int default_node;		/* for list. -1 if none */
+};
+
+struct DistCacheEntry {
+	int node;				/* -1 if unused */
+	char value[DIST_CACHE_VALUE_LEN];
+};
+
+static unsigned int hash_fnv1a(const char *value, int len);
+static unsigned int hash_md5(const char *value, int len);
+static int key_is_integer(char *type);
+static int parse_integer(const char *str, long long *result);
+static int next_token(char **p, char *buf, int buflen);
+static int add_item(struct DistRule *rule, char *value, int node);
+static int compare_item(struct DistRule *rule, DistListItem *item, const char *value, long long ivalue);
+static void free_rule(struct DistRule *rule);
+
+static DistHashFamily hash_families[] = {
+	{"fnv1a", hash_fnv1a},
+	{"md5", hash_md5},
+	{NULL, NULL}
+};
+
+/*
+ * Parse dist_def_func of info. If it is a built-in rule, info->dist_rule
+ * is set, otherwise it is left NULL and the function on SystemDB is
+ * used. Returns 0 on success, -1 if the rule is malformed.
+ */
+int pool_dist_rule_init(DistDefInfo *info)
+{
+	struct DistRule *rule;
+	char *p = info->dist_def_func;
+	char token[DIST_CACHE_VALUE_LEN * 4];
+	char value[sizeof(token)];
+	int t;
+	int i;
+
+	info->dist_rule = NULL;
+	info->dist_cache = NULL;
+
+	/* a function name has no parenthesis */
+	if (strchr(p, '(') == NULL)
+		return 0;
+
+	rule = calloc(1, sizeof(*rule));
+	if (rule == NULL)
+	{
+		pool_error("pool_dist_rule_init: calloc failed: %s", strerror(errno));
+		return -1;
+	}
+	rule->hash = hash_fnv1a;
+	rule->default_node = -1;
+	rule->is_integer = key_is_integer(info->type_list[info->dist_key_col_id]);
+
+	if (next_token(&p, token, sizeof(token)) != 'v')
+		goto syntax_error;
+	if (strcasecmp(token, "modulo") == 0)
+		rule->kind = DIST_RULE_MODULO;
+	else if (strcasecmp(token, "hash") == 0)
+		rule->kind = DIST_RULE_HASH;
+	else if (strcasecmp(token, "range") == 0)
+		rule->kind = DIST_RULE_RANGE;
+	else if (strcasecmp(token, "list") == 0)
+		rule->kind = DIST_RULE_LIST;
+	else
+		goto syntax_error;
+
+	if (next_token(&p, token, sizeof(token)) != '(')
+		goto syntax_error;
+
+	/* arguments */
+	for (i = 0;; i++)
+	{
+		t = next_token(&p, value, sizeof(value));
+		if (t == ')' && i == 0)
+			break;
+		if (t != 'v' && t != 'q')
+			goto syntax_error;
+
+		switch (rule->kind)
+		{
+			case DIST_RULE_MODULO:
+			case DIST_RULE_HASH:
+				if (i == 0)
+				{
+					long long n;
+
+					if (parse_integer(value, &n) || n <= 0 || n > MAX_NUM_BACKENDS)
+						goto syntax_error;
+					rule->num_nodes = n;
+				}
+				else if (i == 1 && rule->kind == DIST_RULE_HASH)
+				{
+					DistHashFamily *f;
+
+					for (f = hash_families; f->name; f++)
+					{
+						if (strcasecmp(f->name, value) == 0)
+							break;
+					}
+					if (f->name == NULL)
+					{
+						pool_error("pool_dist_rule_init: unknown hash family \"%s\"", value);
+						goto syntax_error;
+					}
+					rule->hash = f->func;
+				}
+				else
+					goto syntax_error;
+				break;
+
+			case DIST_RULE_RANGE:
+				if (add_item(rule, value, i) < 0)
+					goto syntax_error;
+				if (i > 0 && compare_item(rule, &rule->items[i - 1], value, rule->items[i].ivalue) >= 0)
+				{
+					pool_error("pool_dist_rule_init: range bounds must be ascending");
+					goto syntax_error;
+				}
+				break;
+
+			case DIST_RULE_LIST:
+			{
+				long long n;
+
+				if (next_token(&p, token, sizeof(token)) != ':' ||
+					next_token(&p, token, sizeof(token)) != 'v' ||
+					parse_integer(token, &n) || n < 0 || n >= MAX_NUM_BACKENDS)
+					goto syntax_error;
+
+				if (t == 'v' && strcmp(value, "*") == 0)
+					rule->default_node = n;
+				else if (add_item(rule, value, n) < 0)
+					goto syntax_error;
+				break;
+			}
+		}
+
+		t = next_token(&p, token, sizeof(token));
+		if (t == ')')
+			break;
+		if (t != ',')
+			goto syntax_error;
+	}
+
+	if (next_token(&p, token, sizeof(token)) != 0)
+		goto syntax_error;
+
+	if (rule->kind == DIST_RULE_MODULO && !rule->is_integer)
+	{
+		pool_error("pool_dist_rule_init: modulo needs an integer key in %s.%s",
+				   info->schema_name, info->table_name);
+		goto error;
+	}
+	if (rule->kind == DIST_RULE_RANGE && rule->num_items == 0)
+		goto syntax_error;
+
+	pool_debug("pool_dist_rule_init: built-in rule %s for %s.%s", info->dist_def_func,
+			   info->schema_name, info->table_name);
+	info->dist_rule = rule;
+	return 0;
+
+syntax_error:
+	pool_error("pool_dist_rule_init: invalid distribution rule \"%s\" for %s.%s",
+			   info->dist_def_func, info->schema_name, info->table_name);
+error:
+	free_rule(rule);
+	return -1;
+}
+
+/*
+ * Returns the node id for value by the built-in rule of info, or -1
+ */
+int pool_dist_rule_eval(DistDefInfo *info, const char *value)
+{
+	struct DistRule *rule = info->dist_rule;
+	long long ivalue = 0;
+	int num_nodes;
+	int node = -1;
+	int i;
+
+	if (rule->is_integer && parse_integer(value, &ivalue))
+	{
+		pool_error("pool_dist_rule_eval: invalid integer \"%s\" for %s.%s",
+				   value, info->schema_name, info->table_name);
+		return -1;
+	}
+
+	num_nodes = rule->num_nodes ? rule->num_nodes : pool_config->backend_desc->num_backends;
+
+	switch (rule->kind)
+	{
+		case DIST_RULE_MODULO:
+			node = ivalue % num_nodes;
+			if (node < 0)
+				node += num_nodes;
+			break;
+
+		case DIST_RULE_HASH:
+		{
+			char buf[32];
+
+			/* hash the canonical form so that " 01" and "1" go together */
+			if (rule->is_integer)
+			{
+				snprintf(buf, sizeof(buf), "%lld", ivalue);
+				value = buf;
+			}
+			node = rule->hash(value, strlen(value)) % num_nodes;
+			break;
+		}
+
+		case DIST_RULE_RANGE:
+		{
+			int low = 0;
+			int high = rule->num_items;
+
+			/* first bound not less than value */
+			while (low < high)
+			{
+				int mid = (low + high) / 2;
+
+				if (compare_item(rule, &rule->items[mid], value, ivalue) < 0)
+					low = mid + 1;
+				else
+					high = mid;
+			}
+			node = low;
+			break;
+		}
+
+		case DIST_RULE_LIST:
+			node = rule->default_node;
+			for (i = 0; i < rule->num_items; i++)
+			{
+				if (compare_item(rule, &rule->items[i], value, ivalue) == 0)
+				{
+					node = rule->items[i].node;
+					break;
+				}
+			}
+			break;
+	}
+
+	if (node < 0)
+		pool_error("pool_dist_rule_eval: no node for \"%s\" in %s.%s",
+				   value, info->schema_name, info->table_name);
+	return node;
+}
+
+/*
+ * Returns the cached node id for value, or -1
+ */
+int pool_dist_cache_lookup(DistDefInfo *info, const char *value)
+{
+	struct DistCacheEntry *e;
+	int len = strlen(value);
+
+	if (info->dist_cache == NULL || len >= DIST_CACHE_VALUE_LEN)
+		return -1;
+
+	e = &info->dist_cache[hash_fnv1a(value, len) & (DIST_CACHE_SIZE - 1)];
+	if (e->node >= 0 && strcmp(e->value, value) == 0)
+		return e->node;
+	return -1;
+}
+
+/*
+ * Remember node id for value. An older value in the same entry is
+ * replaced.
+ */
+void pool_dist_cache_store(DistDefInfo *info, const char *value, int node)
+{
+	struct DistCacheEntry *e;
+	int len = strlen(value);
+	int i;
+
+	if (len >= DIST_CACHE_VALUE_LEN)
+		return;
+
+	if (info->dist_cache == NULL)
+	{
+		info->dist_cache = malloc(sizeof(struct DistCacheEntry) * DIST_CACHE_SIZE);
+		if (info->dist_cache == NULL)
+			return;
+		for (i = 0; i < DIST_CACHE_SIZE; i++)
+			info->dist_cache[i].node = -1;
+	}
+
+	e = &info->dist_cache[hash_fnv1a(value, len) & (DIST_CACHE_SIZE - 1)];
+	memcpy(e->value, value, len + 1);
+	e->node = node;
+}
+
+static unsigned int hash_fnv1a(const char *value, int len)
+{
+	unsigned int h = 2166136261U;
+
+	while (len-- > 0)
+		h = (h ^ (unsigned char)*value++) * 16777619U;
+	return h;
+}
+
+/*
+ * First 32 bits of md5 as an unsigned integer. The node is the same as
+ * (('x' || substr(md5(value), 1, 8))::bit(32)::bigint & 4294967295) % N
+ * in SQL, where value is the text form of the key.
+ */
+static unsigned int hash_md5(const char *value, int len)
+{
+	char hex[33];
+
+	pool_md5_hash(value, len, hex);
+	hex[8] = '\0';
+	return strtoul(hex, NULL, 16);
+}
+
+static int key_is_integer(char *type)
+{
+	static char *types[] = {"integer", "int", "int2", "int4", "int8",
+							"smallint", "bigint", NULL};
+	int i;
+
+	for (i = 0; types[i]; i++)
+	{
+		if (strcasecmp(types[i], type) == 0)
+			return 1;
+	}
+	return 0;
+}
+
+/*
+ * Parse str as a decimal integer. Surrounding spaces are allowed.
+ * Returns 0 on success.
+ */
+static int parse_integer(const char *str, long long *result)
+{
+	char *end;
+
+	errno = 0;
+	*result = strtoll(str, &end, 10);
+	if (end == str || errno != 0)
+		return -1;
+	while (isspace((unsigned char)*end))
+		end++;
+	return *end != '\0';
+}
+
+/*
+ * Read the next token of a rule from *p into buf. Returns 'v' for a
+ * bare word, 'q' for a quoted string, the character for punctuation,
+ * 0 at the end and -1 on error.
+ */
+static int next_token(char **p, char *buf, int buflen)
+{
+	char *s = *p;
+	int len = 0;
+	int t;
+
+	while (isspace((unsigned char)*s))
+		s++;
+
+	if (*s == '\0')
+		t = 0;
+	else if (strchr("(),:", *s))
+		t = *s++;
+	else if (*s == '\'')
+	{
+		t = 'q';
+		for (s++;; s++)
+		{
+			if (*s == '\0')
+				return -1;
+			if (*s == '\'')
+			{
+				if (s[1] != '\'')
+					break;
+				s++;
+			}
+			if (len >= buflen - 1)
+				return -1;
+			buf[len++] = *s;
+		}
+		s++;
+	}
+	else
+	{
+		t = 'v';
+		while (*s && !isspace((unsigned char)*s) && !strchr("(),:'", *s))
+		{
+			if (len >= buflen - 1)
+				return -1;
+			buf[len++] = *s++;
+		}
+	}
+
+	buf[len] = '\0';
+	*p = s;
+	return t;
+}
+
+static int add_item(struct DistRule *rule, char *value, int node)
+{
+	DistListItem *items;
+	DistListItem *item;
+
+	items = realloc(rule->items, sizeof(DistListItem) * (rule->num_items + 1));
+	if (items == NULL)
+	{
+		pool_error("pool_dist_rule_init: realloc failed: %s", strerror(errno));
+		return -1;
+	}
+	rule->items = items;
+
+	item = &items[rule->num_items];
+	item->node = node;
+	item->ivalue = 0;
+	item->value = NULL;
+	if (rule->is_integer)
+	{
+		if (parse_integer(value, &item->ivalue))
+		{
+			pool_error("pool_dist_rule_init: invalid integer \"%s\"", value);
+			return -1;
+		}
+	}
+	else
+	{
+		item->value = strdup(value);
+		if (item->value == NULL)
+		{
+			pool_error("pool_dist_rule_init: strdup failed: %s", strerror(errno));
+			return -1;
+		}
+	}
+	rule->num_items++;
+	return 0;
+}
+
+/* compare an item with value. returns <0, 0 or >0 like strcmp */
+static int compare_item(struct DistRule *rule, DistListItem *item, const char *value, long long ivalue)
+{
+	if (rule->is_integer)
+		return (item->ivalue > ivalue) - (item->ivalue < ivalue);
+	return strcmp(item->value, value);
+}
+
+static void free_rule(struct DistRule *rule)
+{
+	int i;
+
+	for (i = 0; i < rule->num_items; i++)
+		free(rule->items[i].value);
+	free(rule->items);
+	free(rule);
+}
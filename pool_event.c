@@ -0,0 +1,588 @@
+/* -*-pgsql-c-*- */
+/*
+ * $Header$
+ *
+ * pgpool: a language independent connection pool server for PostgreSQL
+ * written by Tatsuo Ishii
+ *
+ * Copyright (c) 2003-2010	PgPool Global Development Group
+ *
+ * Permission to use, copy, modify, and distribute this software and
+ * its documentation for any purpose and without fee is hereby
+ * granted, provided that the above copyright notice appear in all
+ * copies and that both that copyright notice and this permission
+ * notice appear in supporting documentation, and that the name of the
+ * author not be used in advertising or publicity pertaining to
+ * distribution of the software without specific, written prior
+ * permission. The author makes no representations about the
+ * suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * pool_event.c: I/O readiness notification.
+ *
+ * An event set remembers the file descriptors a child is interested
+ * in across calls, so that the caller does not need to rebuild
+ * fd_set on every cycle and is not limited by FD_SETSIZE. If the
+ * platform has epoll(7), registrations are kept in the kernel and
+ * waiting costs only the number of ready descriptors. Otherwise
+ * poll(2) is used.
+ */
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#endif
+#include <poll.h>
+#include <sys/time.h>
+
+#include "pool.h"
+
+#define INIT_EVENT_SET_SIZE 16
+
+struct POOL_EVENT_SET {
+	struct POOL_EVENT_SET *next;	/* chain of all event sets of this process */
+#ifdef HAVE_SYS_EPOLL_H
+	int epfd;			/* epoll descriptor */
+	struct epoll_event *epevents;	/* result buffer for epoll_wait */
+#else
+	struct pollfd *pollfds;	/* poll(2) array. same index as fds */
+#endif
+	int num;			/* number of registered descriptors */
+	int size;			/* allocated entries of fds/events/revents */
+	int *fds;			/* registered descriptors */
+	int *events;		/* interested events. 0 means muted */
+	int *revents;		/* events returned by the last pool_event_wait */
+	int *ready;			/* indexes having non 0 revents */
+	int nready;			/* number of entries in ready */
+	int *index;			/* fd -> index in fds plus 1. 0 if not registered */
+	int index_size;		/* allocated entries of index */
+};
+
+static POOL_EVENT_SET *event_sets;
+
+static int lookup(POOL_EVENT_SET *set, int fd);
+static int add_entry(POOL_EVENT_SET *set, int fd);
+static void remove_entry(POOL_EVENT_SET *set, int idx);
+static int kernel_update(POOL_EVENT_SET *set, int fd, int old, int new);
+
+/*
+ * Create an empty event set. Returns NULL on error.
+ */
+POOL_EVENT_SET *pool_event_create(void)
+{
+	POOL_EVENT_SET *set;
+
+	set = calloc(1, sizeof(*set));
+	if (set == NULL)
+	{
+		pool_error("pool_event_create: calloc failed");
+		return NULL;
+	}
+
+#ifdef HAVE_SYS_EPOLL_H
+	set->epfd = epoll_create(INIT_EVENT_SET_SIZE);
+	if (set->epfd < 0)
+	{
+		pool_error("pool_event_create: epoll_create failed. reason: %s", strerror(errno));
+		free(set);
+		return NULL;
+	}
+#endif
+
+	set->next = event_sets;
+	event_sets = set;
+	return set;
+}
+
+/*
+ * Destroy an event set. Registered descriptors are not closed.
+ */
+void pool_event_destroy(POOL_EVENT_SET *set)
+{
+	POOL_EVENT_SET **p;
+
+	if (set == NULL)
+		return;
+
+	for (p = &event_sets; *p; p = &(*p)->next)
+	{
+		if (*p == set)
+		{
+			*p = set->next;
+			break;
+		}
+	}
+
+#ifdef HAVE_SYS_EPOLL_H
+	close(set->epfd);
+	free(set->epevents);
+#else
+	free(set->pollfds);
+#endif
+	free(set->fds);
+	free(set->events);
+	free(set->revents);
+	free(set->ready);
+	free(set->index);
+	free(set);
+}
+
+/*
+ * Set interested events of fd. events is a bit mask of
+ * POOL_EVENT_READ and POOL_EVENT_EXCEPT, optionally with
+ * POOL_EVENT_EXCLUSIVE for a descriptor shared by many processes
+ * (ignored if the kernel does not support it). If events is 0, the
+ * descriptor is muted: it stays known to the set but is not reported
+ * until it is watched again. Calling this with unchanged events does
+ * not issue any system call.
+ * Returns 0 on success, -1 on error.
+ */
+int pool_event_watch(POOL_EVENT_SET *set, int fd, int events)
+{
+	int idx;
+	int old;
+
+	if (fd < 0)
+		return -1;
+
+	idx = lookup(set, fd);
+	if (idx < 0)
+	{
+		if (events == 0)
+			return 0;
+		idx = add_entry(set, fd);
+		if (idx < 0)
+			return -1;
+	}
+
+	old = set->events[idx];
+	if (old == events)
+		return 0;
+
+	if (kernel_update(set, fd, old, events) < 0)
+		return -1;
+
+	set->events[idx] = events;
+	set->revents[idx] = 0;
+#ifndef HAVE_SYS_EPOLL_H
+	set->pollfds[idx].fd = events ? fd : -1;
+	set->pollfds[idx].events = 0;
+	if (events & POOL_EVENT_READ)
+		set->pollfds[idx].events |= POLLIN;
+	if (events & POOL_EVENT_EXCEPT)
+		set->pollfds[idx].events |= POLLPRI;
+#endif
+	return 0;
+}
+
+/*
+ * Remove fd from the set.
+ */
+void pool_event_unwatch(POOL_EVENT_SET *set, int fd)
+{
+	int idx;
+
+	idx = lookup(set, fd);
+	if (idx < 0)
+		return;
+
+	if (set->events[idx])
+		kernel_update(set, fd, set->events[idx], 0);
+	remove_entry(set, idx);
+}
+
+/*
+ * Remove all descriptors from the set.
+ */
+void pool_event_clear(POOL_EVENT_SET *set)
+{
+	while (set->num > 0)
+		pool_event_unwatch(set, set->fds[set->num - 1]);
+	set->nready = 0;
+}
+
+/*
+ * Forget fd in all event sets of this process. This must be called
+ * before fd is closed, since a descriptor number may be reused by
+ * later open/accept.
+ */
+void pool_event_forget(int fd)
+{
+	POOL_EVENT_SET *set;
+
+	for (set = event_sets; set; set = set->next)
+		pool_event_unwatch(set, fd);
+}
+
+/*
+ * Wait for events. timeout is in milliseconds. if timeout < 0, wait
+ * forever. Returns the number of ready descriptors, 0 on timeout (or
+ * if nothing interesting happened) and -1 on error (errno is set).
+ */
+int pool_event_wait(POOL_EVENT_SET *set, int timeout)
+{
+	int i;
+	int n;
+
+	/* forget results of the previous call */
+	for (i = 0; i < set->nready; i++)
+		set->revents[set->ready[i]] = 0;
+	set->nready = 0;
+
+#ifdef HAVE_SYS_EPOLL_H
+	if (set->size == 0)
+		return poll(NULL, 0, timeout);
+
+	n = epoll_wait(set->epfd, set->epevents, set->size > 0 ? set->size : 1, timeout);
+	if (n <= 0)
+		return n;
+
+	for (i = 0; i < n; i++)
+	{
+		int fd = set->epevents[i].data.fd;
+		int ev = set->epevents[i].events;
+		int idx = lookup(set, fd);
+		int r = 0;
+
+		if (idx < 0 || set->events[idx] == 0)
+			continue;
+
+		/*
+		 * Hang up and error are reported as readable, as select(2)
+		 * does. Following read will detect them.
+		 */
+		if (ev & (EPOLLIN | EPOLLHUP | EPOLLERR))
+			r |= POOL_EVENT_READ;
+		if (ev & EPOLLPRI)
+			r |= POOL_EVENT_EXCEPT;
+
+		r &= set->events[idx];
+		if (r)
+		{
+			set->revents[idx] = r;
+			set->ready[set->nready++] = idx;
+		}
+	}
+#else
+	n = poll(set->pollfds, set->num, timeout);
+	if (n <= 0)
+		return n;
+
+	for (i = 0; i < set->num; i++)
+	{
+		int ev = set->pollfds[i].revents;
+		int r = 0;
+
+		if (ev == 0 || set->events[i] == 0)
+			continue;
+
+		if (ev & (POLLIN | POLLHUP | POLLERR | POLLNVAL))
+			r |= POOL_EVENT_READ;
+		if (ev & POLLPRI)
+			r |= POOL_EVENT_EXCEPT;
+
+		r &= set->events[i];
+		if (r)
+		{
+			set->revents[i] = r;
+			set->ready[set->nready++] = i;
+		}
+	}
+#endif
+
+	return set->nready;
+}
+
+/*
+ * Returns events of fd reported by the last pool_event_wait.
+ */
+int pool_event_ready(POOL_EVENT_SET *set, int fd)
+{
+	int idx;
+
+	idx = lookup(set, fd);
+	if (idx < 0)
+		return 0;
+	return set->revents[idx];
+}
+
+/*
+ * Returns the n th descriptor reported ready by the last
+ * pool_event_wait (0 <= n < its return value), or -1 if there is no
+ * such descriptor. Results are valid until descriptors are added to
+ * or removed from the set.
+ */
+int pool_event_ready_fd(POOL_EVENT_SET *set, int n)
+{
+	if (n < 0 || n >= set->nready)
+		return -1;
+	return set->fds[set->ready[n]];
+}
+
+/*
+ * Wait until fd becomes readable without registering it to any event
+ * set. timeout is in milliseconds. if timeout < 0, wait forever.
+ * return values: ready events(> 0), 0: timeout, -1: error
+ */
+int pool_event_wait_fd(int fd, int timeout)
+{
+	struct pollfd pfd;
+	int r = 0;
+	int fds;
+
+	pfd.fd = fd;
+	pfd.events = POLLIN | POLLPRI;
+	pfd.revents = 0;
+
+	fds = poll(&pfd, 1, timeout);
+	if (fds <= 0)
+		return fds;
+
+	if (pfd.revents & (POLLIN | POLLHUP | POLLERR | POLLNVAL))
+		r |= POOL_EVENT_READ;
+	if (pfd.revents & POLLPRI)
+		r |= POOL_EVENT_EXCEPT;
+	return r;
+}
+
+/*
+ * Wait until any of fds[0..n-1] becomes readable without registering
+ * them to any event set. This is cheaper than an event set when the
+ * descriptors to be watched change on every call. Ready events of
+ * each fd are stored in revents[]. timeout is in milliseconds. if
+ * timeout < 0, wait forever.
+ * return values: number of ready fds, 0: timeout, -1: error
+ */
+int pool_event_wait_fds(int *fds, int *revents, int n, int timeout)
+{
+	struct pollfd pfds[MAX_NUM_BACKENDS];
+	int i;
+	int nready;
+
+	if (n > MAX_NUM_BACKENDS)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+
+	for (i = 0; i < n; i++)
+	{
+		pfds[i].fd = fds[i];
+		pfds[i].events = POLLIN | POLLPRI;
+		pfds[i].revents = 0;
+	}
+
+	nready = poll(pfds, n, timeout);
+	if (nready <= 0)
+		return nready;
+
+	for (i = 0; i < n; i++)
+	{
+		int r = 0;
+
+		if (pfds[i].revents & (POLLIN | POLLHUP | POLLERR | POLLNVAL))
+			r |= POOL_EVENT_READ;
+		if (pfds[i].revents & POLLPRI)
+			r |= POOL_EVENT_EXCEPT;
+		revents[i] = r;
+	}
+	return nready;
+}
+
+/*
+ * Returns current time in milliseconds. Used to compute deadlines.
+ */
+long pool_event_now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec * 1000L + tv.tv_usec / 1000;
+}
+
+static int lookup(POOL_EVENT_SET *set, int fd)
+{
+	if (fd < 0 || fd >= set->index_size)
+		return -1;
+	return set->index[fd] - 1;
+}
+
+static int add_entry(POOL_EVENT_SET *set, int fd)
+{
+	int idx;
+
+	if (fd >= set->index_size)
+	{
+		int newsize = set->index_size ? set->index_size : INIT_EVENT_SET_SIZE;
+		int *p;
+
+		while (newsize <= fd)
+			newsize *= 2;
+
+		p = realloc(set->index, sizeof(int) * newsize);
+		if (p == NULL)
+		{
+			pool_error("pool_event_watch: realloc failed");
+			return -1;
+		}
+		memset(p + set->index_size, 0, sizeof(int) * (newsize - set->index_size));
+		set->index = p;
+		set->index_size = newsize;
+	}
+
+	if (set->num >= set->size)
+	{
+		int newsize = set->size ? set->size * 2 : INIT_EVENT_SET_SIZE;
+		int *fds, *events, *revents, *ready;
+#ifdef HAVE_SYS_EPOLL_H
+		struct epoll_event *ep;
+#else
+		struct pollfd *pf;
+#endif
+
+		fds = realloc(set->fds, sizeof(int) * newsize);
+		if (fds)
+			set->fds = fds;
+		events = realloc(set->events, sizeof(int) * newsize);
+		if (events)
+			set->events = events;
+		revents = realloc(set->revents, sizeof(int) * newsize);
+		if (revents)
+			set->revents = revents;
+		ready = realloc(set->ready, sizeof(int) * newsize);
+		if (ready)
+			set->ready = ready;
+#ifdef HAVE_SYS_EPOLL_H
+		ep = realloc(set->epevents, sizeof(struct epoll_event) * newsize);
+		if (ep)
+			set->epevents = ep;
+#else
+		pf = realloc(set->pollfds, sizeof(struct pollfd) * newsize);
+		if (pf)
+			set->pollfds = pf;
+#endif
+
+		if (fds == NULL || events == NULL || revents == NULL || ready == NULL ||
+#ifdef HAVE_SYS_EPOLL_H
+			ep == NULL)
+#else
+			pf == NULL)
+#endif
+		{
+			pool_error("pool_event_watch: realloc failed");
+			return -1;
+		}
+		set->size = newsize;
+	}
+
+	idx = set->num++;
+	set->fds[idx] = fd;
+	set->events[idx] = 0;
+	set->revents[idx] = 0;
+#ifndef HAVE_SYS_EPOLL_H
+	set->pollfds[idx].fd = -1;
+	set->pollfds[idx].events = 0;
+	set->pollfds[idx].revents = 0;
+#endif
+	set->index[fd] = idx + 1;
+	return idx;
+}
+
+/*
+ * Remove an entry by moving the last entry into its place.
+ */
+static void remove_entry(POOL_EVENT_SET *set, int idx)
+{
+	int last = set->num - 1;
+	int i;
+
+	set->index[set->fds[idx]] = 0;
+
+	/* results of the last wait are not valid for this entry any more */
+	for (i = 0; i < set->nready;)
+	{
+		if (set->ready[i] == idx)
+		{
+			set->ready[i] = set->ready[--set->nready];
+			continue;
+		}
+		if (set->ready[i] == last)
+			set->ready[i] = idx;
+		i++;
+	}
+
+	if (idx != last)
+	{
+		set->fds[idx] = set->fds[last];
+		set->events[idx] = set->events[last];
+		set->revents[idx] = set->revents[last];
+#ifndef HAVE_SYS_EPOLL_H
+		set->pollfds[idx] = set->pollfds[last];
+#endif
+		set->index[set->fds[idx]] = idx + 1;
+	}
+	set->num--;
+}
+
+/*
+ * Reflect the change of interested events to the kernel.
+ */
+static int kernel_update(POOL_EVENT_SET *set, int fd, int old, int new)
+{
+#ifdef HAVE_SYS_EPOLL_H
+	struct epoll_event ev;
+	int op;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.data.fd = fd;
+	if (new & POOL_EVENT_READ)
+		ev.events |= EPOLLIN;
+	if (new & POOL_EVENT_EXCEPT)
+		ev.events |= EPOLLPRI;
+#ifdef EPOLLEXCLUSIVE
+	if (new & POOL_EVENT_EXCLUSIVE)
+		ev.events |= EPOLLEXCLUSIVE;
+#endif
+
+	/*
+	 * Muted descriptors are removed from the kernel, since epoll
+	 * always reports hang up and error conditions and they would wake
+	 * us up again and again.
+	 */
+	if (old == 0)
+		op = EPOLL_CTL_ADD;
+	else if (new == 0)
+		op = EPOLL_CTL_DEL;
+	else
+		op = EPOLL_CTL_MOD;
+
+#ifdef EPOLLEXCLUSIVE
+	/* EPOLL_CTL_MOD is not allowed for exclusive wakeup */
+	if (op == EPOLL_CTL_MOD && ((old | new) & POOL_EVENT_EXCLUSIVE))
+	{
+		if (epoll_ctl(set->epfd, EPOLL_CTL_DEL, fd, &ev) < 0)
+		{
+			pool_error("pool_event_watch: epoll_ctl failed. fd: %d reason: %s", fd, strerror(errno));
+			return -1;
+		}
+		op = EPOLL_CTL_ADD;
+	}
+#endif
+
+	if (epoll_ctl(set->epfd, op, fd, &ev) < 0)
+	{
+		/* already closed by someone else */
+		if (op == EPOLL_CTL_DEL && (errno == EBADF || errno == ENOENT))
+			return 0;
+
+		pool_error("pool_event_watch: epoll_ctl failed. fd: %d reason: %s", fd, strerror(errno));
+		return -1;
+	}
+#endif
+	return 0;
+}
@@ -0,0 +1,670 @@
+/* -*-pgsql-c-*- */
+/*
+ * $Header$
+ *
+ * pgpool: a language independent connection pool server for PostgreSQL
+ * written by Tatsuo Ishii
+ *
+ * Copyright (c) 2003-2010	PgPool Global Development Group
+ *
+ * Permission to use, copy, modify, and distribute this software and
+ * its documentation for any purpose and without fee is hereby
+ * granted, provided that the above copyright notice appear in all
+ * copies and that both that copyright notice and this permission
+ * notice appear in supporting documentation, and that the name of the
+ * author not be used in advertising or publicity pertaining to
+ * distribution of the software without specific, written prior
+ * permission. The author makes no representations about the
+ * suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * pool_handoff.c: passing cached connections from an exiting child to
+ * the child replacing it.
+ *
+ * When a child exits because of child_life_time or
+ * child_max_connections, it sends the sockets of its idle connection
+ * pools to the parent over a UNIX domain datagram socket with
+ * SCM_RIGHTS, along with the state needed to reuse them (startup
+ * packet, authentication and parameter status). The parent keeps them
+ * per process table slot until it forks the replacement child, which
+ * inherits the descriptors by fork() and puts them back into its
+ * connection pool.
+ */
+#include "config.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "pool.h"
+
+#define HANDOFF_MAX_MESSAGE (64 * 1024)	/* max size of a message */
+#define HANDOFF_MAX_FDS 250				/* max descriptors in a message.
+										 * Linux allows 253 */
+
+/* connections passed by an exiting child. kept by the parent */
+typedef struct {
+	char *data;		/* message. NULL if none */
+	int len;		/* message length */
+	int fds[HANDOFF_MAX_FDS];	/* passed descriptors. -1 if consumed */
+	int nfds;		/* number of descriptors */
+} HandoffStash;
+
+/* message being built or parsed */
+typedef struct {
+	char *buf;
+	int len;		/* length of data in buf */
+	int pos;		/* read position */
+} HandoffBuf;
+
+static int handoff_fds[2] = {-1, -1};	/* [0] is read by the parent, [1]
+										 * is written by children */
+static HandoffStash *stash;		/* array of num_init_children */
+
+static int put(HandoffBuf *b, void *data, int len);
+static int put_string(HandoffBuf *b, char *str);
+static int get(HandoffBuf *b, void *data, int len);
+static char *get_string(HandoffBuf *b);
+static int put_pool(HandoffBuf *b, POOL_CONNECTION_POOL *p);
+static int handoff_pool_ok(POOL_CONNECTION_POOL *p);
+static int install_pools(HandoffStash *s);
+static int install_pool(HandoffBuf *b, HandoffStash *s, int *fdpos);
+
+/*
+ * Create the socket to pass connections. This should be called once
+ * from the parent process before forking children.
+ * Returns 0 on success otherwise -1.
+ */
+int pool_handoff_init(void)
+{
+	if (!pool_config->handoff_connections)
+		return 0;
+
+	if (socketpair(AF_UNIX, SOCK_DGRAM, 0, handoff_fds) < 0)
+	{
+		pool_error("pool_handoff_init: socketpair() failed. reason: %s", strerror(errno));
+		return -1;
+	}
+
+	stash = calloc(pool_config->num_init_children, sizeof(HandoffStash));
+	if (stash == NULL)
+	{
+		pool_error("pool_handoff_init: malloc failed");
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Send idle connection pools of this child to the parent. Connection
+ * pools successfully sent are closed without sending Terminate, since
+ * the parent now holds the sockets. Called by an exiting child.
+ */
+void pool_handoff_send(void)
+{
+	HandoffBuf b;
+	POOL_CONNECTION_POOL *p;
+	POOL_CONNECTION_POOL *sent[HANDOFF_MAX_FDS];
+	int fds[HANDOFF_MAX_FDS];
+	int nfds = 0;
+	int npools = 0;
+	int npools_pos;
+	int save;
+	int num_backends = NUM_BACKENDS;
+	int i, j;
+	char valid;
+	struct msghdr msg;
+	struct iovec iov;
+	struct cmsghdr *cmsg;
+	union {
+		struct cmsghdr hdr;
+		char buf[CMSG_SPACE(sizeof(int) * HANDOFF_MAX_FDS)];
+	} cmsgbuf;
+
+	if (handoff_fds[1] < 0 || pool_connection_pool == NULL)
+		return;
+
+	b.buf = malloc(HANDOFF_MAX_MESSAGE);
+	if (b.buf == NULL)
+	{
+		pool_error("pool_handoff_send: malloc failed");
+		return;
+	}
+	b.len = b.pos = 0;
+
+	/* header: process table id and the set of valid nodes */
+	put(&b, &my_proc_id, sizeof(my_proc_id));
+	put(&b, &num_backends, sizeof(num_backends));
+	for (i=0;i<NUM_BACKENDS;i++)
+	{
+		valid = VALID_BACKEND(i) ? 1 : 0;
+		put(&b, &valid, sizeof(valid));
+	}
+	npools_pos = b.len;
+	put(&b, &npools, sizeof(npools));
+
+	for (i=0;i<pool_config->max_pool;i++)
+	{
+		p = &pool_connection_pool[i];
+
+		if (!handoff_pool_ok(p))
+			continue;
+
+		if (nfds + NUM_BACKENDS > HANDOFF_MAX_FDS)
+			break;
+
+		save = b.len;
+		if (put_pool(&b, p) < 0)
+		{
+			/* does not fit in a message */
+			b.len = save;
+			break;
+		}
+
+		for (j=0;j<NUM_BACKENDS;j++)
+		{
+			if (VALID_BACKEND(j))
+				fds[nfds++] = CONNECTION(p, j)->fd;
+		}
+		sent[npools++] = p;
+	}
+
+	if (npools == 0)
+	{
+		free(b.buf);
+		return;
+	}
+	memcpy(b.buf + npools_pos, &npools, sizeof(npools));
+
+	memset(&msg, 0, sizeof(msg));
+	iov.iov_base = b.buf;
+	iov.iov_len = b.len;
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = cmsgbuf.buf;
+	msg.msg_controllen = CMSG_SPACE(sizeof(int) * nfds);
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int) * nfds);
+	memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * nfds);
+
+	/* do not wait for the parent. close connections instead */
+	if (sendmsg(handoff_fds[1], &msg, MSG_DONTWAIT) < 0)
+	{
+		pool_log("pool_handoff_send: could not pass connections. reason: %s", strerror(errno));
+		free(b.buf);
+		return;
+	}
+	free(b.buf);
+
+	pool_debug("pool_handoff_send: passed %d connection pools", npools);
+
+	for (i=0;i<npools;i++)
+	{
+		p = sent[i];
+		pool_discard_cp(MASTER_CONNECTION(p)->sp->user,
+						MASTER_CONNECTION(p)->sp->database,
+						MASTER_CONNECTION(p)->sp->major);
+	}
+}
+
+/*
+ * Receive connections sent by exiting children, and keep them until
+ * the replacing child is forked. Called by the parent.
+ */
+void pool_handoff_receive(void)
+{
+	HandoffStash s;
+	struct msghdr msg;
+	struct iovec iov;
+	struct cmsghdr *cmsg;
+	union {
+		struct cmsghdr hdr;
+		char buf[CMSG_SPACE(sizeof(int) * HANDOFF_MAX_FDS)];
+	} cmsgbuf;
+	int id;
+	int n;
+	int i;
+
+	if (handoff_fds[0] < 0)
+		return;
+
+	for (;;)
+	{
+		memset(&s, 0, sizeof(s));
+		s.data = malloc(HANDOFF_MAX_MESSAGE);
+		if (s.data == NULL)
+		{
+			pool_error("pool_handoff_receive: malloc failed");
+			return;
+		}
+
+		memset(&msg, 0, sizeof(msg));
+		iov.iov_base = s.data;
+		iov.iov_len = HANDOFF_MAX_MESSAGE;
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = cmsgbuf.buf;
+		msg.msg_controllen = sizeof(cmsgbuf.buf);
+
+		n = recvmsg(handoff_fds[0], &msg, MSG_DONTWAIT);
+		if (n < 0)
+		{
+			free(s.data);
+			if (errno == EINTR)
+				continue;
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+				pool_error("pool_handoff_receive: recvmsg() failed. reason: %s", strerror(errno));
+			return;
+		}
+		s.len = n;
+
+		for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg))
+		{
+			int num;
+
+			if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+				continue;
+
+			num = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+			for (i = 0; i < num && s.nfds < HANDOFF_MAX_FDS; i++)
+				memcpy(&s.fds[s.nfds++], CMSG_DATA(cmsg) + sizeof(int) * i, sizeof(int));
+		}
+
+		if (s.len >= sizeof(id))
+			memcpy(&id, s.data, sizeof(id));
+
+		if ((msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC)) || s.len < sizeof(id) ||
+			id < 0 || id >= pool_config->num_init_children)
+		{
+			pool_error("pool_handoff_receive: invalid message");
+			for (i = 0; i < s.nfds; i++)
+				close(s.fds[i]);
+			free(s.data);
+			continue;
+		}
+
+		pool_handoff_forget(id);
+		stash[id] = s;
+	}
+}
+
+/*
+ * Close connections kept for process table slot id. Called by the
+ * parent after forking the child for the slot, which has its own
+ * copies of the descriptors.
+ */
+void pool_handoff_forget(int id)
+{
+	HandoffStash *s;
+	int i;
+
+	if (stash == NULL || id < 0 || id >= pool_config->num_init_children)
+		return;
+
+	s = &stash[id];
+	for (i = 0; i < s->nfds; i++)
+	{
+		if (s->fds[i] >= 0)
+			close(s->fds[i]);
+	}
+	if (s->data)
+		free(s->data);
+	memset(s, 0, sizeof(*s));
+}
+
+/*
+ * Close all connections passed by children, e.g. because backend nodes
+ * have changed by failover. Called by the parent.
+ */
+void pool_handoff_discard(void)
+{
+	int i;
+
+	if (stash == NULL)
+		return;
+
+	pool_handoff_receive();
+	for (i = 0; i < pool_config->num_init_children; i++)
+		pool_handoff_forget(i);
+}
+
+/*
+ * Put connections kept for process table slot id into the connection
+ * pool, and close descriptors inherited for other slots. If id is -1,
+ * only closes descriptors. Called by a newly forked process.
+ */
+void pool_handoff_adopt(int id)
+{
+	int n;
+	int i;
+
+	if (stash == NULL)
+		return;
+
+	close(handoff_fds[0]);
+	handoff_fds[0] = -1;
+
+	for (i = 0; i < pool_config->num_init_children; i++)
+	{
+		if (i == id && stash[i].data)
+		{
+			n = install_pools(&stash[i]);
+			if (n > 0)
+				pool_debug("pool_handoff_adopt: adopted %d connection pools", n);
+		}
+		pool_handoff_forget(i);
+	}
+
+	free(stash);
+	stash = NULL;
+}
+
+/*
+ * Returns non 0 if the connection pool can be passed to another
+ * process: it is released, idle, and has no data buffered or SSL
+ * state in this process.
+ */
+static int handoff_pool_ok(POOL_CONNECTION_POOL *p)
+{
+	POOL_CONNECTION *con;
+	int i;
+
+	if (!MASTER_CONNECTION(p) || !MASTER_CONNECTION(p)->sp ||
+		MASTER_CONNECTION(p)->sp->user == NULL)
+		return 0;
+
+	/* in use */
+	if (MASTER_CONNECTION(p)->closetime == 0)
+		return 0;
+
+	if (MAJOR(p) == PROTO_MAJOR_V3 && TSTATE(p) != 'I')
+		return 0;
+
+	for (i=0;i<NUM_BACKENDS;i++)
+	{
+		if (!VALID_BACKEND(i))
+			continue;
+
+		if (CONNECTION_SLOT(p, i) == NULL)
+			return 0;
+
+		con = CONNECTION(p, i);
+		if (con->ssl_active > 0 || con->len > 0 || con->wbufpo > 0)
+			return 0;
+	}
+	return 1;
+}
+
+/*
+ * Serialize a connection pool. Returns -1 if the buffer is full.
+ */
+static int put_pool(HandoffBuf *b, POOL_CONNECTION_POOL *p)
+{
+	POOL_CONNECTION_POOL_SLOT *s;
+	StartupPacket *sp = MASTER_CONNECTION(p)->sp;
+	char *name, *value;
+	int i, j;
+
+	if (put(b, &sp->major, sizeof(sp->major)) ||
+		put(b, &sp->minor, sizeof(sp->minor)) ||
+		put_string(b, sp->user) ||
+		put_string(b, sp->database) ||
+		put(b, &sp->len, sizeof(sp->len)) ||
+		put(b, sp->startup_packet, sp->len) ||
+		put(b, &MASTER_CONNECTION(p)->closetime, sizeof(time_t)) ||
+		put(b, &p->info->create_time, sizeof(time_t)) ||
+		put(b, &p->info->counter, sizeof(int)) ||
+		put(b, &p->info->load_balancing_node, sizeof(int)))
+		return -1;
+
+	for (i=0;i<NUM_BACKENDS;i++)
+	{
+		if (!VALID_BACKEND(i))
+			continue;
+
+		s = CONNECTION_SLOT(p, i);
+		if (put(b, &s->pid, sizeof(s->pid)) ||
+			put(b, &s->key, sizeof(s->key)) ||
+			put(b, &s->con->tstate, sizeof(char)) ||
+			put(b, &s->con->auth_kind, sizeof(int)) ||
+			put(b, &s->con->pwd_size, sizeof(int)) ||
+			put(b, s->con->password, s->con->pwd_size) ||
+			put(b, s->con->salt, sizeof(s->con->salt)) ||
+			put(b, &s->con->params.num, sizeof(int)))
+			return -1;
+
+		for (j=0;j<s->con->params.num;j++)
+		{
+			pool_get_param(&s->con->params, j, &name, &value);
+			if (put_string(b, name) || put_string(b, value))
+				return -1;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Put all connection pools in a message into the connection pool of
+ * this process. Returns number of connection pools adopted.
+ */
+static int install_pools(HandoffStash *s)
+{
+	HandoffBuf b;
+	int id;
+	int num_backends;
+	int npools;
+	int fdpos = 0;
+	char valid;
+	int i;
+
+	b.buf = s->data;
+	b.len = s->len;
+	b.pos = 0;
+
+	if (get(&b, &id, sizeof(id)) || get(&b, &num_backends, sizeof(num_backends)))
+		return 0;
+
+	/* connections are usable only if nodes have not changed */
+	if (num_backends != NUM_BACKENDS)
+		return 0;
+	for (i=0;i<num_backends;i++)
+	{
+		if (get(&b, &valid, sizeof(valid)) || valid != (VALID_BACKEND(i) ? 1 : 0))
+		{
+			pool_log("pool_handoff_adopt: backend nodes have changed. discard passed connections");
+			return 0;
+		}
+	}
+
+	if (get(&b, &npools, sizeof(npools)))
+		return 0;
+
+	for (i=0;i<npools;i++)
+	{
+		if (install_pool(&b, s, &fdpos) < 0)
+			break;
+	}
+	return i;
+}
+
+/*
+ * Build a connection pool from a message and the descriptors starting
+ * at *fdpos, and release it to be used by clients.
+ * Returns 0 on success otherwise -1.
+ */
+static int install_pool(HandoffBuf *b, HandoffStash *s, int *fdpos)
+{
+	POOL_CONNECTION_POOL *p;
+	POOL_CONNECTION_POOL_SLOT *slots[MAX_NUM_BACKENDS];
+	POOL_CONNECTION_POOL_SLOT *slot;
+	StartupPacket *sp;
+	time_t closetime;
+	time_t create_time;
+	int counter;
+	int load_balancing_node;
+	int nparams;
+	char *name, *value;
+	int i, j;
+
+	p = pool_get_free_cp();
+	if (p == NULL)
+		return -1;
+
+	memset(slots, 0, sizeof(slots));
+
+	sp = calloc(sizeof(*sp), 1);
+	if (sp == NULL)
+	{
+		pool_error("pool_handoff_adopt: malloc failed");
+		return -1;
+	}
+
+	if (get(b, &sp->major, sizeof(sp->major)) ||
+		get(b, &sp->minor, sizeof(sp->minor)) ||
+		(name = get_string(b)) == NULL ||
+		(sp->user = strdup(name)) == NULL ||
+		(value = get_string(b)) == NULL ||
+		(sp->database = strdup(value)) == NULL ||
+		get(b, &sp->len, sizeof(sp->len)) ||
+		sp->len <= 0 || sp->len > MAX_STARTUP_PACKET_LENGTH ||
+		(sp->startup_packet = malloc(sp->len)) == NULL ||
+		get(b, sp->startup_packet, sp->len) ||
+		get(b, &closetime, sizeof(closetime)) ||
+		get(b, &create_time, sizeof(create_time)) ||
+		get(b, &counter, sizeof(counter)) ||
+		get(b, &load_balancing_node, sizeof(load_balancing_node)))
+		goto error;
+
+	for (i=0;i<NUM_BACKENDS;i++)
+	{
+		if (!VALID_BACKEND(i))
+			continue;
+
+		if (*fdpos >= s->nfds)
+			goto error;
+
+		slot = slots[i] = calloc(sizeof(POOL_CONNECTION_POOL_SLOT), 1);
+		if (slot == NULL)
+			goto error;
+
+		slot->con = pool_open(s->fds[*fdpos]);
+		if (slot->con == NULL)
+			goto error;
+		s->fds[(*fdpos)++] = -1;
+
+		slot->sp = sp;
+		slot->con->db_node_id = i;
+		slot->con->isbackend = 1;
+
+		if (get(b, &slot->pid, sizeof(slot->pid)) ||
+			get(b, &slot->key, sizeof(slot->key)) ||
+			get(b, &slot->con->tstate, sizeof(char)) ||
+			get(b, &slot->con->auth_kind, sizeof(int)) ||
+			get(b, &slot->con->pwd_size, sizeof(int)) ||
+			slot->con->pwd_size < 0 || slot->con->pwd_size > MAX_PASSWORD_SIZE ||
+			get(b, slot->con->password, slot->con->pwd_size) ||
+			get(b, slot->con->salt, sizeof(slot->con->salt)) ||
+			get(b, &nparams, sizeof(nparams)) ||
+			pool_init_params(&slot->con->params))
+			goto error;
+
+		for (j=0;j<nparams;j++)
+		{
+			if ((name = get_string(b)) == NULL || (value = get_string(b)) == NULL ||
+				pool_add_param(&slot->con->params, name, value))
+				goto error;
+		}
+	}
+
+	for (i=0;i<NUM_BACKENDS;i++)
+	{
+		p->slots[i] = slots[i];
+		if (slots[i])
+		{
+			p->info[i].pid = slots[i]->pid;
+			p->info[i].key = slots[i]->key;
+		}
+	}
+	p->info->major = sp->major;
+	p->info->minor = sp->minor;
+	strncpy(p->info->database, sp->database, sizeof(p->info->database) - 1);
+	strncpy(p->info->user, sp->user, sizeof(p->info->user) - 1);
+	p->info->counter = counter;
+	p->info->create_time = create_time;
+	p->info->load_balancing_node = load_balancing_node;
+
+	/* release it, keeping the time it was released by the previous child */
+	pool_connection_pool_timer(p);
+	MASTER_CONNECTION(p)->closetime = closetime;
+
+	return 0;
+
+error:
+	pool_error("pool_handoff_adopt: invalid connection pool data");
+	for (i=0;i<NUM_BACKENDS;i++)
+	{
+		if (slots[i])
+		{
+			if (slots[i]->con)
+				pool_close(slots[i]->con);
+			free(slots[i]);
+		}
+	}
+	pool_free_startup_packet(sp);
+	return -1;
+}
+
+/*
+ * Append data to a message. Returns -1 if it does not fit.
+ */
+static int put(HandoffBuf *b, void *data, int len)
+{
+	if (len < 0 || b->len + len > HANDOFF_MAX_MESSAGE)
+		return -1;
+
+	memcpy(b->buf + b->len, data, len);
+	b->len += len;
+	return 0;
+}
+
+static int put_string(HandoffBuf *b, char *str)
+{
+	return put(b, str, strlen(str) + 1);
+}
+
+/*
+ * Read data from a message. Returns -1 if the message is too short.
+ */
+static int get(HandoffBuf *b, void *data, int len)
+{
+	if (len < 0 || b->pos + len > b->len)
+		return -1;
+
+	memcpy(data, b->buf + b->pos, len);
+	b->pos += len;
+	return 0;
+}
+
+/*
+ * Read a null terminated string from a message. Returns a pointer
+ * into the message, or NULL if the message is too short.
+ */
+static char *get_string(HandoffBuf *b)
+{
+	char *str = b->buf + b->pos;
+	char *p;
+
+	p = memchr(str, '\0', b->len - b->pos);
+	if (p == NULL)
+		return NULL;
+
+	b->pos = p - b->buf + 1;
+	return str;
+}
@@ -46,7 +46,7 @@ static char *hbaFileName;
 static POOL_MEMORY_POOL *hba_memory_context = NULL;
 
 static void sendAuthRequest(POOL_CONNECTION *frontend, AuthRequest areq);
-static void auth_failed(POOL_CONNECTION *frontend);
+static int auth_failed(POOL_CONNECTION *frontend);
 static void close_all_backend_connections(void);
 static bool hba_getauthmethod(POOL_CONNECTION *frontend);
 static bool check_hba(POOL_CONNECTION *frontend);
@@ -138,9 +138,13 @@ void load_hba(char *hbapath)
 
 
 /*
- * do frontend <-> pgpool authentication based on pool_hba.conf
+ * do frontend <-> pgpool authentication based on pool_hba.conf.
+ * returns 0 if the frontend is authenticated. If not, an error
+ * message has been sent and this process exits unless it serves
+ * multiple sessions, in which case -1 is returned and the caller
+ * must close the frontend.
  */
-void ClientAuthentication(POOL_CONNECTION *frontend)
+int ClientAuthentication(POOL_CONNECTION *frontend)
 {
 	POOL_STATUS status = POOL_ERROR;
 
@@ -150,6 +154,11 @@ void ClientAuthentication(POOL_CONNECTION *frontend)
 		pool_send_error_message(frontend, frontend->protoVersion, "XX000",
 								"missing or erroneous pool_hba.conf file", "",
 								"See pgpool log for details.", __FILE__, __LINE__);
+
+		/* other sessions of this process are not affected */
+		if (MULTIPLEXED_MODE)
+			return -1;
+
 		close_all_backend_connections();
 		/*
 		 * use exit(2) since this is not so fatal. other entries in
@@ -239,7 +248,9 @@ void ClientAuthentication(POOL_CONNECTION *frontend)
  	if (status == POOL_CONTINUE)
  		sendAuthRequest(frontend, AUTH_REQ_OK);
  	else if (status != POOL_CONTINUE)
-		auth_failed(frontend);
+		return auth_failed(frontend);
+
+	return 0;
 }
 
 
@@ -341,9 +352,10 @@ static char *recv_password_packet(POOL_CONNECTION *frontend)
 #endif /* USE_PAM */
 
 /*
- * Tell the user the authentication failed.
+ * Tell the user the authentication failed. Returns -1 if this process
+ * serves multiple sessions, otherwise exits.
  */
-static void auth_failed(POOL_CONNECTION *frontend)
+static int auth_failed(POOL_CONNECTION *frontend)
 {
 	bool send_error_to_frontend = true;
 	int messagelen;
@@ -413,11 +425,19 @@ static void auth_failed(POOL_CONNECTION *frontend)
 		pool_send_error_message(frontend, frontend->protoVersion, "XX000", errmessage,
 								"", "", __FILE__, __LINE__);
 
+	/* other sessions of this process are not affected */
+	if (MULTIPLEXED_MODE)
+	{
+		free(errmessage);
+		return -1;
+	}
+
 	/*
 	 * don't need to free(errmessage). I will just kill myself.
 	 */
 	close_all_backend_connections();
 	child_exit(2);
+	return -1;
 }
 
 
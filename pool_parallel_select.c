@@ -0,0 +1,2247 @@
+/* -*-pgsql-c-*- */
+/*
+ * $Header$
+ *
+ * pgpool: a language independent connection pool server for PostgreSQL
+ * written by Tatsuo Ishii
+ *
+ * Copyright (c) 2003-2010	PgPool Global Development Group
+ *
+ * Permission to use, copy, modify, and distribute this software and
+ * its documentation for any purpose and without fee is hereby
+ * granted, provided that the above copyright notice appear in all
+ * copies and that both that copyright notice and this permission
+ * notice appear in supporting documentation, and that the name of the
+ * author not be used in advertising or publicity pertaining to
+ * distribution of the software without specific, written prior
+ * permission. The author makes no representations about the
+ * suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * pool_parallel_select.c: SELECT on a distributed table executed by
+ * pgpool itself in parallel mode.
+ *
+ * Usually such a query is rewritten into a dblink() query and executed
+ * on SystemDB, which then fetches all rows from all nodes. For a query
+ * on a single distributed table, the query is instead rewritten into a
+ * fragment which is sent to every node over the connections of the
+ * client, and the results are put together here:
+ *
+ *  - Without aggregates, the rows are merged in the order of ORDER BY
+ *    as they come, which each node has already sorted. LIMIT n OFFSET
+ *    m is sent to the nodes as LIMIT n + m.
+ *
+ *  - With GROUP BY or aggregates count, sum, min, max and avg, each
+ *    node computes partial aggregates for its groups, which are
+ *    combined in a hash table. avg(x) is computed from sum(x) and
+ *    count(x). ORDER BY, OFFSET and LIMIT are applied afterwards.
+ *
+ * Values are compared as numbers if they are integers, numeric or
+ * floats, and as byte strings if they are booleans or character
+ * strings. Character strings are sorted here only if lc_collate of the
+ * master node is C, otherwise the order would differ from PostgreSQL's.
+ *
+ * Queries which cannot be handled this way are left to the dblink
+ * rewriter.
+ */
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+#include <netinet/in.h>
+
+#include "pool.h"
+#include "pool_timestamp.h"
+#include "parser/value.h"
+
+/* type classes of values. they decide how values are compared */
+#define PS_CLASS_UNKNOWN	0
+#define PS_CLASS_NUMERIC	1	/* integers and numeric */
+#define PS_CLASS_FLOAT		2	/* float4 and float8 */
+#define PS_CLASS_BOOL		3
+#define PS_CLASS_TEXT		4	/* character strings */
+
+/* type oids used in RowDescription */
+#define PS_FLOAT4OID	700
+#define PS_FLOAT8OID	701
+#define PS_NUMERICOID	1700
+
+/* for avg of numeric values. see select_div_scale() of PostgreSQL */
+#define PS_NUMERIC_MIN_SIG_DIGITS	16
+#define PS_NUMERIC_MAX_DISPLAY_SCALE	1000
+#define PS_DEC_DIGITS	4
+
+#define PS_INITIAL_BUCKETS	1024
+
+/* how a column of the fragment is combined */
+typedef enum {
+	PS_PLAIN = 0,		/* not combined. the first value is used */
+	PS_GROUP,			/* GROUP BY key */
+	PS_COUNT,
+	PS_SUM,
+	PS_MIN,
+	PS_MAX,
+	PS_AVG				/* sum. count is in count_col */
+} PSColumnKind;
+
+typedef struct {
+	PSColumnKind kind;
+	int class;			/* type class of the value */
+	int count_col;		/* PS_AVG: column of the count */
+} PSColumn;
+
+typedef struct {
+	int col;			/* column number, or the number of the hidden
+						 * column if hidden is true */
+	int hidden;			/* column is not sent to the frontend */
+	int desc;			/* descending order */
+	int nulls_first;
+	int class;
+} PSSortKey;
+
+typedef struct {
+	int aggregate;		/* partial results are combined */
+	int ntargets;		/* number of targets of the original query */
+	int ncols;			/* number of columns of the fragment. only
+						 * known if aggregate is true */
+	int nhidden;		/* number of columns added to the fragment */
+	List *hidden;		/* targets of the columns added */
+	PSColumn *cols;
+	int nkeys;
+	PSSortKey *keys;
+	long offset;
+	long limit;			/* -1 if none */
+} PSPlan;
+
+/* value of a column in a group */
+typedef struct {
+	char *value;		/* text representation. NULL if null */
+	double fvalue;		/* sum of floats */
+} PSValue;
+
+typedef struct PSGroup {
+	struct PSGroup *next;	/* next in the bucket */
+	unsigned int hash;
+	int seq;				/* order of creation */
+	PSValue values[1];		/* ncols values */
+} PSGroup;
+
+/* result of a node */
+typedef struct {
+	int done;			/* CommandComplete or ErrorResponse received */
+	char *row;			/* body of the current DataRow, in the buffer
+						 * of the connection */
+	int *offsets;		/* offsets of columns in row */
+	int *lens;			/* lengths of columns. -1 if null */
+} PSNode;
+
+/* state of the query being executed */
+typedef struct {
+	PSPlan *plan;
+	POOL_CONNECTION *frontend;
+	POOL_CONNECTION_POOL *backend;
+	int ncols;			/* number of columns in RowDescription */
+	int nvisible;		/* number of columns sent to the frontend */
+	int *typoids;		/* types of columns */
+	PSNode nodes[MAX_NUM_BACKENDS];
+	char *error;		/* first ErrorResponse */
+	int errorlen;
+	int failed;			/* communication error */
+	PSGroup **buckets;
+	int nbuckets;
+	int ngroups;
+	PSGroup **groups;	/* groups in the order of creation */
+	int groups_size;
+} PSState;
+
+/* numeric value in text representation */
+typedef struct {
+	int nan;
+	int negative;
+	const char *ip;		/* integer digits without leading zeros */
+	int ilen;
+	const char *fp;		/* fraction digits */
+	int flen;
+} PSNumeric;
+
+static POOL_RELCACHE *collate_cache;
+static PSState *sort_state;		/* for sort_groups() */
+
+static int plan_select(SelectStmt *stmt, POOL_CONNECTION_POOL *backend, PSPlan *plan);
+static int add_hidden_target(PSPlan *plan, Node *expr);
+static int find_target(SelectStmt *stmt, PSPlan *plan, Node *expr, int order_by, DistDefInfo *info);
+static PSColumnKind aggregate_kind(Node *node, int *error);
+static bool aggregate_walker(Node *node, void *context);
+static bool unsafe_walker(Node *node, void *context);
+static int expr_class(Node *node, DistDefInfo *info);
+static int type_class(char *name);
+static int get_limit(Node *node, long *result);
+static int collate_is_c(POOL_CONNECTION_POOL *backend);
+
+static POOL_STATUS execute_select(PSState *state, char *query);
+static int read_message(PSState *state, int node, char *kind, char **body, int *len);
+static int fetch_row(PSState *state, int node);
+static void drain(PSState *state);
+static int send_row_description(PSState *state, char *body, int len);
+static int send_merged_rows(PSState *state);
+static int combine_rows(PSState *state);
+static int send_groups(PSState *state);
+static int combine_row(PSState *state, PSNode *n);
+static void grow_buckets(PSState *state);
+static void finish_group(PSState *state, PSGroup *group);
+static int sort_groups(const void *a, const void *b);
+static int compare_value(PSSortKey *key, const char *a, int alen, const char *b, int blen);
+static int compare_rows(PSState *state, PSNode *a, PSNode *b);
+static void free_state(PSState *state);
+
+static void parse_numeric(const char *s, int len, PSNumeric *n);
+static int numeric_canonical_length(const char *s, int len);
+static int compare_numeric(const char *a, int alen, const char *b, int blen);
+static int compare_float(const char *a, int alen, const char *b, int blen);
+static char *numeric_add(const char *a, const char *b);
+static char *numeric_div_count(const char *sum, const char *count);
+static char *float_out(double value, int float4);
+static void numeric_weight(PSNumeric *n, int *weight, int *firstdigit);
+static char *copy_value(const char *value, int len);
+
+static char *aggregate_names[] = {
+	"count", "sum", "min", "max", "avg", "every", "bool_and", "bool_or",
+	"bit_and", "bit_or", "array_agg", "string_agg", "xmlagg", "stddev",
+	"stddev_pop", "stddev_samp", "variance", "var_pop", "var_samp",
+	"corr", "covar_pop", "covar_samp", "regr_avgx", "regr_avgy",
+	"regr_count", "regr_intercept", "regr_r2", "regr_slope", "regr_sxx",
+	"regr_sxy", "regr_syy", NULL
+};
+
+/*
+ * Execute a SELECT on a distributed table without SystemDB if
+ * possible. Returns 0 if the query cannot be executed this way, in
+ * which case nothing has been sent. Otherwise returns 1 and stores
+ * the result in *status. As in pool_parallel_exec(), ReadyForQuery
+ * of the backends is left to the caller.
+ */
+int pool_parallel_select(POOL_CONNECTION *frontend, POOL_CONNECTION_POOL *backend,
+						 Node *node, POOL_STATUS *status)
+{
+	PSPlan plan;
+	PSState state;
+	char *query;
+
+	if (!IsA(node, SelectStmt) || MAJOR(backend) != PROTO_MAJOR_V3 ||
+		TSTATE(backend) == 'E')
+		return 0;
+
+	if (plan_select((SelectStmt *)node, backend, &plan) < 0)
+		return 0;
+
+	query = nodeToString(node);
+	if (query == NULL)
+		return 0;
+
+	pool_debug("pool_parallel_select: %s", query);
+
+	memset(&state, 0, sizeof(state));
+	state.plan = &plan;
+	state.frontend = frontend;
+	state.backend = backend;
+
+	*status = execute_select(&state, query);
+	free_state(&state);
+	return 1;
+}
+
+/*
+ * Check if the query can be executed by pgpool, and rewrite it into
+ * the fragment for the nodes. Returns 0 if it can, otherwise -1. The
+ * query is not modified in the latter case.
+ */
+static int plan_select(SelectStmt *stmt, POOL_CONNECTION_POOL *backend, PSPlan *plan)
+{
+	RangeVar *rel;
+	DistDefInfo *info;
+	ListCell *lc;
+	int has_star = 0;
+	int need_collate = 0;
+	int max_cols;
+	int i;
+	int error = 0;
+
+	if (stmt->op != SETOP_NONE || stmt->valuesLists || stmt->distinctClause ||
+		stmt->intoClause || stmt->havingClause || stmt->windowClause ||
+		stmt->withClause || stmt->lockingClause)
+		return -1;
+
+	if (list_length(stmt->fromClause) != 1 ||
+		!IsA(linitial(stmt->fromClause), RangeVar))
+		return -1;
+
+	rel = (RangeVar *) linitial(stmt->fromClause);
+	info = pool_get_dist_def_info(MASTER_CONNECTION(backend)->sp->database,
+								  rel->schemaname, rel->relname);
+	if (info == NULL || (rel->alias && rel->alias->colnames))
+		return -1;
+
+	/* the fragment must not refer to other tables */
+	if (raw_expression_tree_walker((Node *) stmt->targetList, unsafe_walker, NULL) ||
+		raw_expression_tree_walker(stmt->whereClause, unsafe_walker, NULL) ||
+		raw_expression_tree_walker((Node *) stmt->groupClause, unsafe_walker, NULL) ||
+		raw_expression_tree_walker((Node *) stmt->sortClause, unsafe_walker, NULL))
+		return -1;
+
+	memset(plan, 0, sizeof(*plan));
+	plan->ntargets = list_length(stmt->targetList);
+
+	if (get_limit(stmt->limitOffset, &plan->offset) < 0 ||
+		get_limit(stmt->limitCount, &plan->limit) < 0)
+		return -1;
+	if (plan->offset < 0)
+		plan->offset = 0;
+
+	max_cols = plan->ntargets * 2 + list_length(stmt->groupClause) +
+		list_length(stmt->sortClause) * 2;
+	plan->cols = palloc0(sizeof(PSColumn) * max_cols);
+	plan->keys = palloc0(sizeof(PSSortKey) * (list_length(stmt->sortClause) + 1));
+
+	i = 0;
+	foreach (lc, stmt->targetList)
+	{
+		ResTarget *target = (ResTarget *) lfirst(lc);
+
+		if (!IsA(target, ResTarget) || target->indirection != NIL)
+			return -1;
+
+		if (IsA(target->val, ColumnRef) &&
+			IsA(llast(((ColumnRef *) target->val)->fields), A_Star))
+			has_star = 1;
+
+		plan->cols[i].kind = aggregate_kind(target->val, &error);
+		if (error)
+			return -1;
+
+		if (plan->cols[i].kind == PS_PLAIN)
+		{
+			if (raw_expression_tree_walker(target->val, aggregate_walker, NULL))
+				return -1;
+			plan->cols[i].class = expr_class(target->val, info);
+		}
+		else
+		{
+			plan->aggregate = 1;
+			plan->cols[i].class = expr_class(target->val, info);
+			if (plan->cols[i].class == PS_CLASS_UNKNOWN)
+				return -1;
+		}
+		i++;
+	}
+
+	if (raw_expression_tree_walker(stmt->whereClause, aggregate_walker, NULL) ||
+		raw_expression_tree_walker((Node *) stmt->groupClause, aggregate_walker, NULL))
+		return -1;
+
+	if (stmt->groupClause)
+		plan->aggregate = 1;
+
+	plan->ncols = plan->ntargets;
+
+	if (plan->aggregate)
+	{
+		if (has_star)
+			return -1;
+
+		/* every GROUP BY key must be a column of the fragment */
+		foreach (lc, stmt->groupClause)
+		{
+			Node *item = lfirst(lc);
+
+			i = find_target(stmt, plan, item, 0, info);
+			if (i < 0)
+			{
+				if (IsA(item, A_Const))
+					return -1;
+				i = add_hidden_target(plan, item);
+				plan->cols[i].class = expr_class(item, info);
+			}
+			else if (plan->cols[i].kind != PS_PLAIN && plan->cols[i].kind != PS_GROUP)
+				return -1;
+			plan->cols[i].kind = PS_GROUP;
+		}
+	}
+
+	/* ORDER BY */
+	foreach (lc, stmt->sortClause)
+	{
+		SortBy *sortby = (SortBy *) lfirst(lc);
+		PSSortKey *key = &plan->keys[plan->nkeys++];
+
+		if (!IsA(sortby, SortBy) || sortby->sortby_dir == SORTBY_USING)
+			return -1;
+
+		key->desc = (sortby->sortby_dir == SORTBY_DESC);
+		if (sortby->sortby_nulls == SORTBY_NULLS_FIRST)
+			key->nulls_first = 1;
+		else if (sortby->sortby_nulls == SORTBY_NULLS_LAST)
+			key->nulls_first = 0;
+		else
+			key->nulls_first = key->desc;
+
+		if (!plan->aggregate &&
+			raw_expression_tree_walker(sortby->node, aggregate_walker, NULL))
+			return -1;
+
+		i = find_target(stmt, plan, sortby->node, 1, info);
+
+		/*
+		 * Columns sent to the frontend are unknown if there is "*". Sort
+		 * on a hidden column, unless it refers to an output column.
+		 */
+		if (has_star && i >= 0)
+		{
+			if (IsA(sortby->node, A_Const) || IsA(sortby->node, ColumnRef))
+				return -1;
+			i = -1;
+		}
+
+		if (i < 0)
+		{
+			if (IsA(sortby->node, A_Const))
+				return -1;
+
+			if (plan->aggregate)
+			{
+				i = add_hidden_target(plan, sortby->node);
+				plan->cols[i].kind = aggregate_kind(sortby->node, &error);
+				if (error)
+					return -1;
+				if (plan->cols[i].kind == PS_PLAIN &&
+					raw_expression_tree_walker(sortby->node, aggregate_walker, NULL))
+					return -1;
+			}
+			else
+				i = add_hidden_target(plan, sortby->node);
+			plan->cols[i].class = expr_class(sortby->node, info);
+		}
+
+		key->class = plan->cols[i].class;
+		if (key->class == PS_CLASS_UNKNOWN)
+			return -1;
+		if (key->class == PS_CLASS_TEXT)
+			need_collate = 1;
+
+		if (i >= plan->ntargets && !plan->aggregate)
+		{
+			key->hidden = 1;
+			key->col = i - plan->ntargets;
+		}
+		else
+			key->col = i;
+	}
+
+	for (i = 0; i < plan->ncols; i++)
+	{
+		if ((plan->cols[i].kind == PS_MIN || plan->cols[i].kind == PS_MAX) &&
+			plan->cols[i].class == PS_CLASS_TEXT)
+			need_collate = 1;
+	}
+
+	if (need_collate && !collate_is_c(backend))
+		return -1;
+
+	/*
+	 * Now the query can be executed. Rewrite it into the fragment.
+	 */
+	if (plan->aggregate)
+	{
+		int ncols = plan->ncols;
+
+		for (i = 0; i < ncols; i++)
+		{
+			ResTarget *target;
+			FuncCall *func;
+			FuncCall *count;
+			Node *arg;
+
+			if (plan->cols[i].kind != PS_AVG)
+				continue;
+
+			/* avg(x) is computed from sum(x) and count(x) */
+			if (i < plan->ntargets)
+				target = (ResTarget *) list_nth(stmt->targetList, i);
+			else
+				target = (ResTarget *) list_nth(plan->hidden, i - plan->ntargets);
+			func = (FuncCall *) target->val;
+			arg = linitial(func->args);
+
+			count = makeNode(FuncCall);
+			count->funcname = list_make1(makeString("count"));
+			count->args = list_make1(arg);
+			count->location = -1;
+			plan->cols[i].count_col = add_hidden_target(plan, (Node *) count);
+			plan->cols[plan->cols[i].count_col].kind = PS_COUNT;
+			plan->cols[plan->cols[i].count_col].class = PS_CLASS_NUMERIC;
+
+			if (plan->cols[i].class == PS_CLASS_FLOAT)
+			{
+				FuncCall *cast = makeNode(FuncCall);
+
+				cast->funcname = list_make1(makeString("float8"));
+				cast->args = list_make1(arg);
+				cast->location = -1;
+				arg = (Node *) cast;
+			}
+
+			func = makeNode(FuncCall);
+			func->funcname = list_make1(makeString("sum"));
+			func->args = list_make1(arg);
+			func->location = -1;
+			target->val = (Node *) func;
+			if (target->name == NULL)
+				target->name = "avg";
+		}
+
+		stmt->sortClause = NIL;
+		stmt->limitOffset = NULL;
+		stmt->limitCount = NULL;
+	}
+	else
+	{
+		stmt->limitOffset = NULL;
+		if (plan->limit >= 0)
+		{
+			A_Const *limit = makeNode(A_Const);
+
+			limit->val.type = T_Integer;
+			limit->val.val.ival = plan->limit + plan->offset;
+			limit->location = -1;
+
+			/* too large to push down */
+			if (plan->limit + plan->offset <= 0x7fffffff)
+				stmt->limitCount = (Node *) limit;
+			else
+				stmt->limitCount = NULL;
+		}
+	}
+
+	foreach (lc, plan->hidden)
+		stmt->targetList = lappend(stmt->targetList, lfirst(lc));
+
+	return 0;
+}
+
+/*
+ * Add expr as a column which is not sent to the frontend. It is
+ * appended to the target list when the query is rewritten. Returns the
+ * column number.
+ */
+static int add_hidden_target(PSPlan *plan, Node *expr)
+{
+	ResTarget *target = makeNode(ResTarget);
+
+	target->val = expr;
+	target->location = -1;
+	plan->hidden = lappend(plan->hidden, target);
+
+	plan->nhidden++;
+	return plan->ncols++;
+}
+
+/*
+ * Find the column of the fragment for a GROUP BY or ORDER BY item.
+ * As PostgreSQL does, a number refers to the position in the target
+ * list, and a simple name refers to an output column name in ORDER BY
+ * and to an input column in GROUP BY. Returns the column number or -1.
+ */
+static int find_target(SelectStmt *stmt, PSPlan *plan, Node *expr, int order_by, DistDefInfo *info)
+{
+	ListCell *lc;
+	char *str;
+	int i;
+
+	if (IsA(expr, A_Const))
+	{
+		A_Const *c = (A_Const *) expr;
+
+		if (c->val.type == T_Integer && c->val.val.ival >= 1 &&
+			c->val.val.ival <= plan->ntargets)
+			return c->val.val.ival - 1;
+		return -1;
+	}
+
+	if (IsA(expr, ColumnRef) && list_length(((ColumnRef *) expr)->fields) == 1 &&
+		IsA(linitial(((ColumnRef *) expr)->fields), String))
+	{
+		char *name = strVal(linitial(((ColumnRef *) expr)->fields));
+		int is_column = 0;
+
+		for (i = 0; i < info->col_num; i++)
+		{
+			if (strcmp(info->col_list[i], name) == 0)
+				is_column = 1;
+		}
+
+		if (order_by || !is_column)
+		{
+			i = 0;
+			foreach (lc, stmt->targetList)
+			{
+				ResTarget *target = (ResTarget *) lfirst(lc);
+
+				if (i >= plan->ntargets)
+					break;
+				if (target->name && strcmp(target->name, name) == 0)
+					return i;
+				i++;
+			}
+		}
+	}
+
+	str = nodeToString(expr);
+	i = 0;
+	foreach (lc, stmt->targetList)
+	{
+		ResTarget *target = (ResTarget *) lfirst(lc);
+
+		if (strcmp(nodeToString(target->val), str) == 0)
+			return i;
+		i++;
+	}
+	foreach (lc, plan->hidden)
+	{
+		ResTarget *target = (ResTarget *) lfirst(lc);
+
+		if (strcmp(nodeToString(target->val), str) == 0)
+			return i;
+		i++;
+	}
+	return -1;
+}
+
+/*
+ * Returns how an expression in the target list is combined. error is
+ * set if it is an aggregate which cannot be combined.
+ */
+static PSColumnKind aggregate_kind(Node *node, int *error)
+{
+	static struct {
+		char *name;
+		PSColumnKind kind;
+	} aggregates[] = {
+		{"count", PS_COUNT}, {"sum", PS_SUM}, {"min", PS_MIN},
+		{"max", PS_MAX}, {"avg", PS_AVG}, {NULL, PS_PLAIN}
+	};
+	FuncCall *func;
+	char *name;
+	int i;
+
+	if (!IsA(node, FuncCall))
+		return PS_PLAIN;
+
+	func = (FuncCall *) node;
+	if (list_length(func->funcname) == 2 &&
+		strcmp(strVal(linitial(func->funcname)), "pg_catalog") == 0)
+		name = strVal(lsecond(func->funcname));
+	else if (list_length(func->funcname) == 1)
+		name = strVal(linitial(func->funcname));
+	else
+		return PS_PLAIN;
+
+	for (i = 0; aggregates[i].name; i++)
+	{
+		if (strcmp(aggregates[i].name, name) == 0)
+			break;
+	}
+
+	if (aggregates[i].name == NULL)
+	{
+		/* aggregates other than above cannot be combined */
+		if (aggregate_walker(node, NULL))
+			*error = 1;
+		return PS_PLAIN;
+	}
+
+	if (func->agg_distinct || func->func_variadic || func->over)
+		*error = 1;
+	else if (func->agg_star)
+	{
+		if (aggregates[i].kind != PS_COUNT)
+			*error = 1;
+	}
+	else if (list_length(func->args) != 1 ||
+			 raw_expression_tree_walker(linitial(func->args), aggregate_walker, NULL))
+		*error = 1;
+
+	return aggregates[i].kind;
+}
+
+/*
+ * Walker to find aggregate functions
+ */
+static bool aggregate_walker(Node *node, void *context)
+{
+	if (node == NULL)
+		return false;
+
+	if (IsA(node, FuncCall))
+	{
+		FuncCall *func = (FuncCall *) node;
+		char *name = strVal(llast(func->funcname));
+		int i;
+
+		if (func->agg_star || func->agg_distinct)
+			return true;
+
+		for (i = 0; aggregate_names[i]; i++)
+		{
+			if (strcmp(aggregate_names[i], name) == 0)
+				return true;
+		}
+	}
+
+	return raw_expression_tree_walker(node, aggregate_walker, context);
+}
+
+/*
+ * Walker to find expressions which cannot be evaluated by each node
+ * separately: sub queries and window functions.
+ */
+static bool unsafe_walker(Node *node, void *context)
+{
+	if (node == NULL)
+		return false;
+
+	if (IsA(node, SubLink) || IsA(node, RangeSubselect) || IsA(node, SelectStmt))
+		return true;
+
+	if (IsA(node, FuncCall) && ((FuncCall *) node)->over)
+		return true;
+
+	return raw_expression_tree_walker(node, unsafe_walker, context);
+}
+
+/*
+ * Returns the type class of an expression, which is known only for
+ * columns of the table, casts, numeric constants and aggregates of
+ * them.
+ */
+static int expr_class(Node *node, DistDefInfo *info)
+{
+	if (IsA(node, ColumnRef))
+	{
+		Node *field = llast(((ColumnRef *) node)->fields);
+		int i;
+
+		if (!IsA(field, String))
+			return PS_CLASS_UNKNOWN;
+
+		for (i = 0; i < info->col_num; i++)
+		{
+			if (strcmp(info->col_list[i], strVal(field)) == 0)
+				return type_class(info->type_list[i]);
+		}
+		return PS_CLASS_UNKNOWN;
+	}
+	else if (IsA(node, TypeCast))
+	{
+		TypeName *typename = ((TypeCast *) node)->typename;
+
+		if (typename->names == NIL || typename->arrayBounds != NIL)
+			return PS_CLASS_UNKNOWN;
+		return type_class(strVal(llast(typename->names)));
+	}
+	else if (IsA(node, A_Const))
+	{
+		A_Const *c = (A_Const *) node;
+
+		if (c->val.type == T_Integer || c->val.type == T_Float)
+			return PS_CLASS_NUMERIC;
+		return PS_CLASS_UNKNOWN;
+	}
+	else if (IsA(node, FuncCall))
+	{
+		int error = 0;
+		int class;
+		PSColumnKind kind = aggregate_kind(node, &error);
+
+		if (error)
+			return PS_CLASS_UNKNOWN;
+
+		switch (kind)
+		{
+			case PS_COUNT:
+				return PS_CLASS_NUMERIC;
+
+			case PS_SUM:
+			case PS_AVG:
+				class = expr_class(linitial(((FuncCall *) node)->args), info);
+				if (class == PS_CLASS_NUMERIC || class == PS_CLASS_FLOAT)
+					return class;
+				return PS_CLASS_UNKNOWN;
+
+			case PS_MIN:
+			case PS_MAX:
+				return expr_class(linitial(((FuncCall *) node)->args), info);
+
+			default:
+				return PS_CLASS_UNKNOWN;
+		}
+	}
+
+	return PS_CLASS_UNKNOWN;
+}
+
+/*
+ * Returns the type class of a type name
+ */
+static int type_class(char *name)
+{
+	static struct {
+		char *name;
+		int class;
+	} types[] = {
+		{"int2", PS_CLASS_NUMERIC}, {"int4", PS_CLASS_NUMERIC},
+		{"int8", PS_CLASS_NUMERIC}, {"smallint", PS_CLASS_NUMERIC},
+		{"integer", PS_CLASS_NUMERIC}, {"int", PS_CLASS_NUMERIC},
+		{"bigint", PS_CLASS_NUMERIC}, {"serial", PS_CLASS_NUMERIC},
+		{"bigserial", PS_CLASS_NUMERIC}, {"numeric", PS_CLASS_NUMERIC},
+		{"decimal", PS_CLASS_NUMERIC}, {"oid", PS_CLASS_NUMERIC},
+		{"float4", PS_CLASS_FLOAT}, {"float8", PS_CLASS_FLOAT},
+		{"real", PS_CLASS_FLOAT}, {"double precision", PS_CLASS_FLOAT},
+		{"float", PS_CLASS_FLOAT},
+		{"bool", PS_CLASS_BOOL}, {"boolean", PS_CLASS_BOOL},
+		{"text", PS_CLASS_TEXT}, {"varchar", PS_CLASS_TEXT},
+		{"character varying", PS_CLASS_TEXT}, {"bpchar", PS_CLASS_TEXT},
+		{"char", PS_CLASS_TEXT}, {"character", PS_CLASS_TEXT},
+		{"name", PS_CLASS_TEXT},
+		{NULL, PS_CLASS_UNKNOWN}
+	};
+	int len;
+	int i;
+
+	while (*name == ' ')
+		name++;
+
+	/* ignore type modifiers such as varchar(10) */
+	for (len = 0; name[len] && name[len] != '(' && name[len] != '['; len++)
+		;
+	while (len > 0 && name[len - 1] == ' ')
+		len--;
+	if (name[len] == '[')
+		return PS_CLASS_UNKNOWN;
+
+	for (i = 0; types[i].name; i++)
+	{
+		if (strlen(types[i].name) == len && strncasecmp(types[i].name, name, len) == 0)
+			return types[i].class;
+	}
+	return PS_CLASS_UNKNOWN;
+}
+
+/*
+ * Get the value of LIMIT or OFFSET. result is -1 if it is not
+ * specified. Returns -1 if it is not a constant.
+ */
+static int get_limit(Node *node, long *result)
+{
+	A_Const *c;
+
+	*result = -1;
+	if (node == NULL)
+		return 0;
+
+	if (!IsA(node, A_Const))
+		return -1;
+
+	c = (A_Const *) node;
+	if (c->val.type == T_Null)		/* LIMIT ALL */
+		return 0;
+	if (c->val.type != T_Integer || c->val.val.ival < 0)
+		return -1;
+
+	*result = c->val.val.ival;
+	return 0;
+}
+
+/*
+ * Returns true if lc_collate of the master node is C, i.e. character
+ * strings are ordered by bytes.
+ */
+static int collate_is_c(POOL_CONNECTION_POOL *backend)
+{
+	if (collate_cache == NULL)
+	{
+		collate_cache = pool_create_relcache(1,
+											 "SELECT count(*) FROM pg_settings WHERE name = 'lc_collate' AND setting IN ('C', 'POSIX')",
+											 int_register_func, int_unregister_func,
+											 false);
+		if (collate_cache == NULL)
+		{
+			pool_error("collate_is_c: pool_create_relcache error");
+			return 0;
+		}
+	}
+
+	return pool_search_relcache(collate_cache, backend, "pg_settings") != NULL;
+}
+
+/*
+ * Send the fragment to all nodes and put together the results
+ */
+static POOL_STATUS execute_select(PSState *state, char *query)
+{
+	POOL_CONNECTION_POOL *backend = state->backend;
+	POOL_CONNECTION *frontend = state->frontend;
+	char *body;
+	char *description = NULL;
+	int description_len = 0;
+	int len;
+	int rows;
+	char kind;
+	char tag[64];
+	int i;
+
+	len = strlen(query) + 1;
+
+	for (i = 0; i < NUM_BACKENDS; i++)
+	{
+		int sendlen = htonl(len + 4);
+
+		if (!VALID_BACKEND(i))
+			continue;
+
+		per_node_statement_log(backend, i, query);
+
+		pool_write(CONNECTION(backend, i), "Q", 1);
+		pool_write(CONNECTION(backend, i), &sendlen, sizeof(sendlen));
+		if (pool_write_and_flush(CONNECTION(backend, i), query, len) < 0)
+			return POOL_END;
+	}
+
+	/* wait for RowDescription of all nodes */
+	for (i = 0; i < NUM_BACKENDS; i++)
+	{
+		if (!VALID_BACKEND(i))
+			continue;
+
+		for (;;)
+		{
+			if (read_message(state, i, &kind, &body, &len) < 0)
+				return POOL_END;
+
+			if (kind == 'T')
+			{
+				if (description == NULL)
+				{
+					description = malloc(len);
+					if (description == NULL)
+					{
+						pool_error("pool_parallel_select: malloc failed");
+						return POOL_END;
+					}
+					memcpy(description, body, len);
+					description_len = len;
+				}
+				break;
+			}
+			if (kind == 'C' || kind == 'E')
+			{
+				state->nodes[i].done = 1;
+				break;
+			}
+			if (kind == 'D')
+			{
+				pool_error("pool_parallel_select: DataRow without RowDescription from node %d", i);
+				return POOL_END;
+			}
+		}
+	}
+
+	if (description && state->error == NULL)
+	{
+		if (send_row_description(state, description, description_len) < 0)
+		{
+			free(description);
+			drain(state);
+			if (state->failed)
+				return POOL_END;
+			pool_send_error_message(frontend, MAJOR(backend), "XX000",
+									"pgpool2 parallel select error",
+									"unexpected RowDescription from backend", "",
+									__FILE__, __LINE__);
+			return POOL_CONTINUE;
+		}
+	}
+	free(description);
+
+	if (state->error)
+		rows = 0;
+	else if (state->plan->aggregate)
+	{
+		if (combine_rows(state) < 0)
+		{
+			drain(state);
+			if (state->failed)
+				return POOL_END;
+			pool_send_error_message(frontend, MAJOR(backend), "XX000",
+									"pgpool2 parallel select error",
+									"failed to combine results", "",
+									__FILE__, __LINE__);
+			return POOL_CONTINUE;
+		}
+		rows = state->error ? 0 : send_groups(state);
+	}
+	else
+		rows = send_merged_rows(state);
+
+	drain(state);
+	if (state->failed || rows < 0)
+		return POOL_END;
+
+	if (state->error)
+	{
+		int sendlen = htonl(state->errorlen + 4);
+
+		pool_write(frontend, "E", 1);
+		pool_write(frontend, &sendlen, sizeof(sendlen));
+		pool_write(frontend, state->error, state->errorlen);
+	}
+	else
+	{
+		int sendlen;
+
+		snprintf(tag, sizeof(tag), "SELECT %d", rows);
+		sendlen = htonl(strlen(tag) + 1 + 4);
+		pool_write(frontend, "C", 1);
+		pool_write(frontend, &sendlen, sizeof(sendlen));
+		pool_write(frontend, tag, strlen(tag) + 1);
+	}
+
+	if (pool_flush(frontend) < 0)
+		return POOL_END;
+
+	return POOL_CONTINUE;
+}
+
+/*
+ * Read a message from a node. NoticeResponse and ParameterStatus are
+ * forwarded from the master node and discarded from others. The first
+ * ErrorResponse is saved in the state. Returns -1 on error.
+ */
+static int read_message(PSState *state, int node, char *kind, char **body, int *len)
+{
+	POOL_CONNECTION *cp = CONNECTION(state->backend, node);
+	int msglen;
+
+	for (;;)
+	{
+		if (pool_read(cp, kind, 1) < 0 || pool_read(cp, &msglen, sizeof(msglen)) < 0)
+		{
+			pool_error("pool_parallel_select: failed to read message from node %d", node);
+			state->failed = 1;
+			return -1;
+		}
+
+		msglen = ntohl(msglen) - 4;
+		if (msglen < 0)
+		{
+			pool_error("pool_parallel_select: invalid message length from node %d", node);
+			state->failed = 1;
+			return -1;
+		}
+
+		*body = NULL;
+		if (msglen > 0)
+		{
+			*body = pool_read2(cp, msglen);
+			if (*body == NULL)
+			{
+				pool_error("pool_parallel_select: failed to read message from node %d", node);
+				state->failed = 1;
+				return -1;
+			}
+		}
+		*len = msglen;
+
+		switch (*kind)
+		{
+			case 'N':
+			case 'S':
+			case 'A':
+				if (node == MASTER_NODE_ID)
+				{
+					int sendlen = htonl(msglen + 4);
+
+					pool_write(state->frontend, kind, 1);
+					pool_write(state->frontend, &sendlen, sizeof(sendlen));
+					pool_write(state->frontend, *body, msglen);
+				}
+				continue;
+
+			case 'E':
+				if (state->error == NULL)
+				{
+					state->error = malloc(msglen);
+					if (state->error == NULL)
+					{
+						pool_error("pool_parallel_select: malloc failed");
+						state->failed = 1;
+						return -1;
+					}
+					memcpy(state->error, *body, msglen);
+					state->errorlen = msglen;
+				}
+				return 0;
+
+			case 'T':
+			case 'D':
+			case 'C':
+				return 0;
+
+			default:
+				pool_error("pool_parallel_select: unexpected message kind %c from node %d", *kind, node);
+				state->failed = 1;
+				return -1;
+		}
+	}
+}
+
+/*
+ * Read the next row of a node into the state of the node. The node is
+ * marked done at CommandComplete or ErrorResponse. Returns -1 on
+ * error.
+ */
+static int fetch_row(PSState *state, int node)
+{
+	PSNode *n = &state->nodes[node];
+	char kind;
+	char *body;
+	int len;
+	short ncols;
+	int offset;
+	int i;
+
+	if (n->done)
+		return 0;
+
+	if (read_message(state, node, &kind, &body, &len) < 0)
+	{
+		n->done = 1;
+		return -1;
+	}
+
+	if (kind != 'D')
+	{
+		n->done = 1;
+		n->row = NULL;
+		return kind == 'T' ? -1 : 0;
+	}
+
+	/* rows are discarded until RowDescription is sent */
+	if (n->offsets == NULL)
+		return 0;
+
+	if (len < sizeof(ncols))
+		goto bad_row;
+	memcpy(&ncols, body, sizeof(ncols));
+	if (ntohs(ncols) != state->ncols)
+		goto bad_row;
+
+	offset = sizeof(ncols);
+	for (i = 0; i < state->ncols; i++)
+	{
+		int collen;
+
+		if (offset + sizeof(collen) > len)
+			goto bad_row;
+		memcpy(&collen, body + offset, sizeof(collen));
+		collen = ntohl(collen);
+		offset += sizeof(collen);
+		n->offsets[i] = offset;
+		n->lens[i] = collen;
+		if (collen > 0)
+		{
+			if (collen > len - offset)
+				goto bad_row;
+			offset += collen;
+		}
+	}
+	n->row = body;
+	return 0;
+
+ bad_row:
+	pool_error("pool_parallel_select: invalid DataRow from node %d", node);
+	state->failed = 1;
+	n->done = 1;
+	n->row = NULL;
+	return -1;
+}
+
+/*
+ * Read all remaining results of all nodes
+ */
+static void drain(PSState *state)
+{
+	int i;
+
+	for (i = 0; i < NUM_BACKENDS; i++)
+	{
+		if (!VALID_BACKEND(i))
+			continue;
+
+		while (!state->nodes[i].done && !state->failed)
+		{
+			if (fetch_row(state, i) < 0)
+				break;
+		}
+	}
+}
+
+/*
+ * Send RowDescription of the master node without hidden columns. The
+ * type of avg columns is changed from the type of sum to that of avg.
+ * Returns -1 if it does not match the plan.
+ */
+static int send_row_description(PSState *state, char *body, int len)
+{
+	PSPlan *plan = state->plan;
+	char *buf;
+	char *p;
+	char *p2;
+	short n;
+	int offset;
+	int sendlen;
+	int i;
+
+	if (len < sizeof(n))
+		return -1;
+	memcpy(&n, body, sizeof(n));
+	state->ncols = ntohs(n);
+	state->nvisible = state->ncols - plan->nhidden;
+	if (state->nvisible <= 0 ||
+		(plan->aggregate && state->ncols != plan->ncols))
+		return -1;
+
+	state->typoids = malloc(sizeof(int) * state->ncols);
+	buf = malloc(len);
+	for (i = 0; i < NUM_BACKENDS; i++)
+	{
+		state->nodes[i].offsets = malloc(sizeof(int) * state->ncols);
+		state->nodes[i].lens = malloc(sizeof(int) * state->ncols);
+		if (state->nodes[i].offsets == NULL || state->nodes[i].lens == NULL)
+			break;
+	}
+	if (state->typoids == NULL || buf == NULL || i < NUM_BACKENDS)
+	{
+		pool_error("pool_parallel_select: malloc failed");
+		free(buf);
+		return -1;
+	}
+
+	n = htons(state->nvisible);
+	memcpy(buf, &n, sizeof(n));
+	p = buf + sizeof(n);
+
+	/*
+	 * each field is name, table oid(4), column number(2), type oid(4),
+	 * type length(2), type modifier(4) and format(2)
+	 */
+	offset = sizeof(n);
+	for (i = 0; i < state->ncols; i++)
+	{
+		char *field = body + offset;
+		int fieldlen;
+		int oid;
+
+		p2 = memchr(field, '\0', len - offset);
+		if (p2 == NULL)
+		{
+			free(buf);
+			return -1;
+		}
+		fieldlen = p2 - field + 1 + 18;
+		if (offset + fieldlen > len)
+		{
+			free(buf);
+			return -1;
+		}
+
+		memcpy(&oid, field + fieldlen - 12, sizeof(oid));
+		state->typoids[i] = ntohl(oid);
+
+		if (i < state->nvisible)
+		{
+			memcpy(p, field, fieldlen);
+
+			if (plan->aggregate && plan->cols[i].kind == PS_AVG)
+			{
+				short typlen;
+				int typmod = htonl(-1);
+
+				if (plan->cols[i].class == PS_CLASS_FLOAT)
+				{
+					oid = htonl(PS_FLOAT8OID);
+					typlen = htons(8);
+				}
+				else
+				{
+					oid = htonl(PS_NUMERICOID);
+					typlen = htons(-1);
+				}
+				memcpy(p + fieldlen - 12, &oid, sizeof(oid));
+				memcpy(p + fieldlen - 8, &typlen, sizeof(typlen));
+				memcpy(p + fieldlen - 6, &typmod, sizeof(typmod));
+			}
+			p += fieldlen;
+		}
+		offset += fieldlen;
+	}
+
+	sendlen = htonl(p - buf + 4);
+	pool_write(state->frontend, "T", 1);
+	pool_write(state->frontend, &sendlen, sizeof(sendlen));
+	pool_write(state->frontend, buf, p - buf);
+	free(buf);
+
+	return 0;
+}
+
+/*
+ * Merge rows of nodes in the order of ORDER BY, which each node has
+ * sorted, and send them to the frontend. Returns the number of rows
+ * sent, or -1 on error.
+ */
+static int send_merged_rows(PSState *state)
+{
+	PSPlan *plan = state->plan;
+	long skipped = 0;
+	int rows = 0;
+	int i;
+
+	for (i = 0; i < NUM_BACKENDS; i++)
+	{
+		if (VALID_BACKEND(i) && fetch_row(state, i) < 0 && state->failed)
+			return -1;
+	}
+
+	while (state->error == NULL)
+	{
+		PSNode *n;
+		PSNode *best = NULL;
+		int best_node = -1;
+		int end;
+		int sendlen;
+		short ncols;
+
+		for (i = 0; i < NUM_BACKENDS; i++)
+		{
+			n = &state->nodes[i];
+			if (!VALID_BACKEND(i) || n->done)
+				continue;
+
+			if (best == NULL || compare_rows(state, n, best) < 0)
+			{
+				best = n;
+				best_node = i;
+			}
+
+			/* rows are not sorted. use a node until it ends */
+			if (plan->nkeys == 0)
+				break;
+		}
+
+		if (best == NULL)
+			break;
+
+		if (plan->limit >= 0 && rows >= plan->limit)
+			break;
+
+		if (skipped < plan->offset)
+			skipped++;
+		else
+		{
+			i = state->nvisible - 1;
+			end = best->offsets[i] + (best->lens[i] > 0 ? best->lens[i] : 0);
+
+			sendlen = htonl(end + 4);
+			ncols = htons(state->nvisible);
+			pool_write(state->frontend, "D", 1);
+			pool_write(state->frontend, &sendlen, sizeof(sendlen));
+			pool_write(state->frontend, &ncols, sizeof(ncols));
+			if (pool_write(state->frontend, best->row + sizeof(ncols), end - sizeof(ncols)) < 0)
+				return -1;
+			rows++;
+		}
+
+		if (fetch_row(state, best_node) < 0 && state->failed)
+			return -1;
+	}
+
+	return rows;
+}
+
+/*
+ * Compare the current rows of two nodes by the sort keys
+ */
+static int compare_rows(PSState *state, PSNode *a, PSNode *b)
+{
+	PSPlan *plan = state->plan;
+	int i;
+
+	for (i = 0; i < plan->nkeys; i++)
+	{
+		PSSortKey *key = &plan->keys[i];
+		int col = key->hidden ? state->nvisible + key->col : key->col;
+		int r;
+
+		r = compare_value(key, a->row + a->offsets[col], a->lens[col],
+						  b->row + b->offsets[col], b->lens[col]);
+		if (r)
+			return r;
+	}
+	return 0;
+}
+
+/*
+ * Read all rows of all nodes and combine them into groups. Returns -1
+ * on error.
+ */
+static int combine_rows(PSState *state)
+{
+	int i;
+
+	state->nbuckets = PS_INITIAL_BUCKETS;
+	state->buckets = calloc(state->nbuckets, sizeof(PSGroup *));
+	if (state->buckets == NULL)
+	{
+		pool_error("pool_parallel_select: malloc failed");
+		return -1;
+	}
+
+	for (i = 0; i < NUM_BACKENDS; i++)
+	{
+		if (!VALID_BACKEND(i))
+			continue;
+
+		for (;;)
+		{
+			if (fetch_row(state, i) < 0)
+				return -1;
+			if (state->nodes[i].done)
+				break;
+			if (state->error == NULL && combine_row(state, &state->nodes[i]) < 0)
+				return -1;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Combine a row into its group
+ */
+static int combine_row(PSState *state, PSNode *n)
+{
+	PSPlan *plan = state->plan;
+	PSGroup *group;
+	unsigned int hash = 2166136261U;
+	int i;
+
+	for (i = 0; i < state->ncols; i++)
+	{
+		int len = n->lens[i];
+		char *p = n->row + n->offsets[i];
+		int j;
+
+		if (plan->cols[i].kind != PS_GROUP)
+			continue;
+
+		if (len < 0)
+		{
+			hash = (hash ^ 0xff) * 16777619U;
+			continue;
+		}
+
+		if (plan->cols[i].class == PS_CLASS_NUMERIC)
+			len = numeric_canonical_length(p, len);
+		for (j = 0; j < len; j++)
+			hash = (hash ^ (unsigned char) p[j]) * 16777619U;
+		hash = (hash ^ 0) * 16777619U;
+	}
+
+	for (group = state->buckets[hash % state->nbuckets]; group; group = group->next)
+	{
+		if (group->hash != hash)
+			continue;
+
+		for (i = 0; i < state->ncols; i++)
+		{
+			char *value = group->values[i].value;
+			char *p = n->row + n->offsets[i];
+			int len = n->lens[i];
+
+			if (plan->cols[i].kind != PS_GROUP)
+				continue;
+			if (value == NULL || len < 0)
+			{
+				if (value != NULL || len >= 0)
+					break;
+				continue;
+			}
+			if (plan->cols[i].class == PS_CLASS_NUMERIC)
+			{
+				if (compare_numeric(value, strlen(value), p, len) != 0)
+					break;
+			}
+			else if (strlen(value) != len || memcmp(value, p, len) != 0)
+				break;
+		}
+		if (i == state->ncols)
+			break;
+	}
+
+	if (group == NULL)
+	{
+		/* new group. values are copied as they are */
+		group = calloc(1, sizeof(PSGroup) + sizeof(PSValue) * (state->ncols - 1));
+		if (group == NULL)
+		{
+			pool_error("pool_parallel_select: malloc failed");
+			return -1;
+		}
+		group->hash = hash;
+		group->seq = state->ngroups;
+
+		if (state->ngroups >= state->groups_size)
+		{
+			int size = state->groups_size ? state->groups_size * 2 : PS_INITIAL_BUCKETS;
+			PSGroup **groups = realloc(state->groups, sizeof(PSGroup *) * size);
+
+			if (groups == NULL)
+			{
+				pool_error("pool_parallel_select: malloc failed");
+				free(group);
+				return -1;
+			}
+			state->groups = groups;
+			state->groups_size = size;
+		}
+		state->groups[state->ngroups++] = group;
+		group->next = state->buckets[hash % state->nbuckets];
+		state->buckets[hash % state->nbuckets] = group;
+
+		if (state->ngroups > state->nbuckets)
+			grow_buckets(state);
+
+		for (i = 0; i < state->ncols; i++)
+		{
+			if (n->lens[i] < 0)
+				continue;
+			group->values[i].value = copy_value(n->row + n->offsets[i], n->lens[i]);
+			if (group->values[i].value == NULL)
+				return -1;
+			if (plan->cols[i].class == PS_CLASS_FLOAT &&
+				(plan->cols[i].kind == PS_SUM || plan->cols[i].kind == PS_AVG))
+				group->values[i].fvalue = strtod(group->values[i].value, NULL);
+		}
+		return 0;
+	}
+
+	for (i = 0; i < state->ncols; i++)
+	{
+		PSValue *v = &group->values[i];
+		PSColumn *col = &plan->cols[i];
+		char *value;
+		char *p = n->row + n->offsets[i];
+		int len = n->lens[i];
+
+		if (len < 0 || col->kind == PS_PLAIN || col->kind == PS_GROUP)
+			continue;
+
+		if (v->value == NULL)
+		{
+			v->value = copy_value(p, len);
+			if (v->value == NULL)
+				return -1;
+			v->fvalue = strtod(v->value, NULL);
+			continue;
+		}
+
+		switch (col->kind)
+		{
+			case PS_COUNT:
+			case PS_SUM:
+			case PS_AVG:
+				if (col->class == PS_CLASS_FLOAT)
+				{
+					value = copy_value(p, len);
+					if (value == NULL)
+						return -1;
+					v->fvalue += strtod(value, NULL);
+					free(value);
+					break;
+				}
+
+				value = copy_value(p, len);
+				if (value == NULL)
+					return -1;
+				p = numeric_add(v->value, value);
+				free(value);
+				if (p == NULL)
+					return -1;
+				free(v->value);
+				v->value = p;
+				break;
+
+			case PS_MIN:
+			case PS_MAX:
+			{
+				PSSortKey key;
+				int r;
+
+				memset(&key, 0, sizeof(key));
+				key.class = col->class;
+				r = compare_value(&key, p, len, v->value, strlen(v->value));
+				if ((col->kind == PS_MIN && r < 0) || (col->kind == PS_MAX && r > 0))
+				{
+					value = copy_value(p, len);
+					if (value == NULL)
+						return -1;
+					free(v->value);
+					v->value = value;
+				}
+				break;
+			}
+
+			default:
+				break;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Double the number of buckets so that chains stay short. If memory
+ * is short, the current buckets are kept; it is only slower.
+ */
+static void grow_buckets(PSState *state)
+{
+	int nbuckets = state->nbuckets * 2;
+	PSGroup **buckets;
+	int i;
+
+	buckets = calloc(nbuckets, sizeof(PSGroup *));
+	if (buckets == NULL)
+	{
+		pool_debug("pool_parallel_select: could not grow hash table to %d buckets", nbuckets);
+		return;
+	}
+
+	for (i = 0; i < state->ngroups; i++)
+	{
+		PSGroup *group = state->groups[i];
+
+		group->next = buckets[group->hash % nbuckets];
+		buckets[group->hash % nbuckets] = group;
+	}
+
+	free(state->buckets);
+	state->buckets = buckets;
+	state->nbuckets = nbuckets;
+}
+
+/*
+ * Compute final values of a group
+ */
+static void finish_group(PSState *state, PSGroup *group)
+{
+	PSPlan *plan = state->plan;
+	int i;
+
+	for (i = 0; i < state->ncols; i++)
+	{
+		PSValue *v = &group->values[i];
+		PSColumn *col = &plan->cols[i];
+		char *value = NULL;
+
+		if (v->value == NULL)
+			continue;
+
+		if (col->kind == PS_SUM && col->class == PS_CLASS_FLOAT)
+			value = float_out(v->fvalue, state->typoids[i] == PS_FLOAT4OID);
+		else if (col->kind == PS_AVG)
+		{
+			char *count = group->values[col->count_col].value;
+
+			if (count == NULL || strcmp(count, "0") == 0)
+				value = NULL;
+			else if (col->class == PS_CLASS_FLOAT)
+				value = float_out(v->fvalue / strtod(count, NULL), 0);
+			else
+				value = numeric_div_count(v->value, count);
+		}
+		else
+			continue;
+
+		free(v->value);
+		v->value = value;
+	}
+}
+
+/*
+ * Sort groups, and send them to the frontend. Returns the number of
+ * rows sent, or -1 on error.
+ */
+static int send_groups(PSState *state)
+{
+	PSPlan *plan = state->plan;
+	int rows = 0;
+	int i;
+	int j;
+
+	for (i = 0; i < state->ngroups; i++)
+		finish_group(state, state->groups[i]);
+
+	if (plan->nkeys > 0 && state->ngroups > 1)
+	{
+		sort_state = state;
+		qsort(state->groups, state->ngroups, sizeof(PSGroup *), sort_groups);
+		sort_state = NULL;
+	}
+
+	for (i = plan->offset; i < state->ngroups; i++)
+	{
+		PSGroup *group = state->groups[i];
+		int sendlen = 4 + sizeof(short);
+		short ncols = htons(state->nvisible);
+
+		if (plan->limit >= 0 && rows >= plan->limit)
+			break;
+
+		for (j = 0; j < state->nvisible; j++)
+		{
+			sendlen += 4;
+			if (group->values[j].value)
+				sendlen += strlen(group->values[j].value);
+		}
+
+		sendlen = htonl(sendlen);
+		pool_write(state->frontend, "D", 1);
+		pool_write(state->frontend, &sendlen, sizeof(sendlen));
+		pool_write(state->frontend, &ncols, sizeof(ncols));
+
+		for (j = 0; j < state->nvisible; j++)
+		{
+			char *value = group->values[j].value;
+			int len = value ? htonl(strlen(value)) : htonl(-1);
+
+			pool_write(state->frontend, &len, sizeof(len));
+			if (value && pool_write(state->frontend, value, strlen(value)) < 0)
+				return -1;
+		}
+		rows++;
+	}
+
+	return rows;
+}
+
+/*
+ * qsort comparator for groups. Groups which are equal stay in the order
+ * of creation.
+ */
+static int sort_groups(const void *a, const void *b)
+{
+	PSGroup *ga = *(PSGroup **) a;
+	PSGroup *gb = *(PSGroup **) b;
+	PSPlan *plan = sort_state->plan;
+	int i;
+
+	for (i = 0; i < plan->nkeys; i++)
+	{
+		PSSortKey *key = &plan->keys[i];
+		char *va = ga->values[key->col].value;
+		char *vb = gb->values[key->col].value;
+		int r;
+
+		r = compare_value(key, va, va ? strlen(va) : -1, vb, vb ? strlen(vb) : -1);
+		if (r)
+			return r;
+	}
+	return ga->seq < gb->seq ? -1 : ga->seq > gb->seq;
+}
+
+/*
+ * Compare two values by a sort key. Length of null is -1.
+ */
+static int compare_value(PSSortKey *key, const char *a, int alen, const char *b, int blen)
+{
+	int r;
+
+	if (alen < 0 || blen < 0)
+	{
+		if (alen < 0 && blen < 0)
+			return 0;
+		return (alen < 0) == key->nulls_first ? -1 : 1;
+	}
+
+	switch (key->class)
+	{
+		case PS_CLASS_NUMERIC:
+			r = compare_numeric(a, alen, b, blen);
+			break;
+
+		case PS_CLASS_FLOAT:
+			r = compare_float(a, alen, b, blen);
+			break;
+
+		default:
+			r = memcmp(a, b, alen < blen ? alen : blen);
+			if (r == 0)
+				r = alen - blen;
+			break;
+	}
+
+	if (r)
+		r = r < 0 ? -1 : 1;
+	return key->desc ? -r : r;
+}
+
+static void free_state(PSState *state)
+{
+	int i;
+	int j;
+
+	for (i = 0; i < state->ngroups; i++)
+	{
+		for (j = 0; j < state->ncols; j++)
+			free(state->groups[i]->values[j].value);
+		free(state->groups[i]);
+	}
+	free(state->groups);
+	free(state->buckets);
+
+	for (i = 0; i < NUM_BACKENDS; i++)
+	{
+		free(state->nodes[i].offsets);
+		free(state->nodes[i].lens);
+	}
+	free(state->typoids);
+	free(state->error);
+}
+
+/*
+ * Split a numeric value in text representation
+ */
+static void parse_numeric(const char *s, int len, PSNumeric *n)
+{
+	const char *end = s + len;
+	const char *p;
+
+	memset(n, 0, sizeof(*n));
+
+	if (len == 3 && strncmp(s, "NaN", 3) == 0)
+	{
+		n->nan = 1;
+		return;
+	}
+
+	if (s < end && (*s == '-' || *s == '+'))
+	{
+		n->negative = (*s == '-');
+		s++;
+	}
+
+	while (s < end && *s == '0')
+		s++;
+
+	for (p = s; p < end && *p != '.'; p++)
+		;
+	n->ip = s;
+	n->ilen = p - s;
+
+	if (p < end)
+	{
+		n->fp = p + 1;
+		n->flen = end - n->fp;
+	}
+	else
+		n->fp = end;
+
+	/* zero has no sign */
+	if (n->ilen == 0)
+	{
+		for (p = n->fp; p < end && *p == '0'; p++)
+			;
+		if (p == end)
+			n->negative = 0;
+	}
+}
+
+/*
+ * Returns the length of a numeric value without trailing zeros of the
+ * fraction, so that equal values have the same representation.
+ */
+static int numeric_canonical_length(const char *s, int len)
+{
+	if (memchr(s, '.', len) == NULL)
+		return len;
+
+	while (len > 0 && s[len - 1] == '0')
+		len--;
+	if (len > 0 && s[len - 1] == '.')
+		len--;
+	return len;
+}
+
+/*
+ * Compare numeric values. NaN is larger than any other value as in
+ * PostgreSQL.
+ */
+static int compare_numeric(const char *a, int alen, const char *b, int blen)
+{
+	PSNumeric na;
+	PSNumeric nb;
+	int r;
+	int i;
+
+	parse_numeric(a, alen, &na);
+	parse_numeric(b, blen, &nb);
+
+	if (na.nan || nb.nan)
+		return na.nan - nb.nan;
+
+	if (na.negative != nb.negative)
+		return na.negative ? -1 : 1;
+
+	/* compare absolute values */
+	if (na.ilen != nb.ilen)
+		r = na.ilen < nb.ilen ? -1 : 1;
+	else
+	{
+		r = memcmp(na.ip, nb.ip, na.ilen);
+		for (i = 0; r == 0 && (i < na.flen || i < nb.flen); i++)
+		{
+			char ca = i < na.flen ? na.fp[i] : '0';
+			char cb = i < nb.flen ? nb.fp[i] : '0';
+
+			r = ca - cb;
+		}
+	}
+
+	return na.negative ? -r : r;
+}
+
+/*
+ * Compare float values. NaN is larger than any other value as in
+ * PostgreSQL.
+ */
+static int compare_float(const char *a, int alen, const char *b, int blen)
+{
+	char buf[64];
+	double da;
+	double db;
+
+	if (alen >= sizeof(buf) || blen >= sizeof(buf))
+		return alen - blen;
+
+	memcpy(buf, a, alen);
+	buf[alen] = '\0';
+	da = strtod(buf, NULL);
+	memcpy(buf, b, blen);
+	buf[blen] = '\0';
+	db = strtod(buf, NULL);
+
+	if (isnan(da) || isnan(db))
+		return isnan(da) - isnan(db);
+	if (da < db)
+		return -1;
+	return da > db;
+}
+
+/*
+ * Add numeric values. Returns a malloced string, or NULL on error.
+ */
+static char *numeric_add(const char *a, const char *b)
+{
+	PSNumeric na;
+	PSNumeric nb;
+	int ilen;
+	int flen;
+	int width;
+	int *digits;
+	int *x;
+	int *y;
+	int *r;
+	char *result;
+	char *p;
+	int carry;
+	int negative;
+	int i;
+
+	parse_numeric(a, strlen(a), &na);
+	parse_numeric(b, strlen(b), &nb);
+
+	if (na.nan || nb.nan)
+		return strdup("NaN");
+
+	ilen = (na.ilen > nb.ilen ? na.ilen : nb.ilen) + 1;
+	flen = na.flen > nb.flen ? na.flen : nb.flen;
+	width = ilen + flen;
+
+	digits = calloc(width * 3, sizeof(int));
+	result = malloc(width + 3);
+	if (digits == NULL || result == NULL)
+	{
+		pool_error("numeric_add: malloc failed");
+		free(digits);
+		free(result);
+		return NULL;
+	}
+	x = digits;
+	y = x + width;
+	r = y + width;
+
+	/* digits aligned at the decimal point */
+	for (i = 0; i < na.ilen; i++)
+		x[ilen - na.ilen + i] = na.ip[i] - '0';
+	for (i = 0; i < na.flen; i++)
+		x[ilen + i] = na.fp[i] - '0';
+	for (i = 0; i < nb.ilen; i++)
+		y[ilen - nb.ilen + i] = nb.ip[i] - '0';
+	for (i = 0; i < nb.flen; i++)
+		y[ilen + i] = nb.fp[i] - '0';
+
+	if (na.negative == nb.negative)
+	{
+		carry = 0;
+		for (i = width - 1; i >= 0; i--)
+		{
+			r[i] = x[i] + y[i] + carry;
+			carry = r[i] / 10;
+			r[i] %= 10;
+		}
+		negative = na.negative;
+	}
+	else
+	{
+		/* subtract the smaller absolute value from the larger */
+		negative = na.negative;
+		for (i = 0; i < width && x[i] == y[i]; i++)
+			;
+		if (i < width && x[i] < y[i])
+		{
+			int *tmp = x;
+
+			x = y;
+			y = tmp;
+			negative = nb.negative;
+		}
+		carry = 0;
+		for (i = width - 1; i >= 0; i--)
+		{
+			r[i] = x[i] - y[i] - carry;
+			carry = r[i] < 0;
+			if (carry)
+				r[i] += 10;
+		}
+	}
+
+	p = result;
+	if (negative)
+	{
+		for (i = 0; i < width && r[i] == 0; i++)
+			;
+		if (i < width)
+			*p++ = '-';
+	}
+	for (i = 0; i < ilen - 1 && r[i] == 0; i++)
+		;
+	for (; i < ilen; i++)
+		*p++ = r[i] + '0';
+	if (flen > 0)
+	{
+		*p++ = '.';
+		for (i = ilen; i < width; i++)
+			*p++ = r[i] + '0';
+	}
+	*p = '\0';
+
+	free(digits);
+	return result;
+}
+
+/*
+ * Compute the weight and the first digit of a numeric value in base
+ * 10000 digits as PostgreSQL does
+ */
+static void numeric_weight(PSNumeric *n, int *weight, int *firstdigit)
+{
+	int start;
+	int i;
+
+	*weight = 0;
+	*firstdigit = 0;
+
+	if (n->ilen > 0)
+	{
+		*weight = (n->ilen - 1) / PS_DEC_DIGITS;
+		for (i = 0; i < (n->ilen - 1) % PS_DEC_DIGITS + 1; i++)
+			*firstdigit = *firstdigit * 10 + n->ip[i] - '0';
+		return;
+	}
+
+	for (start = 0; start < n->flen; start += PS_DEC_DIGITS)
+	{
+		int digit = 0;
+
+		for (i = start; i < start + PS_DEC_DIGITS; i++)
+			digit = digit * 10 + (i < n->flen ? n->fp[i] - '0' : 0);
+		if (digit)
+		{
+			*weight = -(start / PS_DEC_DIGITS + 1);
+			*firstdigit = digit;
+			return;
+		}
+	}
+}
+
+/*
+ * Divide numeric sum by count to compute avg. The scale of the result
+ * is chosen as numeric division of PostgreSQL does. Returns a malloced
+ * string, or NULL on error.
+ */
+static char *numeric_div_count(const char *sum, const char *count)
+{
+	PSNumeric ns;
+	PSNumeric nc;
+	unsigned long long divisor;
+	unsigned long long remainder;
+	int weight1, firstdigit1;
+	int weight2, firstdigit2;
+	int qweight;
+	int rscale;
+	int ndigits;
+	char *digits;
+	char *result;
+	char *p;
+	int i;
+
+	parse_numeric(sum, strlen(sum), &ns);
+	if (ns.nan)
+		return strdup("NaN");
+	parse_numeric(count, strlen(count), &nc);
+	divisor = strtoull(count, NULL, 10);
+	if (divisor == 0)
+		return NULL;
+
+	numeric_weight(&ns, &weight1, &firstdigit1);
+	numeric_weight(&nc, &weight2, &firstdigit2);
+	qweight = weight1 - weight2;
+	if (firstdigit1 <= firstdigit2)
+		qweight--;
+	rscale = PS_NUMERIC_MIN_SIG_DIGITS - qweight * PS_DEC_DIGITS;
+	if (rscale < ns.flen)
+		rscale = ns.flen;
+	if (rscale < 0)
+		rscale = 0;
+	if (rscale > PS_NUMERIC_MAX_DISPLAY_SCALE)
+		rscale = PS_NUMERIC_MAX_DISPLAY_SCALE;
+
+	/*
+	 * digits[0] is for the carry of rounding, followed by the integer
+	 * digits and rscale + 1 fraction digits of the quotient
+	 */
+	ndigits = 1 + ns.ilen + rscale + 1;
+	digits = calloc(ndigits, 1);
+	result = malloc(ndigits + 3);
+	if (digits == NULL || result == NULL)
+	{
+		pool_error("numeric_div_count: malloc failed");
+		free(digits);
+		free(result);
+		return NULL;
+	}
+
+	remainder = 0;
+	for (i = 1; i < ndigits; i++)
+	{
+		int n = i - 1;
+		int d;
+
+		if (n < ns.ilen)
+			d = ns.ip[n] - '0';
+		else if (n - ns.ilen < ns.flen)
+			d = ns.fp[n - ns.ilen] - '0';
+		else
+			d = 0;
+
+		remainder = remainder * 10 + d;
+		digits[i] = remainder / divisor;
+		remainder %= divisor;
+	}
+
+	/* round half away from zero */
+	ndigits--;
+	if (digits[ndigits] >= 5)
+	{
+		for (i = ndigits - 1; i >= 0; i--)
+		{
+			if (++digits[i] < 10)
+				break;
+			digits[i] = 0;
+		}
+	}
+
+	p = result;
+	if (ns.negative)
+	{
+		for (i = 0; i < ndigits && digits[i] == 0; i++)
+			;
+		if (i < ndigits)
+			*p++ = '-';
+	}
+	for (i = 0; i < ns.ilen && digits[i] == 0; i++)
+		;
+	for (; i <= ns.ilen; i++)
+		*p++ = digits[i] + '0';
+	if (rscale > 0)
+	{
+		*p++ = '.';
+		for (i = ns.ilen + 1; i < ndigits; i++)
+			*p++ = digits[i] + '0';
+	}
+	*p = '\0';
+
+	free(digits);
+	return result;
+}
+
+/*
+ * Float to text as float4out() and float8out() of PostgreSQL do with
+ * extra_float_digits = 0. Returns a malloced string.
+ */
+static char *float_out(double value, int float4)
+{
+	char buf[64];
+
+	if (isnan(value))
+		return strdup("NaN");
+	if (isinf(value))
+		return strdup(value > 0 ? "Infinity" : "-Infinity");
+
+	snprintf(buf, sizeof(buf), "%.*g", float4 ? FLT_DIG : DBL_DIG, value);
+	return strdup(buf);
+}
+
+static char *copy_value(const char *value, int len)
+{
+	char *p = malloc(len + 1);
+
+	if (p == NULL)
+	{
+		pool_error("pool_parallel_select: malloc failed");
+		return NULL;
+	}
+	memcpy(p, value, len);
+	p[len] = '\0';
+	return p;
+}
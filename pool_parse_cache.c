@@ -0,0 +1,264 @@
+/* -*-pgsql-c-*- */
+/*
+ * $Header$
+ *
+ * pgpool: a language independent connection pool server for PostgreSQL
+ * written by Tatsuo Ishii
+ *
+ * Copyright (c) 2003-2010	PgPool Global Development Group
+ *
+ * Permission to use, copy, modify, and distribute this software and
+ * its documentation for any purpose and without fee is hereby
+ * granted, provided that the above copyright notice appear in all
+ * copies and that both that copyright notice and this permission
+ * notice appear in supporting documentation, and that the name of the
+ * author not be used in advertising or publicity pertaining to
+ * distribution of the software without specific, written prior
+ * permission. The author makes no representations about the
+ * suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * pool_parse_cache.c: per process cache of raw parse trees.
+ *
+ * Applications tend to send the same statements over and over, and
+ * running the grammar on each of them is the largest CPU cost in a
+ * child. pool_raw_parser() keeps a copy of the parse tree of recently
+ * parsed statements, keyed by the exact query string, and hands out a
+ * copy of it allocated in the current parser memory context instead
+ * of parsing again. Copying is needed because callers free the tree
+ * with free_parser() and some of them modify it.
+ *
+ * Each cached tree lives in its own memory pool so that it can be
+ * released as a whole when the entry is evicted. Entries are kept in
+ * a hash table and in a list ordered by last use, and the least
+ * recently used one is evicted when the cache is full.
+ */
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "pool.h"
+#include "pool_proto_modules.h"
+
+#define PARSE_CACHE_MAX_QUERY_LEN 8192	/* longer queries are not cached */
+#define PARSE_CACHE_BLOCK_SIZE 1024
+
+typedef struct ParseCacheEntry {
+	unsigned int hash;		/* hash of the query string */
+	char *query;			/* query string */
+	POOL_MEMORY_POOL *ctxt;	/* memory context of the parse tree */
+	List *parse_tree_list;	/* parse tree */
+	struct ParseCacheEntry *hash_next;	/* next entry in hash chain */
+	struct ParseCacheEntry *prev;	/* more recently used entry */
+	struct ParseCacheEntry *next;	/* less recently used entry */
+} ParseCacheEntry;
+
+static ParseCacheEntry **parse_cache_buckets;
+static int parse_cache_num_buckets;	/* power of 2 */
+static int parse_cache_num_entries;
+static ParseCacheEntry *parse_cache_head;	/* most recently used */
+static ParseCacheEntry *parse_cache_tail;	/* least recently used */
+
+static int parse_cache_init(void);
+static unsigned int parse_cache_hash(const char *query);
+static ParseCacheEntry **parse_cache_bucket(unsigned int hash);
+static void parse_cache_unlink(ParseCacheEntry *entry);
+static void parse_cache_push(ParseCacheEntry *entry);
+static void parse_cache_evict(void);
+static void parse_cache_store(const char *query, unsigned int hash, List *parse_tree_list);
+
+/*
+ * Parse a query string. Same as raw_parser() except that the result
+ * is taken from the parse tree cache if the same query string has
+ * been parsed recently.
+ */
+List *pool_raw_parser(const char *query)
+{
+	ParseCacheEntry *entry;
+	List *parse_tree_list;
+	unsigned int hash;
+
+	if (pool_config->parse_cache_size <= 0 ||
+		strlen(query) > PARSE_CACHE_MAX_QUERY_LEN ||
+		parse_cache_init() < 0)
+		return raw_parser(query);
+
+	hash = parse_cache_hash(query);
+
+	for (entry = *parse_cache_bucket(hash); entry; entry = entry->hash_next)
+	{
+		if (entry->hash == hash && !strcmp(entry->query, query))
+			break;
+	}
+
+	if (entry)
+	{
+		if (pool_memory == NULL)
+			pool_memory = pool_memory_create(PARSER_BLOCK_SIZE);
+
+		parse_cache_unlink(entry);
+		parse_cache_push(entry);
+		pool_debug("pool_raw_parser: cache hit");
+		return copyObject(entry->parse_tree_list);
+	}
+
+	parse_tree_list = raw_parser(query);
+
+	/* do not remember syntax errors */
+	if (parse_tree_list != NIL)
+		parse_cache_store(query, hash, parse_tree_list);
+
+	return parse_tree_list;
+}
+
+/*
+ * Allocate the hash table on first use.
+ */
+static int parse_cache_init(void)
+{
+	if (parse_cache_buckets)
+		return 0;
+
+	parse_cache_num_buckets = 1;
+	while (parse_cache_num_buckets < pool_config->parse_cache_size)
+		parse_cache_num_buckets <<= 1;
+
+	parse_cache_buckets = calloc(parse_cache_num_buckets, sizeof(ParseCacheEntry *));
+	if (parse_cache_buckets == NULL)
+	{
+		pool_error("parse_cache_init: calloc failed");
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * FNV-1a hash of the query string
+ */
+static unsigned int parse_cache_hash(const char *query)
+{
+	unsigned int hash = 2166136261U;
+
+	while (*query)
+	{
+		hash ^= (unsigned char) *query++;
+		hash *= 16777619U;
+	}
+	return hash;
+}
+
+static ParseCacheEntry **parse_cache_bucket(unsigned int hash)
+{
+	return &parse_cache_buckets[hash & (parse_cache_num_buckets - 1)];
+}
+
+/*
+ * Remove an entry from the LRU list
+ */
+static void parse_cache_unlink(ParseCacheEntry *entry)
+{
+	if (entry->prev)
+		entry->prev->next = entry->next;
+	else
+		parse_cache_head = entry->next;
+
+	if (entry->next)
+		entry->next->prev = entry->prev;
+	else
+		parse_cache_tail = entry->prev;
+
+	entry->prev = entry->next = NULL;
+}
+
+/*
+ * Put an entry at the head of the LRU list
+ */
+static void parse_cache_push(ParseCacheEntry *entry)
+{
+	entry->prev = NULL;
+	entry->next = parse_cache_head;
+	if (parse_cache_head)
+		parse_cache_head->prev = entry;
+	parse_cache_head = entry;
+	if (parse_cache_tail == NULL)
+		parse_cache_tail = entry;
+}
+
+/*
+ * Discard the least recently used entry
+ */
+static void parse_cache_evict(void)
+{
+	ParseCacheEntry *entry = parse_cache_tail;
+	ParseCacheEntry **p;
+
+	if (entry == NULL)
+		return;
+
+	parse_cache_unlink(entry);
+
+	for (p = parse_cache_bucket(entry->hash); *p; p = &(*p)->hash_next)
+	{
+		if (*p == entry)
+		{
+			*p = entry->hash_next;
+			break;
+		}
+	}
+
+	pool_memory_delete(entry->ctxt, 0);
+	free(entry->query);
+	free(entry);
+	parse_cache_num_entries--;
+}
+
+/*
+ * Register a copy of the parse tree. Failures are not fatal since the
+ * query just gets parsed again next time.
+ */
+static void parse_cache_store(const char *query, unsigned int hash, List *parse_tree_list)
+{
+	ParseCacheEntry *entry;
+	ParseCacheEntry **bucket;
+	POOL_MEMORY_POOL *old_context;
+
+	while (parse_cache_num_entries >= pool_config->parse_cache_size)
+		parse_cache_evict();
+
+	entry = calloc(1, sizeof(*entry));
+	if (entry == NULL)
+	{
+		pool_error("parse_cache_store: calloc failed");
+		return;
+	}
+
+	entry->query = strdup(query);
+	if (entry->query == NULL)
+	{
+		pool_error("parse_cache_store: strdup failed");
+		free(entry);
+		return;
+	}
+
+	entry->ctxt = pool_memory_create(PARSE_CACHE_BLOCK_SIZE);
+	if (entry->ctxt == NULL)
+	{
+		pool_error("parse_cache_store: pool_memory_create() failed");
+		free(entry->query);
+		free(entry);
+		return;
+	}
+
+	old_context = pool_memory;
+	pool_memory = entry->ctxt;
+	entry->parse_tree_list = copyObject(parse_tree_list);
+	pool_memory = old_context;
+
+	entry->hash = hash;
+	bucket = parse_cache_bucket(hash);
+	entry->hash_next = *bucket;
+	*bucket = entry;
+	parse_cache_push(entry);
+	parse_cache_num_entries++;
+}
@@ -0,0 +1,391 @@
+/* -*-pgsql-c-*- */
+/*
+ * $Header$
+ *
+ * pgpool: a language independent connection pool server for PostgreSQL
+ * written by Tatsuo Ishii
+ *
+ * Copyright (c) 2003-2010	PgPool Global Development Group
+ *
+ * Permission to use, copy, modify, and distribute this software and
+ * its documentation for any purpose and without fee is hereby
+ * granted, provided that the above copyright notice appear in all
+ * copies and that both that copyright notice and this permission
+ * notice appear in supporting documentation, and that the name of the
+ * author not be used in advertising or publicity pertaining to
+ * distribution of the software without specific, written prior
+ * permission. The author makes no representations about the
+ * suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * pool_prewarm.c: connecting to backends before clients arrive.
+ *
+ * For each user:database pair in prewarm_connections, a child creates
+ * a connection pool when it starts and whenever it becomes idle
+ * without one (e.g. after connection_life_time expired), so that a
+ * client does not have to wait for the connections and
+ * authentication to the backends.
+ *
+ * Cached connections are reused only if the startup packet of the
+ * client is identical, and real clients usually send parameters other
+ * than user and database. So the startup packet of the latest client
+ * which made a new connection with a pair is remembered on shared
+ * memory, and used for later prewarming by all children.
+ */
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+#include "pool.h"
+
+/* startup packet remembered for a pair */
+typedef struct {
+	int len;		/* packet length. 0 if none is remembered yet */
+	char packet[MAX_STARTUP_PACKET_LENGTH];
+} PrewarmPacket;
+
+static int num_prewarm;			/* number of pairs */
+static char **prewarm_users;
+static char **prewarm_databases;
+static PrewarmPacket *prewarm_packets;	/* array of num_prewarm on shared memory */
+static char *prewarm_failed;	/* non 0 if prewarming failed in this child */
+static POOL_CONNECTION *null_frontend;
+
+static int prewarm_lookup(char *user, char *database);
+static StartupPacket *prewarm_startup_packet(int n);
+static int prewarm_connect(StartupPacket *sp);
+static int read_ready_for_query(POOL_CONNECTION_POOL *backend);
+
+/*
+ * Parse prewarm_connections and create the area for startup packets
+ * on shared memory. This should be called once from the parent
+ * process before forking children.
+ * Returns 0 on success otherwise -1.
+ */
+int pool_prewarm_init(void)
+{
+	char *str;
+	char *tok;
+	char *p;
+
+	num_prewarm = 0;
+	if (pool_config->prewarm_connections == NULL || *pool_config->prewarm_connections == '\0')
+		return 0;
+
+	str = strdup(pool_config->prewarm_connections);
+	prewarm_users = malloc(sizeof(char *) * pool_config->max_pool);
+	prewarm_databases = malloc(sizeof(char *) * pool_config->max_pool);
+	if (str == NULL || prewarm_users == NULL || prewarm_databases == NULL)
+	{
+		pool_error("pool_prewarm_init: malloc failed");
+		return -1;
+	}
+
+	for (tok = strtok(str, ","); tok != NULL; tok = strtok(NULL, ","))
+	{
+		while (*tok == ' ' || *tok == '\t')
+			tok++;
+		for (p = tok + strlen(tok); p > tok && (p[-1] == ' ' || p[-1] == '\t'); p--)
+			p[-1] = '\0';
+
+		p = strchr(tok, ':');
+		if (p == NULL || p == tok || p[1] == '\0')
+		{
+			pool_error("pool_prewarm_init: invalid entry \"%s\" in prewarm_connections. user:database expected", tok);
+			return -1;
+		}
+		*p++ = '\0';
+
+		if (num_prewarm >= pool_config->max_pool)
+		{
+			pool_log("pool_prewarm_init: more than max_pool (%d) entries in prewarm_connections. \"%s:%s\" and later are ignored",
+					 pool_config->max_pool, tok, p);
+			break;
+		}
+
+		prewarm_users[num_prewarm] = tok;
+		prewarm_databases[num_prewarm] = p;
+		num_prewarm++;
+	}
+
+	if (num_prewarm == 0)
+		return 0;
+
+	prewarm_packets = pool_shared_memory_create(sizeof(PrewarmPacket) * num_prewarm);
+	if (prewarm_packets == NULL)
+	{
+		pool_error("pool_prewarm_init: failed to allocate shared memory");
+		return -1;
+	}
+	memset(prewarm_packets, 0, sizeof(PrewarmPacket) * num_prewarm);
+
+	prewarm_failed = calloc(num_prewarm, 1);
+	if (prewarm_failed == NULL)
+	{
+		pool_error("pool_prewarm_init: malloc failed");
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Create connection pools for pairs which have none. Existing
+ * connection pools are never discarded for this. Called in a child
+ * while no client is connected.
+ */
+void pool_prewarm_connections(void)
+{
+	StartupPacket *sp;
+	int i;
+
+	for (i = 0; i < num_prewarm; i++)
+	{
+		if (prewarm_failed[i])
+			continue;
+
+		if (pool_num_free_cp() == 0)
+			return;
+
+		sp = prewarm_startup_packet(i);
+		if (sp == NULL)
+			return;
+
+		if (pool_exists_cp(sp->user, sp->database, sp->major))
+		{
+			pool_free_startup_packet(sp);
+			continue;
+		}
+
+		pool_debug("pool_prewarm_connections: connecting user: %s database: %s",
+				   sp->user, sp->database);
+
+		if (prewarm_connect(sp) < 0)
+		{
+			pool_log("pool_prewarm_connections: failed to connect user: %s database: %s. will not retry in this process",
+					 prewarm_users[i], prewarm_databases[i]);
+			prewarm_failed[i] = 1;
+		}
+	}
+}
+
+/*
+ * Remember the startup packet of a client which made a new connection
+ * pool, if its user and database are in prewarm_connections.
+ */
+void pool_prewarm_remember(StartupPacket *sp)
+{
+	PrewarmPacket *pp;
+	int n;
+
+	n = prewarm_lookup(sp->user, sp->database);
+	if (n < 0 || sp->len <= 0 || sp->len > MAX_STARTUP_PACKET_LENGTH)
+		return;
+
+	pp = &prewarm_packets[n];
+
+	/*
+	 * Clients usually send the same packet each time, so check
+	 * without locking first. A torn read only causes a needless
+	 * update.
+	 */
+	if (pp->len == sp->len && memcmp(pp->packet, sp->startup_packet, sp->len) == 0)
+		return;
+
+	pool_semaphore_lock(PREWARM_SEM);
+	memcpy(pp->packet, sp->startup_packet, sp->len);
+	pp->len = sp->len;
+	pool_semaphore_unlock(PREWARM_SEM);
+
+	/* the new packet may work better */
+	prewarm_failed[n] = 0;
+}
+
+/*
+ * Returns the index of the pair for user and database, or -1
+ */
+static int prewarm_lookup(char *user, char *database)
+{
+	int i;
+
+	if (user == NULL || database == NULL)
+		return -1;
+
+	for (i = 0; i < num_prewarm; i++)
+	{
+		if (strcmp(prewarm_users[i], user) == 0 &&
+			strcmp(prewarm_databases[i], database) == 0)
+			return i;
+	}
+	return -1;
+}
+
+/*
+ * Build a startup packet for the n th pair. The remembered packet is
+ * used if any, otherwise a V3 packet containing user and database
+ * only. Returns NULL on error.
+ */
+static StartupPacket *prewarm_startup_packet(int n)
+{
+	StartupPacket *sp;
+	char *user = prewarm_users[n];
+	char *database = prewarm_databases[n];
+	int protov;
+
+	sp = calloc(sizeof(*sp), 1);
+	if (sp == NULL)
+	{
+		pool_error("prewarm_startup_packet: out of memory");
+		return NULL;
+	}
+
+	sp->startup_packet = malloc(MAX_STARTUP_PACKET_LENGTH);
+	sp->user = strdup(user);
+	sp->database = strdup(database);
+	if (sp->startup_packet == NULL || sp->user == NULL || sp->database == NULL)
+	{
+		pool_error("prewarm_startup_packet: out of memory");
+		pool_free_startup_packet(sp);
+		return NULL;
+	}
+
+	pool_semaphore_lock(PREWARM_SEM);
+	sp->len = prewarm_packets[n].len;
+	memcpy(sp->startup_packet, prewarm_packets[n].packet, sp->len);
+	pool_semaphore_unlock(PREWARM_SEM);
+
+	if (sp->len == 0)
+	{
+		protov = htonl(PROTO_MAJOR_V3 << 16);
+		memcpy(sp->startup_packet, &protov, sizeof(protov));
+		sp->len = sizeof(protov);
+		sp->len += snprintf(sp->startup_packet + sp->len, MAX_STARTUP_PACKET_LENGTH - sp->len,
+							"user%c%s%cdatabase%c%s%c", 0, user, 0, 0, database, 0) + 1;
+		if (sp->len >= MAX_STARTUP_PACKET_LENGTH)
+		{
+			pool_error("prewarm_startup_packet: too long user or database name");
+			pool_free_startup_packet(sp);
+			return NULL;
+		}
+	}
+
+	memcpy(&protov, sp->startup_packet, sizeof(protov));
+	sp->major = ntohl(protov) >> 16;
+	sp->minor = ntohl(protov) & 0x0000ffff;
+
+	return sp;
+}
+
+/*
+ * Create a connection pool and authenticate with sp as the null
+ * frontend. The pool is released to be used by clients. sp is freed
+ * on error. Returns 0 on success, otherwise -1.
+ */
+static int prewarm_connect(StartupPacket *sp)
+{
+	POOL_CONNECTION_POOL *backend;
+
+	backend = pool_prewarm_connect(sp);
+	if (backend == NULL)
+		return -1;
+
+	/* make it available for clients */
+	pool_connection_pool_timer(backend);
+
+	return 0;
+}
+
+/*
+ * Create a connection pool with sp and authenticate without a client,
+ * which works only if backends trust the user. The pool is returned
+ * in use, after ReadyForQuery has been read. sp belongs to the pool
+ * and is freed on error. Returns NULL on error.
+ */
+POOL_CONNECTION_POOL *pool_prewarm_connect(StartupPacket *sp)
+{
+	POOL_CONNECTION_POOL *backend;
+	int i;
+
+	if (null_frontend == NULL)
+	{
+		null_frontend = pool_open(-1);
+		if (null_frontend == NULL)
+		{
+			pool_free_startup_packet(sp);
+			return NULL;
+		}
+		/* nothing is sent to the null frontend */
+		null_frontend->no_forward = 1;
+	}
+
+	backend = pool_create_cp();
+	if (backend == NULL)
+	{
+		pool_free_startup_packet(sp);
+		return NULL;
+	}
+
+	for (i=0;i<NUM_BACKENDS;i++)
+	{
+		if (VALID_BACKEND(i))
+		{
+			CONNECTION(backend, i)->db_node_id = i;
+			CONNECTION(backend, i)->isbackend = 1;
+			pool_ssl_negotiate_clientserver(CONNECTION(backend, i));
+
+			CONNECTION_SLOT(backend, i)->sp = sp;
+
+			if (send_startup_packet(CONNECTION_SLOT(backend, i)) < 0)
+			{
+				pool_error("pool_prewarm_connect: fails to send startup packet to the %d th backend", i);
+				pool_discard_pool(backend);
+				return NULL;
+			}
+		}
+	}
+
+	if (pool_do_auth(null_frontend, backend) || read_ready_for_query(backend))
+	{
+		pool_discard_pool(backend);
+		return NULL;
+	}
+
+	return backend;
+}
+
+static int read_ready_for_query(POOL_CONNECTION_POOL *backend)
+{
+	signed char kind;
+	char state;
+	int i;
+
+	kind = pool_read_kind(backend);
+	if (kind != 'Z')
+	{
+		pool_error("read_ready_for_query: expect \"Z\" got %c", kind);
+		return -1;
+	}
+
+	if (MAJOR(backend) != PROTO_MAJOR_V3)
+		return 0;
+
+	if (pool_read_message_length(backend) < 0)
+		return -1;
+
+	for (i=0;i<NUM_BACKENDS;i++)
+	{
+		if (!VALID_BACKEND(i))
+			continue;
+
+		if (pool_read(CONNECTION(backend, i), &state, sizeof(state)) < 0)
+		{
+			pool_error("read_ready_for_query: failed to read transaction state in slot %d", i);
+			return -1;
+		}
+		CONNECTION(backend, i)->tstate = state;
+	}
+
+	return 0;
+}
@@ -45,12 +45,7 @@
 #include "pool_signal.h"
 #include "pool_timestamp.h"
 #include "pool_proto_modules.h"
-
-#ifndef FD_SETSIZE
-#define FD_SETSIZE 512
-#endif
-
-#define INIT_STATEMENT_LIST_SIZE 8
+#include "md5.h"
 
 #define ACTIVE_SQL_TRANSACTION_ERROR_CODE "25001"		/* SET TRANSACTION ISOLATION LEVEL must be called before any query */
 #define DEADLOCK_ERROR_CODE "40P01"
@@ -67,23 +62,35 @@ static int send_deallocate(POOL_CONNECTION_POOL *backend, PreparedStatementList
 static int is_cache_empty(POOL_CONNECTION *frontend, POOL_CONNECTION_POOL *backend);
 static POOL_STATUS ParallelForwardToFrontend(char kind, POOL_CONNECTION *frontend, POOL_CONNECTION *backend, char *database, bool send_to_frontend);
 static void query_cache_register(char kind, POOL_CONNECTION *frontend, char *database, char *data, int data_len);
+static int can_relay_data_rows(POOL_CONNECTION *frontend, POOL_CONNECTION_POOL *backend);
 static int extract_ntuples(char *message);
 static int detect_error(POOL_CONNECTION *master, char *error_code, int major, char class, bool unread);
 static int detect_postmaster_down_error(POOL_CONNECTION *master, int major);
 
 static bool is_internal_transaction_needed(Node *node);
 static int compare(const void *p1, const void *p2);
+static POOL_EVENT_SET *prepare_query_events(POOL_CONNECTION *frontend, POOL_CONNECTION_POOL *backend, int watch_frontend);
+static int wait_for_backends(POOL_CONNECTION_POOL *backend, int *pending, int *ready);
+static int read_kind_skip_parameter_status(POOL_CONNECTION_POOL *backend, int node, unsigned char *kind);
+static void record_query_latency(int node, struct timeval *start);
+static int can_switch_session(POOL_CONNECTION_POOL *backend, int reset_request);
 
 /* timeout sec for pool_check_fd */
 static int timeoutsec;
 
-int in_load_balance;	/* non 0 if in load balance mode */
-int selected_slot;		/* selected DB node */
-int master_slave_dml;	/* non 0 if master/slave mode is specified in config file */
+/* events of frontend and backends waited for in pool_process_query */
+static POOL_EVENT_SET *query_events;
+static POOL_CONNECTION *query_events_frontend;	/* frontend registered in query_events */
+static POOL_CONNECTION_POOL *query_events_backend;	/* backend registered in query_events */
 
 /*
  * Main module for query processing
  * reset_request: if non 0, call reset_backend to execute reset queries
+ *
+ * If a child serves multiple sessions (sessions_per_child > 1), this
+ * returns POOL_IDLE instead of waiting when neither frontend nor
+ * backends have data for the session and the session may be switched
+ * at this point. The caller calls this again when data arrives.
  */
 POOL_STATUS pool_process_query(POOL_CONNECTION *frontend,
 							   POOL_CONNECTION_POOL *backend,
@@ -92,9 +99,6 @@ POOL_STATUS pool_process_query(POOL_CONNECTION *frontend,
 	char kind;	/* packet kind (backend) */
 	char fkind;	/* packet kind (frontend) */
 	short num_fields = 0;
-	fd_set	readmask;
-	fd_set	writemask;
-	fd_set	exceptmask;
 	int fds;
 	POOL_STATUS status;
 	int qcnt;
@@ -166,34 +170,22 @@ POOL_STATUS pool_process_query(POOL_CONNECTION *frontend,
 		 */
 		if (is_cache_empty(frontend, backend))
 		{
-			struct timeval timeoutdata;
-			struct timeval *timeout;
-			int num_fds, was_error = 0;
+			POOL_EVENT_SET *events;
+			int timeout;
+			int was_error = 0;
+			int may_switch;
+			long now;
 
 		    /*
-			 * frontend idle counters. depends on the following
-			 * select(2) call's time out is 1 second.
+			 * frontend idle start time in milliseconds. Instead of
+			 * waking up every second to count idle time, we compute
+			 * how long we may sleep until client_idle_limit (or
+			 * client_idle_limit_in_recovery) is reached.
 			 */
-			int idle_count = 0;	/* for other than in recovery */
-			int idle_count_in_recovery = 0;	/* for in recovery */
+			long idle_start = pool_event_now();	/* for other than in recovery */
+			long idle_start_in_recovery = 0;	/* for in recovery */
 
 		SELECT_RETRY:
-			FD_ZERO(&readmask);
-			FD_ZERO(&writemask);
-			FD_ZERO(&exceptmask);
-
-			num_fds = 0;
-
-			/*
-			 * Do not read a message from frontend while backends process a query.
-			 */
-			if (!reset_request && !in_progress)
-			{
-				FD_SET(frontend->fd, &readmask);
-				FD_SET(frontend->fd, &exceptmask);
-				num_fds = Max(frontend->fd + 1, num_fds);
-			}
-
 			/*
 			 * If we are in load balance mode and the selected node is
 			 * down, we need to re-select load_balancing_node.  Note
@@ -207,63 +199,78 @@ POOL_STATUS pool_process_query(POOL_CONNECTION *frontend,
 				backend->info->load_balancing_node = select_load_balancing_node();
 			}
 
-			for (i=0;i<NUM_BACKENDS;i++)
+			/*
+			 * Do not read a message from frontend while backends process a query.
+			 */
+			events = prepare_query_events(frontend, backend, !reset_request && !session_context->in_progress);
+			if (events == NULL)
+				return POOL_ERROR;
+
+			/*
+			 * check idle limits and compute time to wait. If other
+			 * sessions may run, just poll; the caller waits and
+			 * takes care of idle limits.
+			 */
+			timeout = -1;
+			now = pool_event_now();
+			may_switch = can_switch_session(backend, reset_request);
+
+			if (may_switch)
+				timeout = 0;
+			else if (*InRecovery == 0)
 			{
-				if (VALID_BACKEND(i))
+				idle_start_in_recovery = 0;
+
+				if (pool_config->client_idle_limit > 0)
 				{
-					num_fds = Max(CONNECTION(backend, i)->fd + 1, num_fds);
-					FD_SET(CONNECTION(backend, i)->fd, &readmask);
-					FD_SET(CONNECTION(backend, i)->fd, &exceptmask);
+					timeout = idle_start + pool_config->client_idle_limit * 1000L - now;
+					if (timeout <= 0)
+					{
+						pool_log("pool_process_query: child connection forced to terminate due to client_idle_limit(%d) reached", pool_config->client_idle_limit);
+						return POOL_END;
+					}
+				}
+
+				/*
+				 * Nobody tells us recovery started. Wake up every
+				 * second to check it.
+				 */
+				if (pool_config->client_idle_limit_in_recovery > 0 &&
+					(timeout < 0 || timeout > 1000))
+					timeout = 1000;
+			}
+			else if (pool_config->client_idle_limit_in_recovery > 0)
+			{
+				if (idle_start_in_recovery == 0)
+					idle_start_in_recovery = now;
+
+				timeout = idle_start_in_recovery + pool_config->client_idle_limit_in_recovery * 1000L - now;
+				if (timeout <= 0)
+				{
+					pool_log("pool_process_query: child connection forced to terminate due to client_idle_limit_in_recovery(%d) reached", pool_config->client_idle_limit_in_recovery);
+					return POOL_END;
 				}
 			}
 
 			/*
 			 * wait for data arriving from frontend and backend
 			 */
-			if (pool_config->client_idle_limit > 0 ||
-				pool_config->client_idle_limit_in_recovery > 0)
-			{
-				timeoutdata.tv_sec = 1;
-				timeoutdata.tv_usec = 0;
-				timeout = &timeoutdata;
-			}
-			else
-				timeout = NULL;
-
-			fds = select(num_fds, &readmask, &writemask, &exceptmask, timeout);
+			fds = pool_event_wait(events, timeout);
 
 			if (fds == -1)
 			{
 				if (errno == EINTR)
 					continue;
 
-				pool_error("select() failed. reason: %s", strerror(errno));
+				pool_error("pool_process_query: pool_event_wait() failed. reason: %s", strerror(errno));
 				return POOL_ERROR;
 			}
 
-			/* select timeout */
+			/* timeout */
 			if (fds == 0)
 			{
-				if (*InRecovery == 0 && pool_config->client_idle_limit > 0)
-				{
-					idle_count++;
-
-					if (idle_count > pool_config->client_idle_limit)
-					{
-						pool_log("pool_process_query: child connection forced to terminate due to client_idle_limit(%d) reached", pool_config->client_idle_limit);
-						return POOL_END;
-					}
-				}
-				else if (*InRecovery > 0 && pool_config->client_idle_limit_in_recovery > 0)
-				{
-					idle_count_in_recovery++;
-
-					if (idle_count_in_recovery > pool_config->client_idle_limit_in_recovery)
-					{
-						pool_log("pool_process_query: child connection forced to terminate due to client_idle_limit_in_recovery(%d) reached", pool_config->client_idle_limit_in_recovery);
-						return POOL_END;
-					}
-				}
+				if (may_switch)
+					return POOL_IDLE;
 				goto SELECT_RETRY;
 			}
 
@@ -277,12 +284,12 @@ POOL_STATUS pool_process_query(POOL_CONNECTION *frontend,
 					if (CONNECTION_SLOT(backend, i) == 0)
 					{
 						pool_log("FATAL ERROR: VALID_BACKEND returns non 0 but connection slot is empty. backend id:%d RAW_MODE:%d in_load_balance:%d LOAD_BALANCE_STATUS:%d status:%d",
-								 i, RAW_MODE, in_load_balance, LOAD_BALANCE_STATUS(i), BACKEND_INFO(i).backend_status);
+								 i, RAW_MODE, session_context->in_load_balance, LOAD_BALANCE_STATUS(i), BACKEND_INFO(i).backend_status);
 						was_error = 1;
 						break;
 					}
 
-					if (FD_ISSET(CONNECTION(backend, i)->fd, &readmask))
+					if (pool_event_ready(events, CONNECTION(backend, i)->fd) & POOL_EVENT_READ)
 					{
 						/*
 						 * admin shutdown postmaster or postmaster goes down
@@ -309,11 +316,13 @@ POOL_STATUS pool_process_query(POOL_CONNECTION *frontend,
 			if (was_error)
 				continue;
 
-			if (!reset_request && !in_progress)
+			if (!reset_request && !session_context->in_progress)
 			{
-				if (FD_ISSET(frontend->fd, &exceptmask))
+				int ready = pool_event_ready(events, frontend->fd);
+
+				if (ready & POOL_EVENT_EXCEPT)
 					return POOL_END;
-				else if (FD_ISSET(frontend->fd, &readmask))
+				else if (ready & POOL_EVENT_READ)
 				{
 					status = ProcessFrontendResponse(frontend, backend);
 					if (status != POOL_CONTINUE)
@@ -325,14 +334,14 @@ POOL_STATUS pool_process_query(POOL_CONNECTION *frontend,
 					continue;
 			}
 
-			if (FD_ISSET(MASTER(backend)->fd, &exceptmask))
+			if (pool_event_ready(events, MASTER(backend)->fd) & POOL_EVENT_EXCEPT)
 			{
 				return POOL_ERROR;
 			}
 		}
 		else
 		{
-			if (frontend->len > 0 && !in_progress)
+			if (frontend->len > 0 && !session_context->in_progress)
 			{
 				/* We do not read anything from frontend after receiving X packet.
 				 * Just emit log message. This will guard us from buggy frontend.
@@ -396,12 +405,29 @@ POOL_STATUS pool_process_query(POOL_CONNECTION *frontend,
 					break;
 				case 'S':
 					/* Parameter Status */
+					/* run time parameter was changed by the session */
+					if (!reset_request)
+						session_context->session_state_modified = 1;
 					status = ParameterStatus(frontend, backend);
 					break;
 				case 'Z':
 					/* Ready for query */
 					status = ReadyForQuery(frontend, backend, 1);
 					break;
+				case 'D':
+					/* DataRow */
+					if (can_relay_data_rows(frontend, backend))
+					{
+						session_context->pending_function = NULL;
+						session_context->pending_prepared_portal = NULL;
+						if (pool_relay_messages(MASTER(backend), frontend, kind))
+							return POOL_END;
+						if (pool_flush(frontend))
+							return POOL_END;
+						status = POOL_CONTINUE;
+						break;
+					}
+					/* FALLTHROUGH */
 				default:
 					status = SimpleForwardToFrontend(kind, frontend, backend);
 					if (pool_flush(frontend))
@@ -501,39 +527,154 @@ POOL_STATUS pool_process_query(POOL_CONNECTION *frontend,
 
 
 /*
- * set_fd,isset_fs,zero_fd are used
- * for check fd in parallel mode
+ * Returns non 0 if DataRow messages from backend can be relayed to
+ * frontend without inspecting them: only one backend returns the
+ * result (raw mode or load balanced SELECT) and the query cache does
+ * not need the row data.
  */
+static int can_relay_data_rows(POOL_CONNECTION *frontend, POOL_CONNECTION_POOL *backend)
+{
+	int i;
+	int n = 0;
 
-/* used only in pool_parallel_exec */
-#define BITS (8 * sizeof(long int))
+	if (frontend->no_forward || PARALLEL_MODE)
+		return 0;
 
-static void set_fd(unsigned long fd ,unsigned long *setp)
-{
-	unsigned long tmp = fd / FD_SETSIZE;
-	unsigned long rem = fd % FD_SETSIZE;
-	setp[tmp] |= (1UL<<rem);
+	if (QUERY_CACHE_AVAILABLE)
+		return 0;
+
+	for (i=0;i<NUM_BACKENDS;i++)
+	{
+		if (VALID_BACKEND(i) && ++n > 1)
+			return 0;
+	}
+	return n == 1;
 }
 
-/* used only in pool_parallel_exec */
-static int isset_fd(unsigned long fd, unsigned long *setp)
+/*
+ * Update the event set used to wait for frontend and backends.
+ * Registrations are kept across calls, so system calls are issued
+ * only when the descriptors to be watched change: e.g. frontend is
+ * muted while backends process a query, or load balance node is
+ * changed.  Returns NULL on error.
+ */
+static POOL_EVENT_SET *prepare_query_events(POOL_CONNECTION *frontend, POOL_CONNECTION_POOL *backend, int watch_frontend)
 {
-	unsigned long tmp = fd / FD_SETSIZE;
-	unsigned long rem = fd % FD_SETSIZE;
-	return (setp[tmp] & (1UL<<rem)) != 0;
+	int i;
+
+	if (query_events == NULL)
+	{
+		query_events = pool_event_create();
+		if (query_events == NULL)
+			return NULL;
+	}
+
+	/* session changed. forget descriptors of previous one */
+	if (query_events_frontend != frontend || query_events_backend != backend)
+	{
+		pool_event_clear(query_events);
+		query_events_frontend = frontend;
+		query_events_backend = backend;
+	}
+
+	if (pool_event_watch(query_events, frontend->fd,
+						 watch_frontend ? POOL_EVENT_READ|POOL_EVENT_EXCEPT : 0) < 0)
+		return NULL;
+
+	for (i=0;i<pool_config->backend_desc->num_backends;i++)
+	{
+		int ev = 0;
+
+		if (CONNECTION_SLOT(backend, i) == NULL)
+			continue;
+
+		if (i < NUM_BACKENDS && VALID_BACKEND(i))
+			ev = POOL_EVENT_READ|POOL_EVENT_EXCEPT;
+
+		if (pool_event_watch(query_events, CONNECTION(backend, i)->fd, ev) < 0)
+			return NULL;
+	}
+
+	return query_events;
 }
 
-/* used only in pool_parallel_exec */
-static void zero_fd(unsigned long *setp)
+/*
+ * Fan-in of replies from backends. Wait until at least one of the
+ * backends flagged in pending[] has data to read and set ready[] for
+ * them, so that callers consume replies in the order they arrive
+ * instead of blocking on the slowest node first. Backends having
+ * data in the read buffer (or in the SSL layer, which cannot be
+ * polled) are ready without waiting. The wait is bounded by the same
+ * timeout as pool_check_fd. Returns the number of ready backends, or
+ * -1 on error or timeout.
+ */
+static int wait_for_backends(POOL_CONNECTION_POOL *backend, int *pending, int *ready)
 {
-	unsigned long *tmp = setp;
-	int i = FD_SETSIZE / BITS;
-	while(i)
+	int fds[MAX_NUM_BACKENDS];
+	int revents[MAX_NUM_BACKENDS];
+	int nodes[MAX_NUM_BACKENDS];
+	int num = 0;
+	int nready = 0;
+	int timeout;
+	int i;
+
+	for (i=0;i<NUM_BACKENDS;i++)
+	{
+		POOL_CONNECTION *cp;
+
+		ready[i] = 0;
+
+		if (!pending[i])
+			continue;
+
+		cp = CONNECTION(backend, i);
+		if (cp->len > 0 || cp->ssl_active > 0)
+		{
+			ready[i] = 1;
+			nready++;
+		}
+		else
+		{
+			nodes[num] = i;
+			fds[num++] = cp->fd;
+		}
+	}
+
+	if (nready > 0 || num == 0)
+		return nready;
+
+	timeout = timeoutsec > 0 ? timeoutsec * 1000 : -1;
+
+	for (;;)
 	{
-		i--;
-		*tmp = 0;
-		tmp++;
+		int fdnum = pool_event_wait_fds(fds, revents, num, timeout);
+
+		if (fdnum > 0)
+			break;
+
+		if (fdnum == 0)
+		{
+			for (i=0;i<num;i++)
+				pool_error("wait_for_backends: data is not ready in DB node: %d", nodes[i]);
+			return -1;
+		}
+
+		if (errno == EINTR)
+			continue;
+
+		pool_error("wait_for_backends: pool_event_wait_fds() failed. reason: %s", strerror(errno));
+		return -1;
+	}
+
+	for (i=0;i<num;i++)
+	{
+		if (revents[i])
+		{
+			ready[nodes[i]] = 1;
+			nready++;
+		}
 	}
+	return nready;
 }
 
 /*
@@ -548,17 +689,15 @@ POOL_STATUS pool_parallel_exec(POOL_CONNECTION *frontend,
 	int fds;
 	int i;
 	char kind;
-	fd_set readmask;
-	fd_set writemask;
-	fd_set exceptmask;
-	unsigned long donemask[FD_SETSIZE / BITS];
+	POOL_EVENT_SET *events;
 	static char *sq = "show pool_status";
 	POOL_STATUS status;
 	struct timeval timeout;
-	int num_fds;
 	int used_count = 0;
 	int error_flag = 0;
 	unsigned long datacount = 0;
+	int started[MAX_NUM_BACKENDS];	/* header of the reply was read */
+	bool header_sent = false;
 
 	timeout.tv_sec = 1;
 	timeout.tv_usec = 0;
@@ -583,7 +722,7 @@ POOL_STATUS pool_parallel_exec(POOL_CONNECTION *frontend,
 	{
 		pool_debug("process reporting");
 		process_reporting(frontend, backend);
-		in_progress = 0;
+		session_context->in_progress = 0;
 		return POOL_CONTINUE;
 	}
 
@@ -593,25 +732,25 @@ POOL_STATUS pool_parallel_exec(POOL_CONNECTION *frontend,
 		if (!VALID_BACKEND(i))
 			continue;
 
-		pool_write(CONNECTION(backend, i), "Q", 1);
+		if (write_simplequery_message(CONNECTION(backend, i), len, string, MAJOR(backend)) != POOL_CONTINUE)
+			return POOL_END;
+	}
 
-		if (MAJOR(backend) == PROTO_MAJOR_V3)
-		{
-			int sendlen = htonl(len + 4);
-			pool_write(CONNECTION(backend, i), &sendlen, sizeof(sendlen));
- 		}
+	/* send the query to all backends before waiting for any of them */
+	if (flush_backends(backend) != POOL_CONTINUE)
+		return POOL_END;
 
-		if (pool_write_and_flush(CONNECTION(backend, i), string, len) < 0)
+	/*
+	 * in "strict mode" we need to wait for backend completing the query.
+	 * note that this is not applied if "NO STRICT" is specified as a comment.
+	 */
+	if (is_strict_query(node))
+	{
+		for (i=0;i<NUM_BACKENDS;i++)
 		{
-			return POOL_END;
-		}
+			if (!VALID_BACKEND(i))
+				continue;
 
-		/*
-		 * in "strict mode" we need to wait for backend completing the query.
-		 * note that this is not applied if "NO STRICT" is specified as a comment.
-		 */
-		if (is_strict_query(node))
-		{
 			pool_debug("waiting for backend %d completing the query", i);
 			if (synchronize(CONNECTION(backend, i)))
 				return POOL_END;
@@ -623,197 +762,191 @@ POOL_STATUS pool_parallel_exec(POOL_CONNECTION *frontend,
 		return POOL_END;
 	}
 
-	zero_fd(donemask);
+	/*
+	 * Backends which completed the query are muted in the event set.
+	 * They are watched again by the next prepare_query_events call.
+	 */
+	events = prepare_query_events(frontend, backend, 0);
+	if (events == NULL)
+		return POOL_ERROR;
+
+	memset(started, 0, sizeof(started));
 
 	/* In this loop, receive data from the all backends and send data to frontend */
 	for (;;)
 	{
-		FD_ZERO(&readmask);
-		FD_ZERO(&writemask);
-		FD_ZERO(&exceptmask);
-		num_fds = 0;
-
-		for (i=0;i<NUM_BACKENDS;i++)
-		{
-			if (VALID_BACKEND(i))
-			{
-				int fd = CONNECTION(backend,i)->fd;
-				num_fds = Max(fd + 1, num_fds);
-				if(!isset_fd(fd,donemask))
-				{
-					FD_SET(fd, &readmask);
-					FD_SET(fd, &exceptmask);
-					pool_debug("pool_parallel_query:  %d th FD_SET: %d",i, CONNECTION(backend, i)->fd);
-				}
-			}
-		}
-
-		pool_debug("pool_parallel_query: num_fds: %d", num_fds);
-
-		fds = select(num_fds, &readmask, &writemask, &exceptmask, NULL);
+		fds = pool_event_wait(events, -1);
 
 		if (fds == -1)
 		{
 			if (errno == EINTR)
 				continue;
 
-				pool_error("select() failed. reason: %s", strerror(errno));
+			pool_error("pool_parallel_exec: pool_event_wait() failed. reason: %s", strerror(errno));
 			return POOL_ERROR;
-		 }
+		}
 
 		if (fds == 0)
-		{
-			return POOL_CONTINUE;
-		}
+			continue;
 
-		/* get header of protocol */
 		for (i=0;i<NUM_BACKENDS;i++)
 		{
 			if (!VALID_BACKEND(i) ||
-				!FD_ISSET(CONNECTION(backend, i)->fd, &readmask))
+				!(pool_event_ready(events, CONNECTION(backend, i)->fd) & POOL_EVENT_READ))
 			{
 				continue;
 			}
-			else
-			{
-				status = read_kind_from_one_backend(frontend, backend, &kind,i);
-				if (status != POOL_CONTINUE)
-					return status;
 
-				if (used_count == 0)
-				{
-					status = ParallelForwardToFrontend(kind,
-														frontend,
-														CONNECTION(backend, i),
-														backend->info->database,
-														send_to_frontend);
-					pool_debug("pool_parallel_exec: kind from backend: %c", kind);
-				}
-				else
-				{
-					status = ParallelForwardToFrontend(kind,
-														frontend,
-														CONNECTION(backend, i),
-														backend->info->database,
-														false);
-					pool_debug("pool_parallel_exec: dummy kind from backend: %c", kind);
-				}
-
-				if (status != POOL_CONTINUE)
-					return status;
-
-				if(kind == 'C' || kind == 'E' || kind == 'c')
-				{
-					if(used_count == NUM_BACKENDS -1)
-						return POOL_CONTINUE;
-
-					used_count++;
-					set_fd(CONNECTION(backend, i)->fd, donemask);
-					continue;
-				}
-
-				/* get body of protocol */
-				for(;;)
+			/*
+			 * Relay messages of this backend while they are at hand, then
+			 * go back to waiting so that rows of all backends are relayed
+			 * as they arrive rather than one backend after another.
+			 */
+			do
+			{
+				/* get header of protocol */
+				if (!started[i])
 				{
-					if (pool_read(CONNECTION(backend, i), &kind, 1) < 0)
-					{
-						pool_error("pool_parallel_exec: failed to read kind from %d th backend", i);
-						return POOL_ERROR;
-					}
+					started[i] = 1;
 
-					/*
-					 * Sanity check
-					 */
-					if (kind == 0)
-					{
-						pool_error("pool_parallel_exec: kind is 0!");
-						return POOL_ERROR;
-					}
+					status = read_kind_from_one_backend(frontend, backend, &kind,i);
+					if (status != POOL_CONTINUE)
+						return status;
 
-					if((kind == 'E' ) &&
-						used_count != NUM_BACKENDS -1)
+					if (!header_sent)
 					{
-						if(error_flag ==0)
-						{
-							pool_debug("pool_parallel_exec: kind from backend: %c", kind);
-
-							status = ParallelForwardToFrontend(kind,
+						status = ParallelForwardToFrontend(kind,
 															frontend,
 															CONNECTION(backend, i),
 															backend->info->database,
 															send_to_frontend);
-							error_flag++;
-						} else {
-							pool_debug("pool_parallel_exec: dummy from backend: %c", kind);
-							status = ParallelForwardToFrontend(kind,
-															frontend,
-															CONNECTION(backend, i),
-															backend->info->database,
-															false);
-						}
-						used_count++;
-						set_fd(CONNECTION(backend, i)->fd, donemask);
-						break;
+						header_sent = true;
+						pool_debug("pool_parallel_exec: kind from backend: %c", kind);
 					}
-
-					if((kind == 'c' || kind == 'C') &&
-					   used_count != NUM_BACKENDS -1)
+					else
 					{
-						pool_debug("pool_parallel_exec: dummy from backend: %c", kind);
 						status = ParallelForwardToFrontend(kind,
 															frontend,
 															CONNECTION(backend, i),
 															backend->info->database,
 															false);
-						used_count++;
-						set_fd(CONNECTION(backend, i)->fd, donemask);
-						break;
+						pool_debug("pool_parallel_exec: dummy kind from backend: %c", kind);
 					}
-					if((kind == 'C' || kind == 'c' || kind == 'E') &&
-						used_count == NUM_BACKENDS -1)
+
+					if (status != POOL_CONTINUE)
+						return status;
+
+					if(kind == 'C' || kind == 'E' || kind == 'c')
 					{
-						pool_debug("pool_parallel_exec: kind from backend: D %lu", datacount);
+						if(used_count == NUM_BACKENDS -1)
+							return POOL_CONTINUE;
 
-						if(error_flag == 0)
-						{
-							pool_debug("pool_parallel_exec: kind from backend: %c", kind);
-							status = ParallelForwardToFrontend(kind,
-															frontend,
-															CONNECTION(backend, i),
-															backend->info->database,
-															send_to_frontend);
-						} else {
-							pool_debug("pool_parallel_exec: dummy from backend: %c", kind);
-							status = ParallelForwardToFrontend(kind,
-															frontend,
-															CONNECTION(backend, i),
-															backend->info->database,
-															false);
-						}
-						return POOL_CONTINUE;
+						used_count++;
+						pool_event_watch(events, CONNECTION(backend, i)->fd, 0);
+						break;
 					}
+					continue;
+				}
 
-					if(kind == 'D')
-						datacount++;
-					else
+				/* get body of protocol */
+				if (pool_read(CONNECTION(backend, i), &kind, 1) < 0)
+				{
+					pool_error("pool_parallel_exec: failed to read kind from %d th backend", i);
+					return POOL_ERROR;
+				}
+
+				/*
+				 * Sanity check
+				 */
+				if (kind == 0)
+				{
+					pool_error("pool_parallel_exec: kind is 0!");
+					return POOL_ERROR;
+				}
+
+				if((kind == 'E' ) &&
+					used_count != NUM_BACKENDS -1)
+				{
+					if(error_flag ==0)
+					{
 						pool_debug("pool_parallel_exec: kind from backend: %c", kind);
 
-					status = ParallelForwardToFrontend(kind,
+						status = ParallelForwardToFrontend(kind,
 														frontend,
 														CONNECTION(backend, i),
 														backend->info->database,
 														send_to_frontend);
-
-					if (status != POOL_CONTINUE)
-					{
-						return status;
+						error_flag++;
+					} else {
+						pool_debug("pool_parallel_exec: dummy from backend: %c", kind);
+						status = ParallelForwardToFrontend(kind,
+														frontend,
+														CONNECTION(backend, i),
+														backend->info->database,
+														false);
 					}
-					else
+					used_count++;
+					pool_event_watch(events, CONNECTION(backend, i)->fd, 0);
+					break;
+				}
+
+				if((kind == 'c' || kind == 'C') &&
+				   used_count != NUM_BACKENDS -1)
+				{
+					pool_debug("pool_parallel_exec: dummy from backend: %c", kind);
+					status = ParallelForwardToFrontend(kind,
+														frontend,
+														CONNECTION(backend, i),
+														backend->info->database,
+														false);
+					used_count++;
+					pool_event_watch(events, CONNECTION(backend, i)->fd, 0);
+					break;
+				}
+				if((kind == 'C' || kind == 'c' || kind == 'E') &&
+					used_count == NUM_BACKENDS -1)
+				{
+					pool_debug("pool_parallel_exec: kind from backend: D %lu", datacount);
+
+					if(error_flag == 0)
 					{
-						pool_flush(frontend);
+						pool_debug("pool_parallel_exec: kind from backend: %c", kind);
+						status = ParallelForwardToFrontend(kind,
+														frontend,
+														CONNECTION(backend, i),
+														backend->info->database,
+														send_to_frontend);
+					} else {
+						pool_debug("pool_parallel_exec: dummy from backend: %c", kind);
+						status = ParallelForwardToFrontend(kind,
+														frontend,
+														CONNECTION(backend, i),
+														backend->info->database,
+														false);
 					}
+					return POOL_CONTINUE;
 				}
-			}
+
+				if(kind == 'D')
+					datacount++;
+				else
+					pool_debug("pool_parallel_exec: kind from backend: %c", kind);
+
+				status = ParallelForwardToFrontend(kind,
+													frontend,
+													CONNECTION(backend, i),
+													backend->info->database,
+													send_to_frontend);
+
+				if (status != POOL_CONTINUE)
+				{
+					return status;
+				}
+				else
+				{
+					pool_flush(frontend);
+				}
+			} while (CONNECTION(backend, i)->len > 0 || CONNECTION(backend, i)->ssl_active > 0);
 		}
 	}
 }
@@ -825,18 +958,59 @@ POOL_STATUS pool_parallel_exec(POOL_CONNECTION *frontend,
  */
 POOL_STATUS send_simplequery_message(POOL_CONNECTION *backend, int len, char *string, int major)
 {
-	/* forward the query to the backend */
-	pool_write(backend, "Q", 1);
+	if (write_simplequery_message(backend, len, string, major) != POOL_CONTINUE)
+		return POOL_END;
+
+	if (pool_flush(backend) < 0)
+	{
+		return POOL_END;
+	}
+
+	return POOL_CONTINUE;
+}
+
+/*
+ * Put SimpleQuery message into the write buffer of a node without
+ * flushing it. When a query goes to several nodes, callers write it to
+ * all of them and then call flush_backends(), so that every node has
+ * received the query before we start waiting for any reply.
+ */
+POOL_STATUS write_simplequery_message(POOL_CONNECTION *backend, int len, char *string, int major)
+{
+	/* forward the query to the backend */
+	if (pool_write(backend, "Q", 1) < 0)
+		return POOL_END;
+
+	if (major == PROTO_MAJOR_V3)
+	{
+		int sendlen = htonl(len + 4);
+		if (pool_write(backend, &sendlen, sizeof(sendlen)) < 0)
+			return POOL_END;
+	}
+
+	if (pool_write(backend, string, len) < 0)
+	{
+		return POOL_END;
+	}
+
+	return POOL_CONTINUE;
+}
+
+/*
+ * Flush write buffers of all valid nodes. Nodes with an empty buffer
+ * (e.g. the master node already waited for) are not touched.
+ */
+POOL_STATUS flush_backends(POOL_CONNECTION_POOL *backend)
+{
+	int i;
 
-	if (major == PROTO_MAJOR_V3)
+	for (i=0;i<NUM_BACKENDS;i++)
 	{
-		int sendlen = htonl(len + 4);
-		pool_write(backend, &sendlen, sizeof(sendlen));
-	}
+		if (!VALID_BACKEND(i))
+			continue;
 
-	if (pool_write_and_flush(backend, string, len) < 0)
-	{
-		return POOL_END;
+		if (pool_flush(CONNECTION(backend, i)) < 0)
+			return POOL_END;
 	}
 
 	return POOL_CONTINUE;
@@ -928,6 +1102,25 @@ POOL_STATUS wait_for_query_response(POOL_CONNECTION *frontend, POOL_CONNECTION *
 POOL_STATUS send_extended_protocol_message(POOL_CONNECTION_POOL *backend,
 												  int node_id, char *kind,
 												  int len, char *string)
+{
+	if (write_extended_protocol_message(backend, node_id, kind, len, string) != POOL_CONTINUE)
+		return POOL_ERROR;
+
+	if (pool_flush(CONNECTION(backend, node_id)) < 0)
+	{
+		return POOL_ERROR;
+	}
+
+	return POOL_CONTINUE;
+}
+
+/*
+ * Same as send_extended_protocol_message() but leaves the message in
+ * the write buffer. See write_simplequery_message().
+ */
+POOL_STATUS write_extended_protocol_message(POOL_CONNECTION_POOL *backend,
+											int node_id, char *kind,
+											int len, char *string)
 {
 	POOL_CONNECTION *cp = CONNECTION(backend, node_id);
 	int sendlen;
@@ -944,7 +1137,7 @@ POOL_STATUS send_extended_protocol_message(POOL_CONNECTION_POOL *backend,
 	 */
 	pool_write(cp, "H", 1);
 	sendlen = htonl(4);
-	if (pool_write_and_flush(cp, &sendlen, sizeof(sendlen)) < 0)
+	if (pool_write(cp, &sendlen, sizeof(sendlen)) < 0)
 	{
 		return POOL_ERROR;
 	}
@@ -958,6 +1151,12 @@ POOL_STATUS send_execute_message(POOL_CONNECTION_POOL *backend,
 	return send_extended_protocol_message(backend, node_id, "E", len, string);
 }
 
+POOL_STATUS write_execute_message(POOL_CONNECTION_POOL *backend,
+								  int node_id, int len, char *string)
+{
+	return write_extended_protocol_message(backend, node_id, "E", len, string);
+}
+
 /*
  * wait until read data is ready
  */
@@ -984,44 +1183,32 @@ void pool_set_timeout(int timeoutval)
  */
 int pool_check_fd(POOL_CONNECTION *cp)
 {
-	fd_set readmask;
-	fd_set exceptmask;
 	int fd;
-	int fds;
-	struct timeval timeout;
-	struct timeval *timeoutp;
+	int ready;
+	int timeout;
 
 	fd = cp->fd;
 
 	if (timeoutsec > 0)
-	{
-		timeout.tv_sec = timeoutsec;
-		timeout.tv_usec = 0;
-		timeoutp = &timeout;
-	}
+		timeout = timeoutsec * 1000;
 	else
-		timeoutp = NULL;
+		timeout = -1;
 
 	for (;;)
 	{
-		FD_ZERO(&readmask);
-		FD_ZERO(&exceptmask);
-		FD_SET(fd, &readmask);
-		FD_SET(fd, &exceptmask);
-
-		fds = select(fd+1, &readmask, NULL, &exceptmask, timeoutp);
-		if (fds == -1)
+		ready = pool_event_wait_fd(fd, timeout);
+		if (ready == -1)
 		{
 			if (errno == EAGAIN || errno == EINTR)
 				continue;
 
-			pool_error("pool_check_fd: select() failed. reason %s", strerror(errno));
+			pool_error("pool_check_fd: poll() failed. reason %s", strerror(errno));
 			break;
 		}
-		else if (fds == 0)		/* timeout */
+		else if (ready == 0)		/* timeout */
 			return 1;
 
-		if (FD_ISSET(fd, &exceptmask))
+		if (ready & POOL_EVENT_EXCEPT)
 		{
 			pool_error("pool_check_fd: exception occurred");
 			break;
@@ -1120,7 +1307,7 @@ static POOL_STATUS ParallelForwardToFrontend(char kind, POOL_CONNECTION *fronten
 	if (send_to_frontend)
 	{
 		status = pool_write(frontend, p, len);
-		if (pool_config->enable_query_cache && SYSDB_STATUS == CON_UP && status == 0)
+		if (QUERY_CACHE_AVAILABLE && status == 0)
 		{
 			query_cache_register(kind, frontend, database, p, len);
 		}
@@ -1142,6 +1329,9 @@ POOL_STATUS SimpleForwardToFrontend(char kind, POOL_CONNECTION *frontend, POOL_C
 	int delete_or_update = 0;
 	char kind1;
 	POOL_STATUS ret;
+	int pending[MAX_NUM_BACKENDS];	/* message is not read yet */
+	int ready[MAX_NUM_BACKENDS];	/* reply arrived */
+	int num_pending = 0;
 
 	/*
 	 * Check if packet kind == 'C'(Command complete), '1'(Parse
@@ -1149,36 +1339,36 @@ POOL_STATUS SimpleForwardToFrontend(char kind, POOL_CONNECTION *frontend, POOL_C
 	 * unregister pending prepared statement.
 	 */
 	if ((kind == 'C' || kind == '1' || kind == '3') &&
-		pending_function)
+		session_context->pending_function)
 	{
-		pending_function(&prepared_list, pending_prepared_portal);
-		if (pending_prepared_portal &&
-			pending_prepared_portal->stmt &&
-			IsA(pending_prepared_portal->stmt, DeallocateStmt))
+		session_context->pending_function(session_context->prepared_list, session_context->pending_prepared_portal);
+		if (session_context->pending_prepared_portal &&
+			session_context->pending_prepared_portal->stmt &&
+			IsA(session_context->pending_prepared_portal->stmt, DeallocateStmt))
 		{
-			free(pending_prepared_portal->portal_name);
-			pending_prepared_portal->portal_name = NULL;
-			pool_memory_delete(pending_prepared_portal->prepare_ctxt, 0);
-			free(pending_prepared_portal);
+			free(session_context->pending_prepared_portal->portal_name);
+			session_context->pending_prepared_portal->portal_name = NULL;
+			pool_memory_delete(session_context->pending_prepared_portal->prepare_ctxt, 0);
+			free(session_context->pending_prepared_portal);
 		}
 	}
-	else if (kind == 'E' && pending_function)
+	else if (kind == 'E' && session_context->pending_function)
 	{
 		/* An error occurred with PREPARE or DEALLOCATE command.
 		 * Free pending portal object.
 		 */
-		if (pending_prepared_portal)
+		if (session_context->pending_prepared_portal)
 		{
-			free(pending_prepared_portal->portal_name);
-			pending_prepared_portal->portal_name = NULL;
-			pool_memory_delete(pending_prepared_portal->prepare_ctxt, 0);
-			free(pending_prepared_portal);
+			free(session_context->pending_prepared_portal->portal_name);
+			session_context->pending_prepared_portal->portal_name = NULL;
+			pool_memory_delete(session_context->pending_prepared_portal->prepare_ctxt, 0);
+			free(session_context->pending_prepared_portal);
 		}
 	}
-	else if (kind == 'C' && select_in_transaction)
+	else if (kind == 'C' && session_context->select_in_transaction)
 	{
-		select_in_transaction = 0;
-		execute_select = 0;
+		session_context->select_in_transaction = 0;
+		session_context->execute_select = 0;
 	}
 
 	/*
@@ -1187,8 +1377,8 @@ POOL_STATUS SimpleForwardToFrontend(char kind, POOL_CONNECTION *frontend, POOL_C
 	 */
 	if (kind != 'N')
 	{
-		pending_function = NULL;
-		pending_prepared_portal = NULL;
+		session_context->pending_function = NULL;
+		session_context->pending_prepared_portal = NULL;
 	}
 
 	status = pool_read(MASTER(backend), &len, sizeof(len));
@@ -1215,7 +1405,7 @@ POOL_STATUS SimpleForwardToFrontend(char kind, POOL_CONNECTION *frontend, POOL_C
 		 * if we are in the parallel mode, we have to sum up the number
 		 * of affected rows
 		 */
-		if (PARALLEL_MODE && is_parallel_table &&
+		if (PARALLEL_MODE && session_context->is_parallel_table &&
 			(strstr(p, "UPDATE") || strstr(p, "DELETE")))
 		{
 			delete_or_update = 1;
@@ -1224,12 +1414,33 @@ POOL_STATUS SimpleForwardToFrontend(char kind, POOL_CONNECTION *frontend, POOL_C
 
 	for (i=0;i<NUM_BACKENDS;i++)
 	{
-		if (VALID_BACKEND(i) && !IS_MASTER_NODE_ID(i))
+		pending[i] = VALID_BACKEND(i) && !IS_MASTER_NODE_ID(i);
+		if (pending[i])
+			num_pending++;
+	}
+
+	/* read the message from other backends in the order they reply */
+	while (num_pending > 0)
+	{
+		if (wait_for_backends(backend, pending, ready) < 0)
+		{
+			free(p1);
+			return POOL_ERROR;
+		}
+
+		for (i=0;i<NUM_BACKENDS;i++)
 		{
+			if (!ready[i])
+				continue;
+
+			pending[i] = 0;
+			num_pending--;
+
 			status = pool_read(CONNECTION(backend, i), &len, sizeof(len));
 			if (status < 0)
 			{
 				pool_error("SimpleForwardToFrontend: error while reading message length");
+				free(p1);
 				return POOL_END;
 			}
 
@@ -1238,7 +1449,10 @@ POOL_STATUS SimpleForwardToFrontend(char kind, POOL_CONNECTION *frontend, POOL_C
 
 			p = pool_read2(CONNECTION(backend, i), len);
 			if (p == NULL)
+			{
+				free(p1);
 				return POOL_END;
+			}
 
 			if (len != len1)
 			{
@@ -1260,13 +1474,13 @@ POOL_STATUS SimpleForwardToFrontend(char kind, POOL_CONNECTION *frontend, POOL_C
 				}
 				else if (command_ok_row_count != n) /* mismatch update rows */
 				{
-					mismatch_ntuples = 1;
+					session_context->mismatch_ntuples = 1;
 				}
 			}
 		}
 	}
 
-	if (mismatch_ntuples)
+	if (session_context->mismatch_ntuples)
 	{
 		String *msg = init_string("pgpool detected difference of the number of inserted, updated or deleted tuples. Possible last query was: \"");
 		string_append_char(msg, query_string_buffer);
@@ -1306,7 +1520,7 @@ POOL_STATUS SimpleForwardToFrontend(char kind, POOL_CONNECTION *frontend, POOL_C
 	}
 
 	/* save the received result for each kind */
-	if (pool_config->enable_query_cache && SYSDB_STATUS == CON_UP)
+	if (QUERY_CACHE_AVAILABLE)
 	{
 		query_cache_register(kind, frontend, backend->info->database, p1, len1);
 	}
@@ -1351,11 +1565,11 @@ POOL_STATUS SimpleForwardToFrontend(char kind, POOL_CONNECTION *frontend, POOL_C
 			}
 		}
 
-		if (select_in_transaction)
+		if (session_context->select_in_transaction)
 		{
 			int i;
 
-			in_load_balance = 0;
+			session_context->in_load_balance = 0;
 			REPLICATION = 1;
 			for (i = 0; i < NUM_BACKENDS; i++)
 			{
@@ -1370,14 +1584,14 @@ POOL_STATUS SimpleForwardToFrontend(char kind, POOL_CONNECTION *frontend, POOL_C
 					 * Because extended query protocol ignores all
 					 * messages before receiving Sync message inside error state.
 					 */
-					if (execute_select)
+					if (session_context->execute_select)
 						do_error_execute_command(backend, i, PROTO_MAJOR_V3);
 					else
 						do_error_command(CONNECTION(backend, i), PROTO_MAJOR_V3);
 				}
 			}
-			select_in_transaction = 0;
-			execute_select = 0;
+			session_context->select_in_transaction = 0;
+			session_context->execute_select = 0;
 		}
 
 		for (i = 0;i < NUM_BACKENDS; i++)
@@ -1517,10 +1731,10 @@ POOL_STATUS SimpleForwardToBackend(char kind, POOL_CONNECTION *frontend, POOL_CO
 		stmt_name = p + strlen(portal_name) + 1;
 
 		if (*stmt_name == '\0')
-			portal = unnamed_statement;
+			portal = session_context->unnamed_statement;
 		else
 		{
-			portal = lookup_prepared_statement_by_statement(&prepared_list, stmt_name);
+			portal = lookup_prepared_statement_by_statement(session_context->prepared_list, stmt_name);
 			portal->portal_name = strdup(portal_name);
 		}
 
@@ -1543,7 +1757,7 @@ POOL_STATUS SimpleForwardToBackend(char kind, POOL_CONNECTION *frontend, POOL_CO
 		snprintf(msgbuf, sizeof(msgbuf), "%c message", kind);
 		per_node_statement_log(backend, MASTER_NODE_ID, msgbuf);
 
-		if (send_extended_protocol_message(backend, MASTER_NODE_ID, &kind, len, p))
+		if (write_extended_protocol_message(backend, MASTER_NODE_ID, &kind, len, p))
 			return POOL_END;
 
 		if (REPLICATION || PARALLEL_MODE || MASTER_SLAVE)
@@ -1556,11 +1770,14 @@ POOL_STATUS SimpleForwardToBackend(char kind, POOL_CONNECTION *frontend, POOL_CO
 					per_node_statement_log(backend, i, msgbuf);
 
 					/* Forward to other nodes */
-					if (send_extended_protocol_message(backend, i, &kind, len, p))
+					if (write_extended_protocol_message(backend, i, &kind, len, p))
 						return POOL_END;
 				}
 			}
 		}
+
+		if (flush_backends(backend) != POOL_CONTINUE)
+			return POOL_END;
 	}
 	else	/* Other than Bind, Describe or Close message */
 	{
@@ -1609,14 +1826,14 @@ POOL_STATUS SimpleForwardToBackend(char kind, POOL_CONNECTION *frontend, POOL_CO
 		pool_debug("bind message: portal_name %s stmt_name %s", portal_name, stmt_name);
 
 		if (*stmt_name == '\0')
-			portal = unnamed_statement;
+			portal = session_context->unnamed_statement;
 		else
 		{
-			portal = lookup_prepared_statement_by_statement(&prepared_list, stmt_name);
+			portal = lookup_prepared_statement_by_statement(session_context->prepared_list, stmt_name);
 		}
 
 		if (*portal_name == '\0'){
-			unnamed_portal = portal;
+			session_context->unnamed_portal = portal;
 		}
 		else if (portal)
 		{
@@ -1624,6 +1841,15 @@ POOL_STATUS SimpleForwardToBackend(char kind, POOL_CONNECTION *frontend, POOL_CO
 				free(portal->portal_name);
 			portal->portal_name = strdup(portal_name);
 		}
+
+		/* parameters and result formats are part of query cache key */
+		if (portal && QUERY_CACHE_AVAILABLE)
+		{
+			char *params = stmt_name + strlen(stmt_name) + 1;
+
+			pool_md5_hash(params, len - (params - p), portal->bind_md5);
+		}
+
 		if (rewrite_msg)
 			free(rewrite_msg);
 	}
@@ -1634,14 +1860,14 @@ POOL_STATUS SimpleForwardToBackend(char kind, POOL_CONNECTION *frontend, POOL_CO
 		POOL_MEMORY_POOL *old_context = pool_memory;
 		DeallocateStmt *deallocate_stmt;
 
-		pending_prepared_portal = create_portal();
-		if (pending_prepared_portal == NULL)
+		session_context->pending_prepared_portal = create_portal();
+		if (session_context->pending_prepared_portal == NULL)
 		{
 			pool_error("SimpleForwardToBackend: malloc failed: %s", strerror(errno));
 			return POOL_END;
 		}
 
-		pool_memory = pending_prepared_portal->prepare_ctxt;
+		pool_memory = session_context->pending_prepared_portal->prepare_ctxt;
 		name = pstrdup(p+1);
 		if (name == NULL)
 		{
@@ -1659,9 +1885,9 @@ POOL_STATUS SimpleForwardToBackend(char kind, POOL_CONNECTION *frontend, POOL_CO
 			return POOL_END;
 		}
 		deallocate_stmt->name = name;
-		pending_prepared_portal->stmt = (Node *)deallocate_stmt;
-		pending_prepared_portal->portal_name = NULL;
-		pending_function = del_prepared_list;
+		session_context->pending_prepared_portal->stmt = (Node *)deallocate_stmt;
+		session_context->pending_prepared_portal->portal_name = NULL;
+		session_context->pending_function = del_prepared_list;
 		pool_memory = old_context;
 	}
 
@@ -1840,33 +2066,52 @@ POOL_STATUS ParameterStatus(POOL_CONNECTION *frontend, POOL_CONNECTION_POOL *bac
  */
 void reset_variables(void)
 {
-	in_progress = 0;
+	session_context->in_progress = 0;
 
 	/* End load balance mode */
-	if (in_load_balance)
+	if (session_context->in_load_balance)
 		end_load_balance();
 
-	if (master_slave_dml)
+	if (session_context->master_slave_dml)
 	{
 		MASTER_SLAVE = 1;
-		master_slave_was_enabled = 0;
-		master_slave_dml = 0;
-		if (force_replication)
+		session_context->master_slave_was_enabled = 0;
+		session_context->master_slave_dml = 0;
+		if (session_context->force_replication)
 		{
-			force_replication = 0;
+			session_context->force_replication = 0;
 			REPLICATION = 0;
-			replication_was_enabled = 0;
+			session_context->replication_was_enabled = 0;
 		}
 	}
 
-	internal_transaction_started = 0;
-	mismatch_ntuples = 0;
-	select_in_transaction = 0;
-	execute_select = 0;
-	receive_extended_begin = 0;
+	session_context->internal_transaction_started = 0;
+	session_context->mismatch_ntuples = 0;
+	session_context->select_in_transaction = 0;
+	session_context->execute_select = 0;
+	session_context->receive_extended_begin = 0;
+	session_context->session_state_modified = 0;
 }
 
 
+/*
+ * Return non 0 if the session left something which has to be reset
+ * by reset_query_list before the connection is reused: the
+ * transaction is not finished, prepared statements remain or session
+ * level state such as run time parameters and temporary tables might
+ * have been created.
+ */
+int need_reset_connection(POOL_CONNECTION_POOL *backend)
+{
+	if (TSTATE(backend) != 'I')
+		return 1;
+
+	if (session_context->prepared_list->cnt > 0)
+		return 1;
+
+	return session_context->session_state_modified;
+}
+
 /*
  * if connection_cache == 0, we don't need reset_query.
  * but we need reset prepared list.
@@ -1874,7 +2119,7 @@ void reset_variables(void)
 void reset_connection(void)
 {
 	reset_variables();
-	reset_prepared_list(&prepared_list);
+	reset_prepared_list(session_context->prepared_list);
 }
 
 
@@ -1900,7 +2145,7 @@ static int reset_backend(POOL_CONNECTION_POOL *backend, int qcnt)
 	 */
 	if (qcnt >= qn)
 	{
-		if (prepared_list.cnt == 0)
+		if (session_context->prepared_list->cnt == 0)
 		{
 			/*
 			 * Either no prepared objects were created or DISCARD ALL
@@ -1908,17 +2153,17 @@ static int reset_backend(POOL_CONNECTION_POOL *backend, int qcnt)
 			 * were executed.  The latter causes call to
 			 * reset_prepared_list which removes all prepared objects.
 			 */
-			reset_prepared_list(&prepared_list);
+			reset_prepared_list(session_context->prepared_list);
 			return 2;
 		}
 
 		/* Delete from prepared list */
-		if (send_deallocate(backend, &prepared_list, 0))
+		if (send_deallocate(backend, session_context->prepared_list, 0))
 		{
 			/* Deallocate failed. We are in unknown state. Ask caller
 			 * to reset backend connection.
 			 */
-			reset_prepared_list(&prepared_list);
+			reset_prepared_list(session_context->prepared_list);
 			return -1;
 		}
 		/*
@@ -1929,7 +2174,7 @@ static int reset_backend(POOL_CONNECTION_POOL *backend, int qcnt)
 		 * del_prepared_list() again. This is harmless since trying to
 		 * remove same prepared object will be ignored.
 		 */
-		del_prepared_list(&prepared_list, prepared_list.portal_list[0]);
+		del_prepared_list(session_context->prepared_list, session_context->prepared_list->portal_list[0]);
 		return 1;
 	}
 
@@ -1964,6 +2209,23 @@ int load_balance_enabled(POOL_CONNECTION_POOL *backend, Node* node, char *sql)
 			!is_sequence_query(node));
 }
 
+/*
+ * return non 0 if load balance is possible judging from the SQL
+ * string only. This is the same as load_balance_enabled() for a plain
+ * SELECT and lets the caller skip parsing it. 0 means that the query
+ * needs to be parsed to decide.
+ */
+int load_balance_enabled_without_parse(POOL_CONNECTION_POOL *backend, char *sql)
+{
+	return (pool_config->load_balance_mode &&
+			DUAL_MODE &&
+			!pool_config->parallel_mode &&
+			!QUERY_CACHE_AVAILABLE &&
+			MAJOR(backend) == PROTO_MAJOR_V3 &&
+			TSTATE(backend) == 'I' &&
+			is_read_only_select_query(sql));
+}
+
 
 /*
  * returns non 0 if the SQL statement can be load
@@ -2124,23 +2386,35 @@ void start_load_balance(POOL_CONNECTION_POOL *backend)
 	}
 #endif
 
+	/*
+	 * choose load balance node for each query. this must be done
+	 * before turning off replication mode, which makes VALID_BACKEND
+	 * see the master node only.
+	 */
+	if (pool_config->statement_level_load_balance)
+		backend->info->load_balancing_node = select_load_balancing_node();
+
 	/* temporarily turn off replication mode */
 	if (REPLICATION)
-		replication_was_enabled = 1;
+		session_context->replication_was_enabled = 1;
 	if (MASTER_SLAVE)
-		master_slave_was_enabled = 1;
+		session_context->master_slave_was_enabled = 1;
 
 	REPLICATION = 0;
 	MASTER_SLAVE = 0;
 
 #ifdef NOTUSED
-	backend->slots[0] = slots[selected_slot];
+	backend->slots[0] = slots[session_context->selected_slot];
 #endif
 	LOAD_BALANCE_STATUS(backend->info->load_balancing_node) = LOAD_SELECTED;
-	selected_slot = backend->info->load_balancing_node;
+	session_context->selected_slot = backend->info->load_balancing_node;
+
+	/* let other children know the node is busy */
+	MY_PROCESS_INFO.load_balance_node = session_context->selected_slot;
+	gettimeofday(&session_context->load_balance_start_time, NULL);
 
 	/* start load balancing */
-	in_load_balance = 1;
+	session_context->in_load_balance = 1;
 }
 
 /*
@@ -2148,19 +2422,73 @@ void start_load_balance(POOL_CONNECTION_POOL *backend)
  */
 void end_load_balance(void)
 {
-	in_load_balance = 0;
-	LOAD_BALANCE_STATUS(selected_slot) = LOAD_UNSELECTED;
+	session_context->in_load_balance = 0;
+	LOAD_BALANCE_STATUS(session_context->selected_slot) = LOAD_UNSELECTED;
+
+	if (MY_PROCESS_INFO.load_balance_node >= 0)
+	{
+		record_query_latency(MY_PROCESS_INFO.load_balance_node,
+							 &session_context->load_balance_start_time);
+		MY_PROCESS_INFO.load_balance_node = -1;
+	}
 
 	/* turn on replication mode */
-	REPLICATION = replication_was_enabled;
-	MASTER_SLAVE = master_slave_was_enabled;
+	REPLICATION = session_context->replication_was_enabled;
+	MASTER_SLAVE = session_context->master_slave_was_enabled;
 
-	replication_was_enabled = 0;
-	master_slave_was_enabled = 0;
+	session_context->replication_was_enabled = 0;
+	session_context->master_slave_was_enabled = 0;
 
 	pool_debug("end_load_balance: end load balance mode");
 }
 
+/*
+ * Update moving average of response time of the load balance node,
+ * which is used by load_balance_policy = 'latency'. Updates by
+ * concurrent children may be lost, which is harmless.
+ */
+static void record_query_latency(int node, struct timeval *start)
+{
+	struct timeval now;
+	long usec;
+	long latency;
+
+	gettimeofday(&now, NULL);
+	usec = (now.tv_sec - start->tv_sec) * 1000000L + (now.tv_usec - start->tv_usec);
+	if (usec < 0)
+		usec = 0;
+
+	/* 0 means no query has been recorded yet */
+	latency = BACKEND_INFO(node).query_latency;
+	if (latency == 0)
+		latency = usec;
+	else
+		latency += (usec - latency) / 8;
+
+	BACKEND_INFO(node).query_latency = latency > 0 ? latency : 1;
+}
+
+/*
+ * Returns non 0 if pool_process_query may return POOL_IDLE to let
+ * the child serve other sessions. Query cache registration and V2
+ * result processing keep their state in process wide variables, so
+ * the session must stay current until they finish.
+ */
+static int can_switch_session(POOL_CONNECTION_POOL *backend, int reset_request)
+{
+	if (!MULTIPLEXED_MODE || reset_request)
+		return 0;
+
+	/* query result is being registered to query cache */
+	if (session_context->parsed_query)
+		return 0;
+
+	if (session_context->in_progress && MAJOR(backend) != PROTO_MAJOR_V3)
+		return 0;
+
+	return 1;
+}
+
 /*
  * send error message to frontend
  */
@@ -2747,19 +3075,24 @@ void free_select_result(POOL_SELECT_RESULT *result)
 {
 	int i;
 
-	if (result->nullflags)
-		free(result->nullflags);
-
-	if (result->data)
+	if (result->data && result->nullflags)
 	{
-		for(i=0;i<result->numrows;i++)
+		int num_data = result->numrows * (result->rowdesc ? result->rowdesc->num_attrs : 1);
+
+		/* data is set only if the column is neither null nor empty */
+		for(i=0;i<num_data;i++)
 		{
-			if (result->data[i])
+			if (result->nullflags[i] > 0)
 				free(result->data[i]);
 		}
-		free(result->data);
 	}
 
+	if (result->nullflags)
+		free(result->nullflags);
+
+	if (result->data)
+		free(result->data);
+
 	if (result->rowdesc)
 	{
 		if (result->rowdesc->attrinfo)
@@ -3010,8 +3343,6 @@ POOL_STATUS do_query(POOL_CONNECTION *backend, char *query, POOL_SELECT_RESULT *
  						pool_read(backend, nullmap, nbytes);
  					}
 
-					res->numrows++;
-
 					for (i=0;i<num_fields;i++)
 					{
 						if (major == PROTO_MAJOR_V3)
@@ -3100,6 +3431,9 @@ POOL_STATUS do_query(POOL_CONNECTION *backend, char *query, POOL_SELECT_RESULT *
 							}
 						}
 					}
+
+					/* count the row after all the columns are read */
+					res->numrows++;
 				}
 				break;
 
@@ -3227,7 +3561,7 @@ POOL_STATUS insert_lock(POOL_CONNECTION *frontend, POOL_CONNECTION_POOL *backend
 						MASTER_CONNECTION(backend)->key, 0);
 	if (status == POOL_END)
 	{
-		internal_transaction_started = 0;
+		session_context->internal_transaction_started = 0;
 		return POOL_END;
 	}
 	else if (status == POOL_DEADLOCK)
@@ -3246,7 +3580,7 @@ POOL_STATUS insert_lock(POOL_CONNECTION *frontend, POOL_CONNECTION_POOL *backend
 
 			if (status != POOL_CONTINUE)
 			{
-				internal_transaction_started = 0;
+				session_context->internal_transaction_started = 0;
 				return POOL_END;
 			}
 		}
@@ -3315,7 +3649,7 @@ static int is_cache_empty(POOL_CONNECTION *frontend, POOL_CONNECTION_POOL *backe
 {
 	int i;
 
-	if (frontend->len > 0 && !in_progress)
+	if (frontend->len > 0 && !session_context->in_progress)
 		return 0;
 
 	for (i=0;i<NUM_BACKENDS;i++)
@@ -3358,14 +3692,14 @@ int is_strict_query(Node *node)
 
 int check_copy_from_stdin(Node *node)
 {
-	if (copy_schema)
-		free(copy_schema);
-	if (copy_table)
-		free(copy_table);
-	if (copy_null)
-		free(copy_null);
+	if (session_context->copy_schema)
+		free(session_context->copy_schema);
+	if (session_context->copy_table)
+		free(session_context->copy_table);
+	if (session_context->copy_null)
+		free(session_context->copy_null);
 
-	copy_schema = copy_table = copy_null = NULL;
+	session_context->copy_schema = session_context->copy_table = session_context->copy_null = NULL;
 
 	if (IsA(node, CopyStmt))
 	{
@@ -3377,13 +3711,13 @@ int check_copy_from_stdin(Node *node)
 
 			/* query is COPY FROM STDIN */
 			if (relation->schemaname)
-				copy_schema = strdup(relation->schemaname);
+				session_context->copy_schema = strdup(relation->schemaname);
 			else
-				copy_schema = strdup("public");
-			copy_table = strdup(relation->relname);
+				session_context->copy_schema = strdup("public");
+			session_context->copy_table = strdup(relation->relname);
 
-			copy_delimiter = '\t'; /* default delimiter */
-			copy_null = strdup("\\N"); /* default null string */
+			session_context->copy_delimiter = '\t'; /* default delimiter */
+			session_context->copy_null = strdup("\\N"); /* default null string */
 
 			/* look up delimiter and null string. */
 			foreach (lc, stmt->options)
@@ -3394,14 +3728,14 @@ int check_copy_from_stdin(Node *node)
 				if (strcmp(elem->defname, "delimiter") == 0)
 				{
 					v = (Value *)elem->arg;
-					copy_delimiter = v->val.str[0];
+					session_context->copy_delimiter = v->val.str[0];
 				}
 				else if (strcmp(elem->defname, "null") == 0)
 				{
-					if (copy_null)
-						free(copy_null);
+					if (session_context->copy_null)
+						free(session_context->copy_null);
 					v = (Value *)elem->arg;
-					copy_null = strdup(v->val.str);
+					session_context->copy_null = strdup(v->val.str);
 				}
 			}
 		}
@@ -3437,6 +3771,61 @@ POOL_STATUS read_kind_from_one_backend(POOL_CONNECTION *frontend, POOL_CONNECTIO
 	}
 }
 
+/*
+ * Read kind from a backend. ParameterStatus messages are read and
+ * discarded. Returns -1 on error.
+ */
+static int read_kind_skip_parameter_status(POOL_CONNECTION_POOL *backend, int node, unsigned char *kind)
+{
+	do
+	{
+		char *p, *value;
+		int len;
+
+		if (pool_read(CONNECTION(backend, node), kind, 1) < 0)
+		{
+			pool_error("read_kind_from_backend: failed to read kind from %d th backend", node);
+			return -1;
+		}
+
+		/*
+		 * Read and discard parameter status
+		 */
+		if (*kind != 'S')
+		{
+			break;
+		}
+
+		if (pool_read(CONNECTION(backend, node), &len, sizeof(len)) < 0)
+		{
+			pool_error("read_kind_from_backend: failed to read parameter status packet length from %d th backend", node);
+			return -1;
+		}
+		len = htonl(len) - 4;
+		p = pool_read2(CONNECTION(backend, node), len);
+		if (p == NULL)
+		{
+			pool_error("read_kind_from_backend: failed to read parameter status packet from %d th backend", node);
+			return -1;
+		}
+		value = p + strlen(p) + 1;
+		pool_debug("read_kind_from_backend: parameter name: %s value: %s", p, value);
+	} while (*kind == 'S');
+
+#ifdef DEALLOCATE_ERROR_TEST
+	/*
+	  pool_log("i:%d kind:%c pending_function:%x pending_prepared_portal:%x",
+			 node, *kind, pending_function, pending_prepared_portal);
+	*/
+	if (node == 1 && *kind == 'C' &&
+		session_context->pending_function && session_context->pending_prepared_portal &&
+		IsA(session_context->pending_prepared_portal->stmt, DeallocateStmt))
+		*kind = 'E';
+#endif
+
+	return 0;
+}
+
 /*
  * read_kind_from_backend: read kind from backends.
  * the "frontend" parameter is used to send "kind mismatch" error message to the frontend.
@@ -3456,6 +3845,9 @@ POOL_STATUS read_kind_from_backend(POOL_CONNECTION *frontend, POOL_CONNECTION_PO
 	double max_count = 0;
 	int degenerate_node_num = 0;		/* number of backends degeneration requested */
 	int degenerate_node[MAX_NUM_BACKENDS];		/* degeneration requested backend list */
+	int pending[MAX_NUM_BACKENDS];	/* kind is not read yet */
+	int ready[MAX_NUM_BACKENDS];	/* reply arrived */
+	int num_pending = 0;
 
 	memset(kind_map, 0, sizeof(kind_map));
 
@@ -3463,68 +3855,49 @@ POOL_STATUS read_kind_from_backend(POOL_CONNECTION *frontend, POOL_CONNECTION_PO
 	{
 		/* initialize degenerate record */
 		degenerate_node[i] = 0;
+		kind_list[i] = 0;
 
-		if (VALID_BACKEND(i))
-		{
-			do
-			{
-				char *p, *value;
-				int len;
-
-				if (pool_read(CONNECTION(backend, i), &kind, 1) < 0)
-				{
-					pool_error("read_kind_from_backend: failed to read kind from %d th backend", i);
-					return POOL_ERROR;
-				}
+		pending[i] = VALID_BACKEND(i);
+		if (pending[i])
+			num_pending++;
+	}
 
-				/*
-				 * Read and discard parameter status
-				 */
-				if (kind != 'S')
-				{
-					break;
-				}
+	/* read kinds in the order backends reply */
+	while (num_pending > 0)
+	{
+		if (wait_for_backends(backend, pending, ready) < 0)
+			return POOL_ERROR;
 
-				if (pool_read(CONNECTION(backend, i), &len, sizeof(len)) < 0)
-				{
-					pool_error("read_kind_from_backend: failed to read parameter status packet length from %d th backend", i);
-					return POOL_ERROR;
-				}
-				len = htonl(len) - 4;
-				p = pool_read2(CONNECTION(backend, i), len);
-				if (p == NULL)
-				{
-					pool_error("read_kind_from_backend: failed to read parameter status packet from %d th backend", i);
-				}
-				value = p + strlen(p) + 1;
-				pool_debug("read_kind_from_backend: parameter name: %s value: %s", p, value);
-			} while (kind == 'S');
+		for (i=0;i<NUM_BACKENDS;i++)
+		{
+			if (!ready[i])
+				continue;
 
-#ifdef DEALLOCATE_ERROR_TEST
-			/*
-			  pool_log("i:%d kind:%c pending_function:%x pending_prepared_portal:%x",
-					 i, kind, pending_function, pending_prepared_portal);
-			*/
-			if (i == 1 && kind == 'C' &&
-				pending_function && pending_prepared_portal &&
-				IsA(pending_prepared_portal->stmt, DeallocateStmt))
-				kind = 'E';
-#endif
+			if (read_kind_skip_parameter_status(backend, i, &kind) < 0)
+				return POOL_ERROR;
 
 			kind_list[i] = kind;
+			pending[i] = 0;
+			num_pending--;
 
 			pool_debug("read_kind_from_backend: read kind from %d th backend %c NUM_BACKENDS: %d", i, kind_list[i], NUM_BACKENDS);
+		}
+	}
+
+	/* compare kinds once all of them arrived */
+	for (i=0;i<NUM_BACKENDS;i++)
+	{
+		if (!VALID_BACKEND(i))
+			continue;
 
-			kind_map[kind]++;
+		kind = kind_list[i];
+		kind_map[kind]++;
 
-			if (kind_map[kind] > max_count)
-			{
-				max_kind = kind_list[i];
-				max_count = kind_map[kind];
-			}
+		if (kind_map[kind] > max_count)
+		{
+			max_kind = kind_list[i];
+			max_count = kind_map[kind];
 		}
-		else
-			kind_list[i] = 0;
 	}
 
 #ifdef NOT_USED
@@ -3635,7 +4008,7 @@ POOL_STATUS read_kind_from_backend(POOL_CONNECTION *frontend, POOL_CONNECTION_PO
 								Portal *portal;
 								DeallocateStmt *d = (DeallocateStmt *)node;
 
-								portal = lookup_prepared_statement_by_statement(&prepared_list, d->name);
+								portal = lookup_prepared_statement_by_statement(session_context->prepared_list, d->name);
 								if (portal && portal->sql_string)
 								{
 									string_append_char(msg, "[");
@@ -3692,21 +4065,10 @@ Portal *create_portal(void)
 		free(p);
 		return NULL;
 	}
+	p->bind_md5[0] = '\0';
 	return p;
 }
 
-void init_prepared_list(void)
-{
-	prepared_list.cnt = 0;
-	prepared_list.size = INIT_STATEMENT_LIST_SIZE;
-	prepared_list.portal_list = malloc(sizeof(Portal *) * prepared_list.size);
-	if (prepared_list.portal_list == NULL)
-	{
-		pool_error("init_prepared_list: malloc failed: %s", strerror(errno));
-		exit(1);
-	}
-}
-
 void add_prepared_list(PreparedStatementList *p, Portal *portal)
 {
 	if (p->cnt == p->size)
@@ -3724,14 +4086,14 @@ void add_prepared_list(PreparedStatementList *p, Portal *portal)
 
 void add_unnamed_portal(PreparedStatementList *p, Portal *portal)
 {
-	if (unnamed_statement)
+	if (session_context->unnamed_statement)
 	{
-		pool_memory_delete(unnamed_statement->prepare_ctxt, 0);
-		free(unnamed_statement);
+		pool_memory_delete(session_context->unnamed_statement->prepare_ctxt, 0);
+		free(session_context->unnamed_statement);
 	}
 
-	unnamed_portal = NULL;
-	unnamed_statement = portal;
+	session_context->unnamed_portal = NULL;
+	session_context->unnamed_statement = portal;
 }
 
 void del_prepared_list(PreparedStatementList *p, Portal *portal)
@@ -3785,13 +4147,13 @@ static void reset_prepared_list(PreparedStatementList *p)
 			free(p->portal_list[i]->portal_name);
 			free(p->portal_list[i]);
 		}
-		if (unnamed_statement)
+		if (session_context->unnamed_statement)
 		{
-			pool_memory_delete(unnamed_statement->prepare_ctxt, 0);
-			free(unnamed_statement);
+			pool_memory_delete(session_context->unnamed_statement->prepare_ctxt, 0);
+			free(session_context->unnamed_statement);
 		}
-		unnamed_portal = NULL;
-		unnamed_statement = NULL;
+		session_context->unnamed_portal = NULL;
+		session_context->unnamed_statement = NULL;
 		p->cnt = 0;
 	}
 }
@@ -3802,7 +4164,7 @@ Portal *lookup_prepared_statement_by_statement(PreparedStatementList *p, const c
 
 	/* unnamed portal? */
 	if (name == NULL || name[0] == '\0' || (name[0] == '\"' && name[1] == '\"'))
-		return unnamed_statement;
+		return session_context->unnamed_statement;
 
 	for (i = 0; i < p->cnt; i++)
 	{
@@ -3820,7 +4182,7 @@ Portal *lookup_prepared_statement_by_portal(PreparedStatementList *p, const char
 
 	/* unnamed portal? */
 	if (name == NULL || name[0] == '\0' || (name[0] == '\"' && name[1] == '\"'))
-		return unnamed_portal;
+		return session_context->unnamed_portal;
 
 	for (i = 0; i < p->cnt; i++)
 	{
@@ -3865,112 +4227,42 @@ static int send_deallocate(POOL_CONNECTION_POOL *backend, PreparedStatementList
 	return 0;
 }
 
-/*
- * parse_copy_data()
- *   Parses CopyDataRow string.
- *   Returns divide key value. If cannot parse data, returns NULL.
- */
-char *
-parse_copy_data(char *buf, int len, char delimiter, int col_id)
-{
-	int i, j, field = 0;
-	char *str, *p = NULL;
-
-	str = malloc(len + 1);
-	if (str == NULL)
-	{
-		pool_error("parse_copy_data: malloc failed");
-		return NULL;
-	}
-
-	/* buf is terminated by '\n'. */
-	/* skip '\n' in for loop.     */
-	for (i = 0, j = 0; i < len - 1; i++)
-	{
-		if (buf[i] == '\\' && i != len - 2) /* escape */
-		{
-			if (buf[i+1] == delimiter)
-			{
-				i++;
-				str[j++] = buf[i];
-			}
-			else
-			{
-				str[j++] = buf[i];
-			}
-		}
-		else if (buf[i] == delimiter) /* delimiter */
-		{
-			if (field == col_id)
-			{
-				break;
-			}
-			else
-			{
-				field++;
-				j = 0;
-			}
-		}
-		else
-		{
-			str[j++] = buf[i];
-		}
-	}
-
-	if (field == col_id)
-	{
-		str[j] = '\0';
-		p = malloc(j);
-		if (p == NULL)
-		{
-			pool_error("parse_copy_data: malloc failed");
-			return NULL;
-		}
-		strcpy(p, str);
-		p[j] = '\0';
-		pool_debug("parse_copy_data: divide key value is %s", p);
-	}
-
-	free(str);
-	return p;
-}
-
 static void
 query_cache_register(char kind, POOL_CONNECTION *frontend, char *database, char *data, int data_len)
 {
 	static int inside_T;			/* flag to see the result data sequence */
 	int result;
 
-	if (is_select_pgcatalog || is_select_for_update)
+	if (session_context->is_select_pgcatalog || session_context->is_select_for_update)
 		return;
 
-	if (kind == 'T' && parsed_query)
+	/*
+	 * result of a query starts with RowDescription. result of Execute
+	 * does not since RowDescription is sent in response to Describe.
+	 */
+	if (!inside_T && session_context->parsed_query &&
+		(session_context->cache_execute_result ?
+		 (kind == 'D' || kind == 'C' || kind == 'E') : kind == 'T'))
 	{
-		result = pool_query_cache_register(kind, frontend, database, data, data_len, parsed_query);
-		if (result < 0)
-		{
-			pool_error("pool_query_cache_register: query cache registration failed");
-			inside_T = 0;
-		}
-		else
-		{
-			inside_T = 1;
-		}
+		result = pool_query_cache_register(kind, frontend, database, data, data_len, session_context->parsed_query);
+		inside_T = 1;
 	}
 	else if ((kind == 'D' || kind == 'C' || kind == 'E') && inside_T)
-	{
 		result = pool_query_cache_register(kind, frontend, database, data, data_len, NULL);
-		if (kind == 'C' || kind == 'E' || result < 0)
-		{
-			if (result < 0)
-				pool_error("pool_query_cache_register: query cache registration failed");
-			else
-				pool_debug("pool_query_cache_register: query cache saved");
+	else
+		return;
 
-			inside_T = 0;
-			free(parsed_query);
-			parsed_query = NULL;
-		}
+	if (kind == 'C' || kind == 'E' || result < 0)
+	{
+		if (result < 0)
+			pool_error("pool_query_cache_register: query cache registration failed");
+		else if (kind == 'C')
+			pool_debug("pool_query_cache_register: query cache saved");
+
+		inside_T = 0;
+		free(session_context->parsed_query);
+		session_context->parsed_query = NULL;
+		session_context->cache_execute_result = 0;
 	}
 }
 
@@ -4154,7 +4446,7 @@ POOL_STATUS start_internal_transaction(POOL_CONNECTION *frontend, POOL_CONNECTIO
 		}
 
 		/* mark that we started new transaction */
-		internal_transaction_started = 1;
+		session_context->internal_transaction_started = 1;
 	}
 	return POOL_CONTINUE;
 }
@@ -4186,7 +4478,7 @@ POOL_STATUS end_internal_transaction(POOL_CONNECTION *frontend, POOL_CONNECTION_
 			if (do_command(frontend, CONNECTION(backend, i), "COMMIT", MAJOR(backend), 
 						   MASTER_CONNECTION(backend)->pid,	MASTER_CONNECTION(backend)->key, 1) != POOL_CONTINUE)
 			{
-				internal_transaction_started = 0;
+				session_context->internal_transaction_started = 0;
 				POOL_SETMASK(&oldmask);
 				return POOL_END;
 			}
@@ -4198,12 +4490,12 @@ POOL_STATUS end_internal_transaction(POOL_CONNECTION *frontend, POOL_CONNECTION_
 	if (do_command(frontend, MASTER(backend), "COMMIT", MAJOR(backend), 
 				   MASTER_CONNECTION(backend)->pid,	MASTER_CONNECTION(backend)->key, 1) != POOL_CONTINUE)
 	{
-		internal_transaction_started = 0;
+		session_context->internal_transaction_started = 0;
 		POOL_SETMASK(&oldmask);
 		return POOL_END;
 	}
 
-	internal_transaction_started = 0;
+	session_context->internal_transaction_started = 0;
 	POOL_SETMASK(&oldmask);
 	return POOL_CONTINUE;
 }
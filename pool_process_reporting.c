@@ -18,39 +18,39 @@
  * suitability of this software for any purpose.  It is provided "as
  * is" without express or implied warranty.
  *
- * Process "show pool_status" query.
+ * Process "show pool_status", "show pool_stats" and "show
+ * pool_node_stats" queries.
  */
 #include "pool.h"
 #include "pool_proto_modules.h"
 #include <string.h>
 #include <netinet/in.h>
 
+#define POOLCONFIG_MAXNAMELEN 32
+#define POOLCONFIG_MAXVALLEN 512
+#define POOLCONFIG_MAXDESCLEN 64
+
+typedef struct {
+	char name[POOLCONFIG_MAXNAMELEN+1];
+	char value[POOLCONFIG_MAXVALLEN+1];
+	char desc[POOLCONFIG_MAXDESCLEN+1];
+} POOL_REPORT_STATUS;
+
+#define MAX_REPORT_FIELDS 32
+
+static void pool_stats_reporting(POOL_CONNECTION *frontend, POOL_CONNECTION_POOL *backend);
+static void node_stats_reporting(POOL_CONNECTION *frontend, POOL_CONNECTION_POOL *backend);
+static void send_row_description(POOL_CONNECTION *frontend, POOL_CONNECTION_POOL *backend,
+								 short num_fields, char **field_names);
+static void send_data_row(POOL_CONNECTION *frontend, POOL_CONNECTION_POOL *backend,
+						  short num_fields, char **values);
+static void send_complete_and_ready(POOL_CONNECTION *frontend, POOL_CONNECTION_POOL *backend);
+
 void process_reporting(POOL_CONNECTION *frontend, POOL_CONNECTION_POOL *backend)
 {
-	static char *cursorname = "blank";
 	static short num_fields = 3;
 	static char *field_names[] = {"item", "value", "description"};
-	static int oid = 0;
-	static short fsize = -1;
-	static int mod = 0;
-	short n;
 	int i, j;
-	short s;
-	int len;
-	short colnum;
-
-	static unsigned char nullmap[2] = {0xff, 0xff};
-	int nbytes = (num_fields + 7)/8;
-
-#define POOLCONFIG_MAXNAMELEN 32
-#define POOLCONFIG_MAXVALLEN 512
-#define POOLCONFIG_MAXDESCLEN 64
-
-	typedef struct {
-		char name[POOLCONFIG_MAXNAMELEN+1];
-		char value[POOLCONFIG_MAXVALLEN+1];
-		char desc[POOLCONFIG_MAXDESCLEN+1];
-	} POOL_REPORT_STATUS;
 
 /*
  * Report data buffer.
@@ -63,8 +63,6 @@ void process_reporting(POOL_CONNECTION *frontend, POOL_CONNECTION_POOL *backend)
 	static POOL_REPORT_STATUS status[MAXITEMS];
 
 	short nrows;
-	int size;
-	int hsize;
 
 	i = 0;
 
@@ -88,6 +86,16 @@ void process_reporting(POOL_CONNECTION *frontend, POOL_CONNECTION_POOL *backend)
 	strncpy(status[i].desc, "# of children initially pre-forked", POOLCONFIG_MAXDESCLEN);
 	i++;
 
+	strncpy(status[i].name, "sessions_per_child", POOLCONFIG_MAXNAMELEN);
+	snprintf(status[i].value, POOLCONFIG_MAXVALLEN, "%d", pool_config->sessions_per_child);
+	strncpy(status[i].desc, "max # of frontend sessions a child serves at the same time", POOLCONFIG_MAXDESCLEN);
+	i++;
+
+	strncpy(status[i].name, "pool_mode", POOLCONFIG_MAXNAMELEN);
+	snprintf(status[i].value, POOLCONFIG_MAXVALLEN, "%s", pool_config->pool_mode);
+	strncpy(status[i].desc, "when backend connections return to the pool", POOLCONFIG_MAXDESCLEN);
+	i++;
+
 	strncpy(status[i].name, "child_life_time", POOLCONFIG_MAXNAMELEN);
 	snprintf(status[i].value, POOLCONFIG_MAXVALLEN, "%d", pool_config->child_life_time);
 	strncpy(status[i].desc, "if idle for this seconds, child exits", POOLCONFIG_MAXDESCLEN);
@@ -98,6 +106,16 @@ void process_reporting(POOL_CONNECTION *frontend, POOL_CONNECTION_POOL *backend)
 	strncpy(status[i].desc, "if idle for this seconds, connection closes", POOLCONFIG_MAXDESCLEN);
 	i++;
 
+	strncpy(status[i].name, "prewarm_connections", POOLCONFIG_MAXNAMELEN);
+	snprintf(status[i].value, POOLCONFIG_MAXVALLEN, "%s", pool_config->prewarm_connections);
+	strncpy(status[i].desc, "user:database pairs connected in advance", POOLCONFIG_MAXDESCLEN);
+	i++;
+
+	strncpy(status[i].name, "handoff_connections", POOLCONFIG_MAXNAMELEN);
+	snprintf(status[i].value, POOLCONFIG_MAXVALLEN, "%d", pool_config->handoff_connections);
+	strncpy(status[i].desc, "if true, pass cached connections to the next child", POOLCONFIG_MAXDESCLEN);
+	i++;
+
 	strncpy(status[i].name, "client_idle_limit", POOLCONFIG_MAXNAMELEN);
 	snprintf(status[i].value, POOLCONFIG_MAXVALLEN, "%d", pool_config->client_idle_limit);
 	strncpy(status[i].desc, "if idle for this seconds, child connection closes", POOLCONFIG_MAXDESCLEN);
@@ -143,6 +161,16 @@ void process_reporting(POOL_CONNECTION *frontend, POOL_CONNECTION_POOL *backend)
 	strncpy(status[i].desc, "non 0 if operating in load balancing mode", POOLCONFIG_MAXDESCLEN);
 	i++;
 
+	strncpy(status[i].name, "load_balance_policy", POOLCONFIG_MAXNAMELEN);
+	snprintf(status[i].value, POOLCONFIG_MAXVALLEN, "%s", pool_config->load_balance_policy);
+	strncpy(status[i].desc, "how to choose load balance node", POOLCONFIG_MAXDESCLEN);
+	i++;
+
+	strncpy(status[i].name, "statement_level_load_balance", POOLCONFIG_MAXNAMELEN);
+	snprintf(status[i].value, POOLCONFIG_MAXVALLEN, "%d", pool_config->statement_level_load_balance);
+	strncpy(status[i].desc, "if true, choose load balance node for each query", POOLCONFIG_MAXDESCLEN);
+	i++;
+
 	strncpy(status[i].name, "replication_stop_on_mismatch", POOLCONFIG_MAXNAMELEN);
 	snprintf(status[i].value, POOLCONFIG_MAXVALLEN, "%d", pool_config->replication_stop_on_mismatch);
 	strncpy(status[i].desc, "stop replication mode on fatal error", POOLCONFIG_MAXDESCLEN);
@@ -181,16 +209,46 @@ void process_reporting(POOL_CONNECTION *frontend, POOL_CONNECTION_POOL *backend)
 	strncpy(status[i].desc, "if true, cache connection pool", POOLCONFIG_MAXDESCLEN);
 	i++;
 
+	strncpy(status[i].name, "reset_only_modified_session", POOLCONFIG_MAXNAMELEN);
+	snprintf(status[i].value, POOLCONFIG_MAXVALLEN, "%d", pool_config->reset_only_modified_session);
+	strncpy(status[i].desc, "if true, reset only sessions which modified their state", POOLCONFIG_MAXDESCLEN);
+	i++;
+
+	strncpy(status[i].name, "read_buffer_size", POOLCONFIG_MAXNAMELEN);
+	snprintf(status[i].value, POOLCONFIG_MAXVALLEN, "%d", pool_config->read_buffer_size);
+	strncpy(status[i].desc, "size of per connection read buffer in bytes", POOLCONFIG_MAXDESCLEN);
+	i++;
+
+	strncpy(status[i].name, "relcache_size", POOLCONFIG_MAXNAMELEN);
+	snprintf(status[i].value, POOLCONFIG_MAXVALLEN, "%d", pool_config->relcache_size);
+	strncpy(status[i].desc, "number of relation cache entries on shared memory", POOLCONFIG_MAXDESCLEN);
+	i++;
+
+	strncpy(status[i].name, "parse_cache_size", POOLCONFIG_MAXNAMELEN);
+	snprintf(status[i].value, POOLCONFIG_MAXVALLEN, "%d", pool_config->parse_cache_size);
+	strncpy(status[i].desc, "number of parse trees cached in each child", POOLCONFIG_MAXDESCLEN);
+	i++;
+
 	strncpy(status[i].name, "health_check_timeout", POOLCONFIG_MAXNAMELEN);
-	snprintf(status[i].value, POOLCONFIG_MAXVALLEN, "%d", pool_config->health_check_timeout);
+	snprintf(status[i].value, POOLCONFIG_MAXVALLEN, "%g", pool_config->health_check_timeout / 1000.0);
 	strncpy(status[i].desc, "health check timeout", POOLCONFIG_MAXDESCLEN);
 	i++;
 
 	strncpy(status[i].name, "health_check_period", POOLCONFIG_MAXNAMELEN);
-	snprintf(status[i].value, POOLCONFIG_MAXVALLEN, "%d", pool_config->health_check_period);
+	snprintf(status[i].value, POOLCONFIG_MAXVALLEN, "%g", pool_config->health_check_period / 1000.0);
 	strncpy(status[i].desc, "health check period", POOLCONFIG_MAXDESCLEN);
 	i++;
 
+	strncpy(status[i].name, "health_check_max_retries", POOLCONFIG_MAXNAMELEN);
+	snprintf(status[i].value, POOLCONFIG_MAXVALLEN, "%d", pool_config->health_check_max_retries);
+	strncpy(status[i].desc, "number of health check retries before failover", POOLCONFIG_MAXDESCLEN);
+	i++;
+
+	strncpy(status[i].name, "health_check_retry_delay", POOLCONFIG_MAXNAMELEN);
+	snprintf(status[i].value, POOLCONFIG_MAXVALLEN, "%g", pool_config->health_check_retry_delay / 1000.0);
+	strncpy(status[i].desc, "delay between health check retries", POOLCONFIG_MAXDESCLEN);
+	i++;
+
 	strncpy(status[i].name, "health_check_user", POOLCONFIG_MAXNAMELEN);
 	snprintf(status[i].value, POOLCONFIG_MAXVALLEN, "%s", pool_config->health_check_user);
 	strncpy(status[i].desc, "health check user", POOLCONFIG_MAXDESCLEN);
@@ -336,6 +394,21 @@ void process_reporting(POOL_CONNECTION *frontend, POOL_CONNECTION_POOL *backend)
 	strncpy(status[i].desc, "if non 0, use query cache", POOLCONFIG_MAXDESCLEN);
 	i++;
 
+	strncpy(status[i].name, "query_cache_method", POOLCONFIG_MAXNAMELEN);
+	snprintf(status[i].value, POOLCONFIG_MAXVALLEN, "%s", pool_config->query_cache_method);
+	strncpy(status[i].desc, "where to store query cache", POOLCONFIG_MAXDESCLEN);
+	i++;
+
+	strncpy(status[i].name, "query_cache_size", POOLCONFIG_MAXNAMELEN);
+	snprintf(status[i].value, POOLCONFIG_MAXVALLEN, "%d", pool_config->query_cache_size);
+	strncpy(status[i].desc, "size of shared memory query cache in bytes", POOLCONFIG_MAXDESCLEN);
+	i++;
+
+	strncpy(status[i].name, "query_cache_expire", POOLCONFIG_MAXNAMELEN);
+	snprintf(status[i].value, POOLCONFIG_MAXVALLEN, "%d", pool_config->query_cache_expire);
+	strncpy(status[i].desc, "life time of shared memory query cache in seconds", POOLCONFIG_MAXDESCLEN);
+	i++;
+
 	strncpy(status[i].name, "pgpool2_hostname", POOLCONFIG_MAXNAMELEN);
 	snprintf(status[i].value, POOLCONFIG_MAXVALLEN, "%s", pool_config->pgpool2_hostname);
 	strncpy(status[i].desc, "pgpool2 hostname", POOLCONFIG_MAXDESCLEN);
@@ -371,6 +444,11 @@ void process_reporting(POOL_CONNECTION *frontend, POOL_CONNECTION_POOL *backend)
 	strncpy(status[i].desc, "password to access system DB", POOLCONFIG_MAXDESCLEN);
 	i++;
 
+	strncpy(status[i].name, "copy_batch_size", POOLCONFIG_MAXNAMELEN);
+	snprintf(status[i].value, POOLCONFIG_MAXVALLEN, "%d", pool_config->copy_batch_size);
+	strncpy(status[i].desc, "bytes of rows sent to a backend at once by COPY in parallel mode", POOLCONFIG_MAXDESCLEN);
+	i++;
+
 	for (j = 0; j < NUM_BACKENDS; j++)
 	{
 		if (BACKEND_INFO(j).backend_port == 0)
@@ -399,6 +477,175 @@ void process_reporting(POOL_CONNECTION *frontend, POOL_CONNECTION_POOL *backend)
 
 	nrows = i;
 
+	send_row_description(frontend, backend, num_fields, field_names);
+
+	for (i=0;i<nrows;i++)
+	{
+		char *values[3];
+
+		values[0] = status[i].name;
+		values[1] = status[i].value;
+		values[2] = status[i].desc;
+		send_data_row(frontend, backend, num_fields, values);
+	}
+
+	send_complete_and_ready(frontend, backend);
+}
+
+/*
+ * Returns non 0 if name is the name of a statistics SHOW command
+ */
+int is_stats_reporting(char *name)
+{
+	return name &&
+		(strcasecmp(name, "pool_stats") == 0 ||
+		 strcasecmp(name, "pool_node_stats") == 0);
+}
+
+/*
+ * Process "show pool_stats" or "show pool_node_stats" query.
+ */
+void stats_reporting(POOL_CONNECTION *frontend, POOL_CONNECTION_POOL *backend, char *name)
+{
+	if (strcasecmp(name, "pool_node_stats") == 0)
+		node_stats_reporting(frontend, backend);
+	else
+		pool_stats_reporting(frontend, backend);
+}
+
+/*
+ * "show pool_stats" returns statistics not related to nodes
+ */
+static void pool_stats_reporting(POOL_CONNECTION *frontend, POOL_CONNECTION_POOL *backend)
+{
+	static short num_fields = 3;
+	static char *field_names[] = {"item", "value", "description"};
+	POOL_REPORT_STATUS status[4];
+	PoolStats stats;
+	int i, nrows;
+
+	pool_get_pool_stats(&stats);
+
+	i = 0;
+
+	strncpy(status[i].name, "connection_pool_hit", POOLCONFIG_MAXNAMELEN);
+	snprintf(status[i].value, POOLCONFIG_MAXVALLEN, "%llu", stats.connection_pool_hit);
+	strncpy(status[i].desc, "# of client connections which reused a pooled connection", POOLCONFIG_MAXDESCLEN);
+	i++;
+
+	strncpy(status[i].name, "connection_pool_miss", POOLCONFIG_MAXNAMELEN);
+	snprintf(status[i].value, POOLCONFIG_MAXVALLEN, "%llu", stats.connection_pool_miss);
+	strncpy(status[i].desc, "# of client connections which connected to backends", POOLCONFIG_MAXDESCLEN);
+	i++;
+
+	strncpy(status[i].name, "query_cache_hit", POOLCONFIG_MAXNAMELEN);
+	snprintf(status[i].value, POOLCONFIG_MAXVALLEN, "%llu", stats.query_cache_hit);
+	strncpy(status[i].desc, "# of queries answered from query cache", POOLCONFIG_MAXDESCLEN);
+	i++;
+
+	strncpy(status[i].name, "query_cache_miss", POOLCONFIG_MAXNAMELEN);
+	snprintf(status[i].value, POOLCONFIG_MAXVALLEN, "%llu", stats.query_cache_miss);
+	strncpy(status[i].desc, "# of queries not found in query cache", POOLCONFIG_MAXDESCLEN);
+	i++;
+
+	nrows = i;
+
+	send_row_description(frontend, backend, num_fields, field_names);
+
+	for (i=0;i<nrows;i++)
+	{
+		char *values[3];
+
+		values[0] = status[i].name;
+		values[1] = status[i].value;
+		values[2] = status[i].desc;
+		send_data_row(frontend, backend, num_fields, values);
+	}
+
+	send_complete_and_ready(frontend, backend);
+}
+
+/*
+ * "show pool_node_stats" returns a row of statistics for each node
+ */
+static void node_stats_reporting(POOL_CONNECTION *frontend, POOL_CONNECTION_POOL *backend)
+{
+#define NODE_STATS_FIXED_FIELDS 10
+#define NODE_STATS_FIELDS (NODE_STATS_FIXED_FIELDS + NUM_LATENCY_BUCKETS)
+#define NODE_STATS_VALLEN 32
+
+	static char *fixed_field_names[] = {"node_id", "hostname", "port", "status",
+										"select_count", "write_count",
+										"bytes_received", "bytes_sent",
+										"failover_count", "failback_count"};
+	char names[NUM_LATENCY_BUCKETS][NODE_STATS_VALLEN];
+	char *field_names[NODE_STATS_FIELDS];
+	char buf[NODE_STATS_FIELDS][NODE_STATS_VALLEN];
+	char *values[NODE_STATS_FIELDS];
+	NodeStats stats;
+	int i, j;
+
+	for (i = 0; i < NODE_STATS_FIXED_FIELDS; i++)
+		field_names[i] = fixed_field_names[i];
+
+	for (j = 0; j < NUM_LATENCY_BUCKETS; j++)
+	{
+		int bound = pool_stats_latency_bound(j);
+
+		if (bound < 0)
+			snprintf(names[j], NODE_STATS_VALLEN, "latency_over_%dms",
+					 pool_stats_latency_bound(j - 1));
+		else
+			snprintf(names[j], NODE_STATS_VALLEN, "latency_%dms", bound);
+		field_names[i++] = names[j];
+	}
+
+	send_row_description(frontend, backend, NODE_STATS_FIELDS, field_names);
+
+	for (i = 0; i < NODE_STATS_FIELDS; i++)
+		values[i] = buf[i];
+
+	for (i = 0; i < NUM_BACKENDS; i++)
+	{
+		if (BACKEND_INFO(i).backend_port == 0 ||
+			pool_get_node_stats(i, &stats) < 0)
+			continue;
+
+		snprintf(buf[0], NODE_STATS_VALLEN, "%d", i);
+		values[1] = BACKEND_INFO(i).backend_hostname;
+		snprintf(buf[2], NODE_STATS_VALLEN, "%d", BACKEND_INFO(i).backend_port);
+		snprintf(buf[3], NODE_STATS_VALLEN, "%d", BACKEND_INFO(i).backend_status);
+		snprintf(buf[4], NODE_STATS_VALLEN, "%llu", stats.select_count);
+		snprintf(buf[5], NODE_STATS_VALLEN, "%llu", stats.write_count);
+		snprintf(buf[6], NODE_STATS_VALLEN, "%llu", stats.bytes_received);
+		snprintf(buf[7], NODE_STATS_VALLEN, "%llu", stats.bytes_sent);
+		snprintf(buf[8], NODE_STATS_VALLEN, "%llu", stats.failover_count);
+		snprintf(buf[9], NODE_STATS_VALLEN, "%llu", stats.failback_count);
+		for (j = 0; j < NUM_LATENCY_BUCKETS; j++)
+			snprintf(buf[NODE_STATS_FIXED_FIELDS + j], NODE_STATS_VALLEN, "%llu", stats.latency[j]);
+
+		send_data_row(frontend, backend, NODE_STATS_FIELDS, values);
+	}
+
+	send_complete_and_ready(frontend, backend);
+}
+
+/*
+ * Send row description. All fields are of type text.
+ */
+static void send_row_description(POOL_CONNECTION *frontend, POOL_CONNECTION_POOL *backend,
+								 short num_fields, char **field_names)
+{
+	static char *cursorname = "blank";
+	static int oid = 0;
+	static short fsize = -1;
+	static int mod = 0;
+	short n;
+	int i;
+	short s;
+	int len;
+	short colnum;
+
 	if (MAJOR(backend) == PROTO_MAJOR_V2)
 	{
 		/* cursor response */
@@ -457,59 +704,65 @@ void process_reporting(POOL_CONNECTION *frontend, POOL_CONNECTION_POOL *backend)
 		}
 	}
 	pool_flush(frontend);
+}
+
+/*
+ * Send a data row. None of the values may be NULL.
+ */
+static void send_data_row(POOL_CONNECTION *frontend, POOL_CONNECTION_POOL *backend,
+						  short num_fields, char **values)
+{
+	static unsigned char nullmap[(MAX_REPORT_FIELDS + 7)/8] = {
+		0xff, 0xff, 0xff, 0xff
+	};
+	int nbytes = (num_fields + 7)/8;
+	int size;
+	int hsize;
+	int len;
+	short s;
+	int i;
 
 	if (MAJOR(backend) == PROTO_MAJOR_V2)
 	{
 		/* ascii row */
-		for (i=0;i<nrows;i++)
-		{
-			pool_write(frontend, "D", 1);
-			pool_write_and_flush(frontend, nullmap, nbytes);
+		pool_write(frontend, "D", 1);
+		pool_write_and_flush(frontend, nullmap, nbytes);
 
-			size = strlen(status[i].name);
-			hsize = htonl(size+4);
-			pool_write(frontend, &hsize, sizeof(hsize));
-			pool_write(frontend, status[i].name, size);
-
-			size = strlen(status[i].value);
-			hsize = htonl(size+4);
-			pool_write(frontend, &hsize, sizeof(hsize));
-			pool_write(frontend, status[i].value, size);
-
-			size = strlen(status[i].desc);
+		for (i=0;i<num_fields;i++)
+		{
+			size = strlen(values[i]);
 			hsize = htonl(size+4);
 			pool_write(frontend, &hsize, sizeof(hsize));
-			pool_write(frontend, status[i].desc, size);
+			pool_write(frontend, values[i], size);
 		}
 	}
 	else
 	{
 		/* data row */
-		for (i=0;i<nrows;i++)
-		{
-			pool_write(frontend, "D", 1);
-			len = sizeof(len) + sizeof(nrows);
-			len += sizeof(int) + strlen(status[i].name);
-			len += sizeof(int) + strlen(status[i].value);
-			len += sizeof(int) + strlen(status[i].desc);
-			len = htonl(len);
-			pool_write(frontend, &len, sizeof(len));
-			s = htons(3);
-			pool_write(frontend, &s, sizeof(s));
-
-			len = htonl(strlen(status[i].name));
-			pool_write(frontend, &len, sizeof(len));
-			pool_write(frontend, status[i].name, strlen(status[i].name));
-
-			len = htonl(strlen(status[i].value));
-			pool_write(frontend, &len, sizeof(len));
-			pool_write(frontend, status[i].value, strlen(status[i].value));
+		pool_write(frontend, "D", 1);
+		len = sizeof(len) + sizeof(s);
+		for (i=0;i<num_fields;i++)
+			len += sizeof(int) + strlen(values[i]);
+		len = htonl(len);
+		pool_write(frontend, &len, sizeof(len));
+		s = htons(num_fields);
+		pool_write(frontend, &s, sizeof(s));
 
-			len = htonl(strlen(status[i].desc));
+		for (i=0;i<num_fields;i++)
+		{
+			len = htonl(strlen(values[i]));
 			pool_write(frontend, &len, sizeof(len));
-			pool_write(frontend, status[i].desc, strlen(status[i].desc));
+			pool_write(frontend, values[i], strlen(values[i]));
 		}
 	}
+}
+
+/*
+ * Send command complete and ready for query
+ */
+static void send_complete_and_ready(POOL_CONNECTION *frontend, POOL_CONNECTION_POOL *backend)
+{
+	int len;
 
 	/* complete command response */
 	pool_write(frontend, "C", 1);
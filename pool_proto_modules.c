@@ -49,55 +49,26 @@
 #include "pool_proto_modules.h"
 #include "parser/pool_string.h"
 
-int force_replication;
-int replication_was_enabled;		/* replication mode was enabled */
-int master_slave_was_enabled;	/* master/slave mode was enabled */
-int internal_transaction_started;		/* to issue table lock command a transaction
-												   has been started internally */
-int in_progress = 0;		/* indicates while doing something after receiving Query */
-int mismatch_ntuples;	/* number of updated tuples */
-char *copy_table = NULL;  /* copy table name */
-char *copy_schema = NULL;  /* copy table name */
-char copy_delimiter; /* copy delimiter char */
-char *copy_null = NULL; /* copy null string */
-void (*pending_function)(PreparedStatementList *p, Portal *portal) = NULL;
-Portal *pending_prepared_portal = NULL;
-Portal *unnamed_statement = NULL;
-Portal *unnamed_portal = NULL;
-int select_in_transaction = 0; /* non 0 if select query is in transaction */
-int execute_select = 0; /* non 0 if select query is in transaction */
-
-/* non 0 if "BEGIN" query with extended query protocol received */
-int receive_extended_begin = 0;
-
-/*
- * Non 0 if allow to close internal transaction.  This variable was
- * introduced on 2008/4/3 not to close an internal transaction when
- * Sync message is received after receiving Parse message. This hack
- * is for PHP-PDO.
- */
-static int allow_close_transaction = 1;
-
-PreparedStatementList prepared_list; /* prepared statement name list */
-
-int is_select_pgcatalog = 0;
-int is_select_for_update = 0; /* 1 if SELECT INTO or SELECT FOR UPDATE */
-bool is_parallel_table = false;
-
 /*
  * last query string sent to simpleQuery()
  */
 char query_string_buffer[QUERY_STRING_BUFFER_LEN];
 
-/*
- * query string produced by nodeToString() in simpleQuery().
- * this variable only usefull when enable_query_cache is true.
- */
-char *parsed_query = NULL;
-
 static int check_errors(POOL_CONNECTION_POOL *backend, int backend_id);
 static void generate_error_message(char *prefix, int specific_error, char *query);
 static int is_temp_table(POOL_CONNECTION_POOL *backend, Node *node);
+static void check_session_state(List *parse_tree_list);
+static int is_session_state_query(Node *node);
+static bool session_state_function_walker(Node *node, void *context);
+static int execute_query_cache(POOL_CONNECTION *frontend, POOL_CONNECTION_POOL *backend,
+							   Node *node, Portal *portal, char *message);
+static int copy_split_data(POOL_CONNECTION_POOL *backend, char *data, int len);
+static int copy_route_row(POOL_CONNECTION_POOL *backend, char *row, int len);
+static int copy_get_key(char *row, int len);
+static char *copy_find_unescaped(char *start, char *p, char *end, int c);
+static int copy_buffer_append(char **buf, int *len, int *size, char *data, int datalen);
+static int copy_send(POOL_CONNECTION *cp, char *data, int len);
+static int copy_send_batches(POOL_CONNECTION_POOL *backend);
 
 POOL_STATUS NotificationResponse(POOL_CONNECTION *frontend,
 										POOL_CONNECTION_POOL *backend)
@@ -154,7 +125,7 @@ POOL_STATUS NotificationResponse(POOL_CONNECTION *frontend,
 	POOL_MEMORY_POOL *old_context = NULL;
 	Portal *portal;
 
-	force_replication = 0;
+	session_context->force_replication = 0;
 	if (query == NULL)	/* need to read query from frontend? */
 	{
 		/* read actual query */
@@ -193,47 +164,84 @@ POOL_STATUS NotificationResponse(POOL_CONNECTION *frontend,
 		pool_debug("statement2: %s", string);
 	}
 
-	/* parse SQL string */
-	parse_tree_list = raw_parser(string);
+	/*
+	 * A plain SELECT to be load balanced needs neither a parse tree
+	 * nor other checks below. Recognize it from the string and skip
+	 * parsing.
+	 */
+	if (query == NULL && load_balance_enabled_without_parse(backend, string))
+	{
+		pool_debug("SimpleQuery: load balance without parsing");
+		parse_tree_list = NIL;
+		start_load_balance(backend);
+
+		/* free_parser() is called later */
+		if (pool_memory == NULL)
+			pool_memory = pool_memory_create(PARSER_BLOCK_SIZE);
+	}
+	else
+	{
+		/* parse SQL string */
+		parse_tree_list = pool_raw_parser(string);
+
+		/* queries issued by pgpool itself do not count */
+		if (query == NULL)
+			check_session_state(parse_tree_list);
+	}
 
 	if (parse_tree_list != NIL)
 	{
 		node = (Node *) lfirst(list_head(parse_tree_list));
 
 		if (PARALLEL_MODE)
-			is_parallel_table = is_partition_table(backend,node);
+			session_context->is_parallel_table = is_partition_table(backend,node);
 
-		if (pool_config->enable_query_cache &&
-			SYSDB_STATUS == CON_UP &&
+		/* remember modified tables to invalidate query cache and relation cache */
+		{
+			ListCell *cell;
+
+			foreach(cell, parse_tree_list)
+			{
+				pool_query_cache_add_modified_tables((Node *) lfirst(cell), backend->info->database);
+				pool_relcache_check_ddl((Node *) lfirst(cell));
+			}
+		}
+
+		if (QUERY_CACHE_AVAILABLE &&
 			IsA(node, SelectStmt) &&
-			!(is_select_pgcatalog = IsSelectpgcatalog(node, backend)))
+			!(session_context->is_select_pgcatalog = IsSelectpgcatalog(node, backend)) &&
+			pool_query_cache_set_tables(node, backend->info->database))
 		{
 			SelectStmt *select = (SelectStmt *)node;
 
 			if (! (select->intoClause || select->lockingClause))
 			{
-				parsed_query = strdup(nodeToString(node));
-				if (parsed_query == NULL)
+				session_context->parsed_query = strdup(nodeToString(node));
+				if (session_context->parsed_query == NULL)
 				{
 					pool_error("pool_process_query: malloc failed");
 					return POOL_ERROR;
 				}
+				session_context->cache_execute_result = 0;
 
-				if (parsed_query)
+				if (session_context->parsed_query)
 				{
-					if (pool_query_cache_lookup(frontend, parsed_query, backend->info->database, TSTATE(backend)) == POOL_CONTINUE)
+					int hit = pool_query_cache_lookup(frontend, session_context->parsed_query, backend->info->database, TSTATE(backend)) == POOL_CONTINUE;
+
+					pool_stats_count_query_cache(hit);
+					if (hit)
 					{
-						free(parsed_query);
-						parsed_query = NULL;
+						free(session_context->parsed_query);
+						session_context->parsed_query = NULL;
 						free_parser();
 						return POOL_CONTINUE;
 					}
 				}
-				is_select_for_update = 0;
+				session_context->is_select_for_update = 0;
 			}
 			else
 			{
-				is_select_for_update = 1;
+				session_context->is_select_for_update = 1;
 			}
 		}
 
@@ -270,7 +278,7 @@ POOL_STATUS NotificationResponse(POOL_CONNECTION *frontend,
 				 */
 				POOL_STATUS stats = pool_parallel_exec(frontend,backend,r_query->rewrite_query, node,true);
 				free_parser();
-				in_progress = 0;
+				session_context->in_progress = 0;
 				return stats;
 			}
 			else if(!r_query->is_pg_catalog)
@@ -282,14 +290,14 @@ POOL_STATUS NotificationResponse(POOL_CONNECTION *frontend,
 					free_parser();
 
 					if(r_query->r_code != INSERT_DIST_NO_RULE) {
-						in_progress = 0;
+						session_context->in_progress = 0;
 						return r_query->status;
 					}
 				}
 				else if(r_query->type == T_SelectStmt)
 				{
 					free_parser();
-					in_progress = 0;
+					session_context->in_progress = 0;
 					return r_query->status;
 				}
  			}
@@ -328,14 +336,19 @@ POOL_STATUS NotificationResponse(POOL_CONNECTION *frontend,
 		}
 
 		/* process status reporting? */
-		if (IsA(node, VariableShowStmt) && strncasecmp(sq, string, strlen(sq)) == 0)
+		if (IsA(node, VariableShowStmt) &&
+			(strncasecmp(sq, string, strlen(sq)) == 0 ||
+			 is_stats_reporting(((VariableShowStmt *)node)->name)))
 		{
 			StartupPacket *sp;
 			char psbuf[1024];
 
 			pool_debug("process reporting");
-			process_reporting(frontend, backend);
-			in_progress = 0;
+			if (strncasecmp(sq, string, strlen(sq)) == 0)
+				process_reporting(frontend, backend);
+			else
+				stats_reporting(frontend, backend, ((VariableShowStmt *)node)->name);
+			session_context->in_progress = 0;
 
 			/* show ps status */
 			sp = MASTER_CONNECTION(backend)->sp;
@@ -355,7 +368,7 @@ POOL_STATUS NotificationResponse(POOL_CONNECTION *frontend,
 			 * replicated even if we are in master/slave mode.
 			 */
 			if (MASTER_SLAVE && TSTATE(backend) != 'E')
-				force_replication = 1;
+				session_context->force_replication = 1;
 
 			/*
 			 * Before we did followings only when frontend != NULL,
@@ -366,7 +379,7 @@ POOL_STATUS NotificationResponse(POOL_CONNECTION *frontend,
 			 */
 			if (IsA(node, PrepareStmt))
 			{
-				pending_function = add_prepared_list;
+				session_context->pending_function = add_prepared_list;
 				portal = create_portal();
 				if (portal == NULL)
 				{
@@ -381,11 +394,11 @@ POOL_STATUS NotificationResponse(POOL_CONNECTION *frontend,
 				portal->portal_name = NULL;
 				portal->stmt = copyObject(node);
 				portal->sql_string = NULL;
-				pending_prepared_portal = portal;
+				session_context->pending_prepared_portal = portal;
 			}
 			else if (IsA(node, DeallocateStmt))
 			{
-				pending_function = del_prepared_list;
+				session_context->pending_function = del_prepared_list;
 				portal = create_portal();
 				if (portal == NULL)
 				{
@@ -400,15 +413,15 @@ POOL_STATUS NotificationResponse(POOL_CONNECTION *frontend,
 				portal->portal_name = NULL;
 				portal->stmt = copyObject(node);
 				portal->sql_string = NULL;
-				pending_prepared_portal = portal;
+				session_context->pending_prepared_portal = portal;
 			}
 			else if (IsA(node, DiscardStmt))
 			{
 				DiscardStmt *stmt = (DiscardStmt *)node;
 				if (stmt->target == DISCARD_ALL || stmt->target == DISCARD_PLANS)
 				{
-					pending_function = delete_all_prepared_list;
-					pending_prepared_portal = NULL;
+					session_context->pending_function = delete_all_prepared_list;
+					session_context->pending_prepared_portal = NULL;
 				}
 			}
 
@@ -425,7 +438,7 @@ POOL_STATUS NotificationResponse(POOL_CONNECTION *frontend,
 			PrepareStmt *p_stmt;
 			ExecuteStmt *e_stmt = (ExecuteStmt *)node;
 
-			portal = lookup_prepared_statement_by_statement(&prepared_list,
+			portal = lookup_prepared_statement_by_statement(session_context->prepared_list,
 															e_stmt->name);
 			if (!portal)
 			{
@@ -451,12 +464,12 @@ POOL_STATUS NotificationResponse(POOL_CONNECTION *frontend,
 		else if (MASTER_SLAVE)
 		{
 			pool_debug("SimpleQuery: set master_slave_dml query: %s", string);
-			master_slave_was_enabled = 1;
+			session_context->master_slave_was_enabled = 1;
 			MASTER_SLAVE = 0;
-			master_slave_dml = 1;
-			if (force_replication)
+			session_context->master_slave_dml = 1;
+			if (session_context->force_replication)
 			{
-				replication_was_enabled = 0;
+				session_context->replication_was_enabled = 0;
 				REPLICATION = 1;
 			}
 		}
@@ -465,12 +478,12 @@ POOL_STATUS NotificationResponse(POOL_CONNECTION *frontend,
 				 is_select_query(node1, string1) &&
 				 !is_sequence_query(node1))
 		{
-			selected_slot = MASTER_NODE_ID;
-			replication_was_enabled = 1;
+			session_context->selected_slot = MASTER_NODE_ID;
+			session_context->replication_was_enabled = 1;
 			REPLICATION = 0;
 			LOAD_BALANCE_STATUS(MASTER_NODE_ID) = LOAD_SELECTED;
-			in_load_balance = 1;
-			select_in_transaction = 1;
+			session_context->in_load_balance = 1;
+			session_context->select_in_transaction = 1;
 		}
 
 
@@ -508,13 +521,13 @@ POOL_STATUS NotificationResponse(POOL_CONNECTION *frontend,
 		}
 	}
 	else
-	{  /* syntax error */
+	{  /* syntax error, or load balanced without parsing (MASTER_SLAVE is off then) */
 		if (MASTER_SLAVE)
 		{
 			pool_debug("SimpleQuery: set master_slave_dml query: %s", string);
-			master_slave_was_enabled = 1;
+			session_context->master_slave_was_enabled = 1;
 			MASTER_SLAVE = 0;
-			master_slave_dml = 1;
+			session_context->master_slave_dml = 1;
 		}
 	}
 
@@ -523,6 +536,9 @@ POOL_STATUS NotificationResponse(POOL_CONNECTION *frontend,
 		TSTATE(backend) = 'T';
 	}
 
+	pool_stats_query_start(session_context->in_load_balance ||
+						   (node && is_select_query(node, string)));
+
 	if (REPLICATION || PARALLEL_MODE)
 	{
 		/* check if query is "COMMIT" or "ROLLBACK" */
@@ -541,12 +557,12 @@ POOL_STATUS NotificationResponse(POOL_CONNECTION *frontend,
 
 				if (IsA(node, PrepareStmt))
 				{
-					portal = pending_prepared_portal;
+					portal = session_context->pending_prepared_portal;
 					portal->num_tsparams = 0;
 				}
 				else if (IsA(node, ExecuteStmt))
 					portal = lookup_prepared_statement_by_statement(
-							&prepared_list, ((ExecuteStmt *) node)->name);
+							session_context->prepared_list, ((ExecuteStmt *) node)->name);
 
 				/* rewrite `now()' to timestamp literal */
 				rewrite_query = rewrite_timestamp(backend, node, false, portal);
@@ -573,13 +589,19 @@ POOL_STATUS NotificationResponse(POOL_CONNECTION *frontend,
 
 					per_node_statement_log(backend, i, string);
 
-					if (send_simplequery_message(CONNECTION(backend, i), len, string, MAJOR(backend)) != POOL_CONTINUE)
+					if (write_simplequery_message(CONNECTION(backend, i), len, string, MAJOR(backend)) != POOL_CONTINUE)
 					{
 						free_parser();
 						return POOL_END;
 					}
 				}
 
+				if (flush_backends(backend) != POOL_CONTINUE)
+				{
+					free_parser();
+					return POOL_END;
+				}
+
 				/* Wait for response from DB nodes */
 				for (i=0;i<NUM_BACKENDS;i++)
 				{
@@ -674,13 +696,20 @@ POOL_STATUS NotificationResponse(POOL_CONNECTION *frontend,
 
 			per_node_statement_log(backend, i, string);
 
-			if (send_simplequery_message(CONNECTION(backend, i), len, string, MAJOR(backend)) != POOL_CONTINUE)
+			if (write_simplequery_message(CONNECTION(backend, i), len, string, MAJOR(backend)) != POOL_CONTINUE)
 			{
 				free_parser();
 				return POOL_END;
 			}
 		}
 
+		/* send the query to all of them before waiting for any */
+		if (flush_backends(backend) != POOL_CONTINUE)
+		{
+			free_parser();
+			return POOL_END;
+		}
+
 		/* Wait for nodes othan than the master node */
 		for (i=0;i<NUM_BACKENDS;i++)
 		{
@@ -757,6 +786,17 @@ POOL_STATUS NotificationResponse(POOL_CONNECTION *frontend,
 		if (send_simplequery_message(MASTER(backend), len, string, MAJOR(backend)) != POOL_CONTINUE)
 			return POOL_END;
 
+		/*
+		 * A child serving multiple sessions does not wait here:
+		 * pool_process_query reads the response when it arrives and
+		 * serves other sessions meanwhile.
+		 */
+		if (MULTIPLEXED_MODE)
+		{
+			free_parser();
+			return POOL_CONTINUE;
+		}
+
 		if (wait_for_query_response(frontend, MASTER(backend), string, MAJOR(backend)) != POOL_CONTINUE)
 		{
 				/* Cancel current transaction */
@@ -812,7 +852,7 @@ POOL_STATUS Execute(POOL_CONNECTION *frontend,
 
 	pool_debug("Execute: portal name <%s>", string);
 
-	portal = lookup_prepared_statement_by_portal(&prepared_list,
+	portal = lookup_prepared_statement_by_portal(session_context->prepared_list,
 												 string);
 
 	/* load balance trick */
@@ -827,6 +867,14 @@ POOL_STATUS Execute(POOL_CONNECTION *frontend,
 		node = (Node *)p_stmt->query;
 		strncpy(query_string_buffer, string1, sizeof(query_string_buffer));
 
+		/* remember modified tables to invalidate query cache and relation cache */
+		pool_query_cache_add_modified_tables(node, backend->info->database);
+		pool_relcache_check_ddl(node);
+
+		/* send the result from query cache without touching backends */
+		if (execute_query_cache(frontend, backend, node, portal, string))
+			return POOL_CONTINUE;
+
  		if ((IsA(node, PrepareStmt) || IsA(node, DeallocateStmt) ||
  			 IsA(node, VariableSetStmt)) &&
   			MASTER_SLAVE && TSTATE(backend) != 'E')
@@ -836,7 +884,7 @@ POOL_STATUS Execute(POOL_CONNECTION *frontend,
 			 * should be executed on all nodes.  So we set
 			 * force_replication.
 			 */
-			force_replication = 1;
+			session_context->force_replication = 1;
 		}
 		/*
 		 * JDBC driver sends "BEGIN" query internally if
@@ -855,7 +903,7 @@ POOL_STATUS Execute(POOL_CONNECTION *frontend,
 			if (stmt->kind == TRANS_STMT_BEGIN ||
 				stmt->kind == TRANS_STMT_START)
 				/* Remember we need to send sync later in extended protocol */
-				receive_extended_begin = 1;
+				session_context->receive_extended_begin = 1;
 		}
 
 		if (load_balance_enabled(backend, node, string1))
@@ -865,13 +913,13 @@ POOL_STATUS Execute(POOL_CONNECTION *frontend,
 				 is_select_query((Node *)p_stmt->query, string1) &&
 				 !is_sequence_query((Node *)p_stmt->query))
 		{
-			selected_slot = MASTER_NODE_ID;
-			replication_was_enabled = 1;
+			session_context->selected_slot = MASTER_NODE_ID;
+			session_context->replication_was_enabled = 1;
 			REPLICATION = 0;
 			LOAD_BALANCE_STATUS(MASTER_NODE_ID) = LOAD_SELECTED;
-			in_load_balance = 1;
-			select_in_transaction = 1;
-			execute_select = 1;
+			session_context->in_load_balance = 1;
+			session_context->select_in_transaction = 1;
+			session_context->execute_select = 1;
 		}
 /*
 		else if (REPLICATION && start_internal_transaction(backend, (Node *)p_stmt->query))
@@ -883,14 +931,17 @@ POOL_STATUS Execute(POOL_CONNECTION *frontend,
 		commit = is_commit_query((Node *)p_stmt->query);
 	}
 
+	pool_stats_query_start(session_context->in_load_balance ||
+						   (portal && is_select_query((Node *)p_stmt->query, string1)));
+
 	if (MASTER_SLAVE)
 	{
-		master_slave_was_enabled = 1;
+		session_context->master_slave_was_enabled = 1;
 		MASTER_SLAVE = 0;
-		master_slave_dml = 1;
-		if (force_replication)
+		session_context->master_slave_dml = 1;
+		if (session_context->force_replication)
 		{
-			replication_was_enabled = 0;
+			session_context->replication_was_enabled = 0;
 			REPLICATION = 1;
 		}
 	}
@@ -942,17 +993,20 @@ POOL_STATUS Execute(POOL_CONNECTION *frontend,
 				int len = strlen(msg);
 
 				memset(msg + len, 0, sizeof(int));
-				if (send_execute_message(backend, i, len + 5, msg))
+				if (write_execute_message(backend, i, len + 5, msg))
 					return POOL_END;
 			}
 			else
 			{
 				per_node_statement_log(backend, i, string1);
-				if (send_execute_message(backend, i, len, string) != POOL_CONTINUE)
+				if (write_execute_message(backend, i, len, string) != POOL_CONTINUE)
 					return POOL_END;
 			}
 		}
 
+		if (flush_backends(backend) != POOL_CONTINUE)
+			return POOL_END;
+
 		/* Wait for nodes other than the master node */
 		for (i=0;i<NUM_BACKENDS;i++)
 		{
@@ -1072,7 +1126,8 @@ POOL_STATUS Parse(POOL_CONNECTION *frontend,
 	name = string;
 	stmt = string + strlen(string) + 1;
 
-	parse_tree_list = raw_parser(stmt);
+	parse_tree_list = pool_raw_parser(stmt);
+	check_session_state(parse_tree_list);
 	if (parse_tree_list == NIL)
 	{
 		/* free_parser(); */
@@ -1100,9 +1155,9 @@ POOL_STATUS Parse(POOL_CONNECTION *frontend,
 				 * typically usefull for using temp tables in master/slave
 				 * mode
 				 */
-				master_slave_was_enabled = 1;
+				session_context->master_slave_was_enabled = 1;
 				MASTER_SLAVE = 0;
-				master_slave_dml = 1;
+				session_context->master_slave_dml = 1;
 			}
 		}
 
@@ -1134,15 +1189,15 @@ POOL_STATUS Parse(POOL_CONNECTION *frontend,
 
 		if (*name)
 		{
-			pending_function = add_prepared_list;
-			pending_prepared_portal = portal;
+			session_context->pending_function = add_prepared_list;
+			session_context->pending_prepared_portal = portal;
 		}
 		else /* unnamed statement */
 		{
-			pending_function = add_unnamed_portal;
+			session_context->pending_function = add_unnamed_portal;
 			pfree(p_stmt->name);
 			p_stmt->name = NULL;
-			pending_prepared_portal = portal;
+			session_context->pending_prepared_portal = portal;
 		}
 
 		/*
@@ -1297,10 +1352,10 @@ POOL_STATUS Parse(POOL_CONNECTION *frontend,
 
 					per_node_statement_log(backend, i, POOL_ERROR_QUERY);
 
-					if (send_simplequery_message(CONNECTION(backend, i),
-												 strlen(POOL_ERROR_QUERY)+1,
-												 POOL_ERROR_QUERY,
-												 MAJOR(backend)))
+					if (write_simplequery_message(CONNECTION(backend, i),
+												  strlen(POOL_ERROR_QUERY)+1,
+												  POOL_ERROR_QUERY,
+												  MAJOR(backend)))
 					{
 						free_parser();
 						return POOL_END;
@@ -1311,7 +1366,7 @@ POOL_STATUS Parse(POOL_CONNECTION *frontend,
 					snprintf(per_node_statement_log_buffer, sizeof(per_node_statement_log_buffer), "Parse: %s", stmt);
 					per_node_statement_log(backend, i, per_node_statement_log_buffer);
 
-					if (send_extended_protocol_message(backend, i,"P", len, string))
+					if (write_extended_protocol_message(backend, i,"P", len, string))
 					{
 						free_parser();
 						return POOL_END;
@@ -1320,6 +1375,12 @@ POOL_STATUS Parse(POOL_CONNECTION *frontend,
 			}
 		}
 
+		if (flush_backends(backend) != POOL_CONTINUE)
+		{
+			free_parser();
+			return POOL_END;
+		}
+
 		/* wait for DB nodes completing query except master node */
 		for (i=0;i<NUM_BACKENDS;i++)
 		{
@@ -1394,7 +1455,7 @@ POOL_STATUS ReadyForQuery(POOL_CONNECTION *frontend,
 	 * If the numbers of update tuples are differ, we need to abort transaction
 	 * by using do_error_command. This only works with PROTO_MAJOR_V3.
 	 */
-	if (mismatch_ntuples && MAJOR(backend) == PROTO_MAJOR_V3)
+	if (session_context->mismatch_ntuples && MAJOR(backend) == PROTO_MAJOR_V3)
 	{
 		int i;
 		signed char state;
@@ -1447,14 +1508,14 @@ POOL_STATUS ReadyForQuery(POOL_CONNECTION *frontend,
 				return POOL_END;
 			}
 		}
-		mismatch_ntuples = 0;
+		session_context->mismatch_ntuples = 0;
 	}
 
 	/*
 	 * if a transaction is started for insert lock, we need to close
 	 * the transaction.
 	 */
-	if (internal_transaction_started && allow_close_transaction)
+	if (session_context->internal_transaction_started && session_context->allow_close_transaction)
 	{
 		int len;
 		signed char state;
@@ -1493,7 +1554,7 @@ POOL_STATUS ReadyForQuery(POOL_CONNECTION *frontend,
 		 * If these queries are executed inside a transaction block,
 		 * transation state will be inconsistent. But it is no problem.
 		 */
-		if (master_slave_dml)
+		if (session_context->master_slave_dml)
 		{
 			char kind, kind1;
 
@@ -1529,6 +1590,18 @@ POOL_STATUS ReadyForQuery(POOL_CONNECTION *frontend,
 		}
 	}
 
+	/*
+	 * invalidate query cache and relation cache of tables modified by
+	 * the transaction before the frontend issues next query. since V2
+	 * protocol does not tell the transaction state, invalidate at every
+	 * ReadyForQuery.
+	 */
+	if (MAJOR(backend) != PROTO_MAJOR_V3 || state == 'I')
+	{
+		pool_query_cache_invalidate();
+		pool_relcache_end_transaction();
+	}
+
 	if (send_ready)
 	{
 		pool_write(frontend, "Z", 1);
@@ -1542,22 +1615,26 @@ POOL_STATUS ReadyForQuery(POOL_CONNECTION *frontend,
 		pool_flush(frontend);
 	}
 
-	in_progress = 0;
+	session_context->in_progress = 0;
+	session_context->backend_idle = 1;
+
+	/* count the query on the nodes it was sent to */
+	pool_stats_query_end(backend);
 
 	/* end load balance mode */
-	if (in_load_balance)
+	if (session_context->in_load_balance)
 		end_load_balance();
 
-	if (master_slave_dml)
+	if (session_context->master_slave_dml)
 	{
 		MASTER_SLAVE = 1;
-		master_slave_was_enabled = 0;
-		master_slave_dml = 0;
-		if (force_replication)
+		session_context->master_slave_was_enabled = 0;
+		session_context->master_slave_dml = 0;
+		if (session_context->force_replication)
 		{
-			force_replication = 0;
+			session_context->force_replication = 0;
 			REPLICATION = 0;
-			replication_was_enabled = 0;
+			session_context->replication_was_enabled = 0;
 		}
 	}
 
@@ -1760,9 +1837,9 @@ POOL_STATUS ProcessFrontendResponse(POOL_CONNECTION *frontend,
 	 * If we have received BEGIN in extended protocol before, we need
 	 * to send a sync message to know the transaction stare.
 	 */
-	if (receive_extended_begin)
+	if (session_context->receive_extended_begin)
 	{
-		receive_extended_begin = 0;
+		session_context->receive_extended_begin = 0;
 
 		/* send sync message */
 		send_extended_protocol_message(backend, MASTER_NODE_ID, "S", 0, "");
@@ -1774,6 +1851,9 @@ POOL_STATUS ProcessFrontendResponse(POOL_CONNECTION *frontend,
 			return POOL_END;
 	}
 
+	/* backends are no longer idle even if no reply is expected yet */
+	session_context->backend_idle = 0;
+
 	switch (fkind)
 	{
 
@@ -1786,33 +1866,33 @@ POOL_STATUS ProcessFrontendResponse(POOL_CONNECTION *frontend,
 			return POOL_END;
 
 		case 'Q':  /* Query message*/
-			in_progress = 1;
-			allow_close_transaction = 1;
+			session_context->in_progress = 1;
+			session_context->allow_close_transaction = 1;
 			status = SimpleQuery(frontend, backend, NULL);
 			break;
 
 		case 'E':  /* Execute message */
-			allow_close_transaction = 1;
+			session_context->allow_close_transaction = 1;
 			status = Execute(frontend, backend);
 			break;
 
 		case 'P':  /* Parse message */
-			allow_close_transaction = 0;
+			session_context->allow_close_transaction = 0;
 
 			if (MASTER_SLAVE &&
-				(TSTATE(backend) != 'I' || receive_extended_begin))
+				(TSTATE(backend) != 'I' || session_context->receive_extended_begin))
 			{
 				pool_debug("kind: %c master_slave_dml enabled", fkind);
-				master_slave_was_enabled = 1;
+				session_context->master_slave_was_enabled = 1;
 				MASTER_SLAVE = 0;
-				master_slave_dml = 1;
+				session_context->master_slave_dml = 1;
 			}
 
 			status = Parse(frontend, backend);
 			break;
 
 		case 'S':  /* Sync message */
-			receive_extended_begin = 0;
+			session_context->receive_extended_begin = 0;
 			/* fall through */
 
 		default:
@@ -1821,12 +1901,12 @@ POOL_STATUS ProcessFrontendResponse(POOL_CONNECTION *frontend,
 				 fkind == 'C' || fkind == 'B' || fkind == 'F' || fkind == 'd' || fkind == 'c'))
 			{
 				if (MASTER_SLAVE &&
-					(TSTATE(backend) != 'I' || receive_extended_begin))
+					(TSTATE(backend) != 'I' || session_context->receive_extended_begin))
 				{
 					pool_debug("kind: %c master_slave_dml enabled", fkind);
-					master_slave_was_enabled = 1;
+					session_context->master_slave_was_enabled = 1;
 					MASTER_SLAVE = 0;
-					master_slave_dml = 1;
+					session_context->master_slave_dml = 1;
 				}
 	
 				status = SimpleForwardToBackend(fkind, frontend, backend);
@@ -2392,6 +2472,27 @@ POOL_STATUS CopyOutResponse(POOL_CONNECTION *frontend,
 	return status;
 }
 
+/*
+ * State of COPY FROM a partitioned table in parallel mode. CopyData
+ * messages from the frontend are split into rows regardless of the
+ * message boundaries, each row is routed by its distribution key, and
+ * rows are accumulated for each node up to copy_batch_size bytes
+ * before sending them in one CopyData message. Buffers are kept for
+ * later COPY.
+ */
+typedef struct {
+	char *buf;
+	int len;
+	int size;
+} CopyBuffer;
+
+static struct {
+	DistDefInfo *info;
+	CopyBuffer partial;		/* incomplete row continued in the next message */
+	CopyBuffer key;			/* unescaped distribution key */
+	CopyBuffer batch[MAX_NUM_BACKENDS];	/* rows to be sent to each node */
+} copy_state;
+
 POOL_STATUS CopyDataRows(POOL_CONNECTION *frontend,
 								POOL_CONNECTION_POOL *backend, int copyin)
 {
@@ -2408,8 +2509,15 @@ POOL_STATUS CopyDataRows(POOL_CONNECTION *frontend,
 	if (copyin && pool_config->parallel_mode == TRUE)
 	{
 		info = pool_get_dist_def_info(MASTER_CONNECTION(backend)->sp->database,
-									  copy_schema,
-									  copy_table);
+									  session_context->copy_schema,
+									  session_context->copy_table);
+		if (info)
+		{
+			copy_state.info = info;
+			copy_state.partial.len = 0;
+			for (i=0;i<NUM_BACKENDS;i++)
+				copy_state.batch[i].len = 0;
+		}
 	}
 
 	for (;;)
@@ -2420,14 +2528,13 @@ POOL_STATUS CopyDataRows(POOL_CONNECTION *frontend,
 			{
 				char kind;
 				int sendlen;
-				char *p, *p1;
+				char *p;
 
 				if (pool_read(frontend, &kind, 1) < 0)
 					return POOL_END;
 
 				if (info && kind == 'd')
 				{
-					int id;
 					if (pool_read(frontend, &sendlen, sizeof(sendlen)))
 					{
 						return POOL_END;
@@ -2442,61 +2549,22 @@ POOL_STATUS CopyDataRows(POOL_CONNECTION *frontend,
 					if (p == NULL)
 						return POOL_END;
 
-					/* copy end ? */
-					if (len == 3 && memcmp(p, "\\.\n", 3) == 0)
-					{
-						for (i=0;i<NUM_BACKENDS;i++)
-						{
-							if (VALID_BACKEND(i))
-							{
-								if (pool_write(CONNECTION(backend, i), &kind, 1))
-									return POOL_END;
-								if (pool_write(CONNECTION(backend, i), &sendlen, sizeof(sendlen)))
-									return POOL_END;
-								if (pool_write(CONNECTION(backend, i), p, len))
-									return POOL_END;
-							}
-						}
-					}
-					else
+					if (copy_split_data(backend, p, len))
+						return POOL_END;
+				}
+				else
+				{
+					if (info)
 					{
-						p1 = parse_copy_data(p, len, copy_delimiter, info->dist_key_col_id);
-
-						if (!p1)
-						{
-							pool_error("CopyDataRow: cannot parse data");
-							return POOL_END;
-						}
-						else if (strcmp(p1, copy_null) == 0)
-						{
-							pool_error("CopyDataRow: key parameter is NULL");
-							free(p1);
+						/* the last row may lack the newline */
+						if (copy_state.partial.len > 0 &&
+							copy_route_row(backend, copy_state.partial.buf, copy_state.partial.len))
 							return POOL_END;
-						}
+						copy_state.partial.len = 0;
 
-						id = pool_get_id(info, p1);
-						pool_debug("CopyDataRow: copying id: %d", id);
-						free(p1);
-						if (!VALID_BACKEND(id))
-						{
-							exit(1);
-						}
-						if (pool_write(CONNECTION(backend, id), &kind, 1))
-						{
+						if (copy_send_batches(backend))
 							return POOL_END;
-						}
-						if (pool_write(CONNECTION(backend, id), &sendlen, sizeof(sendlen)))
-						{
-							return POOL_END;
-						}
-						if (pool_write_and_flush(CONNECTION(backend, id), p, len))
-						{
-							return POOL_END;
-						}
 					}
-				}
-				else
-				{
 					SimpleForwardToBackend(kind, frontend, backend);
 				}
 
@@ -2596,6 +2664,302 @@ POOL_STATUS CopyDataRows(POOL_CONNECTION *frontend,
 	return POOL_CONTINUE;
 }
 
+/*
+ * Split CopyData from the frontend into rows and route them. A row
+ * not terminated in data is kept until the next call.
+ */
+static int copy_split_data(POOL_CONNECTION_POOL *backend, char *data, int len)
+{
+	char *p = data;
+	char *end = data + len;
+	char *eol;
+
+	/* complete the row carried over from the previous message */
+	if (copy_state.partial.len > 0)
+	{
+		char *start = copy_state.partial.buf;
+		int prev = copy_state.partial.len;
+
+		/*
+		 * The carried row may end with a backslash escaping the first
+		 * byte of data. Look for the newline in the joined row.
+		 */
+		eol = memchr(p, '\n', end - p);
+		while (eol)
+		{
+			int nbackslash = 0;
+			char *q;
+
+			for (q = eol; q > p && q[-1] == '\\'; q--)
+				nbackslash++;
+			if (q == p)
+			{
+				for (q = start + prev; q > start && q[-1] == '\\'; q--)
+					nbackslash++;
+			}
+			if (nbackslash % 2 == 0)
+				break;
+			eol = memchr(eol + 1, '\n', end - eol - 1);
+		}
+
+		if (eol == NULL)
+			return copy_buffer_append(&copy_state.partial.buf, &copy_state.partial.len,
+									  &copy_state.partial.size, p, len);
+
+		if (copy_buffer_append(&copy_state.partial.buf, &copy_state.partial.len,
+							   &copy_state.partial.size, p, eol + 1 - p))
+			return -1;
+		if (copy_route_row(backend, copy_state.partial.buf, copy_state.partial.len))
+			return -1;
+		copy_state.partial.len = 0;
+		p = eol + 1;
+	}
+
+	while (p < end)
+	{
+		eol = copy_find_unescaped(p, p, end, '\n');
+		if (eol == NULL)
+			return copy_buffer_append(&copy_state.partial.buf, &copy_state.partial.len,
+									  &copy_state.partial.size, p, end - p);
+
+		if (copy_route_row(backend, p, eol + 1 - p))
+			return -1;
+		p = eol + 1;
+	}
+	return 0;
+}
+
+/*
+ * Append a row to the batch of the node chosen by its distribution
+ * key. The end of data marker is sent to all nodes.
+ */
+static int copy_route_row(POOL_CONNECTION_POOL *backend, char *row, int len)
+{
+	CopyBuffer *batch;
+	int id;
+	int i;
+
+	if ((len == 3 && memcmp(row, "\\.\n", 3) == 0) ||
+		(len == 4 && memcmp(row, "\\.\r\n", 4) == 0))
+	{
+		if (copy_send_batches(backend))
+			return -1;
+
+		for (i=0;i<NUM_BACKENDS;i++)
+		{
+			if (VALID_BACKEND(i) && copy_send(CONNECTION(backend, i), row, len))
+				return -1;
+		}
+		return 0;
+	}
+
+	if (copy_get_key(row, len))
+		return -1;
+
+	id = pool_get_id(copy_state.info, copy_state.key.buf);
+	pool_debug("copy_route_row: copying id: %d", id);
+	if (id < 0 || !VALID_BACKEND(id))
+	{
+		pool_error("copy_route_row: cannot decide the node for key \"%s\"", copy_state.key.buf);
+		return -1;
+	}
+
+	batch = &copy_state.batch[id];
+	if (batch->len > 0 && batch->len + len > pool_config->copy_batch_size)
+	{
+		if (copy_send(CONNECTION(backend, id), batch->buf, batch->len))
+			return -1;
+		batch->len = 0;
+	}
+
+	if (len >= pool_config->copy_batch_size)
+		return copy_send(CONNECTION(backend, id), row, len);
+
+	return copy_buffer_append(&batch->buf, &batch->len, &batch->size, row, len);
+}
+
+/*
+ * Extract the distribution key of a row in text format into
+ * copy_state.key, removing escapes.
+ */
+static int copy_get_key(char *row, int len)
+{
+	char delimiter = session_context->copy_delimiter;
+	char *end = row + len;
+	char *p = row;
+	char *field_end;
+	int col_id = copy_state.info->dist_key_col_id;
+	int i;
+
+	if (end > row && end[-1] == '\n')
+		end--;
+	if (end > row && end[-1] == '\r')
+		end--;
+
+	for (i = 0; i < col_id; i++)
+	{
+		p = copy_find_unescaped(row, p, end, delimiter);
+		if (p == NULL)
+		{
+			pool_error("copy_get_key: cannot parse data");
+			return -1;
+		}
+		p++;
+	}
+
+	field_end = copy_find_unescaped(row, p, end, delimiter);
+	if (field_end == NULL)
+		field_end = end;
+
+	if (field_end - p == strlen(session_context->copy_null) &&
+		memcmp(p, session_context->copy_null, field_end - p) == 0)
+	{
+		pool_error("copy_get_key: key parameter is NULL");
+		return -1;
+	}
+
+	copy_state.key.len = 0;
+	if (memchr(p, '\\', field_end - p) == NULL)
+	{
+		if (copy_buffer_append(&copy_state.key.buf, &copy_state.key.len, &copy_state.key.size,
+							   p, field_end - p))
+			return -1;
+	}
+	else
+	{
+		for (; p < field_end; p++)
+		{
+			char c = *p;
+
+			if (c == '\\' && p + 1 < field_end)
+			{
+				switch (*++p)
+				{
+					case 'b': c = '\b'; break;
+					case 'f': c = '\f'; break;
+					case 'n': c = '\n'; break;
+					case 'r': c = '\r'; break;
+					case 't': c = '\t'; break;
+					case 'v': c = '\v'; break;
+					case 'x':
+						/* \xhh. same as COPY of PostgreSQL */
+						if (p + 1 < field_end && isxdigit((unsigned char)p[1]))
+						{
+							int n = 0;
+
+							for (i = 0; i < 2 && p + 1 < field_end && isxdigit((unsigned char)p[1]); i++, p++)
+								n = n * 16 + (isdigit((unsigned char)p[1]) ? p[1] - '0' : (tolower((unsigned char)p[1]) - 'a' + 10));
+							c = n;
+						}
+						else
+							c = 'x';
+						break;
+					default:
+						/* \ooo */
+						if (*p >= '0' && *p <= '7')
+						{
+							int n = *p - '0';
+
+							for (i = 0; i < 2 && p + 1 < field_end && p[1] >= '0' && p[1] <= '7'; i++, p++)
+								n = n * 8 + p[1] - '0';
+							c = n;
+						}
+						else
+							c = *p;
+						break;
+				}
+			}
+			if (copy_buffer_append(&copy_state.key.buf, &copy_state.key.len, &copy_state.key.size,
+								   &c, 1))
+				return -1;
+		}
+	}
+
+	if (copy_buffer_append(&copy_state.key.buf, &copy_state.key.len, &copy_state.key.size, "", 1))
+		return -1;
+	pool_debug("copy_get_key: divide key value is %s", copy_state.key.buf);
+	return 0;
+}
+
+/*
+ * Returns the first c in [p, end) not escaped by a backslash, or
+ * NULL. start is the beginning of the row, where a series of
+ * backslashes can start.
+ */
+static char *copy_find_unescaped(char *start, char *p, char *end, int c)
+{
+	char *q;
+	int nbackslash;
+
+	while (p < end && (p = memchr(p, c, end - p)) != NULL)
+	{
+		nbackslash = 0;
+		for (q = p; q > start && q[-1] == '\\'; q--)
+			nbackslash++;
+		if (nbackslash % 2 == 0)
+			return p;
+		p++;
+	}
+	return NULL;
+}
+
+static int copy_buffer_append(char **buf, int *len, int *size, char *data, int datalen)
+{
+	if (*len + datalen > *size)
+	{
+		int newsize = *size ? *size : 1024;
+		char *newbuf;
+
+		while (*len + datalen > newsize)
+			newsize *= 2;
+		newbuf = realloc(*buf, newsize);
+		if (newbuf == NULL)
+		{
+			pool_error("copy_buffer_append: realloc failed: %s", strerror(errno));
+			return -1;
+		}
+		*buf = newbuf;
+		*size = newsize;
+	}
+	memcpy(*buf + *len, data, datalen);
+	*len += datalen;
+	return 0;
+}
+
+/*
+ * Send data as a CopyData message. It is not flushed here.
+ */
+static int copy_send(POOL_CONNECTION *cp, char *data, int len)
+{
+	char kind = 'd';
+	int sendlen = htonl(len + 4);
+
+	if (pool_write(cp, &kind, 1) ||
+		pool_write(cp, &sendlen, sizeof(sendlen)) ||
+		pool_write(cp, data, len))
+		return -1;
+	return 0;
+}
+
+/*
+ * Send rows accumulated for all nodes
+ */
+static int copy_send_batches(POOL_CONNECTION_POOL *backend)
+{
+	int i;
+
+	for (i=0;i<NUM_BACKENDS;i++)
+	{
+		if (copy_state.batch[i].len == 0)
+			continue;
+		if (VALID_BACKEND(i) &&
+			copy_send(CONNECTION(backend, i), copy_state.batch[i].buf, copy_state.batch[i].len))
+			return -1;
+		copy_state.batch[i].len = 0;
+	}
+	return 0;
+}
+
 POOL_STATUS EmptyQueryResponse(POOL_CONNECTION *frontend,
 									  POOL_CONNECTION_POOL *backend)
 {
@@ -2831,3 +3195,229 @@ void per_node_error_log(POOL_CONNECTION_POOL *backend, int node_id, char *query,
 				 prefix, node_id, ntohl(slot->pid), query, message);
 	}
 }
+
+/*
+ * Remember that the session might have created session level state
+ * which must be reset before the backend connection is reused by
+ * another client.  Queries which we cannot parse are assumed to do
+ * so.
+ */
+static void check_session_state(List *parse_tree_list)
+{
+	ListCell *cell;
+
+	if (session_context->session_state_modified)
+		return;
+
+	if (parse_tree_list == NIL)
+	{
+		session_context->session_state_modified = 1;
+		return;
+	}
+
+	foreach (cell, parse_tree_list)
+	{
+		if (is_session_state_query((Node *) lfirst(cell)))
+		{
+			pool_debug("check_session_state: session state is modified");
+			session_context->session_state_modified = 1;
+			return;
+		}
+	}
+}
+
+/*
+ * Return non 0 if the query creates state which outlives the
+ * transaction.  Prepared statements are not checked here since they
+ * are tracked by prepared_list.  Any function may do so (set_config(),
+ * pg_advisory_lock(), PREPARE run by a user defined function etc.)
+ * unless is_session_safe_function() knows it.
+ */
+static int is_session_state_query(Node *node)
+{
+	RangeVar *rel = NULL;
+
+	if (session_state_function_walker(node, NULL))
+		return 1;
+
+	switch (nodeTag(node))
+	{
+		case T_VariableSetStmt:
+			/* SET LOCAL only lasts until the end of transaction */
+			return !((VariableSetStmt *) node)->is_local;
+
+		case T_DeclareCursorStmt:
+			return (((DeclareCursorStmt *) node)->options & CURSOR_OPT_HOLD) != 0;
+
+		case T_ListenStmt:
+		case T_LoadStmt:
+			return 1;
+
+		case T_CreateStmt:
+			rel = ((CreateStmt *) node)->relation;
+			break;
+
+		case T_CreateSeqStmt:
+			rel = ((CreateSeqStmt *) node)->sequence;
+			break;
+
+		case T_ViewStmt:
+			rel = ((ViewStmt *) node)->view;
+			break;
+
+		case T_SelectStmt:
+			if (((SelectStmt *) node)->intoClause)
+				rel = ((SelectStmt *) node)->intoClause->rel;
+			break;
+
+		default:
+			break;
+	}
+
+	return rel != NULL && rel->istemp;
+}
+
+/*
+ * Return true if a function not known to be safe is called in the
+ * statement or expression.
+ */
+static bool session_state_function_walker(Node *node, void *context)
+{
+	if (node == NULL)
+		return false;
+
+	switch (nodeTag(node))
+	{
+		case T_FuncCall:
+			{
+				List *name = ((FuncCall *) node)->funcname;
+
+				/* a function of another schema may have the same name */
+				if (list_length(name) > 2 ||
+					(list_length(name) == 2 && strcmp(strVal(linitial(name)), "pg_catalog")) ||
+					!is_session_safe_function(strVal(llast(name))))
+				{
+					pool_debug("check_session_state: function %s may change session state",
+							   strVal(llast(name)));
+					return true;
+				}
+			}
+			break;
+
+		/* statements raw_expression_tree_walker does not know */
+		case T_InsertStmt:
+			{
+				InsertStmt *stmt = (InsertStmt *) node;
+
+				return session_state_function_walker(stmt->selectStmt, context) ||
+					session_state_function_walker((Node *) stmt->returningList, context);
+			}
+
+		case T_UpdateStmt:
+			{
+				UpdateStmt *stmt = (UpdateStmt *) node;
+
+				return session_state_function_walker((Node *) stmt->targetList, context) ||
+					session_state_function_walker(stmt->whereClause, context) ||
+					session_state_function_walker((Node *) stmt->fromClause, context) ||
+					session_state_function_walker((Node *) stmt->returningList, context);
+			}
+
+		case T_DeleteStmt:
+			{
+				DeleteStmt *stmt = (DeleteStmt *) node;
+
+				return session_state_function_walker((Node *) stmt->usingClause, context) ||
+					session_state_function_walker(stmt->whereClause, context) ||
+					session_state_function_walker((Node *) stmt->returningList, context);
+			}
+
+		case T_ExplainStmt:
+			return session_state_function_walker(((ExplainStmt *) node)->query, context);
+
+		case T_DeclareCursorStmt:
+			return session_state_function_walker(((DeclareCursorStmt *) node)->query, context);
+
+		case T_ExecuteStmt:
+			return session_state_function_walker((Node *) ((ExecuteStmt *) node)->params, context);
+
+		case T_CopyStmt:
+			return session_state_function_walker(((CopyStmt *) node)->query, context);
+
+		default:
+			break;
+	}
+
+	return raw_expression_tree_walker(node, session_state_function_walker, context);
+}
+
+/*
+ * Look up query cache for the result of Execute message. returns 1
+ * if the result has been sent to the frontend from the cache. if the
+ * result is not found but can be cached, session_context->parsed_query
+ * is set so that the result from the backend is registered.
+ */
+static int execute_query_cache(POOL_CONNECTION *frontend, POOL_CONNECTION_POOL *backend,
+							   Node *node, Portal *portal, char *message)
+{
+	SelectStmt *select;
+	int max_rows;
+	int i;
+
+	if (!QUERY_CACHE_AVAILABLE || !IsA(node, SelectStmt) || portal->bind_md5[0] == '\0')
+		return 0;
+
+	select = (SelectStmt *)node;
+	if (select->intoClause || select->lockingClause)
+		return 0;
+
+	/* partial result fetched by max rows is not cached */
+	memcpy(&max_rows, message + strlen(message) + 1, sizeof(max_rows));
+	if (max_rows != 0)
+		return 0;
+
+	if ((session_context->is_select_pgcatalog = IsSelectpgcatalog(node, backend)) ||
+		!pool_query_cache_set_tables(node, backend->info->database))
+		return 0;
+
+	/*
+	 * The cached result must not overtake replies to the messages sent
+	 * before. Parse, Bind, Describe and Close forward their replies to
+	 * the frontend before returning, so normally nothing is left to be
+	 * read here. If some data is still buffered, let the backend execute
+	 * the query so that the reply is forwarded in order.
+	 */
+	for (i = 0; i < NUM_BACKENDS; i++)
+	{
+		if (VALID_BACKEND(i) && CONNECTION(backend, i)->len > 0)
+		{
+			pool_debug("execute_query_cache: unread data from backend %d. query cache is not used", i);
+			return 0;
+		}
+	}
+
+	/* the same statement returns different result for different parameters */
+	free(session_context->parsed_query);
+	session_context->parsed_query = malloc(strlen(portal->sql_string) + sizeof(portal->bind_md5) + 6);
+	if (session_context->parsed_query == NULL)
+	{
+		pool_error("execute_query_cache: malloc failed");
+		return 0;
+	}
+	sprintf(session_context->parsed_query, "%s\nbind %s", portal->sql_string, portal->bind_md5);
+	session_context->is_select_for_update = 0;
+
+	/* ReadyForQuery is sent in response to Sync message */
+	if (pool_query_cache_lookup(frontend, session_context->parsed_query, backend->info->database, 0) == POOL_CONTINUE)
+	{
+		pool_stats_count_query_cache(1);
+		free(session_context->parsed_query);
+		session_context->parsed_query = NULL;
+		return 1;
+	}
+
+	pool_stats_count_query_cache(0);
+
+	session_context->cache_execute_result = 1;
+	return 0;
+}
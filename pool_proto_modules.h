@@ -37,51 +37,24 @@
 
 
 /* Prepared statement information */
-typedef struct {
+typedef struct pool_portal {
 	char *portal_name; /* portal name*/
 	Node *stmt;        /* parse tree for prepared statement */
 	char *sql_string;  /* original SQL statement */
 	POOL_MEMORY_POOL *prepare_ctxt; /* memory context for parse tree */
 	int num_tsparams;
+	char bind_md5[33]; /* md5 of parameters of the last Bind, used by query cache */
 } Portal;
 
 /*
  * prepared statement list
  */
-typedef struct {
+typedef struct pool_prepared_statement_list {
 	int size;
 	int cnt;
 	Portal **portal_list;
 } PreparedStatementList;
 
-extern int force_replication;
-extern int replication_was_enabled;		/* replication mode was enabled */
-extern int master_slave_was_enabled;	/* master/slave mode was enabled */
-extern int internal_transaction_started;		/* to issue table lock command a transaction
-												   has been started internally */
-extern int in_progress;		/* indicates while doing something after receiving Query */
-extern int mismatch_ntuples;	/* number of updated tuples */
-extern char *copy_table;  /* copy table name */
-extern char *copy_schema;  /* copy table name */
-extern char copy_delimiter; /* copy delimiter char */
-extern char *copy_null; /* copy null string */
-extern void (*pending_function)(PreparedStatementList *p, Portal *portal);
-extern Portal *pending_prepared_portal;
-extern Portal *unnamed_statement;
-extern Portal *unnamed_portal;
-extern int select_in_transaction; /* non 0 if select query is in transaction */
-extern int execute_select; /* non 0 if select query is in transaction */
-
-/* non 0 if "BEGIN" query with extended query protocol received */
-extern int receive_extended_begin;
-
-extern int is_select_pgcatalog;
-extern int is_select_for_update; /* also for SELECT ... INTO */
-extern bool is_parallel_table;
-extern char *parsed_query;
-
-extern PreparedStatementList prepared_list; /* prepared statement name list */
-
 /*
  * modules defined in pool_proto_modules.c
  */
@@ -147,6 +120,7 @@ extern int is_start_transaction_query(Node *node);
 extern int is_commit_query(Node *node);
 extern int is_strict_query(Node *node); /* returns non 0 if this is strict query */
 extern int load_balance_enabled(POOL_CONNECTION_POOL *backend, Node* node, char *sql);
+extern int load_balance_enabled_without_parse(POOL_CONNECTION_POOL *backend, char *sql);
 extern void start_load_balance(POOL_CONNECTION_POOL *backend);
 extern void end_load_balance(void);
 extern int need_insert_lock(POOL_CONNECTION_POOL *backend, char *query, Node *node);
@@ -154,7 +128,6 @@ extern POOL_STATUS insert_lock(POOL_CONNECTION *frontend, POOL_CONNECTION_POOL *
 extern void add_prepared_list(PreparedStatementList *p, Portal *portal);
 extern void add_unnamed_portal(PreparedStatementList *p, Portal *portal);
 extern void delete_all_prepared_list(PreparedStatementList *p, Portal *portal);
-extern char *parse_copy_data(char *buf, int len, char delimiter, int col_id);
 extern Portal *lookup_prepared_statement_by_portal(PreparedStatementList *p, const char *name);extern Portal *lookup_prepared_statement_by_statement(PreparedStatementList *p, const char *name);
 extern int check_copy_from_stdin(Node *node); /* returns non 0 if this is a COPY FROM STDIN */
 extern void query_ps_status(char *query, POOL_CONNECTION_POOL *backend);		/* show ps status */
@@ -169,20 +142,43 @@ extern POOL_STATUS pool_discard_packet(POOL_CONNECTION_POOL *cp);
 
 extern int is_drop_database(Node *node);		/* returns non 0 if this is a DROP DATABASE command */
 extern void process_reporting(POOL_CONNECTION *frontend, POOL_CONNECTION_POOL *backend);
+extern int is_stats_reporting(char *name);
+extern void stats_reporting(POOL_CONNECTION *frontend, POOL_CONNECTION_POOL *backend, char *name);
 extern Portal *create_portal(void);
 extern void del_prepared_list(PreparedStatementList *p, Portal *portal);
 
 extern POOL_STATUS send_simplequery_message(POOL_CONNECTION *backend, int len, char *string, int major);
+extern POOL_STATUS write_simplequery_message(POOL_CONNECTION *backend, int len, char *string, int major);
+extern POOL_STATUS flush_backends(POOL_CONNECTION_POOL *backend);
 extern POOL_STATUS send_extended_protocol_message(POOL_CONNECTION_POOL *backend,
 												  int node_id, char *kind,
 												  int len, char *string);
+extern POOL_STATUS write_extended_protocol_message(POOL_CONNECTION_POOL *backend,
+												   int node_id, char *kind,
+												   int len, char *string);
 
 extern POOL_STATUS send_execute_message(POOL_CONNECTION_POOL *backend,
 										int node_id, int len, char *string);
+extern POOL_STATUS write_execute_message(POOL_CONNECTION_POOL *backend,
+										 int node_id, int len, char *string);
 
 extern int synchronize(POOL_CONNECTION *cp);
 extern POOL_STATUS read_kind_from_backend(POOL_CONNECTION *frontend, POOL_CONNECTION_POOL *backend, char *decided_kind);
 extern POOL_STATUS read_kind_from_one_backend(POOL_CONNECTION *frontend, POOL_CONNECTION_POOL *backend, char *kind, int node);
 extern POOL_STATUS do_error_command(POOL_CONNECTION *backend, int major);
 
+/* pool_query_cache.c */
+extern int pool_query_cache_set_tables(Node *node, char *database);
+extern void pool_query_cache_add_modified_tables(Node *node, char *database);
+
+/* pool_relcache.c */
+extern void pool_relcache_check_ddl(Node *node);
+
+/* pool_query_classify.c */
+extern int is_read_only_select_query(char *sql);
+extern int is_session_safe_function(const char *name);
+
+/* pool_parse_cache.c */
+extern List *pool_raw_parser(const char *query);
+
 #endif
@@ -36,6 +36,7 @@
 #endif
 
 #include "pool.h"
+#include "pool_timestamp.h"
 #include "md5.h"
 
 #define QUERY_CACHE_TABLE_NAME "query_cache"
@@ -65,8 +66,19 @@ typedef enum
 
 static QueryCacheInfo *query_cache_info;
 
+/* tables referenced by the SELECT whose result is being cached in shared memory */
+static unsigned int select_tables[SHMEM_CACHE_MAX_TABLES];
+static unsigned int select_generations[SHMEM_CACHE_MAX_TABLES];
+static int num_select_tables;
+
 static CACHE_STATUS search_system_db_for_cache(POOL_CONNECTION *frontend, char *sql, int sql_len, struct timeval *t, char tstate);
 static int ForwardCacheToFrontend(POOL_CONNECTION *frontend, char *cache, char tstate);
+static int send_cache_to_frontend(POOL_CONNECTION *frontend, char *cache, int len, char tstate);
+static POOL_STATUS shmem_cache_lookup(POOL_CONNECTION *frontend, char *query, char *database, char tstate);
+static int shmem_cache_key(char *database, char *query, char *key);
+static unsigned int table_hash(char *database, char *relname);
+static bool select_table_walker(Node *node, void *context);
+static void add_modified_table(char *database, char *relname);
 static int init_query_cache_info(POOL_CONNECTION *pc, char *database, char *query);
 static void free_query_cache_info(void);
 static int malloc_failed(void *p);
@@ -245,7 +257,8 @@ pool_query_cache_table_exists(void)
  *
  * returns POOL_CONTINUE if cache is found. returns POOL_END if cache was
  * not found. returns POOL_ERROR if an error has been encountered while
- * searching.
+ * searching. tstate 0 means the cache is looked up for Execute message
+ * and ReadyForQuery is not sent to the frontend.
  *
  * Note that POOL_END and POOL_ERROR are treated the same by the caller
  * (pool_process_query.c).
@@ -266,6 +279,9 @@ pool_query_cache_lookup(POOL_CONNECTION *frontend, char *query, char *database,
 	struct timeval timeout;
 	int status;
 
+	if (SHMEM_QUERY_CACHE)
+		return shmem_cache_lookup(frontend, query, database, tstate);
+
 	if (! system_db_connection_exists())
 		return POOL_ERROR;		/* same as POOL_END ... at least for now */
 
@@ -557,8 +573,39 @@ static int ForwardCacheToFrontend(POOL_CONNECTION *frontend, char *cache, char t
 
 	pool_debug("ForwardCacheToFrontend: query cache found (%d bytes)", sendlen);
 
+	if (send_cache_to_frontend(frontend, binary_cache, sendlen, tstate) < 0)
+	{
+		PQfreemem(binary_cache);
+		return -1;
+	}
+
+	PQfreemem(binary_cache);
+	return 0;
+}
+
+/* --------------------------------
+ * send_cache_to_frontend - send cached data followed by ReadyForQuery
+ *
+ * ReadyForQuery is not sent if tstate is 0, which is the case of the
+ * result of Execute message. returns 0 on success, -1 otherwise.
+ * --------------------------------
+ */
+static int send_cache_to_frontend(POOL_CONNECTION *frontend, char *cache, int len, char tstate)
+{
+	int sendlen;
+
 	/* forward cache to the frontend */
-	pool_write(frontend, binary_cache, sendlen);
+	pool_write(frontend, cache, len);
+
+	if (tstate == 0)
+	{
+		if (pool_flush(frontend) < 0)
+		{
+			pool_error("pool_query_cache_lookup: error while writing data to the frontend");
+			return -1;
+		}
+		return 0;
+	}
 
 	/* send ReadyForQuery to the frontend*/
 	pool_write(frontend, "Z", 1);
@@ -567,14 +614,275 @@ static int ForwardCacheToFrontend(POOL_CONNECTION *frontend, char *cache, char t
 	if (pool_write_and_flush(frontend, &tstate, 1) < 0)
 	{
 		pool_error("pool_query_cache_lookup: error while writing data to the frontend");
-		PQfreemem(binary_cache);
 		return -1;
 	}
 
-	PQfreemem(binary_cache);
 	return 0;
 }
 
+/* --------------------------------
+ * shmem_cache_lookup - retrieve query cache from shared memory
+ *
+ * returns POOL_CONTINUE if cache is found and sent to the frontend,
+ * POOL_END if not found, POOL_ERROR on error.
+ * --------------------------------
+ */
+static POOL_STATUS shmem_cache_lookup(POOL_CONNECTION *frontend, char *query, char *database, char tstate)
+{
+	char key[33];
+	char *cache;
+	int len;
+	int status;
+
+	/* without a key we cannot look up, execute the query instead */
+	if (shmem_cache_key(database, query, key) < 0)
+		return POOL_END;
+
+	pool_debug("pool_query_cache_lookup: searching shared memory cache for query: \"%s\"", query);
+	status = pool_shmem_cache_fetch(key, &cache, &len);
+	if (status < 0)
+		return POOL_ERROR;
+	else if (status == 0)
+	{
+		pool_debug("pool_query_cache_lookup: query cache not found");
+		return POOL_END;
+	}
+
+	pool_debug("pool_query_cache_lookup: query cache found (%d bytes)", len);
+	status = send_cache_to_frontend(frontend, cache, len, tstate);
+	free(cache);
+
+	if (status < 0)
+	{
+		/* fatal error has occured while forwarding cache */
+		pool_error("pool_query_cache_lookup: query cache forwarding failed");
+		return POOL_ERROR;
+	}
+	return POOL_CONTINUE;
+}
+
+/* --------------------------------
+ * shmem_cache_key - md5 of database name and query used as the key of
+ * shared memory cache. key must have room for 33 bytes.
+ *
+ * returns 0 on success, -1 on error.
+ * --------------------------------
+ */
+static int shmem_cache_key(char *database, char *query, char *key)
+{
+	int dblen = strlen(database);
+	int qlen = strlen(query);
+	char *buf;
+
+	buf = malloc(dblen + qlen + 2);
+	if (buf == NULL)
+	{
+		pool_error("shmem_cache_key: malloc failed");
+		return -1;
+	}
+
+	memcpy(buf, database, dblen + 1);
+	memcpy(buf + dblen + 1, query, qlen + 1);
+	pool_md5_hash(buf, dblen + qlen + 1, key);
+	free(buf);
+	return 0;
+}
+
+/* --------------------------------
+ * pool_query_cache_set_tables() - remember tables referenced by a
+ * SELECT to register its result to the shared memory cache
+ *
+ * returns 0 if the result should not be cached nor looked up because
+ * the query references too many tables or the current transaction has
+ * modified some of them, otherwise 1. always returns 1 for the SystemDB
+ * cache.
+ * --------------------------------
+ */
+int pool_query_cache_set_tables(Node *node, char *database)
+{
+	int i, j;
+
+	if (!SHMEM_QUERY_CACHE)
+		return 1;
+
+	num_select_tables = 0;
+	if (select_table_walker(node, database))
+	{
+		pool_debug("pool_query_cache_set_tables: query references more than %d tables", SHMEM_CACHE_MAX_TABLES);
+		return 0;
+	}
+
+	/* the cache does not reflect changes not committed yet */
+	for (i = 0; i < num_select_tables; i++)
+	{
+		for (j = 0; j < session_context->num_cache_invalidate_tables; j++)
+		{
+			if (select_tables[i] == session_context->cache_invalidate_tables[j])
+				return 0;
+		}
+	}
+
+	pool_shmem_cache_generations(select_tables, num_select_tables, select_generations);
+	return 1;
+}
+
+/* --------------------------------
+ * pool_query_cache_add_modified_tables() - remember tables modified by
+ * node. shared memory cache of them is invalidated by
+ * pool_query_cache_invalidate() when the transaction ends.
+ * --------------------------------
+ */
+void pool_query_cache_add_modified_tables(Node *node, char *database)
+{
+	ListCell *cell;
+
+	if (!SHMEM_QUERY_CACHE || node == NULL)
+		return;
+
+	if (IsA(node, InsertStmt))
+		add_modified_table(database, ((InsertStmt *)node)->relation->relname);
+	else if (IsA(node, UpdateStmt))
+		add_modified_table(database, ((UpdateStmt *)node)->relation->relname);
+	else if (IsA(node, DeleteStmt))
+		add_modified_table(database, ((DeleteStmt *)node)->relation->relname);
+	else if (IsA(node, TruncateStmt))
+	{
+		foreach(cell, ((TruncateStmt *)node)->relations)
+			add_modified_table(database, ((RangeVar *)lfirst(cell))->relname);
+	}
+	else if (IsA(node, DropStmt))
+	{
+		DropStmt *stmt = (DropStmt *)node;
+
+		/* objects are lists of names. the last one is the relation name */
+		if (stmt->removeType == OBJECT_TABLE || stmt->removeType == OBJECT_VIEW)
+		{
+			foreach(cell, stmt->objects)
+				add_modified_table(database, strVal(llast((List *)lfirst(cell))));
+		}
+	}
+	else if (IsA(node, AlterTableStmt))
+		add_modified_table(database, ((AlterTableStmt *)node)->relation->relname);
+	else if (IsA(node, RenameStmt))
+	{
+		RenameStmt *stmt = (RenameStmt *)node;
+
+		if (stmt->relation)
+			add_modified_table(database, stmt->relation->relname);
+	}
+	else if (IsA(node, CopyStmt))
+	{
+		CopyStmt *stmt = (CopyStmt *)node;
+
+		if (stmt->is_from && stmt->relation)
+			add_modified_table(database, stmt->relation->relname);
+	}
+}
+
+/* --------------------------------
+ * pool_query_cache_invalidate() - invalidate shared memory cache of
+ * tables modified by the transaction just ended
+ * --------------------------------
+ */
+void pool_query_cache_invalidate(void)
+{
+	if (session_context->num_cache_invalidate_tables == 0)
+		return;
+
+	if (SHMEM_QUERY_CACHE)
+	{
+		pool_debug("pool_query_cache_invalidate: invalidate cache of %d tables",
+				   session_context->num_cache_invalidate_tables);
+		pool_shmem_cache_invalidate(session_context->cache_invalidate_tables,
+									session_context->num_cache_invalidate_tables);
+	}
+	session_context->num_cache_invalidate_tables = 0;
+}
+
+/*
+ * hash of database and unqualified table name. since search_path is not
+ * known, tables of the same name in different schemas are not
+ * distinguished.
+ */
+static unsigned int table_hash(char *database, char *relname)
+{
+	unsigned int h = 2166136261U;	/* FNV-1a */
+
+	for (; *database; database++)
+		h = (h ^ (unsigned char)*database) * 16777619U;
+	h = h * 16777619U;			/* separator */
+	for (; *relname; relname++)
+		h = (h ^ (unsigned char)*relname) * 16777619U;
+
+	return h;
+}
+
+/*
+ * walker function for raw_expression_tree_walker to collect tables
+ * referenced by a SELECT into select_tables. returns true if there are
+ * too many tables.
+ */
+static bool select_table_walker(Node *node, void *context)
+{
+	if (node == NULL)
+		return false;
+
+	if (IsA(node, RangeVar))
+	{
+		unsigned int table = table_hash((char *)context, ((RangeVar *)node)->relname);
+		int i;
+
+		for (i = 0; i < num_select_tables; i++)
+		{
+			if (select_tables[i] == table)
+				break;
+		}
+		if (i == num_select_tables)
+		{
+			if (num_select_tables >= SHMEM_CACHE_MAX_TABLES)
+				return true;
+			select_tables[num_select_tables++] = table;
+		}
+	}
+
+	return raw_expression_tree_walker(node, select_table_walker, context);
+}
+
+/*
+ * add a table to the list of tables modified by the current transaction
+ */
+static void add_modified_table(char *database, char *relname)
+{
+	unsigned int table = table_hash(database, relname);
+	POOL_SESSION_CONTEXT *s = session_context;
+	int i;
+
+	for (i = 0; i < s->num_cache_invalidate_tables; i++)
+	{
+		if (s->cache_invalidate_tables[i] == table)
+			return;
+	}
+
+	if (s->num_cache_invalidate_tables >= s->cache_invalidate_tables_size)
+	{
+		int size = s->cache_invalidate_tables_size ? s->cache_invalidate_tables_size * 2 : 8;
+		unsigned int *p = realloc(s->cache_invalidate_tables, sizeof(unsigned int) * size);
+
+		if (p == NULL)
+		{
+			/* invalidating now is better than keeping stale cache */
+			pool_error("add_modified_table: realloc failed");
+			pool_shmem_cache_invalidate(&table, 1);
+			return;
+		}
+		s->cache_invalidate_tables = p;
+		s->cache_invalidate_tables_size = size;
+	}
+
+	s->cache_invalidate_tables[s->num_cache_invalidate_tables++] = table;
+	pool_debug("add_modified_table: %s", relname);
+}
+
 /* --------------------------------
  * pool_query_cache_register() - register query cache to the SystemDB
  *
@@ -592,30 +900,37 @@ pool_query_cache_register(char kind,
 	int ret;
 	int send_len;
 
-	if (! system_db_connection_exists())
-		return -1;
-	if (! CACHE_TABLE_INFO.has_prepared_statement)
-		define_prepared_statements();
+	/* shared memory cache does not need System DB */
+	if (!SHMEM_QUERY_CACHE)
+	{
+		if (! system_db_connection_exists())
+			return -1;
+		if (! CACHE_TABLE_INFO.has_prepared_statement)
+			define_prepared_statements();
+	}
 
-	switch (kind)
+	/* query is given with the first message of the result */
+	if (query != NULL)
 	{
-		case 'T':				/* RowDescription */
+		if (query_cache_info != NULL)
 		{
-			/* for all SELECT result data from the backend, 'T' must come first */
-			if (query_cache_info != NULL)
-			{
-				pool_error("pool_query_cache_register: received RowDescription in the wrong order");
-				free_query_cache_info();
-				return -1;
-			}
+			pool_error("pool_query_cache_register: received %c in the wrong order", kind);
+			free_query_cache_info();
+			return -1;
+		}
 
-			pool_debug("pool_query_cache_register: saving cache for query: \"%s\"", query);
+		pool_debug("pool_query_cache_register: saving cache for query: \"%s\"", query);
 
-			/* initialize query_cache_info and save the query */
-			ret = init_query_cache_info(frontend, database, query);
-			if (ret)
-				return ret;
+		/* initialize query_cache_info and save the query */
+		ret = init_query_cache_info(frontend, database, query);
+		if (ret)
+			return ret;
+	}
 
+	switch (kind)
+	{
+		case 'T':				/* RowDescription */
+		{
 			/* store data into the cache */
 			write_cache(&kind, 1);
 			send_len = htonl(data_len + sizeof(int));
@@ -666,6 +981,22 @@ pool_query_cache_register(char kind,
 			write_cache(&send_len, sizeof(int));
 			write_cache(data, data_len);
 
+			if (SHMEM_QUERY_CACHE)
+			{
+				char key[33];
+
+				/* the result is just not cached if we fail to make a key */
+				if (shmem_cache_key(query_cache_info->db_name, query_cache_info->query, key) < 0)
+				{
+					free_query_cache_info();
+					return 0;
+				}
+				ret = pool_shmem_cache_store(key, query_cache_info->cache, query_cache_info->cache_offset,
+											 select_tables, select_generations, num_select_tables);
+				free_query_cache_info();
+				return ret;
+			}
+
 			query_cache_info->create_time = pq_time_to_str(now);
 			if (malloc_failed(query_cache_info->create_time))
 			{
@@ -746,7 +1077,8 @@ pool_query_cache_register(char kind,
 		{
 			pool_debug("pool_query_cache_register: received 'E': free query cache buffer");
 
-			pool_close_libpq_connection();
+			if (!SHMEM_QUERY_CACHE)
+				pool_close_libpq_connection();
 			free_query_cache_info();
 
 			break;
@@ -770,6 +1102,7 @@ init_query_cache_info(POOL_CONNECTION *pc, char *database, char *query)
 	query_cache_info = (QueryCacheInfo *)malloc(sizeof(QueryCacheInfo));
 	if (malloc_failed(query_cache_info))
 		return -1;
+	memset(query_cache_info, 0, sizeof(QueryCacheInfo));
 
 	/* query */
 	query_len = strlen(query);
@@ -0,0 +1,376 @@
+/* -*-pgsql-c-*- */
+/*
+ * $Header$
+ *
+ * pgpool: a language independent connection pool server for PostgreSQL
+ * written by Tatsuo Ishii
+ *
+ * Copyright (c) 2003-2010	PgPool Global Development Group
+ *
+ * Permission to use, copy, modify, and distribute this software and
+ * its documentation for any purpose and without fee is hereby
+ * granted, provided that the above copyright notice appear in all
+ * copies and that both that copyright notice and this permission
+ * notice appear in supporting documentation, and that the name of the
+ * author not be used in advertising or publicity pertaining to
+ * distribution of the software without specific, written prior
+ * permission. The author makes no representations about the
+ * suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * pool_query_classify.c: classify SQL strings without parsing.
+ *
+ * Running the grammar just to find out that a statement is a plain
+ * SELECT is expensive. The function here scans tokens of the string
+ * and looks up keywords in the parser's keyword table, without any
+ * memory allocation. It only answers when the answer is certain;
+ * anything unusual makes it give up, in which case the caller has to
+ * parse the query.
+ *
+ * is_session_safe_function() tells functions which are known not to
+ * leave anything behind in the session, so that a backend connection
+ * used to call them can be passed to another client.
+ */
+#include "config.h"
+
+#include <string.h>
+#include <ctype.h>
+
+#include "pool.h"
+#include "pool_proto_modules.h"
+#include "parser/gramparse.h"
+#include "parser/keywords.h"
+
+#define IS_IDENT_START(c) (isalpha((unsigned char) (c)) || (c) == '_' || ((unsigned char) (c)) >= 0200)
+#define IS_IDENT_CONT(c) (IS_IDENT_START(c) || isdigit((unsigned char) (c)) || (c) == '$')
+
+static const char *skip_quoted(const char *p, char quote);
+static const char *skip_comment(const char *p);
+static int is_sequence_function(const char *word, int len);
+static int is_unsafe_call(const char *sql, const char *start, const char *p,
+						  const char *name, const ScanKeyword *keyword);
+
+/*
+ * Built-in functions which neither change nor create session level
+ * state. Names are in lower case.
+ */
+static const char *session_safe_functions[] = {
+	/* aggregates and window functions */
+	"array_agg", "avg", "bool_and", "bool_or", "count", "cume_dist",
+	"dense_rank", "every", "first_value", "lag", "last_value", "lead",
+	"max", "min", "nth_value", "ntile", "percent_rank", "rank",
+	"row_number", "stddev", "stddev_pop", "stddev_samp", "string_agg",
+	"sum", "var_pop", "var_samp", "variance",
+	/* strings */
+	"ascii", "bit_length", "btrim", "char_length", "character_length",
+	"chr", "concat", "concat_ws", "initcap", "left", "length",
+	"like_escape", "lower", "lpad", "ltrim", "md5", "octet_length",
+	"position", "quote_ident", "quote_literal", "regexp_matches",
+	"regexp_replace", "repeat", "replace", "reverse", "right", "rpad",
+	"rtrim", "similar_escape", "split_part", "strpos", "substr",
+	"substring", "to_hex", "translate", "upper",
+	/* numbers */
+	"abs", "ceil", "ceiling", "div", "exp", "floor", "ln", "log", "mod",
+	"power", "random", "round", "sign", "sqrt", "trunc",
+	/* date and time */
+	"age", "clock_timestamp", "date_part", "date_trunc", "justify_days",
+	"justify_hours", "justify_interval", "now", "overlaps",
+	"statement_timestamp", "timeofday", "timezone", "to_char", "to_date",
+	"to_number", "to_timestamp", "transaction_timestamp",
+	/* arrays and sets */
+	"array_length", "array_lower", "array_upper", "generate_series",
+	"unnest",
+	/* session information */
+	"current_database", "current_schema", "current_user",
+	"pg_backend_pid", "session_user", "version",
+	NULL
+};
+
+/*
+ * Returns non 0 if the SQL string is a single SELECT which does not
+ * write anything, i.e. is_select_query() and !is_sequence_query()
+ * are true for its parse tree. Followings make this function return
+ * 0:
+ *
+ * - the string does not start with SELECT
+ * - INTO, FOR UPDATE or FOR SHARE
+ * - a call to nextval() or setval()
+ * - a call to a function other than is_session_safe_function() ones,
+ *   so that check_session_state() looks at the parse tree of it
+ * - multiple statements
+ * - dollar quoting and strings including backslashes, since whether
+ *   backslashes are escape characters depends on backend settings
+ *
+ * Since the string must start with SELECT, leading comments such as
+ * "NO LOAD BALANCE" hint make this function return 0 as well.
+ */
+int is_read_only_select_query(char *sql)
+{
+	const char *p = sql;
+	char word[NAMEDATALEN];
+	const ScanKeyword *keyword;
+	int first = 1;
+	int len;
+	int i;
+
+	if (pool_config->ignore_leading_white_space)
+	{
+		while (*p && isspace((unsigned char) *p))
+			p++;
+	}
+
+	/* is_select_query() looks at the first character */
+	if (!IS_IDENT_START(*p))
+		return 0;
+
+	while (*p)
+	{
+		if (isspace((unsigned char) *p))
+		{
+			p++;
+			continue;
+		}
+
+		if (IS_IDENT_START(*p))
+		{
+			const char *start = p;
+
+			while (IS_IDENT_CONT(*p))
+				p++;
+			len = p - start;
+
+			/* too long to be a keyword */
+			if (len >= NAMEDATALEN)
+			{
+				if (first || is_unsafe_call(sql, start, p, "", NULL))
+					return 0;
+				continue;
+			}
+
+			if (is_sequence_function(start, len))
+				return 0;
+
+			memcpy(word, start, len);
+			word[len] = '\0';
+			keyword = ScanKeywordLookup(word);
+
+			if (first)
+			{
+				if (keyword == NULL || strcmp(keyword->name, "select"))
+					return 0;
+				first = 0;
+				continue;
+			}
+
+			/* UPDATE and SHARE appear in a SELECT only in FOR UPDATE/SHARE */
+			if (keyword &&
+				(!strcmp(keyword->name, "into") || !strcmp(keyword->name, "update") ||
+				 !strcmp(keyword->name, "share")))
+				return 0;
+
+			/* unquoted names are case insensitive */
+			for (i = 0; i < len; i++)
+				word[i] = tolower((unsigned char) word[i]);
+			if (is_unsafe_call(sql, start, p, word, keyword))
+				return 0;
+			continue;
+		}
+
+		switch (*p)
+		{
+			case '\'':
+				p = skip_quoted(p, '\'');
+				if (p == NULL)
+					return 0;
+				break;
+
+			case '"':
+				{
+					const char *start = p + 1;
+
+					p = skip_quoted(p, '"');
+					if (p == NULL)
+						return 0;
+					len = p - start - 1;
+					if (is_sequence_function(start, len))
+						return 0;
+					if (len >= NAMEDATALEN)
+						len = 0;
+					memcpy(word, start, len);
+					word[len] = '\0';
+					if (is_unsafe_call(sql, start - 1, p, word, NULL))
+						return 0;
+				}
+				break;
+
+			case '$':
+				/* parameters are fine but dollar quoting is not */
+				p++;
+				if (!isdigit((unsigned char) *p))
+					return 0;
+				while (isdigit((unsigned char) *p))
+					p++;
+				break;
+
+			case '-':
+			case '/':
+				if ((*p == '-' && p[1] == '-') || (*p == '/' && p[1] == '*'))
+				{
+					p = skip_comment(p);
+					if (p == NULL)
+						return 0;
+				}
+				else
+					p++;
+				break;
+
+			case ';':
+				/* only trailing white spaces are allowed */
+				p++;
+				while (*p && isspace((unsigned char) *p))
+					p++;
+				if (*p)
+					return 0;
+				break;
+
+			default:
+				/* skip numbers together with their exponent or suffix */
+				if (isdigit((unsigned char) *p))
+				{
+					while (IS_IDENT_CONT(*p) || *p == '.')
+						p++;
+				}
+				else
+					p++;
+				break;
+		}
+	}
+
+	return !first;
+}
+
+/*
+ * Skip a quoted string or identifier starting at p. Returns the
+ * position just after the closing quote, or NULL if the string is not
+ * terminated or includes a backslash.
+ */
+static const char *skip_quoted(const char *p, char quote)
+{
+	for (p++; *p; p++)
+	{
+		if (*p == '\\' && quote == '\'')
+			return NULL;
+
+		if (*p == quote)
+		{
+			/* doubled quote stands for itself */
+			if (p[1] == quote)
+				p++;
+			else
+				return p + 1;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Skip a comment starting at p. Returns the position just after the
+ * comment, or NULL if the comment is not terminated.
+ */
+static const char *skip_comment(const char *p)
+{
+	int depth = 0;
+
+	if (*p == '-')
+	{
+		while (*p && *p != '\n')
+			p++;
+		return p;
+	}
+
+	/* comments nest as in PostgreSQL */
+	do
+	{
+		if (*p == '/' && p[1] == '*')
+		{
+			depth++;
+			p += 2;
+		}
+		else if (*p == '*' && p[1] == '/')
+		{
+			depth--;
+			p += 2;
+		}
+		else if (*p)
+			p++;
+		else
+			return NULL;
+	} while (depth > 0);
+
+	return p;
+}
+
+/*
+ * Returns non 0 if the name between start and p is followed by "("
+ * and may call a function which changes session state. Reserved and
+ * column name keywords followed by "(" are syntax such as IN (...) or
+ * CAST(...) rather than function calls. Names qualified by a schema
+ * are not trusted.
+ */
+static int is_unsafe_call(const char *sql, const char *start, const char *p,
+						  const char *name, const ScanKeyword *keyword)
+{
+	while (*p)
+	{
+		if (isspace((unsigned char) *p))
+			p++;
+		else if ((*p == '-' && p[1] == '-') || (*p == '/' && p[1] == '*'))
+		{
+			p = skip_comment(p);
+			if (p == NULL)
+				return 1;
+		}
+		else
+			break;
+	}
+
+	if (*p != '(')
+		return 0;
+
+	if (keyword &&
+		(keyword->category == RESERVED_KEYWORD || keyword->category == COL_NAME_KEYWORD))
+		return 0;
+
+	if (start > sql && start[-1] == '.')
+		return 1;
+
+	return !is_session_safe_function(name);
+}
+
+/*
+ * Returns non 0 if the function of the name is known to leave no
+ * session level state behind, i.e. a backend connection used to call
+ * it can be passed to another client. The name must be in lower case
+ * and not qualified by a schema other than pg_catalog.
+ */
+int is_session_safe_function(const char *name)
+{
+	const char **f;
+
+	for (f = session_safe_functions; *f; f++)
+	{
+		if (strcmp(*f, name) == 0)
+			return 1;
+	}
+	return 0;
+}
+
+/*
+ * Returns non 0 if the word is nextval or setval. The same test as
+ * is_sequence_query() does.
+ */
+static int is_sequence_function(const char *word, int len)
+{
+	return (len >= 7 && strncasecmp(word, "NEXTVAL", 7) == 0) ||
+		(len >= 6 && strncasecmp(word, "SETVAL", 6) == 0);
+}
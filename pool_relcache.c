@@ -19,13 +19,164 @@
  * is" without express or implied warranty.
  *
  * pool_relcache.c: Per process relation cache modules
+ *
+ * Results of the catalog queries are also kept in shared memory so
+ * that a child can use the results obtained by other children. The
+ * shared memory relation cache is a fixed number of entries keyed on
+ * the md5 of database name and query, evicted by the clock
+ * algorithm. Each cache entry, shared or per process, remembers the
+ * relation cache generation when it was registered. The generation is
+ * incremented when DDL is issued through pgpool and when the
+ * transaction ends, which makes all the entries invalid.
  */
 #include "config.h"
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
+#include <ctype.h>
+#include <signal.h>
 
 #include "pool.h"
+#include "pool_proto_modules.h"
+#include "md5.h"
+
+#define RELCACHE_DATA_SIZE 2048	/* max size of query result in shared memory */
+#define RELCACHE_ALIGN(len) (((len) + 7) & ~((size_t) 7))
+
+typedef struct {
+	char key[33];		/* md5 of database name and query. empty if unused */
+	char referenced;	/* recently used. cleared by clock sweep */
+	int next;			/* next entry in hash chain */
+	unsigned int generation;	/* relation cache generation when the query was issued */
+	int len;			/* length of data */
+	char data[RELCACHE_DATA_SIZE];	/* serialized query result */
+} SharedRelCache;
+
+typedef struct {
+	volatile unsigned int generation;	/* relation cache generation */
+	int num_entries;
+	int num_buckets;	/* power of 2 */
+	int clock_hand;		/* next entry to be examined by clock sweep */
+} SharedRelCacheHeader;
+
+static SharedRelCacheHeader *shared_header;
+static int *shared_buckets;
+static SharedRelCache *shared_entries;
+
+static unsigned int relcache_generation(void);
+static unsigned int relcache_hash(char *dbname, char *relname);
+static int shared_relcache_key(char *dbname, char *query, char *key);
+static int shared_relcache_bucket(char *key);
+static int shared_relcache_fetch(char *key, POOL_SELECT_RESULT **result);
+static void shared_relcache_store(char *key, unsigned int generation, POOL_SELECT_RESULT *res);
+static int serialize_result(POOL_SELECT_RESULT *res, char *buf, int size);
+static POOL_SELECT_RESULT *deserialize_result(char *buf, int len);
+
+/*
+ * Create shared memory relation cache of size entries. This should
+ * be called once from the parent process before forking children.
+ * Returns 0 on success otherwise -1.
+ */
+int pool_relcache_init(int size)
+{
+	char *p;
+	int num_buckets;
+	int i;
+
+	for (num_buckets = 1; num_buckets < size; num_buckets *= 2)
+		;
+
+	p = pool_shared_memory_create(RELCACHE_ALIGN(sizeof(SharedRelCacheHeader)) +
+								  RELCACHE_ALIGN(sizeof(int) * num_buckets) +
+								  sizeof(SharedRelCache) * size);
+	if (p == NULL)
+	{
+		pool_error("pool_relcache_init: failed to allocate shared memory");
+		return -1;
+	}
+
+	shared_header = (SharedRelCacheHeader *)p;
+	p += RELCACHE_ALIGN(sizeof(SharedRelCacheHeader));
+	shared_buckets = (int *)p;
+	p += RELCACHE_ALIGN(sizeof(int) * num_buckets);
+	shared_entries = (SharedRelCache *)p;
+
+	shared_header->generation = 0;
+	shared_header->num_entries = size;
+	shared_header->num_buckets = num_buckets;
+	shared_header->clock_hand = 0;
+
+	for (i = 0; i < num_buckets; i++)
+		shared_buckets[i] = -1;
+
+	for (i = 0; i < size; i++)
+	{
+		shared_entries[i].key[0] = '\0';
+		shared_entries[i].next = -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Invalidate all the relation cache entries of all processes.
+ */
+void pool_relcache_invalidate(void)
+{
+#ifdef HAVE_SIGPROCMASK
+	sigset_t oldmask;
+#else
+	int	oldmask;
+#endif
+
+	if (shared_header == NULL)
+		return;
+
+	POOL_SETMASK2(&BlockSig, &oldmask);
+	pool_semaphore_lock(RELCACHE_SEM);
+	shared_header->generation++;
+	pool_semaphore_unlock(RELCACHE_SEM);
+	POOL_SETMASK(&oldmask);
+
+	pool_debug("pool_relcache_invalidate: relation cache generation %u", shared_header->generation);
+}
+
+/*
+ * Called when a query is sent to backends. If the query changes
+ * relation definitions, invalidate relation cache. Since other
+ * sessions see the old definitions until the transaction ends, the
+ * cache is invalidated again at the end of the transaction by
+ * pool_relcache_end_transaction(). Until then the session does not
+ * use shared memory relation cache.
+ */
+void pool_relcache_check_ddl(Node *node)
+{
+	if (node == NULL)
+		return;
+
+	if (IsA(node, CreateStmt) || IsA(node, AlterTableStmt) || IsA(node, RenameStmt) ||
+		IsA(node, ViewStmt) || IsA(node, DiscardStmt) ||
+		(IsA(node, DropStmt) && (((DropStmt *)node)->removeType == OBJECT_TABLE ||
+								 ((DropStmt *)node)->removeType == OBJECT_VIEW ||
+								 ((DropStmt *)node)->removeType == OBJECT_SEQUENCE)) ||
+		(IsA(node, SelectStmt) && ((SelectStmt *)node)->intoClause))
+	{
+		pool_relcache_invalidate();
+		session_context->relcache_ddl_in_transaction = 1;
+	}
+}
+
+/*
+ * Called when a transaction ends.
+ */
+void pool_relcache_end_transaction(void)
+{
+	if (session_context->relcache_ddl_in_transaction)
+	{
+		pool_relcache_invalidate();
+		session_context->relcache_ddl_in_transaction = 0;
+	}
+}
 
 /*
  * Create relation cache
@@ -96,6 +247,10 @@ void *pool_search_relcache(POOL_RELCACHE *relcache, POOL_CONNECTION_POOL *backen
 	char query[1024];
 	POOL_SELECT_RESULT *res = NULL;
 	int index = 0;
+	unsigned int hash;
+	unsigned int generation;
+	int shared;
+	char key[33];
 
 	/* Eliminate double quotes */
 	rel = malloc(strlen(table)+1);
@@ -114,6 +269,9 @@ void *pool_search_relcache(POOL_RELCACHE *relcache, POOL_CONNECTION_POOL *backen
 	/* Obtain database name */
 	dbname = MASTER_CONNECTION(backend)->sp->database;
 
+	hash = relcache_hash(dbname, rel);
+	generation = relcache_generation();
+
 	/* Look for cache first */
 	for (i=0;i<relcache->num;i++)
 	{
@@ -126,7 +284,9 @@ void *pool_search_relcache(POOL_RELCACHE *relcache, POOL_CONNECTION_POOL *backen
 				continue;
 		}
 
-		if (strcasecmp(relcache->cache[i].dbname, dbname) == 0 &&
+		if (relcache->cache[i].hash == hash &&
+			relcache->cache[i].generation == generation &&
+			strcasecmp(relcache->cache[i].dbname, dbname) == 0 &&
 			strcasecmp(relcache->cache[i].relname, rel) == 0)
 		{
 			/* Found */
@@ -140,15 +300,32 @@ void *pool_search_relcache(POOL_RELCACHE *relcache, POOL_CONNECTION_POOL *backen
 	/* Not in cache. Check the system catalog */
 	snprintf(query, sizeof(query), relcache->sql, rel);
 
-	per_node_statement_log(backend, MASTER_NODE_ID, query);
+	/*
+	 * Result of session independent query can be shared with other
+	 * processes unless this session has changed relation definitions.
+	 */
+	shared = shared_header && !relcache->cache_is_session_local &&
+		!session_context->relcache_ddl_in_transaction;
+	if (shared && shared_relcache_key(dbname, query, key) < 0)
+		shared = 0;
+	if (shared)
+		shared_relcache_fetch(key, &res);
 
-	if (do_query(MASTER(backend), query, &res, MAJOR(backend)) != POOL_CONTINUE)
+	if (res == NULL)
 	{
-		pool_error("pool_search_relcache: do_query failed");
-		if (res)
-			free_select_result(res);
-		free(rel);
-		return NULL;
+		per_node_statement_log(backend, MASTER_NODE_ID, query);
+
+		if (do_query(MASTER(backend), query, &res, MAJOR(backend)) != POOL_CONTINUE)
+		{
+			pool_error("pool_search_relcache: do_query failed");
+			if (res)
+				free_select_result(res);
+			free(rel);
+			return NULL;
+		}
+
+		if (shared)
+			shared_relcache_store(key, generation, res);
 	}
 
 	/*
@@ -168,6 +345,13 @@ void *pool_search_relcache(POOL_RELCACHE *relcache, POOL_CONNECTION_POOL *backen
 			}
 		}
 
+		/* Invalidated cache can be discarded as well */
+		if (relcache->cache[i].generation != generation)
+		{
+			index = i;
+			break;
+		}
+
 		if (relcache->cache[i].refcnt == 0)
 		{
 			/* Found empty slot */
@@ -186,6 +370,8 @@ void *pool_search_relcache(POOL_RELCACHE *relcache, POOL_CONNECTION_POOL *backen
 	strncpy(relcache->cache[index].relname, rel, MAX_ITEM_LENGTH);
 	relcache->cache[index].refcnt = 1;
 	relcache->cache[index].session_id = LocalSessionId;
+	relcache->cache[index].hash = hash;
+	relcache->cache[index].generation = generation;
 	free(rel);
 
 	/*
@@ -194,6 +380,7 @@ void *pool_search_relcache(POOL_RELCACHE *relcache, POOL_CONNECTION_POOL *backen
 	(*relcache->unregister_func)(relcache->cache[index].data);
 	relcache->cache[index].data = (*relcache->register_func)(res);
 	free_select_result(res);
+	free(res);
 
 	return 	relcache->cache[index].data;
 }
@@ -214,3 +401,297 @@ void *int_unregister_func(void *data)
 	/* Nothing to do since no memory was allocated */
 	return NULL;
 }
+
+/*
+ * Current relation cache generation. Reading the shared counter
+ * without lock is fine since an int is read atomically, and a stale
+ * value only causes one more catalog query or use of cache being
+ * invalidated right now.
+ */
+static unsigned int relcache_generation(void)
+{
+	if (shared_header == NULL)
+		return 0;
+	return shared_header->generation;
+}
+
+/*
+ * Case insensitive hash of database name and relation name
+ */
+static unsigned int relcache_hash(char *dbname, char *relname)
+{
+	unsigned int h = 0;
+
+	while (*dbname)
+		h = h * 31 + tolower((unsigned char)*dbname++);
+	h = h * 31;
+	while (*relname)
+		h = h * 31 + tolower((unsigned char)*relname++);
+
+	return h;
+}
+
+/*
+ * md5 of database name and query used as the key of shared relation
+ * cache. key must have room for 33 bytes. Returns -1 if they are too
+ * long to make a key, in which case the shared cache is not used.
+ */
+static int shared_relcache_key(char *dbname, char *query, char *key)
+{
+	char buf[MAX_ITEM_LENGTH * 2];
+	int dblen = strlen(dbname);
+	int qlen = strlen(query);
+
+	if (dblen + qlen + 1 > sizeof(buf))
+		return -1;
+
+	memcpy(buf, dbname, dblen + 1);
+	memcpy(buf + dblen + 1, query, qlen);
+	pool_md5_hash(buf, dblen + qlen + 1, key);
+	return 0;
+}
+
+static int shared_relcache_bucket(char *key)
+{
+	unsigned int h = 0;
+
+	while (*key)
+		h = h * 31 + (unsigned char)*key++;
+
+	return h & (shared_header->num_buckets - 1);
+}
+
+/*
+ * Look for valid query result for key in shared memory. If found,
+ * *result is set to the result and 1 is returned. Otherwise returns 0.
+ */
+static int shared_relcache_fetch(char *key, POOL_SELECT_RESULT **result)
+{
+#ifdef HAVE_SIGPROCMASK
+	sigset_t oldmask;
+#else
+	int	oldmask;
+#endif
+	char buf[RELCACHE_DATA_SIZE];
+	int len = -1;
+	int e;
+
+	POOL_SETMASK2(&BlockSig, &oldmask);
+	pool_semaphore_lock(RELCACHE_SEM);
+
+	for (e = shared_buckets[shared_relcache_bucket(key)]; e >= 0; e = shared_entries[e].next)
+	{
+		SharedRelCache *entry = &shared_entries[e];
+
+		if (!strcmp(entry->key, key))
+		{
+			if (entry->generation == shared_header->generation)
+			{
+				entry->referenced = 1;
+				len = entry->len;
+				memcpy(buf, entry->data, len);
+			}
+			break;
+		}
+	}
+
+	pool_semaphore_unlock(RELCACHE_SEM);
+	POOL_SETMASK(&oldmask);
+
+	if (len < 0)
+		return 0;
+
+	*result = deserialize_result(buf, len);
+	return *result != NULL;
+}
+
+/*
+ * Register query result for key in shared memory. generation is the
+ * relation cache generation before the query was issued.
+ */
+static void shared_relcache_store(char *key, unsigned int generation, POOL_SELECT_RESULT *res)
+{
+#ifdef HAVE_SIGPROCMASK
+	sigset_t oldmask;
+#else
+	int	oldmask;
+#endif
+	char buf[RELCACHE_DATA_SIZE];
+	SharedRelCache *entry;
+	int len;
+	int e, h;
+	int *link;
+
+	if (shared_header->num_entries == 0)
+		return;
+
+	len = serialize_result(res, buf, sizeof(buf));
+	if (len < 0)
+	{
+		pool_debug("shared_relcache_store: query result is too large to share");
+		return;
+	}
+
+	POOL_SETMASK2(&BlockSig, &oldmask);
+	pool_semaphore_lock(RELCACHE_SEM);
+
+	/* relations have been changed while the query was running */
+	if (generation != shared_header->generation)
+	{
+		pool_semaphore_unlock(RELCACHE_SEM);
+		POOL_SETMASK(&oldmask);
+		return;
+	}
+
+	h = shared_relcache_bucket(key);
+	for (e = shared_buckets[h]; e >= 0; e = shared_entries[e].next)
+	{
+		if (!strcmp(shared_entries[e].key, key))
+			break;
+	}
+
+	if (e < 0)
+	{
+		/* look for an entry unused, invalidated or not used recently */
+		for (;;)
+		{
+			entry = &shared_entries[shared_header->clock_hand];
+			e = shared_header->clock_hand;
+			shared_header->clock_hand = (shared_header->clock_hand + 1) % shared_header->num_entries;
+
+			if (entry->key[0] == '\0' || entry->generation != generation || !entry->referenced)
+				break;
+			entry->referenced = 0;
+		}
+
+		/* unlink from hash chain */
+		if (entry->key[0] != '\0')
+		{
+			for (link = &shared_buckets[shared_relcache_bucket(entry->key)]; *link >= 0; link = &shared_entries[*link].next)
+			{
+				if (*link == e)
+				{
+					*link = entry->next;
+					break;
+				}
+			}
+		}
+
+		strlcpy(entry->key, key, sizeof(entry->key));
+		entry->next = shared_buckets[h];
+		shared_buckets[h] = e;
+	}
+
+	entry = &shared_entries[e];
+	entry->generation = generation;
+	entry->referenced = 1;
+	entry->len = len;
+	memcpy(entry->data, buf, len);
+
+	pool_semaphore_unlock(RELCACHE_SEM);
+	POOL_SETMASK(&oldmask);
+}
+
+/*
+ * Serialize query result into buf of size bytes. Returns length of
+ * serialized data or -1 if buf is too small.
+ */
+static int serialize_result(POOL_SELECT_RESULT *res, char *buf, int size)
+{
+	int num_attrs = res->rowdesc ? res->rowdesc->num_attrs : 0;
+	int i, len;
+	char *p = buf;
+
+	if (sizeof(int) * 2 > size)
+		return -1;
+
+	memcpy(p, &num_attrs, sizeof(int));
+	p += sizeof(int);
+	memcpy(p, &res->numrows, sizeof(int));
+	p += sizeof(int);
+
+	for (i = 0; i < res->numrows * num_attrs; i++)
+	{
+		/* data is not set if the column is null or empty */
+		len = res->nullflags[i] > 0 ? res->nullflags[i] : res->nullflags[i] < 0 ? -1 : 0;
+
+		if (p - buf + sizeof(int) + Max(len, 0) > size)
+			return -1;
+
+		memcpy(p, &len, sizeof(int));
+		p += sizeof(int);
+		if (len > 0)
+		{
+			memcpy(p, res->data[i], len);
+			p += len;
+		}
+	}
+
+	return p - buf;
+}
+
+/*
+ * Build query result from serialized data. Returns NULL on error.
+ */
+static POOL_SELECT_RESULT *deserialize_result(char *buf, int len)
+{
+	POOL_SELECT_RESULT *res;
+	int num_attrs, num_data;
+	int i, n;
+	char *p = buf;
+
+	res = calloc(1, sizeof(*res));
+	if (res == NULL)
+	{
+		pool_error("deserialize_result: malloc failed");
+		return NULL;
+	}
+	res->rowdesc = calloc(1, sizeof(RowDesc));
+	if (res->rowdesc == NULL)
+	{
+		pool_error("deserialize_result: malloc failed");
+		free(res);
+		return NULL;
+	}
+
+	memcpy(&num_attrs, p, sizeof(int));
+	p += sizeof(int);
+	memcpy(&res->numrows, p, sizeof(int));
+	p += sizeof(int);
+	res->rowdesc->num_attrs = num_attrs;
+
+	num_data = res->numrows * num_attrs;
+	res->nullflags = calloc(num_data + 1, sizeof(int));
+	res->data = calloc(num_data + 1, sizeof(char *));
+	if (res->nullflags == NULL || res->data == NULL)
+	{
+		pool_error("deserialize_result: malloc failed");
+		free_select_result(res);
+		free(res);
+		return NULL;
+	}
+
+	for (i = 0; i < num_data; i++)
+	{
+		memcpy(&n, p, sizeof(int));
+		p += sizeof(int);
+		res->nullflags[i] = n;
+
+		if (n > 0)
+		{
+			res->data[i] = malloc(n + 1);
+			if (res->data[i] == NULL)
+			{
+				pool_error("deserialize_result: malloc failed");
+				free_select_result(res);
+				free(res);
+				return NULL;
+			}
+			memcpy(res->data[i], p, n);
+			res->data[i][n] = '\0';
+			p += n;
+		}
+	}
+
+	return res;
+}
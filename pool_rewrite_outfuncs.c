@@ -218,6 +218,7 @@ static void writeRangeHeader(RewriteQuery *message,ConInfoTodblink *dblink, Stri
 static void writeRangeFooter(RewriteQuery *message,ConInfoTodblink *dblink, String *str,DistDefInfo *info, RepliDefInfo *info2,char *alias);
 static bool CheckAggOpt(RewriteQuery *message);
 static char *GetNameFromColumnRef(ColumnRef *node,bool state);
+static char *BuildLimitPushdown(RewriteQuery *message,AnalyzeSelect *analyze,SelectStmt *node);
 static void AvgFuncCall(Node *BaseSelect, RewriteQuery *message, ConInfoTodblink *dblink, String *str, FuncCall *node);
 
 /* under define is used in _rewritejoinExpr */
@@ -2547,6 +2548,7 @@ initSelectStmt(RewriteQuery *message,SelectStmt *node)
 		analyze->larg_count = -1;
 		analyze->ret_count = 0;
 		analyze->retlock = false;
+		analyze->limit_pushdown = NULL;
 
 		for(i = 0; i< 8; i++)
 			analyze->partstate[i] = (char)0;
@@ -3092,6 +3094,9 @@ static void writeSelectFooter(RewriteQuery *message,String *str,AnalyzeSelect *a
 {
 	int i,num;
 
+	if(analyze->limit_pushdown)
+		delay_string_append_char(message, str, analyze->limit_pushdown);
+
 	delay_string_append_char(message, str, "\"");
 	delay_string_append_char(message, str, ")");
 	delay_string_append_char(message, str, "'");
@@ -3167,6 +3172,136 @@ static void writeSelectFooter(RewriteQuery *message,String *str,AnalyzeSelect *a
 	}
 }
 
+/*
+ * Build " ORDER BY ... LIMIT n" to be appended to the query sent to each
+ * node by pool_parallel(), so that every node returns at most
+ * LIMIT + OFFSET rows instead of the whole table.  The outer query
+ * still sorts and applies OFFSET/LIMIT to the merged result.
+ * This is possible only when every row made by the node survives to
+ * the outer ORDER BY, i.e. all of FROM and WHERE run on the node and
+ * there is no aggregate, DISTINCT or locking clause.
+ * Returns NULL if LIMIT cannot be pushed down.
+ */
+static char *BuildLimitPushdown(RewriteQuery *message,AnalyzeSelect *analyze,SelectStmt *node)
+{
+	VirtualTable *virtual = analyze->virtual;
+	String *pushdown;
+	ListCell *lc;
+	long limit;
+	long offset = 0;
+	char buf[32];
+	char *result;
+	int i;
+
+	if(node->larg || node->distinctClause || node->groupClause ||
+		 node->havingClause || node->lockingClause || analyze->aggregate)
+		return NULL;
+
+	for(i = SELECT_FROMCLAUSE; i <= SELECT_HAVINGCLAUSE; i++)
+	{
+		if(analyze->partstate[i] != 'P')
+			return NULL;
+	}
+
+	if(!node->limitCount || !IsA(node->limitCount, A_Const) ||
+		 ((A_Const *) node->limitCount)->val.type != T_Integer)
+		return NULL;
+
+	limit = ((A_Const *) node->limitCount)->val.val.ival;
+
+	if(node->limitOffset)
+	{
+		if(!IsA(node->limitOffset, A_Const) ||
+			 ((A_Const *) node->limitOffset)->val.type != T_Integer)
+			return NULL;
+
+		offset = ((A_Const *) node->limitOffset)->val.val.ival;
+	}
+
+	if(limit < 0 || offset < 0 || limit > INT_MAX - offset)
+		return NULL;
+
+	pushdown = init_string("");
+
+	if(node->sortClause)
+		string_append_char(pushdown, " ORDER BY ");
+
+	foreach(lc, node->sortClause)
+	{
+		SortBy *sort = (SortBy *) lfirst(lc);
+		ColumnRef *col;
+		char *table_name;
+		char *column_name;
+		ListCell *tl;
+		int pos = 0;
+
+		if(!IsA(sort->node, ColumnRef) || sort->sortby_dir == SORTBY_USING)
+			goto unable;
+
+		col = (ColumnRef *) sort->node;
+		column_name = GetNameFromColumnRef(col,true);
+		table_name = GetNameFromColumnRef(col,false);
+
+		if(!column_name || !strcmp(column_name,"*"))
+			goto unable;
+
+		/* ORDER BY may refer to an output column name of the outer query */
+		if(!table_name)
+		{
+			foreach(tl, node->targetList)
+			{
+				ResTarget *target = (ResTarget *) lfirst(tl);
+
+				if(target->name && !strcmp(target->name,column_name))
+					goto unable;
+			}
+		}
+
+		/* position of the column in the select list made by writeSelectHeader */
+		for(i = 0; i < virtual->col_num; i++)
+		{
+			if(virtual->valid[i] == -1)
+				continue;
+
+			pos++;
+
+			if(!strcmp(virtual->col_list[i],column_name) &&
+				 (!table_name || !strcmp(virtual->table_list[i],table_name)))
+				break;
+		}
+
+		if(i == virtual->col_num)
+			goto unable;
+
+		if(lc != list_head(node->sortClause))
+			string_append_char(pushdown, ", ");
+
+		snprintf(buf, sizeof(buf), "%d", pos);
+		string_append_char(pushdown, buf);
+
+		if(sort->sortby_dir == SORTBY_DESC)
+			string_append_char(pushdown, " DESC");
+
+		if(sort->sortby_nulls == SORTBY_NULLS_FIRST)
+			string_append_char(pushdown, " NULLS FIRST");
+		else if(sort->sortby_nulls == SORTBY_NULLS_LAST)
+			string_append_char(pushdown, " NULLS LAST");
+	}
+
+	snprintf(buf, sizeof(buf), " LIMIT %ld", limit + offset);
+	string_append_char(pushdown, buf);
+
+	pool_debug("BuildLimitPushdown select_no=%d:%s",message->current_select,pushdown->data);
+
+	result = pushdown->data;
+	pfree(pushdown);
+	return result;
+
+unable:
+	free_string(pushdown);
+	return NULL;
+}
+
 static void
 CopyFromLeftArg(RewriteQuery *message,int current_num)
 {
@@ -3600,6 +3735,7 @@ _rewriteSelectStmt(Node *BaseSelect, RewriteQuery *message, ConInfoTodblink *dbl
 					}
 					else
 					{
+						analyze->limit_pushdown = BuildLimitPushdown(message,analyze,node);
 						writeSelectHeader(message,dblink,str,PARALLEL, message->part);
 					}
 					message->rewritelock = count;
@@ -372,6 +372,16 @@ RewriteQuery *rewrite_query_stmt(Node *node,POOL_CONNECTION *frontend,POOL_CONNE
 				break;
 			}
 
+			/*
+			 * A query on a distributed table is executed by pgpool
+			 * itself if possible, without going through the system db.
+			 */
+			if (pool_parallel_select(frontend, backend, node, &message->status))
+			{
+				pool_debug("pool_rewrite_stmt: executed by pool_parallel_select");
+				break;
+			}
+
 			/*
 			 * The Query is actually rewritten based on analytical information on the Query.
 			 */
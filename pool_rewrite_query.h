@@ -133,6 +133,7 @@ typedef struct {
 	VirtualTable *virtual; /* Virtual Table in this select statment */
 	JoinTable *join;       /* sumary of join table */
 	SelectDefInfo *select_ret; /* build return list */
+	char *limit_pushdown;      /* ORDER BY/LIMIT appended to parallel query */
 } AnalyzeSelect;
 
 /*
@@ -181,3 +182,6 @@ extern int IsSelectpgcatalog(Node *node,POOL_CONNECTION_POOL *backend);
 extern RewriteQuery *is_parallel_query(Node *node,POOL_CONNECTION_POOL *backend);
 extern POOL_STATUS pool_parallel_exec(POOL_CONNECTION *frontend,POOL_CONNECTION_POOL *backend, char *string,Node *node,bool send_to_frontend);
 
+/* pool_parallel_select.c */
+extern int pool_parallel_select(POOL_CONNECTION *frontend, POOL_CONNECTION_POOL *backend, Node *node, POOL_STATUS *status);
+
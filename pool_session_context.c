@@ -0,0 +1,174 @@
+/* -*-pgsql-c-*- */
+/*
+ * $Header$
+ *
+ * pgpool: a language independent connection pool server for PostgreSQL
+ * written by Tatsuo Ishii
+ *
+ * Copyright (c) 2003-2010	PgPool Global Development Group
+ *
+ * Permission to use, copy, modify, and distribute this software and
+ * its documentation for any purpose and without fee is hereby
+ * granted, provided that the above copyright notice appear in all
+ * copies and that both that copyright notice and this permission
+ * notice appear in supporting documentation, and that the name of the
+ * author not be used in advertising or publicity pertaining to
+ * distribution of the software without specific, written prior
+ * permission. The author makes no representations about the
+ * suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * pool_session_context.c: per session state of query processing.
+ *
+ * Query processing modules keep their state in a POOL_SESSION_CONTEXT
+ * pointed to by session_context rather than in process global
+ * variables. A child creates its context at start up, and a child
+ * serving multiple sessions (sessions_per_child > 1) creates one for
+ * each session. Switching session_context by
+ * pool_set_session_context() is all that is needed to serve another
+ * session in the same process.
+ */
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "pool.h"
+#include "pool_proto_modules.h"
+
+#define INIT_STATEMENT_LIST_SIZE 8
+
+/*
+ * Context used before a child creates its own, e.g. in the parent
+ * process. Load balancing is off and there is no prepared statement.
+ */
+static POOL_SESSION_CONTEXT default_session_context;
+
+POOL_SESSION_CONTEXT *session_context = &default_session_context;
+
+static void save_shared_state(POOL_SESSION_CONTEXT *context);
+static void restore_shared_state(POOL_SESSION_CONTEXT *context);
+
+/*
+ * Create a session context in initial state. Returns NULL on error.
+ */
+POOL_SESSION_CONTEXT *pool_create_session_context(void)
+{
+	POOL_SESSION_CONTEXT *context;
+	PreparedStatementList *list;
+
+	context = calloc(1, sizeof(*context));
+	if (context == NULL)
+	{
+		pool_error("pool_create_session_context: calloc failed: %s", strerror(errno));
+		return NULL;
+	}
+
+	list = malloc(sizeof(*list));
+	if (list == NULL)
+	{
+		pool_error("pool_create_session_context: malloc failed: %s", strerror(errno));
+		free(context);
+		return NULL;
+	}
+
+	list->cnt = 0;
+	list->size = INIT_STATEMENT_LIST_SIZE;
+	list->portal_list = malloc(sizeof(Portal *) * list->size);
+	if (list->portal_list == NULL)
+	{
+		pool_error("pool_create_session_context: malloc failed: %s", strerror(errno));
+		free(list);
+		free(context);
+		return NULL;
+	}
+
+	context->prepared_list = list;
+	context->allow_close_transaction = 1;
+
+	return context;
+}
+
+/*
+ * Free a session context. Prepared statements still registered are
+ * not freed here: callers must discard them by reset_connection()
+ * before.
+ */
+void pool_destroy_session_context(POOL_SESSION_CONTEXT *context)
+{
+	if (context == NULL || context == &default_session_context)
+		return;
+
+	if (context == session_context)
+		session_context = &default_session_context;
+
+	if (context->prepared_list)
+	{
+		free(context->prepared_list->portal_list);
+		free(context->prepared_list);
+	}
+	free(context->cache_invalidate_tables);
+	free(context);
+}
+
+/*
+ * Make context the current session context. Returns previous one.
+ */
+POOL_SESSION_CONTEXT *pool_set_session_context(POOL_SESSION_CONTEXT *context)
+{
+	POOL_SESSION_CONTEXT *old = session_context;
+
+	if (context == NULL)
+		context = &default_session_context;
+
+	if (context != old)
+	{
+		save_shared_state(old);
+		restore_shared_state(context);
+	}
+
+	session_context = context;
+	return old;
+}
+
+/*
+ * Load balancing and master_slave_dml turn off replication and
+ * master/slave mode in pool_config and mark the selected node until
+ * the query or the transaction ends. They are process wide, so save
+ * them when the session is switched out.
+ */
+static void save_shared_state(POOL_SESSION_CONTEXT *context)
+{
+	context->saved_replication_enabled = REPLICATION;
+	context->saved_master_slave_enabled = MASTER_SLAVE;
+	memcpy(context->saved_load_balance_status, pool_config->load_balance_status,
+		   sizeof(context->saved_load_balance_status));
+	context->saved_load_balance_node = MY_PROCESS_INFO.load_balance_node;
+	context->shared_state_saved = 1;
+}
+
+/*
+ * Restore the state saved by save_shared_state(). A session never
+ * switched out starts with the configured modes.
+ */
+static void restore_shared_state(POOL_SESSION_CONTEXT *context)
+{
+	int i;
+
+	if (context->shared_state_saved)
+	{
+		REPLICATION = context->saved_replication_enabled;
+		MASTER_SLAVE = context->saved_master_slave_enabled;
+		memcpy(pool_config->load_balance_status, context->saved_load_balance_status,
+			   sizeof(context->saved_load_balance_status));
+		MY_PROCESS_INFO.load_balance_node = context->saved_load_balance_node;
+		return;
+	}
+
+	REPLICATION = pool_config->replication_mode;
+	MASTER_SLAVE = pool_config->master_slave_mode;
+	for (i = 0; i < MAX_NUM_BACKENDS; i++)
+		LOAD_BALANCE_STATUS(i) = LOAD_UNSELECTED;
+	MY_PROCESS_INFO.load_balance_node = -1;
+}
@@ -0,0 +1,503 @@
+/* -*-pgsql-c-*- */
+/*
+ * $Header$
+ *
+ * pgpool: a language independent connection pool server for PostgreSQL
+ * written by Tatsuo Ishii
+ *
+ * Copyright (c) 2003-2010	PgPool Global Development Group
+ *
+ * Permission to use, copy, modify, and distribute this software and
+ * its documentation for any purpose and without fee is hereby
+ * granted, provided that the above copyright notice appear in all
+ * copies and that both that copyright notice and this permission
+ * notice appear in supporting documentation, and that the name of the
+ * author not be used in advertising or publicity pertaining to
+ * distribution of the software without specific, written prior
+ * permission. The author makes no representations about the
+ * suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * pool_shmem_cache.c: query result cache on shared memory.
+ *
+ * The cache is a single shared memory segment created by the parent
+ * process. It consists of a fixed size hash table of cache entries
+ * keyed on the md5 of database name and query, and a pool of fixed
+ * size blocks which store cached result data. Data of an entry is a
+ * chain of blocks. When no free entry or block is left, entries are
+ * evicted by the clock algorithm. All children access the cache under
+ * QUERY_CACHE_SEM.
+ *
+ * Each entry remembers the tables its query referenced, together with
+ * the generation of each table when the query started. Invalidating a
+ * table just increments its generation, and entries with an older
+ * generation are discarded when they are looked up or evicted.
+ * Generations are kept in a fixed size array indexed by table hash,
+ * so tables sharing a slot invalidate each other, which is harmless.
+ */
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <signal.h>
+
+#include "pool.h"
+
+#define SHMEM_CACHE_BLOCK_SIZE 1024
+#define SHMEM_CACHE_ENTRY_BLOCKS 4	/* expected blocks per entry */
+#define SHMEM_CACHE_ALIGN(len) (((len) + 7) & ~((size_t) 7))
+#define SHMEM_CACHE_TABLE_SLOTS 1024	/* number of table generations */
+#define TABLE_SLOT(table) ((table) % SHMEM_CACHE_TABLE_SLOTS)
+
+typedef struct {
+	char key[33];		/* md5 of database and query. empty if unused */
+	char referenced;	/* recently used. cleared by clock sweep */
+	int next;			/* next entry in hash chain or free list */
+	int first_block;	/* first block of cached data */
+	int size;			/* cached data size in bytes */
+	time_t create_time;	/* time the entry was registered */
+	int num_tables;		/* number of tables referenced by the query */
+	unsigned int tables[SHMEM_CACHE_MAX_TABLES];	/* hash of the tables */
+	unsigned int generations[SHMEM_CACHE_MAX_TABLES];	/* table generations at query start */
+} ShmemCacheEntry;
+
+typedef struct {
+	int num_buckets;	/* power of 2 */
+	int num_entries;
+	int num_blocks;
+	int free_entry;		/* head of free entry list */
+	int free_block;		/* head of free block list */
+	int num_free_blocks;
+	int clock_hand;		/* next entry to be examined by clock sweep */
+	unsigned int table_generations[SHMEM_CACHE_TABLE_SLOTS];
+} ShmemCacheHeader;
+
+static ShmemCacheHeader *cache_header;
+static int *cache_buckets;
+static ShmemCacheEntry *cache_entries;
+static int *cache_block_next;	/* next block of each block. -1 terminates */
+static char *cache_blocks;
+
+static int cache_bucket(char *key);
+static int cache_find(char *key);
+static void cache_remove(int e);
+static int cache_is_stale(ShmemCacheEntry *entry);
+static void cache_evict(void);
+static void cache_reset(void);
+
+/*
+ * create the cache of size bytes on shared memory. this should be
+ * called once from the parent process before forking children.
+ * returns 0 on success otherwise -1.
+ */
+int pool_shmem_cache_init(size_t size)
+{
+	size_t per_block;
+	int num_blocks;
+	int num_entries;
+	int num_buckets;
+	char *p;
+
+	/* each block needs its data, link and a share of entries and buckets */
+	per_block = SHMEM_CACHE_BLOCK_SIZE + sizeof(int) +
+		(sizeof(ShmemCacheEntry) + sizeof(int) * 2) / SHMEM_CACHE_ENTRY_BLOCKS + 1;
+
+	/* leave room for the header and alignment of each area */
+	if (size <= SHMEM_CACHE_ALIGN(sizeof(ShmemCacheHeader)) + 32 + per_block * SHMEM_CACHE_ENTRY_BLOCKS)
+	{
+		pool_error("pool_shmem_cache_init: cache size %lu is too small", (unsigned long)size);
+		return -1;
+	}
+
+	num_blocks = (size - SHMEM_CACHE_ALIGN(sizeof(ShmemCacheHeader)) - 32) / per_block;
+	num_entries = num_blocks / SHMEM_CACHE_ENTRY_BLOCKS;
+	for (num_buckets = 1; num_buckets < num_entries; num_buckets *= 2)
+		;
+
+	p = pool_shared_memory_create(size);
+	if (p == NULL)
+	{
+		pool_error("pool_shmem_cache_init: failed to allocate shared memory");
+		return -1;
+	}
+
+	cache_header = (ShmemCacheHeader *)p;
+	p += SHMEM_CACHE_ALIGN(sizeof(ShmemCacheHeader));
+	cache_entries = (ShmemCacheEntry *)p;
+	p += SHMEM_CACHE_ALIGN(sizeof(ShmemCacheEntry) * num_entries);
+	cache_buckets = (int *)p;
+	p += SHMEM_CACHE_ALIGN(sizeof(int) * num_buckets);
+	cache_block_next = (int *)p;
+	p += SHMEM_CACHE_ALIGN(sizeof(int) * num_blocks);
+	cache_blocks = p;
+
+	cache_header->num_buckets = num_buckets;
+	cache_header->num_entries = num_entries;
+	cache_header->num_blocks = num_blocks;
+	memset(cache_header->table_generations, 0, sizeof(cache_header->table_generations));
+	cache_reset();
+
+	pool_debug("pool_shmem_cache_init: %d entries %d blocks of %d bytes",
+			   num_entries, num_blocks, SHMEM_CACHE_BLOCK_SIZE);
+	return 0;
+}
+
+/*
+ * look for cached data for key. if found, a malloced copy of the data
+ * is returned in *data and its length in *len.
+ * returns 1 if found, 0 if not found, -1 on error.
+ */
+int pool_shmem_cache_fetch(char *key, char **data, int *len)
+{
+#ifdef HAVE_SIGPROCMASK
+	sigset_t oldmask;
+#else
+	int	oldmask;
+#endif
+	ShmemCacheEntry *entry;
+	char *buf;
+	int e, b, n, offset;
+
+	if (cache_header == NULL)
+		return -1;
+
+	POOL_SETMASK2(&BlockSig, &oldmask);
+	pool_semaphore_lock(QUERY_CACHE_SEM);
+
+	e = cache_find(key);
+	if (e < 0)
+	{
+		pool_semaphore_unlock(QUERY_CACHE_SEM);
+		POOL_SETMASK(&oldmask);
+		return 0;
+	}
+
+	entry = &cache_entries[e];
+
+	/* expired or invalidated? */
+	if ((pool_config->query_cache_expire > 0 &&
+		 time(NULL) - entry->create_time >= pool_config->query_cache_expire) ||
+		cache_is_stale(entry))
+	{
+		cache_remove(e);
+		pool_semaphore_unlock(QUERY_CACHE_SEM);
+		POOL_SETMASK(&oldmask);
+		return 0;
+	}
+
+	buf = malloc(entry->size);
+	if (buf == NULL)
+	{
+		pool_semaphore_unlock(QUERY_CACHE_SEM);
+		POOL_SETMASK(&oldmask);
+		pool_error("pool_shmem_cache_fetch: malloc failed");
+		return -1;
+	}
+
+	for (b = entry->first_block, offset = 0; offset < entry->size; b = cache_block_next[b])
+	{
+		n = Min(entry->size - offset, SHMEM_CACHE_BLOCK_SIZE);
+		memcpy(buf + offset, cache_blocks + (size_t)b * SHMEM_CACHE_BLOCK_SIZE, n);
+		offset += n;
+	}
+
+	entry->referenced = 1;
+	*data = buf;
+	*len = entry->size;
+
+	pool_semaphore_unlock(QUERY_CACHE_SEM);
+	POOL_SETMASK(&oldmask);
+	return 1;
+}
+
+/*
+ * register data of len bytes for key. tables and generations are the
+ * tables referenced by the query and their generations obtained by
+ * pool_shmem_cache_generations() before the query was sent. an
+ * existing entry for the key is replaced. least recently used entries
+ * are evicted to make room.
+ * returns 0 on success, -1 if the data could not be cached.
+ */
+int pool_shmem_cache_store(char *key, char *data, int len,
+						   unsigned int *tables, unsigned int *generations, int num_tables)
+{
+#ifdef HAVE_SIGPROCMASK
+	sigset_t oldmask;
+#else
+	int	oldmask;
+#endif
+	ShmemCacheEntry *entry;
+	int need;
+	int e, b, h, n, i, offset;
+	int *link;
+
+	if (cache_header == NULL || num_tables > SHMEM_CACHE_MAX_TABLES)
+		return -1;
+
+	/* do not let a huge result flush out the whole cache */
+	need = (len + SHMEM_CACHE_BLOCK_SIZE - 1) / SHMEM_CACHE_BLOCK_SIZE;
+	if (need > cache_header->num_blocks / SHMEM_CACHE_ENTRY_BLOCKS)
+	{
+		pool_debug("pool_shmem_cache_store: result of %d bytes is too large to cache", len);
+		return -1;
+	}
+
+	POOL_SETMASK2(&BlockSig, &oldmask);
+	pool_semaphore_lock(QUERY_CACHE_SEM);
+
+	e = cache_find(key);
+	if (e >= 0)
+		cache_remove(e);
+
+	/* the tables have been modified while the query was running */
+	for (i = 0; i < num_tables; i++)
+	{
+		if (cache_header->table_generations[TABLE_SLOT(tables[i])] != generations[i])
+		{
+			pool_semaphore_unlock(QUERY_CACHE_SEM);
+			POOL_SETMASK(&oldmask);
+			pool_debug("pool_shmem_cache_store: result is already invalidated");
+			return 0;
+		}
+	}
+
+	while (cache_header->free_entry < 0 || cache_header->num_free_blocks < need)
+		cache_evict();
+
+	/* take an entry from the free list */
+	e = cache_header->free_entry;
+	entry = &cache_entries[e];
+	cache_header->free_entry = entry->next;
+
+	/* take blocks from the free list and copy data */
+	link = &entry->first_block;
+	for (offset = 0; offset < len; offset += n)
+	{
+		b = cache_header->free_block;
+		cache_header->free_block = cache_block_next[b];
+		cache_header->num_free_blocks--;
+		*link = b;
+		link = &cache_block_next[b];
+
+		n = Min(len - offset, SHMEM_CACHE_BLOCK_SIZE);
+		memcpy(cache_blocks + (size_t)b * SHMEM_CACHE_BLOCK_SIZE, data + offset, n);
+	}
+	*link = -1;
+
+	strlcpy(entry->key, key, sizeof(entry->key));
+	entry->size = len;
+	entry->create_time = time(NULL);
+	entry->referenced = 1;
+	entry->num_tables = num_tables;
+	for (i = 0; i < num_tables; i++)
+	{
+		entry->tables[i] = tables[i];
+		entry->generations[i] = generations[i];
+	}
+
+	/* link to hash chain */
+	h = cache_bucket(key);
+	entry->next = cache_buckets[h];
+	cache_buckets[h] = e;
+
+	pool_semaphore_unlock(QUERY_CACHE_SEM);
+	POOL_SETMASK(&oldmask);
+	return 0;
+}
+
+/*
+ * get current generations of tables. the result of a query can be
+ * registered only if none of the tables is invalidated after this.
+ */
+void pool_shmem_cache_generations(unsigned int *tables, int num_tables, unsigned int *generations)
+{
+#ifdef HAVE_SIGPROCMASK
+	sigset_t oldmask;
+#else
+	int	oldmask;
+#endif
+	int i;
+
+	if (cache_header == NULL)
+		return;
+
+	POOL_SETMASK2(&BlockSig, &oldmask);
+	pool_semaphore_lock(QUERY_CACHE_SEM);
+	for (i = 0; i < num_tables; i++)
+		generations[i] = cache_header->table_generations[TABLE_SLOT(tables[i])];
+	pool_semaphore_unlock(QUERY_CACHE_SEM);
+	POOL_SETMASK(&oldmask);
+}
+
+/*
+ * invalidate all cached data referencing any of tables
+ */
+void pool_shmem_cache_invalidate(unsigned int *tables, int num_tables)
+{
+#ifdef HAVE_SIGPROCMASK
+	sigset_t oldmask;
+#else
+	int	oldmask;
+#endif
+	int i;
+
+	if (cache_header == NULL)
+		return;
+
+	POOL_SETMASK2(&BlockSig, &oldmask);
+	pool_semaphore_lock(QUERY_CACHE_SEM);
+	for (i = 0; i < num_tables; i++)
+		cache_header->table_generations[TABLE_SLOT(tables[i])]++;
+	pool_semaphore_unlock(QUERY_CACHE_SEM);
+	POOL_SETMASK(&oldmask);
+}
+
+/*
+ * remove all cached data
+ */
+void pool_shmem_cache_clear(void)
+{
+#ifdef HAVE_SIGPROCMASK
+	sigset_t oldmask;
+#else
+	int	oldmask;
+#endif
+
+	if (cache_header == NULL)
+		return;
+
+	POOL_SETMASK2(&BlockSig, &oldmask);
+	pool_semaphore_lock(QUERY_CACHE_SEM);
+	cache_reset();
+	pool_semaphore_unlock(QUERY_CACHE_SEM);
+	POOL_SETMASK(&oldmask);
+}
+
+static int cache_bucket(char *key)
+{
+	unsigned int h = 0;
+
+	while (*key)
+		h = h * 31 + (unsigned char)*key++;
+
+	return h & (cache_header->num_buckets - 1);
+}
+
+/*
+ * returns entry number of key or -1 if not found
+ */
+static int cache_find(char *key)
+{
+	int e;
+
+	for (e = cache_buckets[cache_bucket(key)]; e >= 0; e = cache_entries[e].next)
+	{
+		if (!strcmp(cache_entries[e].key, key))
+			return e;
+	}
+	return -1;
+}
+
+/*
+ * unlink entry e from its hash chain and return it and its blocks to
+ * the free lists
+ */
+static void cache_remove(int e)
+{
+	ShmemCacheEntry *entry = &cache_entries[e];
+	int *link;
+	int b, next;
+
+	for (link = &cache_buckets[cache_bucket(entry->key)]; *link >= 0; link = &cache_entries[*link].next)
+	{
+		if (*link == e)
+		{
+			*link = entry->next;
+			break;
+		}
+	}
+
+	for (b = entry->first_block; b >= 0; b = next)
+	{
+		next = cache_block_next[b];
+		cache_block_next[b] = cache_header->free_block;
+		cache_header->free_block = b;
+		cache_header->num_free_blocks++;
+	}
+
+	entry->key[0] = '\0';
+	entry->first_block = -1;
+	entry->next = cache_header->free_entry;
+	cache_header->free_entry = e;
+}
+
+/*
+ * returns non 0 if any of the tables referenced by entry has been
+ * invalidated since the entry was registered
+ */
+static int cache_is_stale(ShmemCacheEntry *entry)
+{
+	int i;
+
+	for (i = 0; i < entry->num_tables; i++)
+	{
+		if (cache_header->table_generations[TABLE_SLOT(entry->tables[i])] != entry->generations[i])
+			return 1;
+	}
+	return 0;
+}
+
+/*
+ * evict an entry which has not been used since the clock hand passed
+ * it last time, or has been invalidated
+ */
+static void cache_evict(void)
+{
+	ShmemCacheEntry *entry;
+
+	for (;;)
+	{
+		entry = &cache_entries[cache_header->clock_hand];
+		cache_header->clock_hand = (cache_header->clock_hand + 1) % cache_header->num_entries;
+
+		if (entry->key[0] == '\0')
+			continue;
+
+		if (entry->referenced && !cache_is_stale(entry))
+		{
+			entry->referenced = 0;
+			continue;
+		}
+
+		pool_debug("cache_evict: evict cache entry %s", entry->key);
+		cache_remove(entry - cache_entries);
+		return;
+	}
+}
+
+/*
+ * make all entries and blocks free
+ */
+static void cache_reset(void)
+{
+	int i;
+
+	for (i = 0; i < cache_header->num_buckets; i++)
+		cache_buckets[i] = -1;
+
+	for (i = 0; i < cache_header->num_entries; i++)
+	{
+		cache_entries[i].key[0] = '\0';
+		cache_entries[i].first_block = -1;
+		cache_entries[i].next = i + 1 < cache_header->num_entries ? i + 1 : -1;
+	}
+	cache_header->free_entry = 0;
+
+	for (i = 0; i < cache_header->num_blocks; i++)
+		cache_block_next[i] = i + 1 < cache_header->num_blocks ? i + 1 : -1;
+	cache_header->free_block = 0;
+	cache_header->num_free_blocks = cache_header->num_blocks;
+
+	cache_header->clock_hand = 0;
+}
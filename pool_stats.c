@@ -0,0 +1,294 @@
+/* -*-pgsql-c-*- */
+/*
+ * $Header$
+ *
+ * pgpool: a language independent connection pool server for PostgreSQL
+ * written by Tatsuo Ishii
+ *
+ * Copyright (c) 2003-2010	PgPool Global Development Group
+ *
+ * Permission to use, copy, modify, and distribute this software and
+ * its documentation for any purpose and without fee is hereby
+ * granted, provided that the above copyright notice appear in all
+ * copies and that both that copyright notice and this permission
+ * notice appear in supporting documentation, and that the name of the
+ * author not be used in advertising or publicity pertaining to
+ * distribution of the software without specific, written prior
+ * permission. The author makes no representations about the
+ * suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * pool_stats.c: statistics on shared memory.
+ *
+ * Each child has its own statistics area on shared memory and is the
+ * only process which writes to it, so counting needs neither locking
+ * nor atomic operations. Failover events are counted by the parent in
+ * a separate area. Readers (SHOW commands and pcp) sum up the areas
+ * of all children. Since the areas are indexed by the process table
+ * id, counters survive restarts of children.
+ */
+#include "config.h"
+
+#include <string.h>
+#include <sys/time.h>
+
+#include "pool.h"
+
+#define STATS_ALIGN(len) (((len) + 7) & ~((size_t) 7))
+
+typedef struct {
+	NodeStats node[MAX_NUM_BACKENDS];
+	PoolStats pool;
+} ChildStats;
+
+typedef struct {
+	unsigned long long failover_count[MAX_NUM_BACKENDS];
+	unsigned long long failback_count[MAX_NUM_BACKENDS];
+} FailoverStats;
+
+static FailoverStats *failover_stats;	/* written by the parent */
+static ChildStats *child_stats;			/* array of num_init_children */
+static int num_child_stats;
+static ChildStats *my_stats;			/* area of this child. NULL if
+										 * this is not a child */
+
+/* query being measured */
+static struct timeval query_start_time;
+static int pending_selects;
+static int pending_writes;
+
+static int latency_bucket(long usec);
+
+/*
+ * Create statistics area on shared memory. This should be called once
+ * from the parent process before forking children.
+ * Returns 0 on success otherwise -1.
+ */
+int pool_stats_init(void)
+{
+	char *p;
+	size_t size;
+
+	num_child_stats = pool_config->num_init_children;
+	size = STATS_ALIGN(sizeof(FailoverStats)) + sizeof(ChildStats) * num_child_stats;
+
+	p = pool_shared_memory_create(size);
+	if (p == NULL)
+	{
+		pool_error("pool_stats_init: failed to allocate shared memory");
+		return -1;
+	}
+	memset(p, 0, size);
+
+	failover_stats = (FailoverStats *)p;
+	child_stats = (ChildStats *)(p + STATS_ALIGN(sizeof(FailoverStats)));
+
+	return 0;
+}
+
+/*
+ * Start counting statistics of a child whose process table id is id.
+ * Called in the child process.
+ */
+void pool_stats_set_child(int id)
+{
+	if (child_stats && id >= 0 && id < num_child_stats)
+		my_stats = &child_stats[id];
+}
+
+/*
+ * Count bytes received from a backend
+ */
+void pool_stats_count_received(POOL_CONNECTION *cp, int len)
+{
+	if (my_stats && cp->isbackend && len > 0)
+		my_stats->node[cp->db_node_id].bytes_received += len;
+}
+
+/*
+ * Count bytes sent to a backend
+ */
+void pool_stats_count_sent(POOL_CONNECTION *cp, int len)
+{
+	if (my_stats && cp->isbackend && len > 0)
+		my_stats->node[cp->db_node_id].bytes_sent += len;
+}
+
+/*
+ * Remember that a query is about to be sent to backends. The query is
+ * counted when ReadyForQuery arrives, on the nodes the query was
+ * actually sent to. In extended protocol several queries may be
+ * executed before a Sync, in which case response time is measured
+ * from the first one.
+ */
+void pool_stats_query_start(int is_select)
+{
+	if (my_stats == NULL)
+		return;
+
+	if (pending_selects == 0 && pending_writes == 0)
+		gettimeofday(&query_start_time, NULL);
+
+	if (is_select)
+		pending_selects++;
+	else
+		pending_writes++;
+}
+
+/*
+ * Count queries started by pool_stats_query_start() on each valid
+ * node. Called when ReadyForQuery is received, before the load
+ * balance mode ends.
+ */
+void pool_stats_query_end(POOL_CONNECTION_POOL *backend)
+{
+	struct timeval now;
+	long usec;
+	int bucket;
+	int i;
+
+	if (my_stats == NULL || (pending_selects == 0 && pending_writes == 0))
+		return;
+
+	gettimeofday(&now, NULL);
+	usec = (now.tv_sec - query_start_time.tv_sec) * 1000000 +
+		(now.tv_usec - query_start_time.tv_usec);
+	bucket = latency_bucket(usec);
+
+	for (i = 0; i < NUM_BACKENDS; i++)
+	{
+		if (!VALID_BACKEND(i))
+			continue;
+
+		my_stats->node[i].select_count += pending_selects;
+		my_stats->node[i].write_count += pending_writes;
+		my_stats->node[i].latency[bucket]++;
+	}
+
+	pending_selects = pending_writes = 0;
+}
+
+/*
+ * Count a lookup of the connection pool
+ */
+void pool_stats_count_connection_pool(int hit)
+{
+	if (my_stats == NULL)
+		return;
+
+	if (hit)
+		my_stats->pool.connection_pool_hit++;
+	else
+		my_stats->pool.connection_pool_miss++;
+}
+
+/*
+ * Count a lookup of the query cache
+ */
+void pool_stats_count_query_cache(int hit)
+{
+	if (my_stats == NULL)
+		return;
+
+	if (hit)
+		my_stats->pool.query_cache_hit++;
+	else
+		my_stats->pool.query_cache_miss++;
+}
+
+/*
+ * Count a failover or a failback of a node. Called in the parent.
+ */
+void pool_stats_count_failover(int node_id, int failback)
+{
+	if (failover_stats == NULL || node_id < 0 || node_id >= MAX_NUM_BACKENDS)
+		return;
+
+	if (failback)
+		failover_stats->failback_count[node_id]++;
+	else
+		failover_stats->failover_count[node_id]++;
+}
+
+/*
+ * Sum up statistics of a node. Returns 0 on success, -1 if node_id is
+ * out of range. Since counters are read without locking, the result
+ * may miss queries in progress.
+ */
+int pool_get_node_stats(int node_id, NodeStats *stats)
+{
+	NodeStats *s;
+	int i, j;
+
+	if (child_stats == NULL || node_id < 0 || node_id >= NUM_BACKENDS)
+		return -1;
+
+	memset(stats, 0, sizeof(NodeStats));
+
+	for (i = 0; i < num_child_stats; i++)
+	{
+		s = &child_stats[i].node[node_id];
+
+		stats->select_count += s->select_count;
+		stats->write_count += s->write_count;
+		stats->bytes_received += s->bytes_received;
+		stats->bytes_sent += s->bytes_sent;
+		for (j = 0; j < NUM_LATENCY_BUCKETS; j++)
+			stats->latency[j] += s->latency[j];
+	}
+
+	stats->failover_count = failover_stats->failover_count[node_id];
+	stats->failback_count = failover_stats->failback_count[node_id];
+
+	return 0;
+}
+
+/*
+ * Sum up statistics not related to nodes
+ */
+void pool_get_pool_stats(PoolStats *stats)
+{
+	PoolStats *s;
+	int i;
+
+	memset(stats, 0, sizeof(PoolStats));
+
+	if (child_stats == NULL)
+		return;
+
+	for (i = 0; i < num_child_stats; i++)
+	{
+		s = &child_stats[i].pool;
+
+		stats->connection_pool_hit += s->connection_pool_hit;
+		stats->connection_pool_miss += s->connection_pool_miss;
+		stats->query_cache_hit += s->query_cache_hit;
+		stats->query_cache_miss += s->query_cache_miss;
+	}
+}
+
+/*
+ * Returns the upper bound of a latency bucket in milliseconds, or -1
+ * for the last bucket which has no upper bound.
+ */
+int pool_stats_latency_bound(int bucket)
+{
+	if (bucket >= NUM_LATENCY_BUCKETS - 1)
+		return -1;
+	return 1 << (2 * bucket);
+}
+
+/*
+ * Returns the latency bucket for a response time in microseconds
+ */
+static int latency_bucket(long usec)
+{
+	int bucket;
+
+	for (bucket = 0; bucket < NUM_LATENCY_BUCKETS - 1; bucket++)
+	{
+		if (usec < pool_stats_latency_bound(bucket) * 1000L)
+			break;
+	}
+	return bucket;
+}
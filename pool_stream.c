@@ -33,6 +33,8 @@
 #include <string.h>
 #include <errno.h>
 #include <unistd.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
 
 #include "pool.h"
 
@@ -41,8 +43,10 @@
 
 static int mystrlen(char *str, int upper, int *flag);
 static int mystrlinelen(char *str, int upper, int *flag);
-static int save_pending_data(POOL_CONNECTION *cp, void *data, int len);
 static int consume_pending_data(POOL_CONNECTION *cp, void *data, int len);
+static int read_to_pending(POOL_CONNECTION *cp);
+static int read_fd(POOL_CONNECTION *cp, void *buf, int len);
+static int flush_with_data(POOL_CONNECTION *cp, void *buf, int len);
 
 /*
 * open read/write file descriptors.
@@ -51,6 +55,7 @@ static int consume_pending_data(POOL_CONNECTION *cp, void *data, int len);
 POOL_CONNECTION *pool_open(int fd)
 {
 	POOL_CONNECTION *cp;
+	int bufsz;
 
 	cp = (POOL_CONNECTION *)malloc(sizeof(POOL_CONNECTION));
 	if (cp == NULL)
@@ -71,20 +76,23 @@ POOL_CONNECTION *pool_open(int fd)
 	cp->wbufsz = WRITEBUFSZ;
 	cp->wbufpo = 0;
 
-	/* initialize pending data buffer */
-	cp->hp = malloc(READBUFSZ);
+	/* initialize pending data buffer, which is also used as the read buffer */
+	bufsz = READBUFSZ;
+	if (pool_config && pool_config->read_buffer_size > bufsz)
+		bufsz = pool_config->read_buffer_size;
+	cp->hp = malloc(bufsz);
 	if (cp->hp == NULL)
 	{
 		pool_error("pool_open: malloc failed");
 		return NULL;
 	}
-	cp->bufsz = READBUFSZ;
+	cp->bufsz = bufsz;
 	cp->po = 0;
 	cp->len = 0;
 	cp->sbuf = NULL;
 	cp->sbufsz = 0;
 	cp->buf2 = NULL;
-	cp->sbufsz = 0;
+	cp->bufsz2 = 0;
 
 	cp->fd = fd;
 	return cp;
@@ -100,6 +108,7 @@ void pool_close(POOL_CONNECTION *cp)
 	 */
 	if (!cp->isbackend)
 		shutdown(cp->fd, 1);
+	pool_event_forget(cp->fd);
 	close(cp->fd);
 
 	free(cp->wbuf);
@@ -121,93 +130,31 @@ void pool_close(POOL_CONNECTION *cp)
 */
 int pool_read(POOL_CONNECTION *cp, void *buf, int len)
 {
-	static char readbuf[READBUFSZ];
-
 	int consume_size;
 	int readlen;
 
-	consume_size = consume_pending_data(cp, buf, len);
-	len -= consume_size;
-	buf += consume_size;
-
-	while (len > 0)
+	for (;;)
 	{
-		if (pool_check_fd(cp))
-		{
-			if (!IS_MASTER_NODE_ID(cp->db_node_id))
-			{
-				pool_log("pool_read: data is not ready in DB node: %d. abort this session",
-						 cp->db_node_id);
-				exit(1);
-			}
-			else
-			{
-				pool_error("pool_read: pool_check_fd failed (%s)", strerror(errno));
-			    return -1;
-			}
-		}
+		consume_size = consume_pending_data(cp, buf, len);
+		len -= consume_size;
+		buf += consume_size;
 
-		if (cp->ssl_active > 0) {
-		  readlen = pool_ssl_read(cp, readbuf, READBUFSZ);
-		} else {
-		  readlen = read(cp->fd, readbuf, READBUFSZ);
-		}
-
-		if (readlen == -1)
-		{
-			if (errno == EINTR || errno == EAGAIN)
-			{
-				pool_debug("pool_read: retrying due to %s", strerror(errno));
-				continue;
-			}
-
-			pool_error("pool_read: read failed (%s)", strerror(errno));
+		if (len <= 0)
+			break;
 
-			if (cp->isbackend)
-			{
-			    /* fatal error, notice to parent and exit */
-				notice_backend_error(cp->db_node_id);
-				child_exit(1);
-			}
-			else
-			{
-			    return -1;
-			}
-		}
+		readlen = read_to_pending(cp);
+		if (readlen < 0)
+			return -1;
 		else if (readlen == 0)
 		{
 			if (cp->isbackend)
-			{
 				pool_error("pool_read: EOF encountered with backend");
-				return -1;
-
-#ifdef NOT_USED
-			    /* fatal error, notice to parent and exit */
-			    notice_backend_error(IS_MASTER_NODE_ID(cp->db_node_id));
-				child_exit(1);
-#endif
-			}
-			else
-			{
-				/*
-				 * if backend offers authentication method, frontend could close connection
-				 */
-				return -1;
-			}
-		}
 
-		if (len < readlen)
-		{
-			/* overrun. we need to save remaining data to pending buffer */
-			if (save_pending_data(cp, readbuf+len, readlen-len))
-				return -1;
-			memmove(buf, readbuf, len);
-			break;
+			/*
+			 * if backend offers authentication method, frontend could close connection
+			 */
+			return -1;
 		}
-
-		memmove(buf, readbuf, readlen);
-		buf += readlen;
-		len -= readlen;
 	}
 
 	return 0;
@@ -225,7 +172,7 @@ char *pool_read2(POOL_CONNECTION *cp, int len)
 	int consume_size;
 	int readlen;
 
-	req_size = cp->len + len;
+	req_size = len;
 
 	if (req_size > cp->bufsz2)
 	{
@@ -247,72 +194,40 @@ char *pool_read2(POOL_CONNECTION *cp, int len)
 
 	while (len > 0)
 	{
-		if (pool_check_fd(cp))
+		/*
+		 * small message. read ahead into the read buffer so that
+		 * following messages do not need another read(2)
+		 */
+		if (len < cp->bufsz / 2)
 		{
-			if (!IS_MASTER_NODE_ID(cp->db_node_id))
+			readlen = read_to_pending(cp);
+			if (readlen > 0)
 			{
-				pool_log("pool_read2: data is not ready in DB node:%d. abort this session",
-						 cp->db_node_id);
-				exit(1);
-			}
-			else
-			{
-				pool_error("pool_read2: pool_check_fd failed (%s)", strerror(errno));
-			    return NULL;
+				consume_size = consume_pending_data(cp, buf, len);
+				buf += consume_size;
+				len -= consume_size;
+				continue;
 			}
 		}
-
-		if (cp->ssl_active > 0) {
-		  readlen = pool_ssl_read(cp, buf, len);
-		} else {
-		  readlen = read(cp->fd, buf, len);
-		}
-
-		if (readlen == -1)
+		else
 		{
-			if (errno == EINTR || errno == EAGAIN)
+			/* large message. read directly into the result buffer */
+			readlen = read_fd(cp, buf, len);
+			if (readlen > 0)
 			{
-				pool_debug("pool_read2: retrying due to %s", strerror(errno));
+				buf += readlen;
+				len -= readlen;
 				continue;
 			}
-
-			pool_error("pool_read2: read failed (%s)", strerror(errno));
-
-			if (cp->isbackend)
-			{
-			    /* fatal error, notice to parent and exit */
-				notice_backend_error(cp->db_node_id);
-				child_exit(1);
-			}
-			else
-			{
-			    return NULL;
-			}
 		}
-		else if (readlen == 0)
-		{
-			if (cp->isbackend)
-			{
-				pool_error("pool_read2: EOF encountered with backend");
-				return NULL;
 
-#ifdef NOT_USED
-			    /* fatal error, notice to parent and exit */
-			    notice_backend_error(IS_MASTER_NODE_ID(cp->db_node_id));
-				child_exit(1);
-#endif
-			}
-			else
-			{
-				/*
-				 * if backend offers authentication method, frontend could close connection
-				 */
-				return NULL;
-			}
-		}
+		if (readlen == 0 && cp->isbackend)
+			pool_error("pool_read2: EOF encountered with backend");
 
-		buf += readlen;
-		len -= readlen;
+		/*
+		 * if backend offers authentication method, frontend could close connection
+		 */
+		return NULL;
 	}
 
 	return cp->buf2;
@@ -333,6 +248,14 @@ int pool_write(POOL_CONNECTION *cp, void *buf, int len)
 	if (cp->no_forward)
 		return 0;
 
+	/*
+	 * data does not fit in the write buffer. instead of copying it to
+	 * the buffer and flushing chunk by chunk, send buffered data and
+	 * the given data at once.
+	 */
+	if (len > WRITEBUFSZ - cp->wbufpo && cp->ssl_active <= 0)
+		return flush_with_data(cp, buf, len);
+
 	while (len > 0)
 	{
 		int remainder = WRITEBUFSZ - cp->wbufpo;
@@ -423,6 +346,8 @@ int pool_flush_it(POOL_CONNECTION *cp)
 		  sts = write(cp->fd, cp->wbuf + offset, wlen);
 		}
 
+		pool_stats_count_sent(cp, sts);
+
 		if (sts > 0)
 		{
 			wlen -= sts;
@@ -475,6 +400,70 @@ int pool_flush_it(POOL_CONNECTION *cp)
 	return 0;
 }
 
+/*
+ * send data in the write buffer followed by len bytes of buf with
+ * writev(2), without copying buf to the write buffer.
+ * returns 0 on success otherwise -1.
+ */
+static int flush_with_data(POOL_CONNECTION *cp, void *buf, int len)
+{
+	struct iovec iov[2];
+	int i = 0;
+	int sts;
+
+	iov[0].iov_base = cp->wbuf;
+	iov[0].iov_len = cp->wbufpo;
+	iov[1].iov_base = buf;
+	iov[1].iov_len = len;
+
+	while (i < 2)
+	{
+		if (iov[i].iov_len == 0)
+		{
+			i++;
+			continue;
+		}
+
+		errno = 0;
+		sts = writev(cp->fd, &iov[i], 2 - i);
+		pool_stats_count_sent(cp, sts);
+
+		if (sts > 0)
+		{
+			/* skip written data */
+			for (; i < 2 && sts >= iov[i].iov_len; i++)
+				sts -= iov[i].iov_len;
+			if (i < 2)
+			{
+				iov[i].iov_base = (char *)iov[i].iov_base + sts;
+				iov[i].iov_len -= sts;
+			}
+		}
+
+		else if (errno == EAGAIN || errno == EINTR)
+		{
+			continue;
+		}
+
+		else
+		{
+			if (cp->isbackend)
+				pool_error("flush_with_data: write failed to backend (%d). reason: %s",
+						   cp->db_node_id, strerror(errno));
+			else
+				pool_debug("flush_with_data: write failed to frontend. reason: %s",
+						   strerror(errno));
+
+			cp->wbufpo = 0;
+			return -1;
+		}
+	}
+
+	cp->wbufpo = 0;
+
+	return 0;
+}
+
 /*
 * flush write buffer and degenerate/failover if error occurs
 */
@@ -516,169 +505,216 @@ int pool_write_and_flush(POOL_CONNECTION *cp, void *buf, int len)
 }
 
 /*
- * read a string until EOF or NULL is encountered.
- * if line is not 0, read until new line is encountered.
-*/
-char *pool_read_string(POOL_CONNECTION *cp, int *len, int line)
+ * Relay a run of protocol V3 messages of the same kind from src to
+ * dst. The kind of the first message has already been read by the
+ * caller. Data is read from src directly into the write buffer of dst
+ * and message headers are examined in place, so that message bodies
+ * are never copied. The run ends when a message of another kind
+ * arrives, or when no more data is available from src without
+ * blocking. Data read beyond the run is put back to src.
+ * returns 0 on success otherwise -1.
+ */
+int pool_relay_messages(POOL_CONNECTION *src, POOL_CONNECTION *dst, char kind)
 {
-	int readp;
-	int readsize;
+	char *wbuf;
+	int pos;		/* data before this position is ready to be sent */
+	int end;		/* data up to this position has been read */
+	int remaining;	/* bytes of current message to be read. -1: length word */
 	int readlen;
-	int strlength;
-	int flag;
-	int consume_size;
+	int len;
 
-#ifdef DEBUG
-	static char pbuf[READBUFSZ];
-#endif
+	if (dst->wbufpo >= WRITEBUFSZ && pool_flush(dst))
+		return -1;
 
-	*len = 0;
-	readp = 0;
+	wbuf = dst->wbuf;
+	pos = dst->wbufpo;
+	wbuf[pos++] = kind;
+	end = pos;
+	remaining = -1;
 
-	/* initialize read buffer */
-	if (cp->sbufsz == 0)
+	for (;;)
 	{
-		cp->sbuf = malloc(READBUFSZ);
-		if (cp->sbuf == NULL)
+		if (remaining > 0)
 		{
-			pool_error("pool_read_string: malloc failed");
-			return NULL;
+			len = Min(remaining, end - pos);
+			pos += len;
+			remaining -= len;
 		}
-		cp->sbufsz = READBUFSZ;
-		*cp->sbuf = '\0';
-	}
 
-	/* any pending data? */
-	if (cp->len)
-	{
-		if (line)
-			strlength = mystrlinelen(cp->hp+cp->po, cp->len, &flag);
-		else
-			strlength = mystrlen(cp->hp+cp->po, cp->len, &flag);
-
-		/* buffer is too small? */
-		if ((strlength + 1) > cp->sbufsz)
+		if (remaining == 0)
 		{
-			cp->sbufsz = ((strlength+1)/READBUFSZ+1)*READBUFSZ;
-			cp->sbuf = realloc(cp->sbuf, cp->sbufsz);
-			if (cp->sbuf == NULL)
+			/* end of a message. continue if more data is at hand */
+			if (end == pos && src->len == 0 &&
+				pool_event_wait_fd(src->fd, 0) <= 0)
+				break;
+
+			if (end > pos)
 			{
-				pool_error("pool_read_string: realloc failed");
-				return NULL;
+				if (wbuf[pos] != kind)
+					break;
+				pos++;
+				remaining = -1;
 			}
 		}
 
-		/* consume pending and save to read string buffer */
-		consume_size = consume_pending_data(cp, cp->sbuf, strlength);
+		if (remaining == -1 && end - pos >= 4)
+		{
+			memcpy(&len, wbuf + pos, sizeof(len));
+			len = ntohl(len);
+			if (len < 4)
+			{
+				pool_error("pool_relay_messages: invalid message length %d kind: %c", len, kind);
+				return -1;
+			}
+			pos += 4;
+			remaining = len - 4;
+			continue;
+		}
 
-		*len = strlength;
+		if (remaining > 0 && end > pos)
+			continue;
 
-		/* is the string null terminated? */
-		if (consume_size == strlength && !flag)
+		/* need more data. make room in the buffer if necessary */
+		if (end >= WRITEBUFSZ)
 		{
-			/* not null or line terminated.
-			 * we need to read more since we have not encountered NULL or new line yet
-			 */
-			readsize = cp->sbufsz - strlength;
-			readp = strlength;
+			len = end - pos;		/* partial message header */
+			dst->wbufpo = pos;
+			if (pool_flush(dst))
+				return -1;
+			memmove(wbuf, wbuf + pos, len);
+			pos = 0;
+			end = len;
 		}
-		else
+
+		readlen = consume_pending_data(src, wbuf + end, WRITEBUFSZ - end);
+		if (readlen > 0)
 		{
-			pool_debug("pool_read_string: read all from pending data. po:%d len:%d",
-					   cp->po, cp->len);
-			return cp->sbuf;
+			end += readlen;
+			continue;
 		}
-	} else
-	{
-		readsize = cp->sbufsz;
-	}
 
-	for (;;)
-	{
-		if (pool_check_fd(cp))
+		if (pool_check_fd(src))
 		{
-			if (!IS_MASTER_NODE_ID(cp->db_node_id))
-			{
-				pool_log("pool_read_string: data is not ready in DB node:%d. abort this session",
-						 cp->db_node_id);
-				exit(1);
-			}
-			else
-			{
-				pool_error("pool_read_string: pool_check_fd failed (%s)", strerror(errno));
-			    return NULL;
-			}
+			pool_error("pool_relay_messages: pool_check_fd failed (%s)", strerror(errno));
+			return -1;
 		}
 
-		if (cp->ssl_active > 0) {
-		  readlen = pool_ssl_read(cp, cp->sbuf+readp, readsize);
+		if (src->ssl_active > 0) {
+		  readlen = pool_ssl_read(src, wbuf + end, WRITEBUFSZ - end);
 		} else {
-		  readlen = read(cp->fd, cp->sbuf+readp, readsize);
+		  readlen = read(src->fd, wbuf + end, WRITEBUFSZ - end);
 		}
 
+		pool_stats_count_received(src, readlen);
+
 		if (readlen == -1)
 		{
-			pool_error("pool_read_string: read() failed. reason:%s", strerror(errno));
+			if (errno == EINTR || errno == EAGAIN)
+				continue;
 
-			if (cp->isbackend)
+			pool_error("pool_relay_messages: read failed (%s)", strerror(errno));
+			if (src->isbackend)
 			{
-				notice_backend_error(cp->db_node_id);
+			    /* fatal error, notice to parent and exit */
+				notice_backend_error(src->db_node_id);
 				child_exit(1);
 			}
-			else
-			{
-			    return NULL;
-			}
+			return -1;
 		}
-		else if (readlen == 0)	/* EOF detected */
+		else if (readlen == 0)
 		{
-			/*
-			 * just returns an error, not trigger failover or degeneration
-			 */
-			pool_error("pool_read_string: read () EOF detected");
-			return NULL;
+			pool_error("pool_relay_messages: EOF encountered");
+			return -1;
 		}
 
-		/* check overrun */
-		if (line)
-			strlength = mystrlinelen(cp->sbuf+readp, readlen, &flag);
-		else
-			strlength = mystrlen(cp->sbuf+readp, readlen, &flag);
+		end += readlen;
+	}
 
-		if (strlength < readlen)
-		{
-			save_pending_data(cp, cp->sbuf+readp+strlength, readlen-strlength);
-			*len += strlength;
-			pool_debug("pool_read_string: total result %d with pending data po:%d len:%d", *len, cp->po, cp->len);
-			return cp->sbuf;
-		}
+	dst->wbufpo = pos;
+
+	/* put back data which does not belong to this run */
+	if (end > pos)
+		return pool_unread(src, wbuf + pos, end - pos);
+
+	return 0;
+}
+
+/*
+ * read a string until EOF or NULL is encountered.
+ * if line is not 0, read until new line is encountered.
+*/
+char *pool_read_string(POOL_CONNECTION *cp, int *len, int line)
+{
+	int readlen;
+	int strlength;
+	int flag;
 
-		*len += readlen;
+	*len = 0;
 
-		/* encountered null or newline? */
-		if (flag)
+	/* initialize read buffer */
+	if (cp->sbufsz == 0)
+	{
+		cp->sbuf = malloc(READBUFSZ);
+		if (cp->sbuf == NULL)
 		{
-			/* ok we have read all data */
-			pool_debug("pool_read_string: total result %d ", *len);
-			break;
+			pool_error("pool_read_string: malloc failed");
+			return NULL;
 		}
+		cp->sbufsz = READBUFSZ;
+		*cp->sbuf = '\0';
+	}
 
-		readp += readlen;
-		readsize = READBUFSZ;
-
-		if ((*len+readsize) > cp->sbufsz)
+	for (;;)
+	{
+		/* any pending data? */
+		if (cp->len)
 		{
-			cp->sbufsz += READBUFSZ;
+			if (line)
+				strlength = mystrlinelen(cp->hp+cp->po, cp->len, &flag);
+			else
+				strlength = mystrlen(cp->hp+cp->po, cp->len, &flag);
+
+			/* buffer is too small? */
+			if ((*len + strlength + 1) > cp->sbufsz)
+			{
+				cp->sbufsz = ((*len+strlength+1)/READBUFSZ+1)*READBUFSZ;
+				cp->sbuf = realloc(cp->sbuf, cp->sbufsz);
+				if (cp->sbuf == NULL)
+				{
+					pool_error("pool_read_string: realloc failed");
+					return NULL;
+				}
+			}
+
+			/* consume pending and save to read string buffer */
+			consume_pending_data(cp, cp->sbuf + *len, strlength);
+			*len += strlength;
 
-			cp->sbuf = realloc(cp->sbuf, cp->sbufsz);
-			if (cp->sbuf == NULL)
+			/* encountered null or newline? */
+			if (flag)
 			{
-				pool_error("pool_read_string: realloc failed");
-				return NULL;
+				/* ok we have read all data */
+				pool_debug("pool_read_string: total result %d with pending data po:%d len:%d", *len, cp->po, cp->len);
+				return cp->sbuf;
 			}
 		}
+
+		/*
+		 * not null or line terminated.
+		 * we need to read more since we have not encountered NULL or new line yet
+		 */
+		readlen = read_to_pending(cp);
+		if (readlen < 0)
+			return NULL;
+		else if (readlen == 0)	/* EOF detected */
+		{
+			/*
+			 * just returns an error, not trigger failover or degeneration
+			 */
+			pool_error("pool_read_string: read () EOF detected");
+			return NULL;
+		}
 	}
-	return cp->sbuf;
 }
 
 /*
@@ -692,20 +728,17 @@ char *pool_read_string(POOL_CONNECTION *cp, int *len, int line)
  */
 static int mystrlen(char *str, int upper, int *flag)
 {
-	int len;
-
-	*flag = 0;
+	char *p;
 
-	for (len = 0;len < upper; len++, str++)
+	p = memchr(str, '\0', upper);
+	if (p == NULL)
 	{
-	    if (!*str)
-	    {
-			len++;
-			*flag = 1;
-			break;
-	    }
+		*flag = 0;
+		return upper;
 	}
-	return len;
+
+	*flag = 1;
+	return p - str + 1;
 }
 
 /*
@@ -739,11 +772,15 @@ static int mystrlinelen(char *str, int upper, int *flag)
 }
 
 /*
- * save pending data
+ * read available data into the pending data buffer. the buffer is
+ * compacted or enlarged if there is not enough room, so that a
+ * read(2) can fetch many protocol messages at once.
+ * returns number of bytes read, 0 on EOF or -1 on error.
  */
-static int save_pending_data(POOL_CONNECTION *cp, void *data, int len)
+static int read_to_pending(POOL_CONNECTION *cp)
 {
-	int reqlen;
+	int readsize;
+	int readlen;
 	size_t realloc_size;
 	char *p;
 
@@ -751,28 +788,92 @@ static int save_pending_data(POOL_CONNECTION *cp, void *data, int len)
 	if (cp->len == 0)
 		cp->po = 0;
 
-	reqlen = cp->po + cp->len + len;
+	readsize = cp->bufsz - cp->po - cp->len;
 
-	/* pending buffer is enough? */
-	if (reqlen > cp->bufsz)
+	/* move pending data to the head of the buffer */
+	if (cp->po > 0 && readsize < cp->bufsz / 2)
 	{
-		/* too small, enlarge it */
-		realloc_size = (reqlen/READBUFSZ+1)*READBUFSZ;
+		memmove(cp->hp, cp->hp + cp->po, cp->len);
+		cp->po = 0;
+		readsize = cp->bufsz - cp->len;
+	}
+
+	if (readsize < READBUFSZ)
+	{
+		realloc_size = ((cp->po + cp->len)/READBUFSZ+2)*READBUFSZ;
 		p = realloc(cp->hp, realloc_size);
 		if (p == NULL)
 		{
-			pool_error("save_pending_data: realloc failed");
+			pool_error("read_to_pending: realloc failed");
 			return -1;
 		}
-
 		cp->bufsz = realloc_size;
 		cp->hp = p;
+		readsize = cp->bufsz - cp->po - cp->len;
 	}
 
-	memmove(cp->hp + cp->po + cp->len, data, len);
-	cp->len += len;
+	readlen = read_fd(cp, cp->hp + cp->po + cp->len, readsize);
+	if (readlen > 0)
+		cp->len += readlen;
 
-	return 0;
+	return readlen;
+}
+
+/*
+ * read at most len bytes from cp into buf. waits for data if none is
+ * available.
+ * returns number of bytes read, 0 on EOF or -1 on error.
+ */
+static int read_fd(POOL_CONNECTION *cp, void *buf, int len)
+{
+	int readlen;
+
+	for (;;)
+	{
+		if (pool_check_fd(cp))
+		{
+			if (cp->isbackend && !IS_MASTER_NODE_ID(cp->db_node_id))
+			{
+				pool_log("read_fd: data is not ready in DB node: %d. abort this session",
+						 cp->db_node_id);
+				exit(1);
+			}
+			else
+			{
+				pool_error("read_fd: pool_check_fd failed (%s)", strerror(errno));
+			    return -1;
+			}
+		}
+
+		if (cp->ssl_active > 0) {
+		  readlen = pool_ssl_read(cp, buf, len);
+		} else {
+		  readlen = read(cp->fd, buf, len);
+		}
+
+		pool_stats_count_received(cp, readlen);
+
+		if (readlen == -1)
+		{
+			if (errno == EINTR || errno == EAGAIN)
+			{
+				pool_debug("read_fd: retrying due to %s", strerror(errno));
+				continue;
+			}
+
+			pool_error("read_fd: read failed (%s)", strerror(errno));
+
+			if (cp->isbackend)
+			{
+			    /* fatal error, notice to parent and exit */
+				notice_backend_error(cp->db_node_id);
+				child_exit(1);
+			}
+			return -1;
+		}
+
+		return readlen;
+	}
 }
 
 /*
@@ -806,6 +907,15 @@ int pool_unread(POOL_CONNECTION *cp, void *data, int len)
 	int n = cp->len + len;
 	int realloc_size;
 
+	/* data consumed last is still there. just rewind the cursor */
+	if (cp->po >= len)
+	{
+		cp->po -= len;
+		memmove(cp->hp + cp->po, data, len);
+		cp->len += len;
+		return 0;
+	}
+
 	if (cp->bufsz < n)
 	{
 		realloc_size = (n/READBUFSZ+1)*READBUFSZ;
@@ -816,6 +926,7 @@ int pool_unread(POOL_CONNECTION *cp, void *data, int len)
 			return -1;
 		}
 		cp->hp = p;
+		cp->bufsz = realloc_size;
 	}
 	if (cp->len != 0)
 		memmove(p + len, cp->hp + cp->po, cp->len);
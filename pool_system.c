@@ -28,6 +28,7 @@
 #include "pool.h"
 
 static int create_prepared_statement(DistDefInfo *dist_info);
+static int get_id_from_system_db(DistDefInfo *info, const char *value);
 static int  get_col_list(DistDefInfo *info);
 static int  get_col_list2(RepliDefInfo *info);
 
@@ -321,6 +322,13 @@ int pool_memset_system_db_info (SystemDBInfo *info)
 				return -1;
 			}
 
+			if (pool_dist_rule_init(&dist_info[i]) < 0)
+			{
+				PQclear(result);
+				pool_close_libpq_connection();
+				return -1;
+			}
+
 			/* create PREPARE statement */
 			len = strlen(t_dbname) + strlen(t_schema_name) +
 				strlen(t_table_name) + strlen("pgpool_");
@@ -550,13 +558,38 @@ RepliDefInfo *pool_get_repli_def_info (char *dbname, char *schema_name, char *ta
 
 /*
  * pool_get_id:
- *    Returns the backend node id from value.
+ *    Returns the backend node id from value. Built-in rules are
+ *    evaluated here, otherwise the distribution function on System DB
+ *    is called. The result is cached by value.
  */
 int pool_get_id (DistDefInfo *info, const char *value)
+{
+	int num;
+
+	num = pool_dist_cache_lookup(info, value);
+	if (num >= 0)
+		return num;
+
+	if (info->dist_rule)
+		num = pool_dist_rule_eval(info, value);
+	else
+		num = get_id_from_system_db(info, value);
+
+	if (num < 0 || num >= NUM_BACKENDS)
+		return -1;
+
+	pool_dist_cache_store(info, value, num);
+	return num;
+}
+
+/*
+ * get_id_from_system_db:
+ *    Calls the distribution function on System DB.
+ */
+static int get_id_from_system_db(DistDefInfo *info, const char *value)
 {
 	int num;
 	PGresult *result;
-	char *type;
 	int length;
 
 	if (!system_db_info->pgconn ||
@@ -572,7 +605,6 @@ int pool_get_id (DistDefInfo *info, const char *value)
 			return -1;
 	}
 
-	type=info->type_list[info->dist_key_col_id];
 	length = strlen(value);
 	result = PQexecPrepared(system_db_info->pgconn, info->prepare_name,
 							1, &value, &length, NULL, 0);
@@ -581,6 +613,7 @@ int pool_get_id (DistDefInfo *info, const char *value)
 		PQgetisnull(result, 0, 0))
 	{
 		pool_error("PQexecPrepared failed: %s", PQerrorMessage(system_db_info->pgconn));
+		PQclear(result);
 		return -1;
 	}
 	else
@@ -588,19 +621,11 @@ int pool_get_id (DistDefInfo *info, const char *value)
 		char *id;
 		id = PQgetvalue(result, 0 ,0);
 
+		num = -1;
 		if(strlen(id))
-		{
 			num = atoi(id);
-			PQclear(result);
-
-			if(num < NUM_BACKENDS)
-			{
-				return num;
-			} else {
-				return -1;
-			}
-		}
-		return -1;
+		PQclear(result);
+		return num;
 	}
 }
 
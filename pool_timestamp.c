@@ -61,7 +61,6 @@ static bool rewrite_timestamp_insert(InsertStmt *i_stmt, TSRewriteContext *ctx);
 static bool rewrite_timestamp_update(UpdateStmt *u_stmt, TSRewriteContext *ctx);
 static char *get_current_timestamp(POOL_CONNECTION_POOL *backend);
 static Node *makeTsExpr(TSRewriteContext *ctx);
-bool raw_expression_tree_walker(Node *node, bool (*walker) (), void *context);
 
 #define		MAX_RELCACHE 32
 POOL_RELCACHE	*ts_relcache;
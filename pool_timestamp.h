@@ -6,5 +6,6 @@
 
 char *rewrite_timestamp(POOL_CONNECTION_POOL *backend, Node *node, bool rewrite_to_params, Portal *portal);
 char *bind_rewrite_timestamp(POOL_CONNECTION_POOL *backend, Portal *portal, const char *orig_msg, int *len);
+bool raw_expression_tree_walker(Node *node, bool (*walker) (), void *context);
 
 #endif /* POOL_TIMESTAMP_H */
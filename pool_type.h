@@ -107,6 +107,12 @@ typedef struct {
 	double backend_weight;	/* normalized backend load balance ratio */
 	double unnormalized_weight; /* descripted parameter */
 	char backend_data_directory[MAX_PATH_LENGTH];
+	volatile unsigned int query_latency;	/* moving average of load balanced
+											 * query response time in
+											 * microseconds */
+	volatile unsigned int health_check_latency;	/* response time of the last
+												 * health check in
+												 * microseconds */
 } BackendInfo;
 
 typedef struct {
@@ -138,8 +144,42 @@ typedef struct {
 	pid_t pid; /* OS's process id */
 	time_t start_time; /* fork() time */
 	ConnectionInfo *connection_info; /* head of the connection info for this process */
+	volatile int load_balance_node; /* node running load balanced query of this process. -1 if none */
+	volatile int connected; /* number of frontends connected to this process */
 } ProcessInfo;
 
+/*
+ * Statistics of a backend node. Each child counts them in its own
+ * area on shared memory, and they are summed up when reported.
+ */
+#define NUM_LATENCY_BUCKETS 8
+
+typedef struct {
+	unsigned long long select_count;	/* number of read only queries */
+	unsigned long long write_count;		/* number of other queries */
+	unsigned long long bytes_received;	/* bytes received from the node */
+	unsigned long long bytes_sent;		/* bytes sent to the node */
+	unsigned long long latency[NUM_LATENCY_BUCKETS]; /* number of queries
+													  * by response time.
+													  * bucket i counts
+													  * queries shorter
+													  * than 4^i msec, the
+													  * last one counts
+													  * the rest */
+	unsigned long long failover_count;	/* times the node was detached */
+	unsigned long long failback_count;	/* times the node was attached */
+} NodeStats;
+
+/*
+ * Statistics not related to a particular node
+ */
+typedef struct {
+	unsigned long long connection_pool_hit;	/* connections reused */
+	unsigned long long connection_pool_miss; /* connections created */
+	unsigned long long query_cache_hit;		/* queries answered from cache */
+	unsigned long long query_cache_miss;	/* cache lookups failed */
+} PoolStats;
+
 /*
  * 
  * system db structure
@@ -156,6 +196,8 @@ typedef struct {
 	char *dist_def_func;	/* function name of distribution rule */
 	char *prepare_name;		/* prepared statement name */
 	int is_created_prepare;	/* is prepare statement created? */
+	struct DistRule *dist_rule;	/* built-in rule. NULL if dist_def_func is a function */
+	struct DistCacheEntry *dist_cache;	/* node ids cached by value */
 } DistDefInfo;
 
 typedef struct {
@@ -345,13 +345,13 @@ static int wait_connection_closed(void)
 
 	do {
 
-		if (Req_info->conn_counter == 0)
+		if (pool_get_connection_count() == 0)
 			return 0;
 
 		if (WAIT_RETRY_COUNT != 0)
 			sleep(3);
 	} while (i++ < WAIT_RETRY_COUNT);
 
-	pool_error("wait_connection_closed: existing connections (%d) did not close in %d sec.", Req_info->conn_counter, pool_config->recovery_timeout);
+	pool_error("wait_connection_closed: existing connections (%d) did not close in %d sec.", pool_get_connection_count(), pool_config->recovery_timeout);
 	return 1;
 }
@@ -0,0 +1,38 @@
+SELECT 1
+select * from t1 where c1 = 'abc'
+SeLeCt c1 FROM t1 WhErE c2 = 1
+   SELECT 1
+	SELECT 1
+SELECT /* comment */ c1 FROM t1
+SELECT c1 FROM t1 -- comment
+SELECT c1 /* nested /* comment */ */ FROM t1
+SELECT count(*), max(c1) FROM t1 GROUP BY c2
+SELECT pg_catalog.count(*) FROM t1
+SELECT "c1", "Count" FROM t1
+SELECT c1 FROM t1 WHERE c2 = $1
+SELECT c1 FROM t1;
+SELECT c1 FROM t1;  
+SELECT c1 FROM t1 WHERE c2 IN (SELECT c2 FROM t2)
+SELECT 1.5e10, 'it''s'
+SELECT * FROM t1 FOR UPDATE
+SELECT * FROM t1 FOR SHARE
+select * from t1 for update of t1
+SELECT nextval('s1')
+SELECT setval('s1', 10)
+SELECT "nextval"('s1')
+SELECT NEXTVAL('s1')
+SELECT * INTO t2 FROM t1
+SELECT c1 into temp t2 FROM t1
+WITH x AS (INSERT INTO t1 VALUES (1) RETURNING *) SELECT * FROM x
+WITH x AS (SELECT 1) SELECT * FROM x
+SELECT 1; SELECT 2
+SELECT 1; DELETE FROM t1
+SELECT my_func(c1) FROM t1
+SELECT set_config('search_path', 'public', false)
+SELECT pg_advisory_lock(1)
+SELECT public.count(*) FROM t1
+SELECT "my_func"(c1) FROM t1
+SELECT 'abc\d'
+SELECT $$abc$$
+/* comment */ SELECT 1
+INSERT INTO t1 VALUES (1)
@@ -0,0 +1,28 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include "pool.h"
+#include "pool_proto_modules.h"
+
+POOL_CONFIG _pool_config;
+POOL_CONFIG *pool_config = &_pool_config;
+
+int
+main(int argc, char **argv)
+{
+	if (argc != 2)
+	{
+		fprintf(stderr, "./classify-test query\n");
+		exit(1);
+	}
+
+	pool_config->ignore_leading_white_space = 1;
+
+	printf("%d: %s\n", is_read_only_select_query(argv[1]), argv[1]);
+	return 0;
+}
+
+void child_exit(int code) { exit (code); }
+void pool_error(const char *fmt,...) {}
+void pool_debug(const char *fmt,...) {}
+void pool_log(const char *fmt,...) {}
@@ -0,0 +1,23 @@
+SELECT id, name FROM t1, t2 WHERE t1.id = t2.id ORDER BY name LIMIT 10 OFFSET 5
+SELECT id, name FROM t1 ORDER BY id LIMIT 10
+SELECT * FROM t1, t2 ORDER BY price DESC NULLS LAST, t2.val LIMIT 3 OFFSET 1
+SELECT * FROM t1, t2 ORDER BY t1.id NULLS FIRST LIMIT 1
+SELECT * FROM t1 LIMIT 20 OFFSET 7
+SELECT * FROM t1 LIMIT 0
+SELECT id AS k FROM t1 ORDER BY k LIMIT 10
+SELECT name AS id FROM t1 ORDER BY id LIMIT 10
+SELECT id FROM t1 ORDER BY id + 1 LIMIT 10
+SELECT id FROM t1 ORDER BY lower(name) LIMIT 10
+SELECT id FROM t1 ORDER BY 1 LIMIT 10
+SELECT id FROM t1 ORDER BY tmp LIMIT 10
+SELECT id FROM t1 ORDER BY t3.id LIMIT 10
+SELECT id FROM t1 ORDER BY id USING < LIMIT 10
+SELECT id FROM t1 ORDER BY id LIMIT ALL
+SELECT id FROM t1 ORDER BY id LIMIT ALL OFFSET 5
+SELECT id FROM t1 ORDER BY id OFFSET 5
+SELECT id FROM t1 ORDER BY id
+SELECT id FROM t1 ORDER BY id LIMIT 10 OFFSET $1
+SELECT id FROM t1 ORDER BY id LIMIT 2147483647 OFFSET 1
+SELECT DISTINCT id FROM t1 ORDER BY id LIMIT 10
+SELECT id FROM t1 GROUP BY id ORDER BY id LIMIT 10
+SELECT id FROM t1 ORDER BY id LIMIT 10 FOR UPDATE
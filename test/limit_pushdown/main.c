@@ -0,0 +1,82 @@
+/*
+ * Test of BuildLimitPushdown() in pool_rewrite_outfuncs.c. The source
+ * is included here so that the static function can be called
+ * directly.
+ *
+ * The query is analyzed as if every part of it could be executed on
+ * the nodes (partstate 'P'), with FROM clause made of t1 and t2 below.
+ * The program prints what is appended to the query sent to the nodes.
+ */
+#include "pool_rewrite_outfuncs.c"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "parser/parser.h"
+
+/* virtual table of "FROM t1, t2". t1.tmp is not in the select list */
+static char *col_list[] = {"id", "name", "tmp", "price", "val"};
+static char *type_list[] = {"int4", "text", "int4", "numeric", "text"};
+static char *table_list[] = {"t1", "t1", "t1", "t1", "t2"};
+static int column_no[] = {0, 1, 2, 3, 4};
+static int valid[] = {1, 1, -1, 1, 1};
+
+int
+main(int argc, char **argv)
+{
+	List *tree;
+	Node *node;
+	RewriteQuery message;
+	AnalyzeSelect analyze;
+	VirtualTable virtual;
+	char *pushdown;
+	int i;
+
+	if (argc != 2)
+	{
+		fprintf(stderr, "./limit-pushdown-test query\n");
+		exit(1);
+	}
+
+	tree = raw_parser(argv[1]);
+	if (tree == NULL)
+	{
+		printf("syntax error: %s\n", argv[1]);
+		exit(0);
+	}
+
+	node = (Node *) linitial(tree);
+	if (!IsA(node, SelectStmt))
+	{
+		printf("not a SELECT: %s\n", argv[1]);
+		exit(0);
+	}
+
+	memset(&message, 0, sizeof(message));
+	memset(&analyze, 0, sizeof(analyze));
+	memset(&virtual, 0, sizeof(virtual));
+
+	virtual.col_list = col_list;
+	virtual.type_list = type_list;
+	virtual.table_list = table_list;
+	virtual.column_no = column_no;
+	virtual.valid = valid;
+	virtual.col_num = sizeof(col_list) / sizeof(col_list[0]);
+	analyze.virtual = &virtual;
+	for (i = SELECT_FROMCLAUSE; i <= SELECT_HAVINGCLAUSE; i++)
+		analyze.partstate[i] = 'P';
+
+	pushdown = BuildLimitPushdown(&message, &analyze, (SelectStmt *) node);
+	if (pushdown)
+		printf("%s =>%s\n", argv[1], pushdown);
+	else
+		printf("%s => not pushed down\n", argv[1]);
+
+	return 0;
+}
+
+void child_exit(int code) { exit (code); }
+void pool_error(const char *fmt,...) {}
+void pool_debug(const char *fmt,...) {}
+void pool_log(const char *fmt,...) {}
+DistDefInfo *pool_get_dist_def_info(char *dbname, char *schema_name, char *table_name) { return NULL; }
+RepliDefInfo *pool_get_repli_def_info(char *dbname, char *schema_name, char *table_name) { return NULL; }
@@ -0,0 +1,43 @@
+compare 1 2
+compare 2 1
+compare 1.50 1.5
+compare -1 1
+compare -2 -1
+compare 0 -0.00
+compare 10 9.99
+compare 0.001 0.0001
+compare NaN 1
+compare 1 NaN
+compare NaN NaN
+compare 007 7
+compare +3 3
+add 1 2
+add 0.5 0.25
+add 99.9 0.1
+add -1 1
+add -1.5 0.5
+add 1.5 -2.75
+add -2 -3.5
+add 0 0
+add 0.00 -0.00
+add NaN 1
+add 1 NaN
+add 12345678901234567890 1
+avg 10 4
+avg 1 3
+avg 2 3
+avg -2 3
+avg -10 4
+avg 0 5
+avg 0.000 3
+avg 1.5000 2
+avg 100000 3
+avg 0.00001 3
+avg NaN 2
+avg 1 0
+canonical 1.500
+canonical 1.000
+canonical 100
+canonical 0.0
+canonical -2.50
+canonical NaN
@@ -0,0 +1,34 @@
+SELECT id, name FROM t1 WHERE id > 10
+SELECT * FROM t1 ORDER BY price DESC
+SELECT id FROM t1 ORDER BY name LIMIT 10 OFFSET 5
+SELECT id FROM t1 ORDER BY 1 LIMIT ALL OFFSET 3
+SELECT id FROM t1 ORDER BY price NULLS FIRST
+SELECT * FROM t1 ORDER BY id
+SELECT * FROM t1 ORDER BY price + 1
+SELECT count(*), sum(price), min(name), max(score) FROM t1
+SELECT avg(price) FROM t1
+SELECT name, avg(score) AS a FROM t1 GROUP BY name ORDER BY a DESC LIMIT 3
+SELECT count(*) FROM t1 GROUP BY flag, name
+SELECT name FROM t1 GROUP BY name ORDER BY max(price)
+SELECT name, count(*) FROM t1 GROUP BY name ORDER BY name LIMIT 5 OFFSET 2
+SELECT DISTINCT name FROM t1
+SELECT name, count(*) FROM t1 GROUP BY name HAVING count(*) > 1
+WITH x AS (SELECT 1) SELECT id FROM t1
+SELECT id, rank() OVER (ORDER BY price) FROM t1
+SELECT id FROM t1 WHERE id IN (SELECT id FROM t2)
+SELECT (SELECT max(id) FROM t2) FROM t1
+SELECT id FROM t1 LIMIT 1 + 1
+SELECT id FROM t1 LIMIT $1
+SELECT id FROM t1 OFFSET 1 + 1
+SELECT id FROM t1 UNION SELECT id FROM t1
+SELECT id FROM t1, t2
+SELECT id FROM t2
+SELECT id FROM t1 FOR UPDATE
+SELECT stddev(price) FROM t1
+SELECT avg(name) FROM t1
+SELECT count(DISTINCT name) FROM t1
+SELECT id FROM t1 ORDER BY 1 USING <
+SELECT id FROM t1 WHERE count(*) > 1
+SELECT * FROM t1 GROUP BY name
+SELECT count(*) FROM t1 GROUP BY 1
+SELECT name FROM t1 ORDER BY upper(name)
@@ -0,0 +1,183 @@
+/*
+ * Test of pool_parallel_select.c. The source is included here so that
+ * its static functions can be called directly.
+ *
+ *  ./parallel-select-test "SELECT ..."
+ *    prints the fragment sent to the nodes and the plan, or "rejected"
+ *  ./parallel-select-test "compare a b"
+ *  ./parallel-select-test "add a b"
+ *  ./parallel-select-test "avg sum count"
+ *  ./parallel-select-test "canonical a"
+ *    call numeric functions
+ */
+#include "pool_parallel_select.c"
+
+#include <stdio.h>
+#include "parser/parser.h"
+
+POOL_REQUEST_INFO _req_info;
+POOL_REQUEST_INFO *Req_info = &_req_info;
+POOL_SESSION_CONTEXT _session_context;
+POOL_SESSION_CONTEXT *session_context = &_session_context;
+POOL_CONFIG _pool_config;
+POOL_CONFIG *pool_config = &_pool_config;
+
+/* t1 is distributed. t2 is not */
+static char *t1_cols[] = {"id", "name", "price", "score", "flag"};
+static char *t1_types[] = {"int4", "text", "numeric", "float8", "bool"};
+static DistDefInfo t1_info = {
+	"db", "public", "t1", "id", 0, 5, t1_cols, t1_types, "hash", NULL, 0, NULL, NULL
+};
+
+DistDefInfo *
+pool_get_dist_def_info(char *dbname, char *schema_name, char *table_name)
+{
+	if (strcmp(table_name, "t1") == 0)
+		return &t1_info;
+	return NULL;
+}
+
+POOL_RELCACHE *
+pool_create_relcache(int cachesize, char *sql, func_ptr register_func, func_ptr unregister_func, bool issessionlocal)
+{
+	return (POOL_RELCACHE *) 1;
+}
+
+/* lc_collate is C */
+void *
+pool_search_relcache(POOL_RELCACHE *relcache, POOL_CONNECTION_POOL *backend, char *table)
+{
+	return (void *) 1;
+}
+
+static void
+print_plan(PSPlan *plan)
+{
+	static char *kinds[] = {"plain", "group", "count", "sum", "min", "max", "avg"};
+	static char *classes[] = {"unknown", "numeric", "float", "bool", "text"};
+	int i;
+
+	printf("  aggregate: %d targets: %d", plan->aggregate, plan->ntargets);
+	if (plan->aggregate)
+	{
+		printf(" columns:");
+		for (i = 0; i < plan->ncols; i++)
+		{
+			printf(" %s/%s", kinds[plan->cols[i].kind], classes[plan->cols[i].class]);
+			if (plan->cols[i].kind == PS_AVG)
+				printf("(%d)", plan->cols[i].count_col);
+		}
+	}
+	printf("\n");
+
+	if (plan->nkeys > 0)
+	{
+		printf("  order by:");
+		for (i = 0; i < plan->nkeys; i++)
+			printf(" %s%d%s%s", plan->keys[i].hidden ? "hidden " : "",
+				   plan->keys[i].col, plan->keys[i].desc ? " desc" : "",
+				   plan->keys[i].nulls_first ? " nulls first" : "");
+		printf("\n");
+	}
+
+	printf("  offset: %ld limit: %ld\n", plan->offset, plan->limit);
+}
+
+static void
+test_plan(char *query)
+{
+	POOL_CONNECTION_POOL backend;
+	POOL_CONNECTION_POOL_SLOT slot;
+	StartupPacket sp;
+	List *tree;
+	Node *node;
+	PSPlan plan;
+
+	memset(&slot, 0, sizeof(slot));
+	memset(&sp, 0, sizeof(sp));
+	sp.database = "db";
+	slot.sp = &sp;
+	backend.slots[0] = &slot;
+
+	tree = raw_parser(query);
+	if (tree == NULL)
+	{
+		printf("syntax error: %s\n", query);
+		return;
+	}
+
+	node = (Node *) linitial(tree);
+	if (!IsA(node, SelectStmt) || plan_select((SelectStmt *) node, &backend, &plan) < 0)
+	{
+		printf("rejected: %s\n", query);
+		return;
+	}
+
+	printf("%s\n", nodeToString(node));
+	print_plan(&plan);
+}
+
+int
+main(int argc, char **argv)
+{
+	char cmd[16];
+	char a[256];
+	char b[256];
+	char *result;
+	int n;
+
+	if (argc != 2)
+	{
+		fprintf(stderr, "./parallel-select-test query\n");
+		exit(1);
+	}
+
+	n = sscanf(argv[1], "%15s %255s %255s", cmd, a, b);
+
+	if (n == 3 && strcmp(cmd, "compare") == 0)
+	{
+		int r = compare_numeric(a, strlen(a), b, strlen(b));
+
+		printf("compare %s %s: %d\n", a, b, r < 0 ? -1 : r > 0);
+	}
+	else if (n == 3 && strcmp(cmd, "add") == 0)
+	{
+		result = numeric_add(a, b);
+		printf("add %s %s: %s\n", a, b, result ? result : "error");
+		free(result);
+	}
+	else if (n == 3 && strcmp(cmd, "avg") == 0)
+	{
+		result = numeric_div_count(a, b);
+		printf("avg %s %s: %s\n", a, b, result ? result : "error");
+		free(result);
+	}
+	else if (n == 2 && strcmp(cmd, "canonical") == 0)
+	{
+		printf("canonical %s: %.*s\n", a, numeric_canonical_length(a, strlen(a)), a);
+	}
+	else
+		test_plan(argv[1]);
+
+	return 0;
+}
+
+void child_exit(int code) { exit (code); }
+void pool_error(const char *fmt,...) {}
+void pool_debug(const char *fmt,...) {}
+void pool_log(const char *fmt,...) {}
+void *int_register_func(POOL_SELECT_RESULT *res) { return NULL; }
+void *int_unregister_func(void *data) { return NULL; }
+void per_node_statement_log(POOL_CONNECTION_POOL *backend, int node_id, char *query) {}
+int pool_read(POOL_CONNECTION *cp, void *buf, int len) { return -1; }
+char *pool_read2(POOL_CONNECTION *cp, int len) { return NULL; }
+int pool_write(POOL_CONNECTION *cp, void *buf, int len) { return -1; }
+int pool_flush(POOL_CONNECTION *cp) { return -1; }
+int pool_write_and_flush(POOL_CONNECTION *cp, void *buf, int len) { return -1; }
+void pool_send_error_message(POOL_CONNECTION *frontend, int protoMajor, char *code, char *message,
+							 char *detail, char *hint, char *file, int line) {}
+POOL_STATUS do_query(POOL_CONNECTION *backend, char *query, POOL_SELECT_RESULT **result, int major)
+{
+	return POOL_ERROR;
+}
+void free_select_result(POOL_SELECT_RESULT *result) {}
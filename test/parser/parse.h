@@ -0,0 +1,536 @@
+/* A Bison parser, made by GNU Bison 3.8.2.  */
+
+/* Bison interface for Yacc-like parsers in C
+
+   Copyright (C) 1984, 1989-1990, 2000-2015, 2018-2021 Free Software Foundation,
+   Inc.
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program.  If not, see <https://www.gnu.org/licenses/>.  */
+
+/* As a special exception, you may create a larger work that contains
+   part or all of the Bison parser skeleton and distribute that work
+   under terms of your choice, so long as that work isn't itself a
+   parser generator using the skeleton or a modified version thereof
+   as a parser skeleton.  Alternatively, if you modify or redistribute
+   the parser skeleton itself, you may (at your option) remove this
+   special exception, which will cause the skeleton and the resulting
+   Bison output files to be licensed under the GNU General Public
+   License without this special exception.
+
+   This special exception was added by the Free Software Foundation in
+   version 2.2 of Bison.  */
+
+/* DO NOT RELY ON FEATURES THAT ARE NOT DOCUMENTED in the manual,
+   especially those whose name start with YY_ or yy_.  They are
+   private implementation details that can be changed or removed.  */
+
+#ifndef YY_BASE_YY_GRAM_TAB_H_INCLUDED
+# define YY_BASE_YY_GRAM_TAB_H_INCLUDED
+/* Debug traces.  */
+#ifndef YYDEBUG
+# define YYDEBUG 0
+#endif
+#if YYDEBUG
+extern int base_yydebug;
+#endif
+
+/* Token kinds.  */
+#ifndef YYTOKENTYPE
+# define YYTOKENTYPE
+  enum yytokentype
+  {
+    YYEMPTY = -2,
+    YYEOF = 0,                     /* "end of file"  */
+    YYerror = 256,                 /* error  */
+    YYUNDEF = 257,                 /* "invalid token"  */
+    ABORT_P = 258,                 /* ABORT_P  */
+    ABSOLUTE_P = 259,              /* ABSOLUTE_P  */
+    ACCESS = 260,                  /* ACCESS  */
+    ACTION = 261,                  /* ACTION  */
+    ADD_P = 262,                   /* ADD_P  */
+    ADMIN = 263,                   /* ADMIN  */
+    AFTER = 264,                   /* AFTER  */
+    AGGREGATE = 265,               /* AGGREGATE  */
+    ALL = 266,                     /* ALL  */
+    ALSO = 267,                    /* ALSO  */
+    ALTER = 268,                   /* ALTER  */
+    ALWAYS = 269,                  /* ALWAYS  */
+    ANALYSE = 270,                 /* ANALYSE  */
+    ANALYZE = 271,                 /* ANALYZE  */
+    AND = 272,                     /* AND  */
+    ANY = 273,                     /* ANY  */
+    ARRAY = 274,                   /* ARRAY  */
+    AS = 275,                      /* AS  */
+    ASC = 276,                     /* ASC  */
+    ASSERTION = 277,               /* ASSERTION  */
+    ASSIGNMENT = 278,              /* ASSIGNMENT  */
+    ASYMMETRIC = 279,              /* ASYMMETRIC  */
+    AT = 280,                      /* AT  */
+    AUTHORIZATION = 281,           /* AUTHORIZATION  */
+    BACKWARD = 282,                /* BACKWARD  */
+    BEFORE = 283,                  /* BEFORE  */
+    BEGIN_P = 284,                 /* BEGIN_P  */
+    BETWEEN = 285,                 /* BETWEEN  */
+    BIGINT = 286,                  /* BIGINT  */
+    BINARY = 287,                  /* BINARY  */
+    BIT = 288,                     /* BIT  */
+    BOOLEAN_P = 289,               /* BOOLEAN_P  */
+    BOTH = 290,                    /* BOTH  */
+    BY = 291,                      /* BY  */
+    CACHE = 292,                   /* CACHE  */
+    CALLED = 293,                  /* CALLED  */
+    CASCADE = 294,                 /* CASCADE  */
+    CASCADED = 295,                /* CASCADED  */
+    CASE = 296,                    /* CASE  */
+    CAST = 297,                    /* CAST  */
+    CATALOG_P = 298,               /* CATALOG_P  */
+    CHAIN = 299,                   /* CHAIN  */
+    CHAR_P = 300,                  /* CHAR_P  */
+    CHARACTER = 301,               /* CHARACTER  */
+    CHARACTERISTICS = 302,         /* CHARACTERISTICS  */
+    CHECK = 303,                   /* CHECK  */
+    CHECKPOINT = 304,              /* CHECKPOINT  */
+    CLASS = 305,                   /* CLASS  */
+    CLOSE = 306,                   /* CLOSE  */
+    CLUSTER = 307,                 /* CLUSTER  */
+    COALESCE = 308,                /* COALESCE  */
+    COLLATE = 309,                 /* COLLATE  */
+    COLUMN = 310,                  /* COLUMN  */
+    COMMENT = 311,                 /* COMMENT  */
+    COMMIT = 312,                  /* COMMIT  */
+    COMMITTED = 313,               /* COMMITTED  */
+    CONCURRENTLY = 314,            /* CONCURRENTLY  */
+    CONFIGURATION = 315,           /* CONFIGURATION  */
+    CONNECTION = 316,              /* CONNECTION  */
+    CONSTRAINT = 317,              /* CONSTRAINT  */
+    CONSTRAINTS = 318,             /* CONSTRAINTS  */
+    CONTENT_P = 319,               /* CONTENT_P  */
+    CONTINUE_P = 320,              /* CONTINUE_P  */
+    CONVERSION_P = 321,            /* CONVERSION_P  */
+    COPY = 322,                    /* COPY  */
+    COST = 323,                    /* COST  */
+    CREATE = 324,                  /* CREATE  */
+    CREATEDB = 325,                /* CREATEDB  */
+    CREATEROLE = 326,              /* CREATEROLE  */
+    CREATEUSER = 327,              /* CREATEUSER  */
+    CROSS = 328,                   /* CROSS  */
+    CSV = 329,                     /* CSV  */
+    CURRENT_P = 330,               /* CURRENT_P  */
+    CURRENT_CATALOG = 331,         /* CURRENT_CATALOG  */
+    CURRENT_DATE = 332,            /* CURRENT_DATE  */
+    CURRENT_ROLE = 333,            /* CURRENT_ROLE  */
+    CURRENT_SCHEMA = 334,          /* CURRENT_SCHEMA  */
+    CURRENT_TIME = 335,            /* CURRENT_TIME  */
+    CURRENT_TIMESTAMP = 336,       /* CURRENT_TIMESTAMP  */
+    CURRENT_USER = 337,            /* CURRENT_USER  */
+    CURSOR = 338,                  /* CURSOR  */
+    CYCLE = 339,                   /* CYCLE  */
+    DATA_P = 340,                  /* DATA_P  */
+    DATABASE = 341,                /* DATABASE  */
+    DAY_P = 342,                   /* DAY_P  */
+    DEALLOCATE = 343,              /* DEALLOCATE  */
+    DEC = 344,                     /* DEC  */
+    DECIMAL_P = 345,               /* DECIMAL_P  */
+    DECLARE = 346,                 /* DECLARE  */
+    DEFAULT = 347,                 /* DEFAULT  */
+    DEFAULTS = 348,                /* DEFAULTS  */
+    DEFERRABLE = 349,              /* DEFERRABLE  */
+    DEFERRED = 350,                /* DEFERRED  */
+    DEFINER = 351,                 /* DEFINER  */
+    DELETE_P = 352,                /* DELETE_P  */
+    DELIMITER = 353,               /* DELIMITER  */
+    DELIMITERS = 354,              /* DELIMITERS  */
+    DESC = 355,                    /* DESC  */
+    DICTIONARY = 356,              /* DICTIONARY  */
+    DISABLE_P = 357,               /* DISABLE_P  */
+    DISCARD = 358,                 /* DISCARD  */
+    DISTINCT = 359,                /* DISTINCT  */
+    DO = 360,                      /* DO  */
+    DOCUMENT_P = 361,              /* DOCUMENT_P  */
+    DOMAIN_P = 362,                /* DOMAIN_P  */
+    DOUBLE_P = 363,                /* DOUBLE_P  */
+    DROP = 364,                    /* DROP  */
+    EACH = 365,                    /* EACH  */
+    ELSE = 366,                    /* ELSE  */
+    ENABLE_P = 367,                /* ENABLE_P  */
+    ENCODING = 368,                /* ENCODING  */
+    ENCRYPTED = 369,               /* ENCRYPTED  */
+    END_P = 370,                   /* END_P  */
+    ENUM_P = 371,                  /* ENUM_P  */
+    ESCAPE = 372,                  /* ESCAPE  */
+    EXCEPT = 373,                  /* EXCEPT  */
+    EXCLUDING = 374,               /* EXCLUDING  */
+    EXCLUSIVE = 375,               /* EXCLUSIVE  */
+    EXECUTE = 376,                 /* EXECUTE  */
+    EXISTS = 377,                  /* EXISTS  */
+    EXPLAIN = 378,                 /* EXPLAIN  */
+    EXTERNAL = 379,                /* EXTERNAL  */
+    EXTRACT = 380,                 /* EXTRACT  */
+    FALSE_P = 381,                 /* FALSE_P  */
+    FAMILY = 382,                  /* FAMILY  */
+    FETCH = 383,                   /* FETCH  */
+    FIRST_P = 384,                 /* FIRST_P  */
+    FLOAT_P = 385,                 /* FLOAT_P  */
+    FOLLOWING = 386,               /* FOLLOWING  */
+    FOR = 387,                     /* FOR  */
+    FORCE = 388,                   /* FORCE  */
+    FOREIGN = 389,                 /* FOREIGN  */
+    FORWARD = 390,                 /* FORWARD  */
+    FREEZE = 391,                  /* FREEZE  */
+    FROM = 392,                    /* FROM  */
+    FULL = 393,                    /* FULL  */
+    FUNCTION = 394,                /* FUNCTION  */
+    GLOBAL = 395,                  /* GLOBAL  */
+    GRANT = 396,                   /* GRANT  */
+    GRANTED = 397,                 /* GRANTED  */
+    GREATEST = 398,                /* GREATEST  */
+    GROUP_P = 399,                 /* GROUP_P  */
+    HANDLER = 400,                 /* HANDLER  */
+    HAVING = 401,                  /* HAVING  */
+    HEADER_P = 402,                /* HEADER_P  */
+    HOLD = 403,                    /* HOLD  */
+    HOUR_P = 404,                  /* HOUR_P  */
+    IDENTITY_P = 405,              /* IDENTITY_P  */
+    IF_P = 406,                    /* IF_P  */
+    ILIKE = 407,                   /* ILIKE  */
+    IMMEDIATE = 408,               /* IMMEDIATE  */
+    IMMUTABLE = 409,               /* IMMUTABLE  */
+    IMPLICIT_P = 410,              /* IMPLICIT_P  */
+    IN_P = 411,                    /* IN_P  */
+    INCLUDING = 412,               /* INCLUDING  */
+    INCREMENT = 413,               /* INCREMENT  */
+    INDEX = 414,                   /* INDEX  */
+    INDEXES = 415,                 /* INDEXES  */
+    INHERIT = 416,                 /* INHERIT  */
+    INHERITS = 417,                /* INHERITS  */
+    INITIALLY = 418,               /* INITIALLY  */
+    INNER_P = 419,                 /* INNER_P  */
+    INOUT = 420,                   /* INOUT  */
+    INPUT_P = 421,                 /* INPUT_P  */
+    INSENSITIVE = 422,             /* INSENSITIVE  */
+    INSERT = 423,                  /* INSERT  */
+    INSTEAD = 424,                 /* INSTEAD  */
+    INT_P = 425,                   /* INT_P  */
+    INTEGER = 426,                 /* INTEGER  */
+    INTERSECT = 427,               /* INTERSECT  */
+    INTERVAL = 428,                /* INTERVAL  */
+    INTO = 429,                    /* INTO  */
+    INVOKER = 430,                 /* INVOKER  */
+    IS = 431,                      /* IS  */
+    ISNULL = 432,                  /* ISNULL  */
+    ISOLATION = 433,               /* ISOLATION  */
+    JOIN = 434,                    /* JOIN  */
+    KEY = 435,                     /* KEY  */
+    LANCOMPILER = 436,             /* LANCOMPILER  */
+    LANGUAGE = 437,                /* LANGUAGE  */
+    LARGE_P = 438,                 /* LARGE_P  */
+    LAST_P = 439,                  /* LAST_P  */
+    LC_COLLATE_P = 440,            /* LC_COLLATE_P  */
+    LC_CTYPE_P = 441,              /* LC_CTYPE_P  */
+    LEADING = 442,                 /* LEADING  */
+    LEAST = 443,                   /* LEAST  */
+    LEFT = 444,                    /* LEFT  */
+    LEVEL = 445,                   /* LEVEL  */
+    LIKE = 446,                    /* LIKE  */
+    LIMIT = 447,                   /* LIMIT  */
+    LISTEN = 448,                  /* LISTEN  */
+    LOAD = 449,                    /* LOAD  */
+    LOCAL = 450,                   /* LOCAL  */
+    LOCALTIME = 451,               /* LOCALTIME  */
+    LOCALTIMESTAMP = 452,          /* LOCALTIMESTAMP  */
+    LOCATION = 453,                /* LOCATION  */
+    LOCK_P = 454,                  /* LOCK_P  */
+    LOGIN_P = 455,                 /* LOGIN_P  */
+    MAPPING = 456,                 /* MAPPING  */
+    MATCH = 457,                   /* MATCH  */
+    MAXVALUE = 458,                /* MAXVALUE  */
+    MINUTE_P = 459,                /* MINUTE_P  */
+    MINVALUE = 460,                /* MINVALUE  */
+    MODE = 461,                    /* MODE  */
+    MONTH_P = 462,                 /* MONTH_P  */
+    MOVE = 463,                    /* MOVE  */
+    NAME_P = 464,                  /* NAME_P  */
+    NAMES = 465,                   /* NAMES  */
+    NATIONAL = 466,                /* NATIONAL  */
+    NATURAL = 467,                 /* NATURAL  */
+    NCHAR = 468,                   /* NCHAR  */
+    NEW = 469,                     /* NEW  */
+    NEXT = 470,                    /* NEXT  */
+    NO = 471,                      /* NO  */
+    NOCREATEDB = 472,              /* NOCREATEDB  */
+    NOCREATEROLE = 473,            /* NOCREATEROLE  */
+    NOCREATEUSER = 474,            /* NOCREATEUSER  */
+    NOINHERIT = 475,               /* NOINHERIT  */
+    NOLOGIN_P = 476,               /* NOLOGIN_P  */
+    NONE = 477,                    /* NONE  */
+    NOSUPERUSER = 478,             /* NOSUPERUSER  */
+    NOT = 479,                     /* NOT  */
+    NOTHING = 480,                 /* NOTHING  */
+    NOTIFY = 481,                  /* NOTIFY  */
+    NOTNULL = 482,                 /* NOTNULL  */
+    NOWAIT = 483,                  /* NOWAIT  */
+    NULL_P = 484,                  /* NULL_P  */
+    NULLIF = 485,                  /* NULLIF  */
+    NULLS_P = 486,                 /* NULLS_P  */
+    NUMERIC = 487,                 /* NUMERIC  */
+    OBJECT_P = 488,                /* OBJECT_P  */
+    OF = 489,                      /* OF  */
+    OFF = 490,                     /* OFF  */
+    OFFSET = 491,                  /* OFFSET  */
+    OIDS = 492,                    /* OIDS  */
+    OLD = 493,                     /* OLD  */
+    ON = 494,                      /* ON  */
+    ONLY = 495,                    /* ONLY  */
+    OPERATOR = 496,                /* OPERATOR  */
+    OPTION = 497,                  /* OPTION  */
+    OPTIONS = 498,                 /* OPTIONS  */
+    OR = 499,                      /* OR  */
+    ORDER = 500,                   /* ORDER  */
+    OUT_P = 501,                   /* OUT_P  */
+    OUTER_P = 502,                 /* OUTER_P  */
+    OVER = 503,                    /* OVER  */
+    OVERLAPS = 504,                /* OVERLAPS  */
+    OVERLAY = 505,                 /* OVERLAY  */
+    OWNED = 506,                   /* OWNED  */
+    OWNER = 507,                   /* OWNER  */
+    PARSER = 508,                  /* PARSER  */
+    PARTIAL = 509,                 /* PARTIAL  */
+    PARTITION = 510,               /* PARTITION  */
+    PASSWORD = 511,                /* PASSWORD  */
+    PLACING = 512,                 /* PLACING  */
+    PLANS = 513,                   /* PLANS  */
+    POSITION = 514,                /* POSITION  */
+    PRECEDING = 515,               /* PRECEDING  */
+    PRECISION = 516,               /* PRECISION  */
+    PRESERVE = 517,                /* PRESERVE  */
+    PREPARE = 518,                 /* PREPARE  */
+    PREPARED = 519,                /* PREPARED  */
+    PRIMARY = 520,                 /* PRIMARY  */
+    PRIOR = 521,                   /* PRIOR  */
+    PRIVILEGES = 522,              /* PRIVILEGES  */
+    PROCEDURAL = 523,              /* PROCEDURAL  */
+    PROCEDURE = 524,               /* PROCEDURE  */
+    QUOTE = 525,                   /* QUOTE  */
+    RANGE = 526,                   /* RANGE  */
+    READ = 527,                    /* READ  */
+    REAL = 528,                    /* REAL  */
+    REASSIGN = 529,                /* REASSIGN  */
+    RECHECK = 530,                 /* RECHECK  */
+    RECURSIVE = 531,               /* RECURSIVE  */
+    REFERENCES = 532,              /* REFERENCES  */
+    REINDEX = 533,                 /* REINDEX  */
+    RELATIVE_P = 534,              /* RELATIVE_P  */
+    RELEASE = 535,                 /* RELEASE  */
+    RENAME = 536,                  /* RENAME  */
+    REPEATABLE = 537,              /* REPEATABLE  */
+    REPLACE = 538,                 /* REPLACE  */
+    REPLICA = 539,                 /* REPLICA  */
+    RESET = 540,                   /* RESET  */
+    RESTART = 541,                 /* RESTART  */
+    RESTRICT = 542,                /* RESTRICT  */
+    RETURNING = 543,               /* RETURNING  */
+    RETURNS = 544,                 /* RETURNS  */
+    REVOKE = 545,                  /* REVOKE  */
+    RIGHT = 546,                   /* RIGHT  */
+    ROLE = 547,                    /* ROLE  */
+    ROLLBACK = 548,                /* ROLLBACK  */
+    ROW = 549,                     /* ROW  */
+    ROWS = 550,                    /* ROWS  */
+    RULE = 551,                    /* RULE  */
+    SAVEPOINT = 552,               /* SAVEPOINT  */
+    SCHEMA = 553,                  /* SCHEMA  */
+    SCROLL = 554,                  /* SCROLL  */
+    SEARCH = 555,                  /* SEARCH  */
+    SECOND_P = 556,                /* SECOND_P  */
+    SECURITY = 557,                /* SECURITY  */
+    SELECT = 558,                  /* SELECT  */
+    SEQUENCE = 559,                /* SEQUENCE  */
+    SERIALIZABLE = 560,            /* SERIALIZABLE  */
+    SERVER = 561,                  /* SERVER  */
+    SESSION = 562,                 /* SESSION  */
+    SESSION_USER = 563,            /* SESSION_USER  */
+    SET = 564,                     /* SET  */
+    SETOF = 565,                   /* SETOF  */
+    SHARE = 566,                   /* SHARE  */
+    SHOW = 567,                    /* SHOW  */
+    SIMILAR = 568,                 /* SIMILAR  */
+    SIMPLE = 569,                  /* SIMPLE  */
+    SMALLINT = 570,                /* SMALLINT  */
+    SOME = 571,                    /* SOME  */
+    STABLE = 572,                  /* STABLE  */
+    STANDALONE_P = 573,            /* STANDALONE_P  */
+    START = 574,                   /* START  */
+    STATEMENT = 575,               /* STATEMENT  */
+    STATISTICS = 576,              /* STATISTICS  */
+    STDIN = 577,                   /* STDIN  */
+    STDOUT = 578,                  /* STDOUT  */
+    STORAGE = 579,                 /* STORAGE  */
+    STRICT_P = 580,                /* STRICT_P  */
+    STRIP_P = 581,                 /* STRIP_P  */
+    SUBSTRING = 582,               /* SUBSTRING  */
+    SUPERUSER_P = 583,             /* SUPERUSER_P  */
+    SYMMETRIC = 584,               /* SYMMETRIC  */
+    SYSID = 585,                   /* SYSID  */
+    SYSTEM_P = 586,                /* SYSTEM_P  */
+    TABLE = 587,                   /* TABLE  */
+    TABLESPACE = 588,              /* TABLESPACE  */
+    TEMP = 589,                    /* TEMP  */
+    TEMPLATE = 590,                /* TEMPLATE  */
+    TEMPORARY = 591,               /* TEMPORARY  */
+    TEXT_P = 592,                  /* TEXT_P  */
+    THEN = 593,                    /* THEN  */
+    TIME = 594,                    /* TIME  */
+    TIMESTAMP = 595,               /* TIMESTAMP  */
+    TO = 596,                      /* TO  */
+    TRAILING = 597,                /* TRAILING  */
+    TRANSACTION = 598,             /* TRANSACTION  */
+    TREAT = 599,                   /* TREAT  */
+    TRIGGER = 600,                 /* TRIGGER  */
+    TRIM = 601,                    /* TRIM  */
+    TRUE_P = 602,                  /* TRUE_P  */
+    TRUNCATE = 603,                /* TRUNCATE  */
+    TRUSTED = 604,                 /* TRUSTED  */
+    TYPE_P = 605,                  /* TYPE_P  */
+    UNBOUNDED = 606,               /* UNBOUNDED  */
+    UNCOMMITTED = 607,             /* UNCOMMITTED  */
+    UNENCRYPTED = 608,             /* UNENCRYPTED  */
+    UNION = 609,                   /* UNION  */
+    UNIQUE = 610,                  /* UNIQUE  */
+    UNKNOWN = 611,                 /* UNKNOWN  */
+    UNLISTEN = 612,                /* UNLISTEN  */
+    UNTIL = 613,                   /* UNTIL  */
+    UPDATE = 614,                  /* UPDATE  */
+    USER = 615,                    /* USER  */
+    USING = 616,                   /* USING  */
+    VACUUM = 617,                  /* VACUUM  */
+    VALID = 618,                   /* VALID  */
+    VALIDATOR = 619,               /* VALIDATOR  */
+    VALUE_P = 620,                 /* VALUE_P  */
+    VALUES = 621,                  /* VALUES  */
+    VARCHAR = 622,                 /* VARCHAR  */
+    VARIADIC = 623,                /* VARIADIC  */
+    VARYING = 624,                 /* VARYING  */
+    VERBOSE = 625,                 /* VERBOSE  */
+    VERSION_P = 626,               /* VERSION_P  */
+    VIEW = 627,                    /* VIEW  */
+    VOLATILE = 628,                /* VOLATILE  */
+    WHEN = 629,                    /* WHEN  */
+    WHERE = 630,                   /* WHERE  */
+    WHITESPACE_P = 631,            /* WHITESPACE_P  */
+    WINDOW = 632,                  /* WINDOW  */
+    WITH = 633,                    /* WITH  */
+    WITHOUT = 634,                 /* WITHOUT  */
+    WORK = 635,                    /* WORK  */
+    WRAPPER = 636,                 /* WRAPPER  */
+    WRITE = 637,                   /* WRITE  */
+    XML_P = 638,                   /* XML_P  */
+    XMLATTRIBUTES = 639,           /* XMLATTRIBUTES  */
+    XMLCONCAT = 640,               /* XMLCONCAT  */
+    XMLELEMENT = 641,              /* XMLELEMENT  */
+    XMLFOREST = 642,               /* XMLFOREST  */
+    XMLPARSE = 643,                /* XMLPARSE  */
+    XMLPI = 644,                   /* XMLPI  */
+    XMLROOT = 645,                 /* XMLROOT  */
+    XMLSERIALIZE = 646,            /* XMLSERIALIZE  */
+    YEAR_P = 647,                  /* YEAR_P  */
+    YES_P = 648,                   /* YES_P  */
+    ZONE = 649,                    /* ZONE  */
+    NULLS_FIRST = 650,             /* NULLS_FIRST  */
+    NULLS_LAST = 651,              /* NULLS_LAST  */
+    WITH_TIME = 652,               /* WITH_TIME  */
+    IDENT = 653,                   /* IDENT  */
+    FCONST = 654,                  /* FCONST  */
+    SCONST = 655,                  /* SCONST  */
+    BCONST = 656,                  /* BCONST  */
+    XCONST = 657,                  /* XCONST  */
+    Op = 658,                      /* Op  */
+    ICONST = 659,                  /* ICONST  */
+    PARAM = 660,                   /* PARAM  */
+    POSTFIXOP = 661,               /* POSTFIXOP  */
+    UMINUS = 662,                  /* UMINUS  */
+    TYPECAST = 663                 /* TYPECAST  */
+  };
+  typedef enum yytokentype yytoken_kind_t;
+#endif
+
+/* Value type.  */
+#if ! defined YYSTYPE && ! defined YYSTYPE_IS_DECLARED
+union YYSTYPE
+{
+#line 162 "../../parser/gram.y"
+
+	int					ival;
+	char				chr;
+	char				*str;
+	const char			*keyword;
+	bool				boolean;
+	JoinType			jtype;
+	DropBehavior		dbehavior;
+	OnCommitAction		oncommit;
+	List				*list;
+	Node				*node;
+	Value				*value;
+	ObjectType			objtype;
+
+	TypeName			*typnam;
+	FunctionParameter   *fun_param;
+	FunctionParameterMode fun_param_mode;
+	FuncWithArgs		*funwithargs;
+	DefElem				*defelt;
+	SortBy				*sortby;
+	WindowDef			*windef;
+	JoinExpr			*jexpr;
+	IndexElem			*ielem;
+	Alias				*alias;
+	RangeVar			*range;
+	IntoClause			*into;
+	WithClause			*with;
+	A_Indices			*aind;
+	ResTarget			*target;
+	struct PrivTarget	*privtarget;
+	AccessPriv			*accesspriv;
+
+	InsertStmt			*istmt;
+	VariableSetStmt		*vsetstmt;
+
+#line 508 "gram.tab.h"
+
+};
+typedef union YYSTYPE YYSTYPE;
+# define YYSTYPE_IS_TRIVIAL 1
+# define YYSTYPE_IS_DECLARED 1
+#endif
+
+/* Location type.  */
+#if ! defined YYLTYPE && ! defined YYLTYPE_IS_DECLARED
+typedef struct YYLTYPE YYLTYPE;
+struct YYLTYPE
+{
+  int first_line;
+  int first_column;
+  int last_line;
+  int last_column;
+};
+# define YYLTYPE_IS_DECLARED 1
+# define YYLTYPE_IS_TRIVIAL 1
+#endif
+
+
+extern YYSTYPE base_yylval;
+extern YYLTYPE base_yylloc;
+
+int base_yyparse (void);
+
+
+#endif /* !YY_BASE_YY_GRAM_TAB_H_INCLUDED  */
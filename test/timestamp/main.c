@@ -9,8 +9,8 @@
 /* for get_current_timestamp() (MASTER() macro) */
 POOL_REQUEST_INFO		_req_info;
 POOL_REQUEST_INFO *Req_info = &_req_info;
-int selected_slot = 0;		/* selected DB node */
-int in_load_balance = 1;	/* non 0 if in load balance mode */
+POOL_SESSION_CONTEXT _session_context = {1, 0};	/* in load balance mode, selected DB node is 0 */
+POOL_SESSION_CONTEXT *session_context = &_session_context;
 POOL_CONFIG _pool_config;
 POOL_CONFIG *pool_config = &_pool_config;
 
@@ -78,6 +78,16 @@ main(int argc, char **argv)
 	Portal		 portal;
 	POOL_CONNECTION_POOL	backend;
 	POOL_CONNECTION_POOL_SLOT slot;
+	StartupPacket sp;
+	POOL_CONNECTION con;
+
+	memset(&backend, 0, sizeof(backend));
+	memset(&slot, 0, sizeof(slot));
+	memset(&sp, 0, sizeof(sp));
+	memset(&con, 0, sizeof(con));
+	sp.major = PROTO_MAJOR_V3;
+	slot.sp = &sp;
+	slot.con = &con;
 	backend.slots[0] = &slot;
 
 	pool_config->replication_enabled = 1;